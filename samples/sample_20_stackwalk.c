@@ -2,8 +2,8 @@
  * 20 - Call stacks
  *
  * Shows: CMUTIL_StackWalker capturing the current stack as a string array or
- *        printing it into a buffer, and the logging macros that carry a
- *        stack trace.
+ *        printing it into a buffer, capturing raw frames to print later,
+ *        and the logging macros that carry a stack trace.
  *
  * Symbolization depends on the platform and on the build: a stripped release
  * binary yields addresses rather than function names. Building with
@@ -18,6 +18,7 @@ static void print_stack(CMUTIL_StackWalker *walker)
 {
     CMUTIL_StringArray *frames;
     CMUTIL_String *buffer;
+    CMUTIL_StackTrace trace;
     uint32_t i;
 
     /*
@@ -41,6 +42,18 @@ static void print_stack(CMUTIL_StackWalker *walker)
     CMLogDebug("PrintStack produced %u bytes",
                (unsigned)CMCall(buffer, GetSize));
     CMCall(buffer, Destroy);
+
+    /*
+     * Capture stores return addresses only, which is cheap enough to do on
+     * a hot path. Symbols are resolved when the trace is printed, and cached
+     * for the whole process, so printing the same frames again is cheap too.
+     */
+    CMCall(walker, Capture, &trace, 0);
+    buffer = CMUTIL_StringCreate();
+    CMCall(walker, PrintTrace, &trace, buffer);
+    CMLogInfo("captured %d raw frame(s):%s", trace.depth,
+              CMCall(buffer, GetCString));
+    CMCall(buffer, Destroy);
 }
 
 static void level_three(CMUTIL_StackWalker *walker)
@@ -86,6 +99,6 @@ int main(void)
     CMCall(walker, Destroy);
 
     /* The same machinery backs the CMMemDebug allocator, which records a
-     * stack for every allocation so a leak can be traced to its origin. */
+     * raw stack for every allocation so a leak can be traced to its origin. */
     return sample_exit(0);
 }
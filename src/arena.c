@@ -0,0 +1,328 @@
+/*
+MIT License
+
+Copyright (c) 2020 Dennis Soungjin Park<xcomart@gmail.com>
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+ */
+
+#include "functions.h"
+
+CMUTIL_LogDefine("cmutils.arena")
+
+/*
+ * CMUTIL_Mem has no context pointer, so every arena occupies one of fixed
+ * slots, each slot has its own set of memory operator functions.
+ */
+#define CMUTIL_ARENA_SLOTS      32
+#define CMUTIL_ARENA_DEFAULT    (64 * 1024)
+#define CMUTIL_ARENA_ALIGN(x)   (((x) + 15) & ~(size_t)15)
+
+typedef struct CMUTIL_ArenaChunk {
+    struct CMUTIL_ArenaChunk    *next;
+    size_t                      size;   // usable bytes after chunk header
+    size_t                      used;
+    size_t                      dummy_padder;
+} CMUTIL_ArenaChunk;
+
+#define CMUTIL_ARENA_CHUNK_HDR  CMUTIL_ARENA_ALIGN(sizeof(CMUTIL_ArenaChunk))
+// every block is preceded by its size, which is required for Realloc.
+#define CMUTIL_ARENA_BLOCK_HDR  CMUTIL_ARENA_ALIGN(sizeof(size_t))
+
+typedef struct CMUTIL_Arena_Internal {
+    CMUTIL_Arena        base;
+    CMUTIL_Mem          *mem;       // memory operators of the slot
+    CMUTIL_Mem          *memst;     // allocator of chunks
+    CMUTIL_ArenaChunk   *chunks;    // current chunk comes first
+    void                *last;      // last block of current chunk
+    size_t              chunksz;
+    int                 slot;
+    int                 dummy_padder;
+} CMUTIL_Arena_Internal;
+
+static CMUTIL_Mutex *g_cmutil_arena_mutex = NULL;
+static CMUTIL_Arena_Internal *g_cmutil_arenas[CMUTIL_ARENA_SLOTS];
+
+CMUTIL_STATIC CMUTIL_ArenaChunk *CMUTIL_ArenaAddChunk(
+        CMUTIL_Arena_Internal *iarena, size_t size)
+{
+    CMUTIL_ArenaChunk *chunk =
+            iarena->memst->Alloc(CMUTIL_ARENA_CHUNK_HDR + size);
+    if (chunk == NULL)
+        return NULL;
+    chunk->size = size;
+    chunk->used = 0;
+    if (iarena->chunks && size > iarena->chunksz) {
+        // oversized chunk holds only one block, keep the current chunk.
+        chunk->next = iarena->chunks->next;
+        iarena->chunks->next = chunk;
+    } else {
+        chunk->next = iarena->chunks;
+        iarena->chunks = chunk;
+        iarena->last = NULL;
+    }
+    return chunk;
+}
+
+CMUTIL_STATIC void *CMUTIL_ArenaAllocImpl(
+        CMUTIL_Arena_Internal *iarena, size_t size)
+{
+    size_t need;
+    uint8_t *res;
+    CMUTIL_ArenaChunk *chunk = iarena->chunks;
+    if (size > SIZE_MAX -
+            CMUTIL_ARENA_BLOCK_HDR - CMUTIL_ARENA_CHUNK_HDR - 15) {
+        CMLogError("arena allocation size too big(%zu).", size);
+        return NULL;
+    }
+    need = CMUTIL_ARENA_BLOCK_HDR + CMUTIL_ARENA_ALIGN(size);
+    if (chunk == NULL || chunk->size - chunk->used < need) {
+        chunk = CMUTIL_ArenaAddChunk(
+                    iarena, need > iarena->chunksz? need:iarena->chunksz);
+        if (chunk == NULL) {
+            CMLogError("cannot allocate arena chunk for %zu bytes.", size);
+            return NULL;
+        }
+    }
+    res = (uint8_t*)chunk + CMUTIL_ARENA_CHUNK_HDR + chunk->used;
+    chunk->used += need;
+    *(size_t*)res = size;
+    res += CMUTIL_ARENA_BLOCK_HDR;
+    if (chunk == iarena->chunks)
+        iarena->last = res;
+    return res;
+}
+
+CMUTIL_STATIC void *CMUTIL_ArenaCallocImpl(
+        CMUTIL_Arena_Internal *iarena, size_t nmem, size_t size)
+{
+    void *res;
+    if (nmem != 0 && size > (SIZE_MAX / nmem)) {
+        CMLogError("arena calloc size overflow(%zu * %zu).", nmem, size);
+        return NULL;
+    }
+    res = CMUTIL_ArenaAllocImpl(iarena, nmem * size);
+    if (res)
+        memset(res, 0x0, nmem * size);
+    return res;
+}
+
+CMUTIL_STATIC void *CMUTIL_ArenaReallocImpl(
+        CMUTIL_Arena_Internal *iarena, void *ptr, size_t size)
+{
+    size_t *psize, oldsz;
+    void *res;
+    if (ptr == NULL)
+        return CMUTIL_ArenaAllocImpl(iarena, size);
+    psize = (size_t*)((uint8_t*)ptr - CMUTIL_ARENA_BLOCK_HDR);
+    oldsz = *psize;
+    if (size <= oldsz) {
+        *psize = size;
+        return ptr;
+    }
+    if (ptr == iarena->last &&
+            size <= SIZE_MAX - CMUTIL_ARENA_BLOCK_HDR - 15) {
+        // the last block grows in place while the chunk has room.
+        CMUTIL_ArenaChunk *chunk = iarena->chunks;
+        size_t grow = CMUTIL_ARENA_ALIGN(size) - CMUTIL_ARENA_ALIGN(oldsz);
+        if (chunk->size - chunk->used >= grow) {
+            chunk->used += grow;
+            *psize = size;
+            return ptr;
+        }
+    }
+    res = CMUTIL_ArenaAllocImpl(iarena, size);
+    if (res == NULL)
+        return NULL;
+    memcpy(res, ptr, oldsz);
+    return res;
+}
+
+CMUTIL_STATIC char *CMUTIL_ArenaStrdupImpl(
+        CMUTIL_Arena_Internal *iarena, const char *str)
+{
+    size_t size;
+    char *res;
+    if (str == NULL) {
+        CMLogErrorS("strdup with null pointer");
+        return NULL;
+    }
+    size = strlen(str) + 1;
+    res = CMUTIL_ArenaAllocImpl(iarena, size);
+    if (res)
+        memcpy(res, str, size);
+    return res;
+}
+
+CMUTIL_STATIC void CMUTIL_ArenaFree(void *ptr)
+{
+    // memory is released all at once with Reset or Destroy.
+    CMUTIL_UNUSED(ptr);
+}
+
+#define CMUTIL_ARENA_SLOT(n)                                                \
+CMUTIL_STATIC void *CMUTIL_ArenaAlloc##n(size_t size)                       \
+{                                                                           \
+    return CMUTIL_ArenaAllocImpl(g_cmutil_arenas[n], size);                 \
+}                                                                           \
+CMUTIL_STATIC void *CMUTIL_ArenaCalloc##n(size_t nmem, size_t size)         \
+{                                                                           \
+    return CMUTIL_ArenaCallocImpl(g_cmutil_arenas[n], nmem, size);          \
+}                                                                           \
+CMUTIL_STATIC void *CMUTIL_ArenaRealloc##n(void *ptr, size_t size)          \
+{                                                                           \
+    return CMUTIL_ArenaReallocImpl(g_cmutil_arenas[n], ptr, size);          \
+}                                                                           \
+CMUTIL_STATIC char *CMUTIL_ArenaStrdup##n(const char *str)                  \
+{                                                                           \
+    return CMUTIL_ArenaStrdupImpl(g_cmutil_arenas[n], str);                 \
+}
+
+#define CMUTIL_ARENA_MEM(n) {                                               \
+    CMUTIL_ArenaAlloc##n,                                                   \
+    CMUTIL_ArenaCalloc##n,                                                  \
+    CMUTIL_ArenaRealloc##n,                                                 \
+    CMUTIL_ArenaStrdup##n,                                                  \
+    CMUTIL_ArenaFree                                                        \
+}
+
+CMUTIL_ARENA_SLOT(0)  CMUTIL_ARENA_SLOT(1)  CMUTIL_ARENA_SLOT(2)
+CMUTIL_ARENA_SLOT(3)  CMUTIL_ARENA_SLOT(4)  CMUTIL_ARENA_SLOT(5)
+CMUTIL_ARENA_SLOT(6)  CMUTIL_ARENA_SLOT(7)  CMUTIL_ARENA_SLOT(8)
+CMUTIL_ARENA_SLOT(9)  CMUTIL_ARENA_SLOT(10) CMUTIL_ARENA_SLOT(11)
+CMUTIL_ARENA_SLOT(12) CMUTIL_ARENA_SLOT(13) CMUTIL_ARENA_SLOT(14)
+CMUTIL_ARENA_SLOT(15) CMUTIL_ARENA_SLOT(16) CMUTIL_ARENA_SLOT(17)
+CMUTIL_ARENA_SLOT(18) CMUTIL_ARENA_SLOT(19) CMUTIL_ARENA_SLOT(20)
+CMUTIL_ARENA_SLOT(21) CMUTIL_ARENA_SLOT(22) CMUTIL_ARENA_SLOT(23)
+CMUTIL_ARENA_SLOT(24) CMUTIL_ARENA_SLOT(25) CMUTIL_ARENA_SLOT(26)
+CMUTIL_ARENA_SLOT(27) CMUTIL_ARENA_SLOT(28) CMUTIL_ARENA_SLOT(29)
+CMUTIL_ARENA_SLOT(30) CMUTIL_ARENA_SLOT(31)
+
+static CMUTIL_Mem g_cmutil_arena_mems[CMUTIL_ARENA_SLOTS] = {
+    CMUTIL_ARENA_MEM(0),  CMUTIL_ARENA_MEM(1),  CMUTIL_ARENA_MEM(2),
+    CMUTIL_ARENA_MEM(3),  CMUTIL_ARENA_MEM(4),  CMUTIL_ARENA_MEM(5),
+    CMUTIL_ARENA_MEM(6),  CMUTIL_ARENA_MEM(7),  CMUTIL_ARENA_MEM(8),
+    CMUTIL_ARENA_MEM(9),  CMUTIL_ARENA_MEM(10), CMUTIL_ARENA_MEM(11),
+    CMUTIL_ARENA_MEM(12), CMUTIL_ARENA_MEM(13), CMUTIL_ARENA_MEM(14),
+    CMUTIL_ARENA_MEM(15), CMUTIL_ARENA_MEM(16), CMUTIL_ARENA_MEM(17),
+    CMUTIL_ARENA_MEM(18), CMUTIL_ARENA_MEM(19), CMUTIL_ARENA_MEM(20),
+    CMUTIL_ARENA_MEM(21), CMUTIL_ARENA_MEM(22), CMUTIL_ARENA_MEM(23),
+    CMUTIL_ARENA_MEM(24), CMUTIL_ARENA_MEM(25), CMUTIL_ARENA_MEM(26),
+    CMUTIL_ARENA_MEM(27), CMUTIL_ARENA_MEM(28), CMUTIL_ARENA_MEM(29),
+    CMUTIL_ARENA_MEM(30), CMUTIL_ARENA_MEM(31)
+};
+
+CMUTIL_STATIC CMUTIL_Mem *CMUTIL_ArenaGetMem(const CMUTIL_Arena *arena)
+{
+    const CMUTIL_Arena_Internal *iarena = (const CMUTIL_Arena_Internal*)arena;
+    return iarena->mem;
+}
+
+CMUTIL_STATIC void CMUTIL_ArenaReset(CMUTIL_Arena *arena)
+{
+    CMUTIL_Arena_Internal *iarena = (CMUTIL_Arena_Internal*)arena;
+    CMUTIL_ArenaChunk *keep = NULL;
+    // keep the oldest regular chunk for reuse, release the others.
+    while (iarena->chunks) {
+        CMUTIL_ArenaChunk *chunk = iarena->chunks;
+        iarena->chunks = chunk->next;
+        if (chunk->size == iarena->chunksz) {
+            if (keep)
+                iarena->memst->Free(keep);
+            keep = chunk;
+        } else {
+            iarena->memst->Free(chunk);
+        }
+    }
+    if (keep) {
+        keep->next = NULL;
+        keep->used = 0;
+    }
+    iarena->chunks = keep;
+    iarena->last = NULL;
+}
+
+CMUTIL_STATIC void CMUTIL_ArenaDestroy(CMUTIL_Arena *arena)
+{
+    CMUTIL_Arena_Internal *iarena = (CMUTIL_Arena_Internal*)arena;
+    if (iarena) {
+        while (iarena->chunks) {
+            CMUTIL_ArenaChunk *chunk = iarena->chunks;
+            iarena->chunks = chunk->next;
+            iarena->memst->Free(chunk);
+        }
+        CMCall(g_cmutil_arena_mutex, Lock);
+        g_cmutil_arenas[iarena->slot] = NULL;
+        CMCall(g_cmutil_arena_mutex, Unlock);
+        iarena->memst->Free(iarena);
+    }
+}
+
+static CMUTIL_Arena g_cmutil_arena = {
+    CMUTIL_ArenaGetMem,
+    CMUTIL_ArenaReset,
+    CMUTIL_ArenaDestroy
+};
+
+void CMUTIL_ArenaInit(void)
+{
+    memset(g_cmutil_arenas, 0x0, sizeof(g_cmutil_arenas));
+    g_cmutil_arena_mutex = CMUTIL_MutexCreateInternal(CMUTIL_GetMem());
+}
+
+void CMUTIL_ArenaClear(void)
+{
+    if (g_cmutil_arena_mutex) {
+        CMCall(g_cmutil_arena_mutex, Destroy);
+        g_cmutil_arena_mutex = NULL;
+    }
+}
+
+CMUTIL_Arena *CMUTIL_ArenaCreateInternal(CMUTIL_Mem *memst, size_t chunksz)
+{
+    int slot;
+    CMUTIL_Arena_Internal *res = NULL;
+    CMCall(g_cmutil_arena_mutex, Lock);
+    for (slot=0; slot<CMUTIL_ARENA_SLOTS; slot++)
+        if (g_cmutil_arenas[slot] == NULL)
+            break;
+    if (slot < CMUTIL_ARENA_SLOTS) {
+        res = memst->Alloc(sizeof(CMUTIL_Arena_Internal));
+        if (res) {
+            memset(res, 0x0, sizeof(CMUTIL_Arena_Internal));
+            memcpy(res, &g_cmutil_arena, sizeof(CMUTIL_Arena));
+            res->memst = memst;
+            res->mem = &g_cmutil_arena_mems[slot];
+            res->chunksz = CMUTIL_ARENA_ALIGN(
+                        chunksz > 0? chunksz:CMUTIL_ARENA_DEFAULT);
+            res->slot = slot;
+            g_cmutil_arenas[slot] = res;
+        }
+    }
+    CMCall(g_cmutil_arena_mutex, Unlock);
+    if (slot >= CMUTIL_ARENA_SLOTS)
+        CMLogError("too many arenas, at most %d arenas can exist at once.",
+                   CMUTIL_ARENA_SLOTS);
+    return (CMUTIL_Arena*)res;
+}
+
+CMUTIL_Arena *CMUTIL_ArenaCreate(size_t chunk_size)
+{
+    return CMUTIL_ArenaCreateInternal(CMUTIL_GetMem(), chunk_size);
+}
@@ -328,6 +328,309 @@ CMUTIL_STATIC void *CMUTIL_ArrayBottom(const CMUTIL_Array *array)
     return NULL;
 }
 
+#define CMUTIL_ARRAY_INSERTION_MAX      16
+#define CMUTIL_ARRAY_PARALLEL_MIN       65536   // items to sort in parallel
+#define CMUTIL_ARRAY_PARALLEL_PART      16384   // items of a part at least
+#define CMUTIL_ARRAY_PARALLEL_MAXPARTS  64
+
+CMUTIL_STATIC void CMUTIL_ArrayInsertionSort(
+        void **data, size_t n, CMCompareCB cmp)
+{
+    size_t i, j;
+    for (i=1; i<n; i++) {
+        void *item = data[i];
+        for (j=i; j>0 && cmp(item, data[j-1]) < 0; j--)
+            data[j] = data[j-1];
+        data[j] = item;
+    }
+}
+
+CMUTIL_STATIC void CMUTIL_ArraySiftDown(
+        void **data, size_t root, size_t n, CMCompareCB cmp)
+{
+    void *item = data[root];
+    size_t child;
+    while ((child = root * 2 + 1) < n) {
+        if (child + 1 < n && cmp(data[child], data[child+1]) < 0)
+            child++;
+        if (cmp(item, data[child]) >= 0)
+            break;
+        data[root] = data[child];
+        root = child;
+    }
+    data[root] = item;
+}
+
+CMUTIL_STATIC void CMUTIL_ArrayHeapSort(
+        void **data, size_t n, CMCompareCB cmp)
+{
+    size_t i;
+    for (i=n/2; i>0; i--)
+        CMUTIL_ArraySiftDown(data, i-1, n, cmp);
+    for (i=n-1; i>0; i--) {
+        void *t = data[0];
+        data[0] = data[i];
+        data[i] = t;
+        CMUTIL_ArraySiftDown(data, 0, i, cmp);
+    }
+}
+
+CMUTIL_STATIC void CMUTIL_ArraySwap(void **data, size_t a, size_t b)
+{
+    void *t = data[a];
+    data[a] = data[b];
+    data[b] = t;
+}
+
+/*
+ * Quicksort with median of three pivots, falls back to heapsort when
+ * partitions keep degenerating and to insertion sort for short ranges.
+ * The smaller side is recursed, so the stack depth stays O(log n).
+ */
+CMUTIL_STATIC void CMUTIL_ArrayIntroSort(
+        void **data, size_t n, CMCompareCB cmp, int depth)
+{
+    while (n > CMUTIL_ARRAY_INSERTION_MAX) {
+        size_t mid = (n - 1) / 2, left;
+        ptrdiff_t i = -1, j = (ptrdiff_t)n;
+        void *pivot;
+        if (depth-- == 0) {
+            CMUTIL_ArrayHeapSort(data, n, cmp);
+            return;
+        }
+        if (cmp(data[mid], data[0]) < 0)
+            CMUTIL_ArraySwap(data, 0, mid);
+        if (cmp(data[n-1], data[mid]) < 0) {
+            CMUTIL_ArraySwap(data, mid, n-1);
+            if (cmp(data[mid], data[0]) < 0)
+                CMUTIL_ArraySwap(data, 0, mid);
+        }
+        pivot = data[mid];
+        for (;;) {
+            do i++; while (cmp(data[i], pivot) < 0);
+            do j--; while (cmp(data[j], pivot) > 0);
+            if (i >= j)
+                break;
+            CMUTIL_ArraySwap(data, (size_t)i, (size_t)j);
+        }
+        left = (size_t)j + 1;
+        if (left < n - left) {
+            CMUTIL_ArrayIntroSort(data, left, cmp, depth);
+            data += left;
+            n -= left;
+        } else {
+            CMUTIL_ArrayIntroSort(data + left, n - left, cmp, depth);
+            n = left;
+        }
+    }
+    CMUTIL_ArrayInsertionSort(data, n, cmp);
+}
+
+// merges sorted runs src[0..mid) and src[mid..n) into dst, keeping order
+// of equal items.
+CMUTIL_STATIC void CMUTIL_ArrayMerge(
+        void *const *src, size_t mid, size_t n, void **dst, CMCompareCB cmp)
+{
+    size_t i = 0, j = mid, k = 0;
+    while (i < mid && j < n)
+        dst[k++] = cmp(src[j], src[i]) < 0? src[j++] : src[i++];
+    while (i < mid)
+        dst[k++] = src[i++];
+    while (j < n)
+        dst[k++] = src[j++];
+}
+
+// stable sort of data[0..n), tmp must have room for n items.
+CMUTIL_STATIC void CMUTIL_ArrayMergeSort(
+        void **data, void **tmp, size_t n, CMCompareCB cmp)
+{
+    size_t mid = n / 2;
+    if (n <= CMUTIL_ARRAY_INSERTION_MAX) {
+        CMUTIL_ArrayInsertionSort(data, n, cmp);
+        return;
+    }
+    CMUTIL_ArrayMergeSort(data, tmp, mid, cmp);
+    CMUTIL_ArrayMergeSort(data + mid, tmp + mid, n - mid, cmp);
+    if (cmp(data[mid], data[mid-1]) >= 0)
+        return;     // runs are in order already
+    memcpy(tmp, data, n * sizeof(void*));
+    CMUTIL_ArrayMerge(tmp, mid, n, data, cmp);
+}
+
+typedef struct CMUTIL_ArraySortJob {
+    void                **src;
+    void                **dst;
+    size_t              mid;
+    size_t              len;
+    CMCompareCB         comparator;
+    CMUTIL_Semaphore    *done;
+} CMUTIL_ArraySortJob;
+
+CMUTIL_STATIC void CMUTIL_ArraySortPartProc(void *udata)
+{
+    CMUTIL_ArraySortJob *job = (CMUTIL_ArraySortJob*)udata;
+    CMUTIL_ArrayMergeSort(job->src, job->dst, job->len, job->comparator);
+    CMCall(job->done, Release);
+}
+
+CMUTIL_STATIC void CMUTIL_ArrayMergePartProc(void *udata)
+{
+    CMUTIL_ArraySortJob *job = (CMUTIL_ArraySortJob*)udata;
+    CMUTIL_ArrayMerge(job->src, job->mid, job->len, job->dst,
+                      job->comparator);
+    CMCall(job->done, Release);
+}
+
+CMUTIL_STATIC void CMUTIL_ArraySortWait(CMUTIL_Semaphore *done, size_t count)
+{
+    while (count > 0)
+        if (CMCall(done, Acquire, -1))
+            count--;
+}
+
+/*
+ * Stable merge sort on a thread pool: parts are sorted by jobs of the
+ * pool, then merged pairwise, every pair of a round by its own job.
+ * Returns CMFalse without touching the array if resources are short.
+ */
+CMUTIL_STATIC CMBool CMUTIL_ArrayParallelSort(
+        CMUTIL_Array_Internal *iarray, CMCompareCB cmp,
+        CMUTIL_ThreadPool *pool)
+{
+    size_t n = iarray->size, nparts = 1, njobs, width, i;
+    void **src = iarray->data, **dst, **tmp = NULL;
+    CMUTIL_ArraySortJob *jobs = NULL;
+    CMUTIL_Semaphore *done = NULL;
+
+    while (nparts < CMUTIL_ARRAY_PARALLEL_MAXPARTS &&
+           n / (nparts * 2) >= CMUTIL_ARRAY_PARALLEL_PART)
+        nparts *= 2;
+    tmp = iarray->memst->Alloc(n * sizeof(void*));
+    jobs = iarray->memst->Alloc(nparts * sizeof(CMUTIL_ArraySortJob));
+    done = CMUTIL_SemaphoreCreateInternal(iarray->memst, 0);
+    if (tmp == NULL || jobs == NULL || done == NULL) {
+        if (tmp) iarray->memst->Free(tmp);
+        if (jobs) iarray->memst->Free(jobs);
+        if (done) CMCall(done, Destroy);
+        return CMFalse;
+    }
+
+    dst = tmp;
+    for (i=0; i<nparts; i++) {
+        size_t lo = i * n / nparts, hi = (i + 1) * n / nparts;
+        CMUTIL_ArraySortJob *job = &jobs[i];
+        job->src = src + lo;
+        job->dst = dst + lo;
+        job->len = hi - lo;
+        job->comparator = cmp;
+        job->done = done;
+        CMCall(pool, Execute, CMUTIL_ArraySortPartProc, job);
+    }
+    CMUTIL_ArraySortWait(done, nparts);
+
+    for (width=1; width<nparts; width*=2) {
+        void **t;
+        njobs = 0;
+        for (i=0; i<nparts; i+=width*2) {
+            size_t lo = i * n / nparts;
+            CMUTIL_ArraySortJob *job = &jobs[njobs++];
+            job->src = src + lo;
+            job->dst = dst + lo;
+            job->mid = (i + width) * n / nparts - lo;
+            job->len = (i + width * 2) * n / nparts - lo;
+            CMCall(pool, Execute, CMUTIL_ArrayMergePartProc, job);
+        }
+        CMUTIL_ArraySortWait(done, njobs);
+        t = src; src = dst; dst = t;
+    }
+    if (src != iarray->data)
+        memcpy(iarray->data, src, n * sizeof(void*));
+
+    iarray->memst->Free(tmp);
+    iarray->memst->Free(jobs);
+    CMCall(done, Destroy);
+    return CMTrue;
+}
+
+CMUTIL_STATIC CMBool CMUTIL_ArraySortBase(
+        CMUTIL_Array_Internal *iarray, CMCompareCB cmp,
+        CMUTIL_ThreadPool *pool, CMBool stable)
+{
+    size_t n = iarray->size;
+    if (n < 2)
+        return CMTrue;
+    if (pool && n >= CMUTIL_ARRAY_PARALLEL_MIN &&
+            CMUTIL_ArrayParallelSort(iarray, cmp, pool))
+        return CMTrue;
+    if (stable) {
+        void **tmp = iarray->memst->Alloc(n * sizeof(void*));
+        if (tmp == NULL) {
+            CMLogErrorS("Failed to allocate memory for sorting.");
+            return CMFalse;
+        }
+        CMUTIL_ArrayMergeSort(iarray->data, tmp, n, cmp);
+        iarray->memst->Free(tmp);
+    } else {
+        int depth = 0;
+        size_t m;
+        for (m=n; m>1; m>>=1)
+            depth += 2;
+        CMUTIL_ArrayIntroSort(iarray->data, n, cmp, depth);
+    }
+    return CMTrue;
+}
+
+CMUTIL_STATIC CMBool CMUTIL_ArraySort(
+        CMUTIL_Array *array, CMCompareCB comparator, CMUTIL_ThreadPool *pool)
+{
+    CMUTIL_Array_Internal *iarray = (CMUTIL_Array_Internal*)array;
+    if (comparator == NULL)
+        comparator = iarray->comparator;
+    if (comparator == NULL) {
+        CMLogErrorS("Sort requires a comparator.");
+        return CMFalse;
+    }
+    if (iarray->issorted) {
+        if (comparator == iarray->comparator)
+            return CMTrue;
+        CMLogErrorS("Sort with another comparator is not applicable "
+                    "to sorted array.");
+        return CMFalse;
+    }
+    return CMUTIL_ArraySortBase(iarray, comparator, pool, CMFalse);
+}
+
+CMUTIL_STATIC CMBool CMUTIL_ArraySetSorted(
+        CMUTIL_Array *array, CMCompareCB comparator, CMUTIL_ThreadPool *pool)
+{
+    CMUTIL_Array_Internal *iarray = (CMUTIL_Array_Internal*)array;
+    size_t i, k;
+    if (comparator == NULL)
+        comparator = iarray->comparator;
+    if (comparator == NULL) {
+        CMLogErrorS("SetSorted requires a comparator.");
+        return CMFalse;
+    }
+    if (iarray->issorted && comparator == iarray->comparator)
+        return CMTrue;
+    if (!CMUTIL_ArraySortBase(iarray, comparator, pool, CMTrue))
+        return CMFalse;
+    // equal items keep the last one as Add of sorted array does.
+    for (i=0, k=0; i<iarray->size; i++) {
+        if (k > 0 && comparator(iarray->data[k-1], iarray->data[i]) == 0) {
+            if (iarray->freecb && iarray->data[k-1] != iarray->data[i])
+                iarray->freecb(iarray->data[k-1]);
+            iarray->data[k-1] = iarray->data[i];
+        } else {
+            iarray->data[k++] = iarray->data[i];
+        }
+    }
+    iarray->size = k;
+    iarray->comparator = comparator;
+    iarray->issorted = CMTrue;
+    return CMTrue;
+}
+
 typedef struct CMUTIL_ArrayIterator_st {
     CMUTIL_Iterator             base;
     const CMUTIL_Array_Internal *iarray;
@@ -383,6 +686,17 @@ CMUTIL_STATIC CMUTIL_Iterator *CMUTIL_ArrayIterator(const CMUTIL_Array *array)
     return (CMUTIL_Iterator*)res;
 }
 
+CMUTIL_STATIC CMBool CMUTIL_ArrayEach(
+        const CMUTIL_Array *array, CMEachCB callback, void *udata)
+{
+    const CMUTIL_Array_Internal *iarray = (const CMUTIL_Array_Internal*)array;
+    size_t i;
+    for (i=0; i<iarray->size; i++)
+        if (!callback(iarray->data[i], udata))
+            return CMFalse;
+    return CMTrue;
+}
+
 CMUTIL_STATIC void CMUTIL_ArrayClear(CMUTIL_Array *array)
 {
     CMUTIL_Array_Internal *iarray = (CMUTIL_Array_Internal*)array;
@@ -429,7 +743,10 @@ static CMUTIL_Array g_cmutil_array = {
         CMUTIL_ArrayBottom,
         CMUTIL_ArrayIterator,
         CMUTIL_ArrayClear,
-        CMUTIL_ArrayDestroy
+        CMUTIL_ArrayDestroy,
+        CMUTIL_ArraySort,
+        CMUTIL_ArraySetSorted,
+        CMUTIL_ArrayEach
 };
 
 CMUTIL_Array *CMUTIL_ArrayCreateInternal(
@@ -475,3 +792,471 @@ CMUTIL_Array *CMUTIL_ArrayCreateEx(size_t initcapacity,
 }
 
 
+
+
+//*****************************************************************************
+// CMUTIL_Vector implementation
+//*****************************************************************************
+
+///
+/// \brief Implementation structure of CMUTIL_Vector.
+///
+typedef struct CMUTIL_Vector_Internal {
+    CMUTIL_Vector   base;           // CMUTIL_Vector interface
+    uint8_t         *data;
+    size_t          capacity;       // in elements
+    size_t          size;           // in elements
+    size_t          elemsize;
+    CMUTIL_Mem      *memst;
+} CMUTIL_Vector_Internal;
+
+#define CMUTIL_VectorElem(ivec, index)  \
+    ((ivec)->data + (index) * (ivec)->elemsize)
+
+CMUTIL_STATIC CMBool CMUTIL_VectorCheckSize(
+        CMUTIL_Vector_Internal *ivec, const size_t insize)
+{
+    uint8_t *newdata;
+    size_t reqsz = ivec->size + insize;
+    if (reqsz < ivec->size || reqsz > SIZE_MAX / ivec->elemsize) {
+        CMLogErrorS("Vector size overflow.");
+        return CMFalse;
+    }
+    if (ivec->capacity < reqsz) {
+        size_t newcap = ivec->capacity ? ivec->capacity * 2 : 4;
+        while (newcap < reqsz) newcap *= 2;
+        if (newcap > SIZE_MAX / ivec->elemsize)
+            newcap = reqsz;
+        newdata = ivec->memst->Realloc(ivec->data, newcap * ivec->elemsize);
+        if (newdata == NULL) {
+            CMLogErrorS("Failed to allocate memory for vector.");
+            return CMFalse;
+        }
+        ivec->data = newdata;
+        ivec->capacity = newcap;
+    }
+    return CMTrue;
+}
+
+CMUTIL_STATIC CMBool CMUTIL_VectorInsert(
+        CMUTIL_Vector *vec, size_t index, const void *elems, size_t count)
+{
+    CMUTIL_Vector_Internal *ivec = (CMUTIL_Vector_Internal*)vec;
+    uint8_t *pos;
+    if (index > ivec->size) {
+        CMLogErrorS("Index out of bound: %zu (vector size is %zu).",
+                   index, ivec->size);
+        return CMFalse;
+    }
+    if (count == 0)
+        return CMTrue;
+    if (!CMUTIL_VectorCheckSize(ivec, count))
+        return CMFalse;
+    pos = CMUTIL_VectorElem(ivec, index);
+    if (index < ivec->size)
+        memmove(pos + count * ivec->elemsize, pos,
+                (ivec->size - index) * ivec->elemsize);
+    if (elems)
+        memcpy(pos, elems, count * ivec->elemsize);
+    else
+        memset(pos, 0x0, count * ivec->elemsize);
+    ivec->size += count;
+    return CMTrue;
+}
+
+CMUTIL_STATIC CMBool CMUTIL_VectorAppend(
+        CMUTIL_Vector *vec, const void *elems, size_t count)
+{
+    CMUTIL_Vector_Internal *ivec = (CMUTIL_Vector_Internal*)vec;
+    return CMUTIL_VectorInsert(vec, ivec->size, elems, count);
+}
+
+CMUTIL_STATIC CMBool CMUTIL_VectorErase(
+        CMUTIL_Vector *vec, size_t index, size_t count)
+{
+    CMUTIL_Vector_Internal *ivec = (CMUTIL_Vector_Internal*)vec;
+    if (index > ivec->size || count > ivec->size - index) {
+        CMLogErrorS("Range out of bound: %zu+%zu (vector size is %zu).",
+                   index, count, ivec->size);
+        return CMFalse;
+    }
+    if (index + count < ivec->size)
+        memmove(CMUTIL_VectorElem(ivec, index),
+                CMUTIL_VectorElem(ivec, index + count),
+                (ivec->size - index - count) * ivec->elemsize);
+    ivec->size -= count;
+    return CMTrue;
+}
+
+CMUTIL_STATIC void *CMUTIL_VectorGetAt(const CMUTIL_Vector *vec, size_t index)
+{
+    const CMUTIL_Vector_Internal *ivec = (const CMUTIL_Vector_Internal*)vec;
+    if (index < ivec->size)
+        return CMUTIL_VectorElem(ivec, index);
+    CMLogErrorS("Index out of range: %zu (vector size is %zu).",
+               index, ivec->size);
+    return NULL;
+}
+
+CMUTIL_STATIC CMBool CMUTIL_VectorSetAt(
+        CMUTIL_Vector *vec, size_t index, const void *elem)
+{
+    CMUTIL_Vector_Internal *ivec = (CMUTIL_Vector_Internal*)vec;
+    if (index < ivec->size) {
+        memmove(CMUTIL_VectorElem(ivec, index), elem, ivec->elemsize);
+        return CMTrue;
+    }
+    CMLogErrorS("Index out of bound: %zu (vector size is %zu).",
+               index, ivec->size);
+    return CMFalse;
+}
+
+CMUTIL_STATIC void *CMUTIL_VectorGetData(const CMUTIL_Vector *vec)
+{
+    const CMUTIL_Vector_Internal *ivec = (const CMUTIL_Vector_Internal*)vec;
+    return ivec->data;
+}
+
+CMUTIL_STATIC size_t CMUTIL_VectorGetSize(const CMUTIL_Vector *vec)
+{
+    const CMUTIL_Vector_Internal *ivec = (const CMUTIL_Vector_Internal*)vec;
+    return ivec->size;
+}
+
+CMUTIL_STATIC size_t CMUTIL_VectorGetElementSize(const CMUTIL_Vector *vec)
+{
+    const CMUTIL_Vector_Internal *ivec = (const CMUTIL_Vector_Internal*)vec;
+    return ivec->elemsize;
+}
+
+CMUTIL_STATIC CMBool CMUTIL_VectorResize(CMUTIL_Vector *vec, size_t count)
+{
+    CMUTIL_Vector_Internal *ivec = (CMUTIL_Vector_Internal*)vec;
+    if (count > ivec->size)
+        return CMUTIL_VectorInsert(vec, ivec->size, NULL, count - ivec->size);
+    ivec->size = count;
+    return CMTrue;
+}
+
+CMUTIL_STATIC CMBool CMUTIL_VectorReserve(CMUTIL_Vector *vec, size_t count)
+{
+    CMUTIL_Vector_Internal *ivec = (CMUTIL_Vector_Internal*)vec;
+    if (count <= ivec->size)
+        return CMTrue;
+    return CMUTIL_VectorCheckSize(ivec, count - ivec->size);
+}
+
+CMUTIL_STATIC void CMUTIL_VectorSort(CMUTIL_Vector *vec, CMCompareCB comparator)
+{
+    CMUTIL_Vector_Internal *ivec = (CMUTIL_Vector_Internal*)vec;
+    if (ivec->size > 1)
+        qsort(ivec->data, ivec->size, ivec->elemsize, comparator);
+}
+
+CMUTIL_STATIC CMBool CMUTIL_VectorBinarySearch(
+        const CMUTIL_Vector *vec, const void *key,
+        CMCompareCB comparator, size_t *index)
+{
+    const CMUTIL_Vector_Internal *ivec = (const CMUTIL_Vector_Internal*)vec;
+    size_t stpos = 0, edpos = ivec->size;
+    // lower bound, so the first of equal elements is found.
+    while (stpos < edpos) {
+        const size_t mid = stpos + (edpos - stpos) / 2;
+        if (comparator(key, CMUTIL_VectorElem(ivec, mid)) > 0)
+            stpos = mid + 1;
+        else
+            edpos = mid;
+    }
+    if (index)
+        *index = stpos;
+    return stpos < ivec->size &&
+            comparator(key, CMUTIL_VectorElem(ivec, stpos)) == 0?
+                CMTrue : CMFalse;
+}
+
+CMUTIL_STATIC void CMUTIL_VectorClear(CMUTIL_Vector *vec)
+{
+    CMUTIL_Vector_Internal *ivec = (CMUTIL_Vector_Internal*)vec;
+    ivec->size = 0;
+}
+
+CMUTIL_STATIC void CMUTIL_VectorDestroy(CMUTIL_Vector *vec)
+{
+    CMUTIL_Vector_Internal *ivec = (CMUTIL_Vector_Internal*)vec;
+    if (ivec) {
+        if (ivec->data)
+            ivec->memst->Free(ivec->data);
+        ivec->memst->Free(ivec);
+    }
+}
+
+static CMUTIL_Vector g_cmutil_vector = {
+        CMUTIL_VectorAppend,
+        CMUTIL_VectorInsert,
+        CMUTIL_VectorErase,
+        CMUTIL_VectorGetAt,
+        CMUTIL_VectorSetAt,
+        CMUTIL_VectorGetData,
+        CMUTIL_VectorGetSize,
+        CMUTIL_VectorGetElementSize,
+        CMUTIL_VectorResize,
+        CMUTIL_VectorReserve,
+        CMUTIL_VectorSort,
+        CMUTIL_VectorBinarySearch,
+        CMUTIL_VectorClear,
+        CMUTIL_VectorDestroy
+};
+
+CMUTIL_Vector *CMUTIL_VectorCreateInternal(
+        CMUTIL_Mem *mem, size_t elemsize, size_t initcapacity)
+{
+    CMUTIL_Vector_Internal *ivec;
+    if (elemsize == 0) {
+        CMLogErrorS("Element size of vector must not be zero.");
+        return NULL;
+    }
+    ivec = mem->Alloc(sizeof(CMUTIL_Vector_Internal));
+    if (!ivec) {
+        CMLogErrorS("Failed to allocate memory for vector.");
+        return NULL;
+    }
+    memset(ivec, 0x0, sizeof(CMUTIL_Vector_Internal));
+
+    memcpy(ivec, &g_cmutil_vector, sizeof(CMUTIL_Vector));
+    ivec->elemsize = elemsize;
+    ivec->memst = mem;
+    if (initcapacity > 0 && !CMUTIL_VectorCheckSize(ivec, initcapacity)) {
+        mem->Free(ivec);
+        return NULL;
+    }
+    return (CMUTIL_Vector*)ivec;
+}
+
+CMUTIL_Vector *CMUTIL_VectorCreateEx(size_t elemsize, size_t initcapacity)
+{
+    return CMUTIL_VectorCreateInternal(
+                CMUTIL_GetMem(), elemsize, initcapacity);
+}
+
+
+
+
+//*****************************************************************************
+// CMUTIL_Heap implementation
+//*****************************************************************************
+
+/*
+ * 4-ary heap: children of i are 4i+1 .. 4i+4. It is half as deep as a
+ * binary heap and the children of a node share a cache line, so sifting
+ * down costs fewer misses for a few more comparisons.
+ */
+#define CMUTIL_HEAP_ARITY   4
+
+///
+/// \brief Implementation structure of CMUTIL_Heap.
+///
+typedef struct CMUTIL_Heap_Internal {
+    CMUTIL_Heap     base;           // CMUTIL_Heap interface
+    void            **items;
+    size_t          capacity;
+    size_t          size;
+    CMCompareCB     comparator;
+    CMHeapIndexCB   indexcb;        // tells items where they are, or NULL
+    CMFreeCB        freecb;
+    CMUTIL_Mem      *memst;
+} CMUTIL_Heap_Internal;
+
+CMUTIL_STATIC void CMUTIL_HeapPlace(
+        CMUTIL_Heap_Internal *iheap, void *item, size_t index)
+{
+    iheap->items[index] = item;
+    if (iheap->indexcb)
+        iheap->indexcb(item, index);
+}
+
+CMUTIL_STATIC size_t CMUTIL_HeapSiftUp(
+        CMUTIL_Heap_Internal *iheap, size_t index)
+{
+    void *item = iheap->items[index];
+    size_t start = index;
+    while (index > 0) {
+        size_t parent = (index - 1) / CMUTIL_HEAP_ARITY;
+        if (iheap->comparator(item, iheap->items[parent]) >= 0)
+            break;
+        CMUTIL_HeapPlace(iheap, iheap->items[parent], index);
+        index = parent;
+    }
+    if (index != start)
+        CMUTIL_HeapPlace(iheap, item, index);
+    return index;
+}
+
+CMUTIL_STATIC void CMUTIL_HeapSiftDown(
+        CMUTIL_Heap_Internal *iheap, size_t index)
+{
+    void *item = iheap->items[index];
+    size_t size = iheap->size, start = index;
+    // index <= (size - 2) / 4 means the first child is in range.
+    while (size > 1 && index <= (size - 2) / CMUTIL_HEAP_ARITY) {
+        size_t child = index * CMUTIL_HEAP_ARITY + 1, best = child;
+        size_t last = size - child > CMUTIL_HEAP_ARITY?
+                    child + CMUTIL_HEAP_ARITY : size;
+        for (child++; child < last; child++)
+            if (iheap->comparator(iheap->items[child], iheap->items[best]) < 0)
+                best = child;
+        if (iheap->comparator(iheap->items[best], item) >= 0)
+            break;
+        CMUTIL_HeapPlace(iheap, iheap->items[best], index);
+        index = best;
+    }
+    if (index != start)
+        CMUTIL_HeapPlace(iheap, item, index);
+}
+
+CMUTIL_STATIC CMBool CMUTIL_HeapPush(CMUTIL_Heap *heap, void *item)
+{
+    CMUTIL_Heap_Internal *iheap = (CMUTIL_Heap_Internal*)heap;
+    if (iheap->size == iheap->capacity) {
+        size_t newcap = iheap->capacity? iheap->capacity * 2 : 16;
+        void **newitems;
+        if (newcap > SIZE_MAX / sizeof(void*)) {
+            CMLogErrorS("Heap size overflow.");
+            return CMFalse;
+        }
+        newitems = iheap->memst->Realloc(iheap->items, newcap * sizeof(void*));
+        if (newitems == NULL) {
+            CMLogErrorS("Failed to allocate memory for heap.");
+            return CMFalse;
+        }
+        iheap->items = newitems;
+        iheap->capacity = newcap;
+    }
+    CMUTIL_HeapPlace(iheap, item, iheap->size++);
+    CMUTIL_HeapSiftUp(iheap, iheap->size - 1);
+    return CMTrue;
+}
+
+CMUTIL_STATIC void *CMUTIL_HeapPeek(const CMUTIL_Heap *heap)
+{
+    const CMUTIL_Heap_Internal *iheap = (const CMUTIL_Heap_Internal*)heap;
+    return iheap->size > 0? iheap->items[0] : NULL;
+}
+
+CMUTIL_STATIC void *CMUTIL_HeapRemoveAt(CMUTIL_Heap *heap, size_t index)
+{
+    CMUTIL_Heap_Internal *iheap = (CMUTIL_Heap_Internal*)heap;
+    void *item;
+    if (index >= iheap->size) {
+        CMLogErrorS("Heap index %zu out of bound (size: %zu).",
+                    index, iheap->size);
+        return NULL;
+    }
+    item = iheap->items[index];
+    if (index < --iheap->size) {
+        // the last item fills the hole and moves to wherever it belongs.
+        CMUTIL_HeapPlace(iheap, iheap->items[iheap->size], index);
+        if (CMUTIL_HeapSiftUp(iheap, index) == index)
+            CMUTIL_HeapSiftDown(iheap, index);
+    }
+    if (iheap->indexcb)
+        iheap->indexcb(item, CMUTIL_HEAP_NONE);
+    return item;
+}
+
+CMUTIL_STATIC void *CMUTIL_HeapPop(CMUTIL_Heap *heap)
+{
+    CMUTIL_Heap_Internal *iheap = (CMUTIL_Heap_Internal*)heap;
+    return iheap->size > 0? CMUTIL_HeapRemoveAt(heap, 0) : NULL;
+}
+
+CMUTIL_STATIC CMBool CMUTIL_HeapUpdate(CMUTIL_Heap *heap, size_t index)
+{
+    CMUTIL_Heap_Internal *iheap = (CMUTIL_Heap_Internal*)heap;
+    if (index >= iheap->size) {
+        CMLogErrorS("Heap index %zu out of bound (size: %zu).",
+                    index, iheap->size);
+        return CMFalse;
+    }
+    if (CMUTIL_HeapSiftUp(iheap, index) == index)
+        CMUTIL_HeapSiftDown(iheap, index);
+    return CMTrue;
+}
+
+CMUTIL_STATIC void *CMUTIL_HeapGetAt(const CMUTIL_Heap *heap, size_t index)
+{
+    const CMUTIL_Heap_Internal *iheap = (const CMUTIL_Heap_Internal*)heap;
+    return index < iheap->size? iheap->items[index] : NULL;
+}
+
+CMUTIL_STATIC size_t CMUTIL_HeapGetSize(const CMUTIL_Heap *heap)
+{
+    const CMUTIL_Heap_Internal *iheap = (const CMUTIL_Heap_Internal*)heap;
+    return iheap->size;
+}
+
+CMUTIL_STATIC void CMUTIL_HeapClear(CMUTIL_Heap *heap)
+{
+    CMUTIL_Heap_Internal *iheap = (CMUTIL_Heap_Internal*)heap;
+    size_t i;
+    for (i=0; i<iheap->size; i++) {
+        if (iheap->indexcb)
+            iheap->indexcb(iheap->items[i], CMUTIL_HEAP_NONE);
+        if (iheap->freecb)
+            iheap->freecb(iheap->items[i]);
+    }
+    iheap->size = 0;
+}
+
+CMUTIL_STATIC void CMUTIL_HeapDestroy(CMUTIL_Heap *heap)
+{
+    CMUTIL_Heap_Internal *iheap = (CMUTIL_Heap_Internal*)heap;
+    if (iheap) {
+        CMUTIL_HeapClear(heap);
+        if (iheap->items)
+            iheap->memst->Free(iheap->items);
+        iheap->memst->Free(iheap);
+    }
+}
+
+static CMUTIL_Heap g_cmutil_heap = {
+        CMUTIL_HeapPush,
+        CMUTIL_HeapPeek,
+        CMUTIL_HeapPop,
+        CMUTIL_HeapRemoveAt,
+        CMUTIL_HeapUpdate,
+        CMUTIL_HeapGetAt,
+        CMUTIL_HeapGetSize,
+        CMUTIL_HeapClear,
+        CMUTIL_HeapDestroy
+};
+
+CMUTIL_Heap *CMUTIL_HeapCreateInternal(
+        CMUTIL_Mem *mem, CMCompareCB comparator,
+        CMHeapIndexCB indexcb, CMFreeCB freecb)
+{
+    CMUTIL_Heap_Internal *iheap;
+    if (comparator == NULL) {
+        CMLogErrorS("Heap requires a comparator.");
+        return NULL;
+    }
+    iheap = mem->Alloc(sizeof(CMUTIL_Heap_Internal));
+    if (!iheap) {
+        CMLogErrorS("Failed to allocate memory for heap.");
+        return NULL;
+    }
+    memset(iheap, 0x0, sizeof(CMUTIL_Heap_Internal));
+
+    memcpy(iheap, &g_cmutil_heap, sizeof(CMUTIL_Heap));
+    iheap->comparator = comparator;
+    iheap->indexcb = indexcb;
+    iheap->freecb = freecb;
+    iheap->memst = mem;
+    return (CMUTIL_Heap*)iheap;
+}
+
+CMUTIL_Heap *CMUTIL_HeapCreateEx(
+        CMCompareCB comparator, CMHeapIndexCB indexcb, CMFreeCB freecb)
+{
+    return CMUTIL_HeapCreateInternal(
+                CMUTIL_GetMem(), comparator, indexcb, freecb);
+}
@@ -41,7 +41,12 @@ void CMUTIL_Init(CMMemOper memoper)
         const CMUTIL_LogSystem *log_system = NULL;
         CMUTIL_CallStackInit();
         CMUTIL_MemDebugInit(memoper);
+        CMUTIL_ObjectPoolInit();
+        CMUTIL_HashInit();
+        CMUTIL_EpochInit();
+        CMUTIL_MapAtomInit();
         CMUTIL_ThreadInit();
+        CMUTIL_ArenaInit();
         CMUTIL_StringBaseInit();
         CMUTIL_XmlInit();
         CMUTIL_NetworkInit();
@@ -69,12 +74,17 @@ CMBool CMUTIL_Clear()
     if (g_cmutil_init_cnt > 0) {
         g_cmutil_init_cnt--;
         if (g_cmutil_init_cnt == 0) {
+            CMUTIL_MemStopTrimmer();
             CMUTIL_HttpClear();
             CMUTIL_LogClear();
             CMUTIL_NetworkClear();
             CMUTIL_XmlClear();
             CMUTIL_StringBaseClear();
+            CMUTIL_ArenaClear();
             CMUTIL_ThreadClear();
+            CMUTIL_MapAtomClear();
+            CMUTIL_EpochClear();
+            CMUTIL_ObjectPoolClear();
             res = CMUTIL_MemDebugClear();
             CMUTIL_CallStackClear();
         }
@@ -0,0 +1,545 @@
+/*
+MIT License
+
+Copyright (c) 2020 Dennis Soungjin Park<xcomart@gmail.com>
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+ */
+
+
+#include "functions.h"
+
+CMUTIL_LogDefine("cmutils.cache")
+
+/*
+ * Bounded cache: keys are spread over shards by the upper half of their
+ * hash, each shard has its own mutex, an intrusive hash table chaining
+ * entries by the lower half of the same hash and intrusive recency lists,
+ * so a hit or an eviction is O(1) and threads only contend on keys of the
+ * same shard. The key is stored once, inline in its entry.
+ *
+ * With the segmented policy a new entry starts in the probation list and
+ * moves to the protected list on its second access. Victims are taken
+ * from probation first, so one pass over many keys which are never read
+ * again can not flush entries which are used repeatedly.
+ *
+ * Entries leaving the cache are chained while the shard is locked and
+ * handed to the eviction callback after it is unlocked, so the callback
+ * may use the cache.
+ */
+
+#define CMUTIL_CACHE_SHARDS     16
+// initial number of hash buckets in a shard, a power of 2.
+#define CMUTIL_CACHE_BUCKETS    64
+// share of the protected segment in a shard, in percent.
+#define CMUTIL_CACHE_PROTECTED  80
+
+typedef struct CMUTIL_CacheEntry CMUTIL_CacheEntry;
+struct CMUTIL_CacheEntry {
+    CMUTIL_CacheEntry   *prev;      // towards the most recently used
+    CMUTIL_CacheEntry   *next;      // towards the least recently used
+    CMUTIL_CacheEntry   *chain;     // next entry in the same bucket
+    uint64_t            hash;
+    void                *value;
+    size_t              weight;
+    int64_t             expire;     // in milliseconds, 0 if never expires
+    CMBool              protect;    // in the protected segment
+    CMCacheEvictReason  reason;     // why it left, for the callback
+    char                key[];
+};
+
+typedef struct CMUTIL_CacheList {
+    CMUTIL_CacheEntry   *head;
+    CMUTIL_CacheEntry   *tail;
+    size_t              weight;
+} CMUTIL_CacheList;
+
+typedef struct CMUTIL_CacheShard {
+    CMUTIL_Mutex        *mutex;
+    CMUTIL_CacheEntry   **buckets;
+    uint64_t            bucketmask;
+    size_t              count;
+    CMUTIL_CacheList    probation;  // the only list with plain LRU
+    CMUTIL_CacheList    protect;
+    size_t              capacity;
+    size_t              protcap;
+    uint64_t            hits;
+    uint64_t            misses;
+    uint64_t            evictions;
+    uint64_t            expirations;
+    // writers of neighbour shards must not share a cache line.
+    char                dummy_padder[24];
+} CMUTIL_CacheShard;
+
+typedef struct CMUTIL_Cache_Internal {
+    CMUTIL_Cache        base;
+    CMUTIL_CacheShard   *shards;
+    uint32_t            shardmask;
+    CMCachePolicy       policy;
+    CMCacheEvictCB      evictcb;
+    void                *udata;
+    void                *(*dupcb)(void *value);
+    CMUTIL_Mem          *memst;
+} CMUTIL_Cache_Internal;
+
+CMUTIL_STATIC int64_t CMUTIL_CacheNow(void)
+{
+    struct timeval tv;
+    gettimeofday(&tv, NULL);
+    return (int64_t)tv.tv_sec * 1000 + tv.tv_usec / 1000;
+}
+
+CMUTIL_STATIC CMUTIL_CacheShard *CMUTIL_CacheShardOf(
+        const CMUTIL_Cache_Internal *icache, uint64_t hash)
+{
+    return &icache->shards[(uint32_t)(hash >> 32) & icache->shardmask];
+}
+
+CMUTIL_STATIC CMUTIL_CacheEntry **CMUTIL_CacheBucketOf(
+        CMUTIL_CacheShard *shard, uint64_t hash, const char *key)
+{
+    CMUTIL_CacheEntry **link = &shard->buckets[hash & shard->bucketmask];
+    while (*link && ((*link)->hash != hash || strcmp((*link)->key, key)))
+        link = &(*link)->chain;
+    return link;
+}
+
+CMUTIL_STATIC CMUTIL_CacheEntry *CMUTIL_CacheFind(
+        CMUTIL_CacheShard *shard, uint64_t hash, const char *key)
+{
+    return *CMUTIL_CacheBucketOf(shard, hash, key);
+}
+
+// doubles the buckets, the old ones are kept if allocation fails.
+CMUTIL_STATIC void CMUTIL_CacheRehash(
+        CMUTIL_Cache_Internal *icache, CMUTIL_CacheShard *shard)
+{
+    uint64_t i, nbuckets = (shard->bucketmask + 1) * 2;
+    CMUTIL_CacheEntry **buckets = icache->memst->Calloc(
+            (size_t)nbuckets, sizeof(CMUTIL_CacheEntry*));
+    if (buckets == NULL)
+        return;
+    for (i=0; i<=shard->bucketmask; i++) {
+        CMUTIL_CacheEntry *entry = shard->buckets[i];
+        while (entry) {
+            CMUTIL_CacheEntry *chain = entry->chain;
+            CMUTIL_CacheEntry **link = &buckets[entry->hash & (nbuckets - 1)];
+            entry->chain = *link;
+            *link = entry;
+            entry = chain;
+        }
+    }
+    icache->memst->Free(shard->buckets);
+    shard->buckets = buckets;
+    shard->bucketmask = nbuckets - 1;
+}
+
+// indexes the entry, returns the entry it replaces or NULL.
+CMUTIL_STATIC CMUTIL_CacheEntry *CMUTIL_CacheIndex(
+        CMUTIL_Cache_Internal *icache, CMUTIL_CacheShard *shard,
+        CMUTIL_CacheEntry *entry)
+{
+    CMUTIL_CacheEntry **link =
+            CMUTIL_CacheBucketOf(shard, entry->hash, entry->key);
+    CMUTIL_CacheEntry *prev = *link;
+    if (prev) {
+        entry->chain = prev->chain;
+        *link = entry;
+        return prev;
+    }
+    entry->chain = NULL;
+    *link = entry;
+    shard->count++;
+    // keep the chains short, 3/4 of an entry per bucket at most.
+    if (shard->count > (shard->bucketmask + 1) / 4 * 3)
+        CMUTIL_CacheRehash(icache, shard);
+    return NULL;
+}
+
+CMUTIL_STATIC void CMUTIL_CacheUnindex(
+        CMUTIL_CacheShard *shard, CMUTIL_CacheEntry *entry)
+{
+    CMUTIL_CacheEntry **link = &shard->buckets[entry->hash & shard->bucketmask];
+    while (*link != entry)
+        link = &(*link)->chain;
+    *link = entry->chain;
+    shard->count--;
+}
+
+CMUTIL_STATIC void CMUTIL_CacheListUnlink(
+        CMUTIL_CacheList *list, CMUTIL_CacheEntry *entry)
+{
+    if (entry->prev) entry->prev->next = entry->next;
+    else list->head = entry->next;
+    if (entry->next) entry->next->prev = entry->prev;
+    else list->tail = entry->prev;
+    list->weight -= entry->weight;
+}
+
+CMUTIL_STATIC void CMUTIL_CacheListPush(
+        CMUTIL_CacheList *list, CMUTIL_CacheEntry *entry)
+{
+    entry->prev = NULL;
+    entry->next = list->head;
+    if (list->head) list->head->prev = entry;
+    else list->tail = entry;
+    list->head = entry;
+    list->weight += entry->weight;
+}
+
+CMUTIL_STATIC CMUTIL_CacheList *CMUTIL_CacheListOf(
+        CMUTIL_CacheShard *shard, CMUTIL_CacheEntry *entry)
+{
+    return entry->protect? &shard->protect : &shard->probation;
+}
+
+// unlinks an entry and chains it to the entries to be released.
+CMUTIL_STATIC void CMUTIL_CacheDrop(
+        CMUTIL_CacheShard *shard, CMUTIL_CacheEntry *entry,
+        CMCacheEvictReason reason, CMUTIL_CacheEntry **dropped)
+{
+    CMUTIL_CacheListUnlink(CMUTIL_CacheListOf(shard, entry), entry);
+    CMUTIL_CacheUnindex(shard, entry);
+    entry->reason = reason;
+    entry->next = *dropped;
+    *dropped = entry;
+}
+
+CMUTIL_STATIC void CMUTIL_CacheTouch(
+        CMUTIL_Cache_Internal *icache, CMUTIL_CacheShard *shard,
+        CMUTIL_CacheEntry *entry)
+{
+    CMUTIL_CacheListUnlink(CMUTIL_CacheListOf(shard, entry), entry);
+    if (icache->policy == CMCacheSegmented && !entry->protect) {
+        entry->protect = CMTrue;
+        CMUTIL_CacheListPush(&shard->protect, entry);
+        // overflow of the protected segment gets another chance on trial.
+        while (shard->protect.weight > shard->protcap &&
+               shard->protect.tail != entry) {
+            CMUTIL_CacheEntry *demoted = shard->protect.tail;
+            CMUTIL_CacheListUnlink(&shard->protect, demoted);
+            demoted->protect = CMFalse;
+            CMUTIL_CacheListPush(&shard->probation, demoted);
+        }
+    } else {
+        CMUTIL_CacheListPush(CMUTIL_CacheListOf(shard, entry), entry);
+    }
+}
+
+CMUTIL_STATIC void CMUTIL_CacheRelease(
+        CMUTIL_Cache_Internal *icache, CMUTIL_CacheEntry *dropped)
+{
+    while (dropped) {
+        CMUTIL_CacheEntry *next = dropped->next;
+        if (icache->evictcb)
+            icache->evictcb(dropped->key, dropped->value,
+                            dropped->reason, icache->udata);
+        icache->memst->Free(dropped);
+        dropped = next;
+    }
+}
+
+CMUTIL_STATIC CMBool CMUTIL_CachePut(
+        CMUTIL_Cache *cache, const char *key, void *value,
+        size_t weight, long ttl)
+{
+    CMUTIL_Cache_Internal *icache = (CMUTIL_Cache_Internal*)cache;
+    uint64_t hash = CMUTIL_HashStr(key);
+    CMUTIL_CacheShard *shard = CMUTIL_CacheShardOf(icache, hash);
+    CMUTIL_CacheEntry *entry, *prev, *dropped = NULL;
+    size_t keylen = strlen(key);
+
+    if (weight == 0)
+        weight = 1;
+    // a shard gets capacity / shards, evicting it all would not help.
+    if (weight > shard->capacity) {
+        CMLogErrorS("Cache entry weight %zu exceeds the shard capacity %zu.",
+                    weight, shard->capacity);
+        return CMFalse;
+    }
+    entry = icache->memst->Alloc(sizeof(CMUTIL_CacheEntry) + keylen + 1);
+    if (entry == NULL) {
+        CMLogErrorS("Failed to allocate memory for cache entry.");
+        return CMFalse;
+    }
+    memset(entry, 0x0, sizeof(CMUTIL_CacheEntry));
+    memcpy(entry->key, key, keylen + 1);
+    entry->hash = hash;
+    entry->value = value;
+    entry->weight = weight;
+    entry->expire = ttl > 0? CMUTIL_CacheNow() + ttl : 0;
+
+    CMCall(shard->mutex, Lock);
+    prev = CMUTIL_CacheIndex(icache, shard, entry);
+    if (prev) {
+        // the index holds the new entry already.
+        CMUTIL_CacheListUnlink(CMUTIL_CacheListOf(shard, prev), prev);
+        prev->reason = CMCacheEvictReplaced;
+        prev->next = dropped;
+        dropped = prev;
+        entry->protect = prev->protect;
+    }
+    CMUTIL_CacheListPush(CMUTIL_CacheListOf(shard, entry), entry);
+    while (shard->probation.weight + shard->protect.weight >
+           shard->capacity) {
+        // the new entry fits alone, so there is always another one.
+        CMUTIL_CacheEntry *victim = shard->probation.tail;
+        if (victim == NULL || victim == entry)
+            victim = shard->protect.tail;
+        if (victim == NULL || victim == entry)
+            break;
+        CMUTIL_CacheDrop(shard, victim, CMCacheEvictCapacity, &dropped);
+        shard->evictions++;
+    }
+    CMCall(shard->mutex, Unlock);
+
+    CMUTIL_CacheRelease(icache, dropped);
+    return CMTrue;
+}
+
+CMUTIL_STATIC void *CMUTIL_CacheGet(CMUTIL_Cache *cache, const char *key)
+{
+    CMUTIL_Cache_Internal *icache = (CMUTIL_Cache_Internal*)cache;
+    uint64_t hash = CMUTIL_HashStr(key);
+    CMUTIL_CacheShard *shard = CMUTIL_CacheShardOf(icache, hash);
+    CMUTIL_CacheEntry *entry, *dropped = NULL;
+    void *res = NULL;
+
+    CMCall(shard->mutex, Lock);
+    entry = CMUTIL_CacheFind(shard, hash, key);
+    if (entry && entry->expire > 0 && entry->expire <= CMUTIL_CacheNow()) {
+        CMUTIL_CacheDrop(shard, entry, CMCacheEvictExpired, &dropped);
+        shard->expirations++;
+        entry = NULL;
+    }
+    if (entry) {
+        CMUTIL_CacheTouch(icache, shard, entry);
+        res = icache->dupcb? icache->dupcb(entry->value) : entry->value;
+        shard->hits++;
+    } else {
+        shard->misses++;
+    }
+    CMCall(shard->mutex, Unlock);
+
+    CMUTIL_CacheRelease(icache, dropped);
+    return res;
+}
+
+CMUTIL_STATIC void *CMUTIL_CacheRemove(CMUTIL_Cache *cache, const char *key)
+{
+    CMUTIL_Cache_Internal *icache = (CMUTIL_Cache_Internal*)cache;
+    uint64_t hash = CMUTIL_HashStr(key);
+    CMUTIL_CacheShard *shard = CMUTIL_CacheShardOf(icache, hash);
+    CMUTIL_CacheEntry *entry;
+    void *res = NULL;
+
+    CMCall(shard->mutex, Lock);
+    entry = CMUTIL_CacheFind(shard, hash, key);
+    if (entry) {
+        CMUTIL_CacheListUnlink(CMUTIL_CacheListOf(shard, entry), entry);
+        CMUTIL_CacheUnindex(shard, entry);
+    }
+    CMCall(shard->mutex, Unlock);
+
+    if (entry) {
+        res = entry->value;
+        icache->memst->Free(entry);
+    }
+    return res;
+}
+
+CMUTIL_STATIC size_t CMUTIL_CacheRemoveExpired(CMUTIL_Cache *cache)
+{
+    CMUTIL_Cache_Internal *icache = (CMUTIL_Cache_Internal*)cache;
+    int64_t now = CMUTIL_CacheNow();
+    size_t res = 0;
+    uint32_t i;
+
+    for (i=0; i<=icache->shardmask; i++) {
+        CMUTIL_CacheShard *shard = &icache->shards[i];
+        CMUTIL_CacheEntry *dropped = NULL;
+        CMUTIL_CacheList *lists[2];
+        int j;
+        lists[0] = &shard->probation;
+        lists[1] = &shard->protect;
+        CMCall(shard->mutex, Lock);
+        for (j=0; j<2; j++) {
+            CMUTIL_CacheEntry *entry = lists[j]->head;
+            while (entry) {
+                CMUTIL_CacheEntry *next = entry->next;
+                if (entry->expire > 0 && entry->expire <= now) {
+                    CMUTIL_CacheDrop(shard, entry, CMCacheEvictExpired,
+                                     &dropped);
+                    shard->expirations++;
+                    res++;
+                }
+                entry = next;
+            }
+        }
+        CMCall(shard->mutex, Unlock);
+        CMUTIL_CacheRelease(icache, dropped);
+    }
+    return res;
+}
+
+CMUTIL_STATIC void CMUTIL_CacheGetStats(
+        const CMUTIL_Cache *cache, CMUTIL_CacheStats *stats)
+{
+    const CMUTIL_Cache_Internal *icache = (const CMUTIL_Cache_Internal*)cache;
+    uint32_t i;
+
+    memset(stats, 0x0, sizeof(CMUTIL_CacheStats));
+    for (i=0; i<=icache->shardmask; i++) {
+        CMUTIL_CacheShard *shard = &icache->shards[i];
+        CMCall(shard->mutex, Lock);
+        stats->hits += shard->hits;
+        stats->misses += shard->misses;
+        stats->evictions += shard->evictions;
+        stats->expirations += shard->expirations;
+        stats->count += shard->count;
+        stats->weight += shard->probation.weight + shard->protect.weight;
+        CMCall(shard->mutex, Unlock);
+    }
+}
+
+CMUTIL_STATIC size_t CMUTIL_CacheGetSize(const CMUTIL_Cache *cache)
+{
+    CMUTIL_CacheStats stats;
+    CMUTIL_CacheGetStats(cache, &stats);
+    return stats.count;
+}
+
+CMUTIL_STATIC void CMUTIL_CacheClear(CMUTIL_Cache *cache)
+{
+    CMUTIL_Cache_Internal *icache = (CMUTIL_Cache_Internal*)cache;
+    uint32_t i;
+
+    for (i=0; i<=icache->shardmask; i++) {
+        CMUTIL_CacheShard *shard = &icache->shards[i];
+        CMUTIL_CacheEntry *dropped = NULL;
+        if (shard->mutex == NULL)
+            continue;
+        CMCall(shard->mutex, Lock);
+        while (shard->probation.head)
+            CMUTIL_CacheDrop(shard, shard->probation.head,
+                             CMCacheEvictCleared, &dropped);
+        while (shard->protect.head)
+            CMUTIL_CacheDrop(shard, shard->protect.head,
+                             CMCacheEvictCleared, &dropped);
+        CMCall(shard->mutex, Unlock);
+        CMUTIL_CacheRelease(icache, dropped);
+    }
+}
+
+CMUTIL_STATIC void CMUTIL_CacheDestroy(CMUTIL_Cache *cache)
+{
+    CMUTIL_Cache_Internal *icache = (CMUTIL_Cache_Internal*)cache;
+    uint32_t i;
+
+    if (icache == NULL)
+        return;
+    CMUTIL_CacheClear(cache);
+    for (i=0; i<=icache->shardmask; i++) {
+        CMUTIL_CacheShard *shard = &icache->shards[i];
+        if (shard->buckets)
+            icache->memst->Free(shard->buckets);
+        if (shard->mutex)
+            CMCall(shard->mutex, Destroy);
+    }
+    icache->memst->Free(icache->shards);
+    icache->memst->Free(icache);
+}
+
+static CMUTIL_Cache g_cmutil_cache = {
+    CMUTIL_CachePut,
+    CMUTIL_CacheGet,
+    CMUTIL_CacheRemove,
+    CMUTIL_CacheRemoveExpired,
+    CMUTIL_CacheGetStats,
+    CMUTIL_CacheGetSize,
+    CMUTIL_CacheClear,
+    CMUTIL_CacheDestroy
+};
+
+CMUTIL_Cache *CMUTIL_CacheCreateInternal(
+        CMUTIL_Mem *memst, size_t capacity, uint32_t shards,
+        CMCachePolicy policy, CMCacheEvictCB evictcb, void *udata,
+        void *(*dupcb)(void *value))
+{
+    CMUTIL_Cache_Internal *icache;
+    uint32_t i, n = 1;
+
+    if (capacity == 0) {
+        CMLogErrorS("Cache capacity must not be zero.");
+        return NULL;
+    }
+    if (shards == 0)
+        shards = CMUTIL_CACHE_SHARDS;
+    // every shard must hold at least one entry.
+    while (n < shards && n < capacity && n < 0x80000000U)
+        n <<= 1;
+    if (n > capacity)
+        n >>= 1;
+
+    icache = memst->Alloc(sizeof(CMUTIL_Cache_Internal));
+    if (icache == NULL) {
+        CMLogErrorS("Failed to allocate memory for cache.");
+        return NULL;
+    }
+    memset(icache, 0x0, sizeof(CMUTIL_Cache_Internal));
+    memcpy(icache, &g_cmutil_cache, sizeof(CMUTIL_Cache));
+    icache->memst = memst;
+    icache->policy = policy;
+    icache->evictcb = evictcb;
+    icache->udata = udata;
+    icache->dupcb = dupcb;
+    icache->shardmask = n - 1;
+    icache->shards = memst->Alloc(sizeof(CMUTIL_CacheShard) * n);
+    if (icache->shards == NULL) {
+        CMLogErrorS("Failed to allocate memory for cache.");
+        memst->Free(icache);
+        return NULL;
+    }
+    memset(icache->shards, 0x0, sizeof(CMUTIL_CacheShard) * n);
+    for (i=0; i<n; i++) {
+        CMUTIL_CacheShard *shard = &icache->shards[i];
+        // the remainder of the division goes to the first shards.
+        shard->capacity = capacity / n + (i < capacity % n? 1 : 0);
+        shard->protcap = shard->capacity / 100 * CMUTIL_CACHE_PROTECTED +
+                shard->capacity % 100 * CMUTIL_CACHE_PROTECTED / 100;
+        shard->mutex = CMUTIL_MutexCreateInternal(memst);
+        shard->buckets = memst->Calloc(
+                CMUTIL_CACHE_BUCKETS, sizeof(CMUTIL_CacheEntry*));
+        shard->bucketmask = CMUTIL_CACHE_BUCKETS - 1;
+        if (shard->mutex == NULL || shard->buckets == NULL) {
+            CMLogErrorS("Failed to create cache shard.");
+            CMUTIL_CacheDestroy((CMUTIL_Cache*)icache);
+            return NULL;
+        }
+    }
+    return (CMUTIL_Cache*)icache;
+}
+
+CMUTIL_Cache *CMUTIL_CacheCreateEx(
+        size_t capacity, uint32_t shards, CMCachePolicy policy,
+        CMCacheEvictCB evictcb, void *udata, void *(*dupcb)(void *value))
+{
+    return CMUTIL_CacheCreateInternal(CMUTIL_GetMem(), capacity, shards,
+                                      policy, evictcb, udata, dupcb);
+}
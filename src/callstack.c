@@ -22,8 +22,42 @@ OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
 SOFTWARE.
  */
 
+// dladdr is a GNU extension.
+#if defined(__linux__) && !defined(_GNU_SOURCE)
+# define _GNU_SOURCE
+#endif
+
 #include "functions.h"
 
+#if defined(_MSC_VER)
+# define CMUTIL_CS_STRDUP _strdup
+#else
+# define CMUTIL_CS_STRDUP strdup
+#endif
+
+// symbol lookups(and dbghelp APIs which are not thread safe) are serialized
+// with this mutex. this module is initialized before(and cleared after) the
+// debugging allocator, so system allocator must be used here.
+static CMUTIL_Mem g_cmutil_callstack_memsys = {
+    malloc,
+    calloc,
+    realloc,
+    CMUTIL_CS_STRDUP,
+    free
+};
+
+static CMUTIL_Mutex *g_cmutil_callstack_mutex = NULL;
+
+#define CMUTIL_CALLSTACK_SYMLEN 1024
+
+CMUTIL_STATIC void CMUTIL_CallStackCacheClear(void);
+CMUTIL_STATIC int CMUTIL_StackWalkerCapture(
+    const CMUTIL_StackWalker *walker, CMUTIL_StackTrace *trace,
+    int skipdepth);
+CMUTIL_STATIC void CMUTIL_StackWalkerPrintTrace(
+    const CMUTIL_StackWalker *walker, const CMUTIL_StackTrace *trace,
+    CMUTIL_String *outbuf);
+
 #if defined(MSWIN)
 # include <dbghelp.h>
 
@@ -165,24 +199,8 @@ static tSGSP pSGSP;
 static HANDLE hProcess;
 static DWORD dwProcessId;
 
-#if defined(_MSC_VER)
-# define CMUTIL_CS_STRDUP _strdup
-#else
-# define CMUTIL_CS_STRDUP strdup
-#endif
-
-// dbghelp APIs are not thread safe, every stack walk must be serialized.
-// this module is initialized before(and cleared after) the debugging
-// allocator, so system allocator must be used here.
-static CMUTIL_Mem g_cmutil_callstack_memsys = {
-    malloc,
-    calloc,
-    realloc,
-    CMUTIL_CS_STRDUP,
-    free
-};
-
-static CMUTIL_Mutex *g_cmutil_callstack_mutex = NULL;
+// modules are loaded to dbghelp on the first symbol lookup.
+static BOOL g_cmutil_callstack_modloaded = FALSE;
 
 void CMUTIL_CallStackInit()
 {
@@ -289,6 +307,8 @@ void CMUTIL_CallStackClear()
     pSC = NULL; pSFTA = NULL; pSGLFA = NULL; pSGMB = NULL; pSGMI = NULL;
     pSGO = NULL; pSGSFA = NULL; pSI = NULL; pSLM = NULL; pSSO = NULL;
     pSW = NULL; pUDSN = NULL; pSGSP = NULL;
+    g_cmutil_callstack_modloaded = FALSE;
+    CMUTIL_CallStackCacheClear();
     if (g_cmutil_callstack_mutex) {
         CMUTIL_Mutex *mutex = g_cmutil_callstack_mutex;
         g_cmutil_callstack_mutex = NULL;
@@ -924,7 +944,9 @@ static CMUTIL_StackWalker_Internal g_cmutil_stackwalker = {
     {
         CMUTIL_StackWalkerGetStack,
         CMUTIL_StackWalkerPrintStack,
-        CMUTIL_StackWalkerDestroy
+        CMUTIL_StackWalkerDestroy,
+        CMUTIL_StackWalkerCapture,
+        CMUTIL_StackWalkerPrintTrace
     },
     CMUTIL_StackWalkerLoadModule,
     CMUTIL_StackWalkerGetModuleListTH32,
@@ -948,10 +970,63 @@ CMUTIL_StackWalker *CMUTIL_StackWalkerCreate()
     return CMUTIL_StackWalkerCreateInternal(CMUTIL_GetMem());
 }
 
+int CMUTIL_CallStackCapture(void **frames, int maxdepth, int skipdepth)
+{
+    if (maxdepth <= 0)
+        return 0;
+    // skip this function too.
+    return (int)RtlCaptureStackBackTrace(
+        (DWORD)(skipdepth + 1), (DWORD)maxdepth, frames, NULL);
+}
+
+// resolves a code address with the callstack mutex locked.
+CMUTIL_STATIC void CMUTIL_CallStackResolve(
+    void *addr, char *name, size_t namesz, char *line, size_t linesz)
+{
+    union {
+        IMAGEHLP_SYMBOL64 sym;
+        char buf[sizeof(IMAGEHLP_SYMBOL64) + STACKWALK_MAX_NAMELEN];
+    } symbuf;
+    IMAGEHLP_LINE64 Line;
+    DWORD64 disp = 0;
+    DWORD ldisp = 0;
+
+    snprintf(name, namesz, "%p", addr);
+    snprintf(line, linesz, "%p", addr);
+    if (hProcess == NULL || pSGSFA == NULL)
+        return;
+    if (!g_cmutil_callstack_modloaded) {
+        CMUTIL_StackWalker_Internal *walker =
+            (CMUTIL_StackWalker_Internal*)CMUTIL_StackWalkerCreateInternal(
+                &g_cmutil_callstack_memsys);
+        CMCall(walker, LoadModules);  // ignore the result...
+        CMCall(&walker->base, Destroy);
+        g_cmutil_callstack_modloaded = TRUE;
+    }
+    memset(&symbuf, 0, sizeof(symbuf));
+    symbuf.sym.SizeOfStruct = sizeof(IMAGEHLP_SYMBOL64);
+    symbuf.sym.MaxNameLength = STACKWALK_MAX_NAMELEN;
+    if (pSGSFA(hProcess, (DWORD64)addr, &disp, &symbuf.sym) != FALSE) {
+        if (pUDSN == NULL || pUDSN(symbuf.sym.Name, name, (DWORD)namesz,
+                                   UNDNAME_NAME_ONLY) == 0)
+            snprintf(name, namesz, "%s", symbuf.sym.Name);
+    }
+    memset(&Line, 0, sizeof(Line));
+    Line.SizeOfStruct = sizeof(Line);
+    if (pSGLFA != NULL &&
+        pSGLFA(hProcess, (DWORD64)addr, &ldisp, &Line) != FALSE)
+        snprintf(line, linesz, "%s (%d): %s",
+                 Line.FileName, (int)Line.LineNumber, name);
+    else
+        snprintf(line, linesz, "%p: %s", addr, name);
+}
+
 #else
 
 #include <execinfo.h>
 
+#define CMUTIL_STACK_MAX    1024
+
 typedef struct CMUTIL_StackWalker_Internal {
     CMUTIL_StackWalker  base;
     CMUTIL_Mem          *memst;
@@ -959,12 +1034,18 @@ typedef struct CMUTIL_StackWalker_Internal {
 
 void CMUTIL_CallStackInit()
 {
-    // do nothing
+    if (g_cmutil_callstack_mutex == NULL)
+        g_cmutil_callstack_mutex = CMUTIL_MutexCreateInternal(
+            &g_cmutil_callstack_memsys);
 }
 
 void CMUTIL_CallStackClear()
 {
-    // do nothing
+    CMUTIL_CallStackCacheClear();
+    if (g_cmutil_callstack_mutex) {
+        CMCall(g_cmutil_callstack_mutex, Destroy);
+        g_cmutil_callstack_mutex = NULL;
+    }
 }
 
 #if defined(SUNOS)
@@ -972,126 +1053,124 @@ void CMUTIL_CallStackClear()
 #include <ucontext.h>
 #include <dlfcn.h>
 
-typedef struct CMUTIL_StackWalkerCtx {
+typedef struct CMUTIL_StackCaptureCtx {
     int currdepth;
     int stdepth;
-    CMUTIL_StringArray *stack;
-    CMUTIL_String *buffer;
-    const CMUTIL_StackWalker_Internal *walker;
-} CMUTIL_StackWalkerCtx;
+    int maxdepth;
+    int count;
+    void **frames;
+} CMUTIL_StackCaptureCtx;
 
-CMUTIL_STATIC int CMUTIL_StackWalkerIterator(
+CMUTIL_STATIC int CMUTIL_StackCaptureIterator(
     unsigned long pc, int sig, void* uarg)
 {
-    Dl_info dlip;
-
+    CMUTIL_StackCaptureCtx *ctx = (CMUTIL_StackCaptureCtx*)uarg;
     CMUTIL_UNUSED(sig);
-    if (dladdr((void*)pc, &dlip)) {
-        CMUTIL_StackWalkerCtx *stk = (CMUTIL_StackWalkerCtx*)uarg;
-        const char *fname = dlip.dli_fname? dlip.dli_fname:"(unknown)";
-        const char *sname = dlip.dli_sname? dlip.dli_sname:"(unknown)";
-        if (stk->currdepth++ > stk->stdepth) {
-            if (stk->buffer) {
-                CMCall(stk->buffer, AddPrint, "\n%08lx %s %s",
-                    pc, fname, sname);
-            } else if (stk->stack) {
-                CMUTIL_String *item = CMUTIL_StringCreateInternal(
-                            stk->walker->memst, 50, NULL);
-                CMCall(item, AddPrint, "%08lx %s %s",
-                    pc, fname, sname);
-                CMCall(stk->stack, Add, item);
-            }
-        }
-        return 0;
-    }
-    else {
-        return -1;
+    if (ctx->currdepth++ > ctx->stdepth) {
+        if (ctx->count >= ctx->maxdepth)
+            return -1;
+        ctx->frames[ctx->count++] = (void*)pc;
     }
+    return 0;
 }
 
-CMUTIL_STATIC CMUTIL_StringArray *CMUTIL_StackWalkerGetStack(
-    const CMUTIL_StackWalker *walker, int skipdepth)
+int CMUTIL_CallStackCapture(void **frames, int maxdepth, int skipdepth)
 {
-    const CMUTIL_StackWalker_Internal *iwalker =
-            (const CMUTIL_StackWalker_Internal*)walker;
     ucontext_t ucp;
-    if(getcontext(&ucp) == 0) {
-        CMUTIL_StackWalkerCtx wtemp = {
-            0, skipdepth+1,
-            CMUTIL_StringArrayCreateInternal(iwalker->memst, 10),
-            NULL, iwalker
+    if (maxdepth > 0 && getcontext(&ucp) == 0) {
+        CMUTIL_StackCaptureCtx ctx = {
+            0, skipdepth, maxdepth, 0, frames
         };
-        walkcontext(&ucp, CMUTIL_StackWalkerIterator, &wtemp);
-        return wtemp.stack;
+        walkcontext(&ucp, CMUTIL_StackCaptureIterator, &ctx);
+        return ctx.count;
     }
-    return NULL;
+    return 0;
 }
 
-CMUTIL_STATIC void CMUTIL_StackWalkerPrintStack(
-    const CMUTIL_StackWalker *walker, CMUTIL_String *outbuf, int skipdepth)
+#else   /* not SUNOS */
+
+int CMUTIL_CallStackCapture(void **frames, int maxdepth, int skipdepth)
 {
-    const CMUTIL_StackWalker_Internal *iwalker =
-            (const CMUTIL_StackWalker_Internal*)walker;
-    ucontext_t ucp;
-    if(getcontext(&ucp) == 0) {
-        CMUTIL_StackWalkerCtx wtemp = {
-            0, skipdepth + 1, NULL, outbuf, iwalker
-        };
-        walkcontext(&ucp, CMUTIL_StackWalkerIterator, &wtemp);
-    }
+    void *buffer[CMUTIL_STACK_MAX];
+    int i, nptrs, want = maxdepth + skipdepth + 1;
+    if (maxdepth <= 0)
+        return 0;
+    if (want > CMUTIL_STACK_MAX)
+        want = CMUTIL_STACK_MAX;
+    nptrs = backtrace(buffer, want);
+    // skip this function too.
+    for (i=skipdepth+1; i<nptrs; i++)
+        frames[i-skipdepth-1] = buffer[i];
+    return nptrs > skipdepth + 1? nptrs - skipdepth - 1:0;
 }
 
-#else   /* not SUNOS */
+#endif
 
-#define CMUTIL_STACK_MAX    1024
+// resolves a code address with the callstack mutex locked. 'line' has the
+// same form as backtrace_symbols output.
+CMUTIL_STATIC void CMUTIL_CallStackResolve(
+    void *addr, char *name, size_t namesz, char *line, size_t linesz)
+{
+    Dl_info info;
+    const char *fname, *base;
+    memset(&info, 0, sizeof(info));
+    if (!dladdr(addr, &info)) {
+        snprintf(name, namesz, "%p", addr);
+        snprintf(line, linesz, "[%p]", addr);
+        return;
+    }
+    fname = info.dli_fname? info.dli_fname:"(unknown)";
+    base = strrchr(fname, '/');
+    base = base? base + 1:fname;
+    if (info.dli_sname) {
+        unsigned long off = (unsigned long)(
+                    (uintptr_t)addr - (uintptr_t)info.dli_saddr);
+        snprintf(name, namesz, "%s", info.dli_sname);
+        snprintf(line, linesz, "%s(%s+0x%lx) [%p]",
+                 fname, info.dli_sname, off, addr);
+    } else {
+        // not exported, module name and offset are the best we can do.
+        unsigned long off = (unsigned long)(
+                    (uintptr_t)addr - (uintptr_t)info.dli_fbase);
+        snprintf(name, namesz, "%s+0x%lx", base, off);
+        snprintf(line, linesz, "%s(+0x%lx) [%p]", fname, off, addr);
+    }
+}
+
+CMUTIL_STATIC void CMUTIL_CallStackAppend(
+    void *addr, CMUTIL_String *out, CMBool full);
 
 CMUTIL_STATIC CMUTIL_StringArray *CMUTIL_StackWalkerGetStack(
     const CMUTIL_StackWalker *walker, int skipdepth)
 {
     const CMUTIL_StackWalker_Internal *iwalker =
             (const CMUTIL_StackWalker_Internal*)walker;
-    char **stacks = NULL;
-    void *buffer[CMUTIL_STACK_MAX];
-    int i, nptrs = backtrace(buffer, CMUTIL_STACK_MAX);
-    if (nptrs > 0) {
-        CMUTIL_StringArray *res = CMUTIL_StringArrayCreateInternal(
-                    iwalker->memst, 10);
-        if (nptrs > CMUTIL_STACK_MAX)
-            nptrs = CMUTIL_STACK_MAX;
-        stacks = backtrace_symbols(buffer, nptrs);
-        if (stacks) {
-            for (i=skipdepth+1; i<nptrs; i++)
-                CMCall(res, AddCString, stacks[i]);
-            free(stacks);
-        }
-        return res;
+    void *frames[CMUTIL_STACK_MAX];
+    int i, depth = CMUTIL_CallStackCapture(
+                frames, CMUTIL_STACK_MAX, skipdepth + 1);
+    CMUTIL_StringArray *res;
+    if (depth <= 0)
+        return NULL;
+    res = CMUTIL_StringArrayCreateInternal(iwalker->memst, 10);
+    for (i=0; i<depth; i++) {
+        CMUTIL_String *item = CMUTIL_StringCreateInternal(
+                    iwalker->memst, 64, NULL);
+        CMUTIL_CallStackAppend(frames[i], item, CMTrue);
+        CMCall(res, Add, item);
     }
-    CMUTIL_UNUSED(walker);
-    return NULL;
+    return res;
 }
 
 CMUTIL_STATIC void CMUTIL_StackWalkerPrintStack(
     const CMUTIL_StackWalker *walker, CMUTIL_String *outbuf, int skipdepth)
 {
-    char **stacks = NULL;
-    void *buffer[CMUTIL_STACK_MAX];
-    int i, nptrs = backtrace(buffer, CMUTIL_STACK_MAX);
-    if (nptrs > 0) {
-        if (nptrs > CMUTIL_STACK_MAX)
-            nptrs = CMUTIL_STACK_MAX;
-        stacks = backtrace_symbols(buffer, nptrs);
-        if (stacks) {
-            for (i=skipdepth+1; i<nptrs; i++)
-                CMCall(outbuf, AddPrint, S_CRLF"%s", stacks[i]);
-            free(stacks);
-        }
-    }
+    void *frames[CMUTIL_STACK_MAX];
+    int depth = CMUTIL_CallStackCapture(
+                frames, CMUTIL_STACK_MAX, skipdepth + 1);
+    CMUTIL_CallStackPrint(frames, depth, outbuf);
     CMUTIL_UNUSED(walker);
 }
 
-#endif
-
-
 CMUTIL_STATIC void CMUTIL_StackWalkerDestroy(
     CMUTIL_StackWalker *walker)
 {
@@ -1104,7 +1183,9 @@ static CMUTIL_StackWalker_Internal g_cmutil_stackwalker = {
     {
         CMUTIL_StackWalkerGetStack,
         CMUTIL_StackWalkerPrintStack,
-        CMUTIL_StackWalkerDestroy
+        CMUTIL_StackWalkerDestroy,
+        CMUTIL_StackWalkerCapture,
+        CMUTIL_StackWalkerPrintTrace
     },
     NULL
 };
@@ -1124,3 +1205,161 @@ CMUTIL_StackWalker *CMUTIL_StackWalkerCreate()
 }
 
 #endif
+
+/*
+ * Process wide cache of resolved symbols. Entries are never removed until
+ * the library is cleared, so every distinct frame is resolved only once.
+ */
+typedef struct CMUTIL_CallStackSym {
+    void    *addr;
+    char    *name;
+    char    *line;
+} CMUTIL_CallStackSym;
+
+// open addressing table, capacity is a power of 2.
+static CMUTIL_CallStackSym *g_cmutil_callstack_syms = NULL;
+static uint32_t g_cmutil_callstack_symcnt = 0;
+static uint32_t g_cmutil_callstack_symcap = 0;
+
+CMUTIL_STATIC uint32_t CMUTIL_CallStackHash(void *addr)
+{
+    return (uint32_t)(((uint64_t)(uintptr_t)addr *
+                       0x9E3779B97F4A7C15ULL) >> 32);
+}
+
+// must be called with the callstack mutex locked.
+CMUTIL_STATIC CMBool CMUTIL_CallStackCacheGrow(void)
+{
+    uint32_t i, ncap = g_cmutil_callstack_symcap?
+                g_cmutil_callstack_symcap * 2:1024;
+    CMUTIL_CallStackSym *nsyms = g_cmutil_callstack_memsys.Calloc(
+                ncap, sizeof(CMUTIL_CallStackSym));
+    if (nsyms == NULL)
+        return CMFalse;
+    for (i=0; i<g_cmutil_callstack_symcap; i++) {
+        CMUTIL_CallStackSym *sym = &g_cmutil_callstack_syms[i];
+        if (sym->addr) {
+            uint32_t pos = CMUTIL_CallStackHash(sym->addr) & (ncap - 1);
+            while (nsyms[pos].addr)
+                pos = (pos + 1) & (ncap - 1);
+            nsyms[pos] = *sym;
+        }
+    }
+    if (g_cmutil_callstack_syms)
+        g_cmutil_callstack_memsys.Free(g_cmutil_callstack_syms);
+    g_cmutil_callstack_syms = nsyms;
+    g_cmutil_callstack_symcap = ncap;
+    return CMTrue;
+}
+
+// must be called with the callstack mutex locked, NULL if out of memory.
+CMUTIL_STATIC CMUTIL_CallStackSym *CMUTIL_CallStackLookup(void *addr)
+{
+    char name[CMUTIL_CALLSTACK_SYMLEN], line[CMUTIL_CALLSTACK_SYMLEN * 2];
+    CMUTIL_CallStackSym *sym;
+    uint32_t pos;
+    if ((g_cmutil_callstack_symcnt + 1) * 2 > g_cmutil_callstack_symcap &&
+            !CMUTIL_CallStackCacheGrow())
+        return NULL;
+    pos = CMUTIL_CallStackHash(addr) & (g_cmutil_callstack_symcap - 1);
+    while (g_cmutil_callstack_syms[pos].addr) {
+        if (g_cmutil_callstack_syms[pos].addr == addr)
+            return &g_cmutil_callstack_syms[pos];
+        pos = (pos + 1) & (g_cmutil_callstack_symcap - 1);
+    }
+    CMUTIL_CallStackResolve(addr, name, sizeof(name), line, sizeof(line));
+    sym = &g_cmutil_callstack_syms[pos];
+    sym->name = g_cmutil_callstack_memsys.Strdup(name);
+    sym->line = g_cmutil_callstack_memsys.Strdup(line);
+    if (sym->name == NULL || sym->line == NULL) {
+        if (sym->name) g_cmutil_callstack_memsys.Free(sym->name);
+        if (sym->line) g_cmutil_callstack_memsys.Free(sym->line);
+        sym->name = sym->line = NULL;
+        return NULL;
+    }
+    sym->addr = addr;
+    g_cmutil_callstack_symcnt++;
+    return sym;
+}
+
+CMUTIL_STATIC void CMUTIL_CallStackCacheClear(void)
+{
+    uint32_t i;
+    for (i=0; i<g_cmutil_callstack_symcap; i++) {
+        CMUTIL_CallStackSym *sym = &g_cmutil_callstack_syms[i];
+        if (sym->addr) {
+            g_cmutil_callstack_memsys.Free(sym->name);
+            g_cmutil_callstack_memsys.Free(sym->line);
+        }
+    }
+    if (g_cmutil_callstack_syms)
+        g_cmutil_callstack_memsys.Free(g_cmutil_callstack_syms);
+    g_cmutil_callstack_syms = NULL;
+    g_cmutil_callstack_symcnt = g_cmutil_callstack_symcap = 0;
+}
+
+// appends the symbol of an address, with file and offset if 'full' is true.
+CMUTIL_STATIC void CMUTIL_CallStackAppend(
+    void *addr, CMUTIL_String *out, CMBool full)
+{
+    CMUTIL_CallStackSym *sym = NULL;
+    // not cached before initialization, nothing serializes it yet.
+    if (g_cmutil_callstack_mutex) {
+        CMCall(g_cmutil_callstack_mutex, Lock);
+        sym = CMUTIL_CallStackLookup(addr);
+    }
+    if (sym) {
+        CMCall(out, AddString, full? sym->line:sym->name);
+    } else {
+        char name[CMUTIL_CALLSTACK_SYMLEN], line[CMUTIL_CALLSTACK_SYMLEN * 2];
+        CMUTIL_CallStackResolve(addr, name, sizeof(name), line, sizeof(line));
+        CMCall(out, AddString, full? line:name);
+    }
+    if (g_cmutil_callstack_mutex)
+        CMCall(g_cmutil_callstack_mutex, Unlock);
+}
+
+void CMUTIL_CallStackSymbol(void *addr, char *buf, size_t bufsz)
+{
+    CMUTIL_CallStackSym *sym = NULL;
+    if (g_cmutil_callstack_mutex) {
+        CMCall(g_cmutil_callstack_mutex, Lock);
+        sym = CMUTIL_CallStackLookup(addr);
+    }
+    if (sym) {
+        snprintf(buf, bufsz, "%s", sym->name);
+    } else {
+        char line[CMUTIL_CALLSTACK_SYMLEN * 2];
+        CMUTIL_CallStackResolve(addr, buf, bufsz, line, sizeof(line));
+    }
+    if (g_cmutil_callstack_mutex)
+        CMCall(g_cmutil_callstack_mutex, Unlock);
+}
+
+void CMUTIL_CallStackPrint(
+    void * const *frames, int depth, CMUTIL_String *outbuf)
+{
+    int i;
+    for (i=0; i<depth; i++) {
+        CMCall(outbuf, AddString, S_CRLF);
+        CMUTIL_CallStackAppend(frames[i], outbuf, CMTrue);
+    }
+}
+
+CMUTIL_STATIC int CMUTIL_StackWalkerCapture(
+    const CMUTIL_StackWalker *walker, CMUTIL_StackTrace *trace,
+    int skipdepth)
+{
+    CMUTIL_UNUSED(walker);
+    trace->depth = CMUTIL_CallStackCapture(
+                trace->frames, CMUTIL_STACK_MAX_FRAMES, skipdepth + 1);
+    return trace->depth;
+}
+
+CMUTIL_STATIC void CMUTIL_StackWalkerPrintTrace(
+    const CMUTIL_StackWalker *walker, const CMUTIL_StackTrace *trace,
+    CMUTIL_String *outbuf)
+{
+    CMUTIL_UNUSED(walker);
+    CMUTIL_CallStackPrint(trace->frames, trace->depth, outbuf);
+}
@@ -0,0 +1,555 @@
+/*
+MIT License
+
+Copyright (c) 2020 Dennis Soungjin Park<xcomart@gmail.com>
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+ */
+
+
+#include "functions.h"
+
+CMUTIL_LogDefine("cmutils.concmap")
+
+/*
+ * Concurrent hashmap: entries are spread over shards by the upper half of
+ * the hash, every shard has chained buckets selected by the lower half.
+ * Writers lock their shard and publish nodes with release stores, readers
+ * walk the chains with acquire loads and no lock at all. A node is never
+ * changed after publication except its value, so unlinked nodes, replaced
+ * values and outgrown bucket arrays are retired and freed by the epoch
+ * reclamation when no reader can reach them any more. Growing a shard
+ * copies its nodes into a new bucket array, since nodes which readers may
+ * be walking can not be relinked.
+ */
+
+#define CMUTIL_CMAP_SHARDS      16
+#define CMUTIL_CMAP_MINBUCKETS  8
+// retired objects a shard collects before trying to reclaim them.
+#define CMUTIL_CMAP_RECLAIM     64
+
+typedef struct CMUTIL_CMapNode CMUTIL_CMapNode;
+struct CMUTIL_CMapNode {
+    CMUTIL_CMapNode     *next;
+    void                *value;
+    uint64_t            hash;
+    size_t              keylen;
+    char                key[];
+};
+
+typedef struct CMUTIL_CMapTable {
+    size_t              mask;
+    CMUTIL_CMapNode     *buckets[];
+} CMUTIL_CMapTable;
+
+typedef struct CMUTIL_CMapRetired {
+    void                *ptr;
+    uint64_t            epoch;
+    CMBool              isvalue;
+} CMUTIL_CMapRetired;
+
+typedef struct CMUTIL_CMapShard {
+    CMUTIL_CMapTable    *table;
+    CMUTIL_Mutex        *mutex;
+    int64_t             size;
+    CMUTIL_CMapRetired  *retired;
+    size_t              nretired;
+    size_t              capretired;
+    size_t              reclaimat;
+    // writers of neighbour shards must not share a cache line.
+    char                dummy_padder[8];
+} CMUTIL_CMapShard;
+
+typedef struct CMUTIL_ConcurrentMap_Internal {
+    CMUTIL_ConcurrentMap    base;
+    CMUTIL_CMapShard        *shards;
+    uint32_t                shardmask;
+    int                     dummy_padder;
+    CMFreeCB                freecb;
+    CMUTIL_Mem              *memst;
+} CMUTIL_ConcurrentMap_Internal;
+
+CMUTIL_STATIC uint32_t CMUTIL_CMapPow2(uint32_t n, uint32_t min)
+{
+    uint32_t res = min;
+    while (res < n && res < 0x80000000U)
+        res <<= 1;
+    return res;
+}
+
+CMUTIL_STATIC CMUTIL_CMapShard *CMUTIL_CMapShardOf(
+        const CMUTIL_ConcurrentMap_Internal *imap, uint64_t hash)
+{
+    return &imap->shards[(uint32_t)(hash >> 32) & imap->shardmask];
+}
+
+CMUTIL_STATIC CMUTIL_CMapTable *CMUTIL_CMapTableAlloc(
+        CMUTIL_ConcurrentMap_Internal *imap, size_t nbuckets)
+{
+    size_t bsize = nbuckets * sizeof(CMUTIL_CMapNode*);
+    CMUTIL_CMapTable *tab = imap->memst->Alloc(sizeof(CMUTIL_CMapTable) + bsize);
+    if (tab) {
+        tab->mask = nbuckets - 1;
+        memset(tab->buckets, 0x0, bsize);
+    }
+    return tab;
+}
+
+CMUTIL_STATIC CMUTIL_CMapNode *CMUTIL_CMapNodeAlloc(
+        CMUTIL_ConcurrentMap_Internal *imap, uint64_t hash,
+        const char *key, size_t keylen, void *value)
+{
+    CMUTIL_CMapNode *node =
+            imap->memst->Alloc(sizeof(CMUTIL_CMapNode) + keylen + 1);
+    if (node) {
+        node->next = NULL;
+        node->value = value;
+        node->hash = hash;
+        node->keylen = keylen;
+        memcpy(node->key, key, keylen);
+        node->key[keylen] = 0x0;
+    }
+    return node;
+}
+
+// safe for readers, writers may call it with the shard locked as well.
+CMUTIL_STATIC CMUTIL_CMapNode *CMUTIL_CMapFind(
+        const CMUTIL_CMapShard *shard, uint64_t hash,
+        const char *key, size_t keylen)
+{
+    CMUTIL_CMapTable *tab = CMUTIL_ATOMIC_LOADP(&shard->table);
+    CMUTIL_CMapNode *node = CMUTIL_ATOMIC_LOADP(&tab->buckets[hash & tab->mask]);
+    while (node) {
+        if (node->hash == hash && node->keylen == keylen &&
+                memcmp(node->key, key, keylen) == 0)
+            return node;
+        node = CMUTIL_ATOMIC_LOADP(&node->next);
+    }
+    return NULL;
+}
+
+CMUTIL_STATIC void CMUTIL_CMapFreeRetired(
+        CMUTIL_ConcurrentMap_Internal *imap, CMUTIL_CMapRetired *r)
+{
+    if (r->isvalue)
+        imap->freecb(r->ptr);
+    else
+        imap->memst->Free(r->ptr);
+}
+
+CMUTIL_STATIC void CMUTIL_CMapReclaim(
+        CMUTIL_ConcurrentMap_Internal *imap, CMUTIL_CMapShard *shard)
+{
+    uint64_t epoch = CMUTIL_EpochAdvance();
+    size_t i = 0;
+    // retired objects are tagged in ascending order.
+    while (i < shard->nretired && shard->retired[i].epoch + 2 <= epoch) {
+        CMUTIL_CMapFreeRetired(imap, &shard->retired[i]);
+        i++;
+    }
+    if (i > 0) {
+        shard->nretired -= i;
+        memmove(shard->retired, shard->retired + i,
+                shard->nretired * sizeof(CMUTIL_CMapRetired));
+    }
+    shard->reclaimat = shard->nretired + CMUTIL_CMAP_RECLAIM;
+}
+
+// shard must be locked and 'ptr' unreachable for readers who enter later.
+CMUTIL_STATIC void CMUTIL_CMapRetire(
+        CMUTIL_ConcurrentMap_Internal *imap, CMUTIL_CMapShard *shard,
+        void *ptr, CMBool isvalue)
+{
+    CMUTIL_CMapRetired *r;
+    if (shard->nretired == shard->capretired) {
+        size_t ncap = shard->capretired? shard->capretired * 2 :
+                                         CMUTIL_CMAP_RECLAIM;
+        CMUTIL_CMapRetired *nret = imap->memst->Realloc(
+                    shard->retired, ncap * sizeof(CMUTIL_CMapRetired));
+        if (nret == NULL) {
+            // leaking is the only safe way out, readers may hold it.
+            CMLogError("cannot retire object, out of memory");
+            return;
+        }
+        shard->retired = nret;
+        shard->capretired = ncap;
+    }
+    r = &shard->retired[shard->nretired++];
+    r->ptr = ptr;
+    r->isvalue = isvalue;
+    r->epoch = CMUTIL_EpochCurrent();
+    if (shard->nretired >= shard->reclaimat)
+        CMUTIL_CMapReclaim(imap, shard);
+}
+
+CMUTIL_STATIC void CMUTIL_CMapRetireValue(
+        CMUTIL_ConcurrentMap_Internal *imap, CMUTIL_CMapShard *shard,
+        void *value, void **prev)
+{
+    if (prev)
+        *prev = value;
+    else if (imap->freecb && value)
+        CMUTIL_CMapRetire(imap, shard, value, CMTrue);
+}
+
+CMUTIL_STATIC CMBool CMUTIL_CMapGrow(
+        CMUTIL_ConcurrentMap_Internal *imap, CMUTIL_CMapShard *shard)
+{
+    CMUTIL_CMapTable *old = shard->table;
+    CMUTIL_CMapTable *tab = CMUTIL_CMapTableAlloc(imap, (old->mask + 1) * 2);
+    size_t i;
+    if (tab == NULL)
+        return CMFalse;
+    // new table is private until published, plain stores are enough.
+    for (i=0; i<=old->mask; i++) {
+        CMUTIL_CMapNode *node;
+        for (node = old->buckets[i]; node; node = node->next) {
+            size_t idx = node->hash & tab->mask;
+            CMUTIL_CMapNode *copy = CMUTIL_CMapNodeAlloc(
+                        imap, node->hash, node->key, node->keylen,
+                        node->value);
+            if (copy == NULL)
+                goto FAILED;
+            copy->next = tab->buckets[idx];
+            tab->buckets[idx] = copy;
+        }
+    }
+    CMUTIL_ATOMIC_STOREP(&shard->table, tab);
+    for (i=0; i<=old->mask; i++) {
+        CMUTIL_CMapNode *node = old->buckets[i];
+        while (node) {
+            CMUTIL_CMapNode *next = node->next;
+            CMUTIL_CMapRetire(imap, shard, node, CMFalse);
+            node = next;
+        }
+    }
+    CMUTIL_CMapRetire(imap, shard, old, CMFalse);
+    return CMTrue;
+FAILED:
+    for (i=0; i<=tab->mask; i++) {
+        CMUTIL_CMapNode *node = tab->buckets[i];
+        while (node) {
+            CMUTIL_CMapNode *next = node->next;
+            imap->memst->Free(node);
+            node = next;
+        }
+    }
+    imap->memst->Free(tab);
+    return CMFalse;
+}
+
+// shard must be locked and must not have the key.
+CMUTIL_STATIC CMBool CMUTIL_CMapInsert(
+        CMUTIL_ConcurrentMap_Internal *imap, CMUTIL_CMapShard *shard,
+        uint64_t hash, const char *key, size_t keylen, void *value)
+{
+    CMUTIL_CMapTable *tab;
+    CMUTIL_CMapNode *node;
+    size_t idx;
+    // a failed growth only lengthens the chains.
+    if ((size_t)shard->size > shard->table->mask)
+        CMUTIL_CMapGrow(imap, shard);
+    node = CMUTIL_CMapNodeAlloc(imap, hash, key, keylen, value);
+    if (node == NULL)
+        return CMFalse;
+    tab = shard->table;
+    idx = hash & tab->mask;
+    node->next = tab->buckets[idx];
+    CMUTIL_ATOMIC_STOREP(&tab->buckets[idx], node);
+    CMUTIL_ATOMIC_ADD64(&shard->size, 1);
+    return CMTrue;
+}
+
+CMUTIL_STATIC CMBool CMUTIL_ConcurrentMapPut(
+        CMUTIL_ConcurrentMap *map, const char *key, void *value, void **prev)
+{
+    CMUTIL_ConcurrentMap_Internal *imap = (CMUTIL_ConcurrentMap_Internal*)map;
+    size_t keylen = strlen(key);
+    uint64_t hash = CMUTIL_HashBytes(key, keylen);
+    CMUTIL_CMapShard *shard = CMUTIL_CMapShardOf(imap, hash);
+    CMUTIL_CMapNode *node;
+    CMBool res = CMTrue;
+
+    CMCall(shard->mutex, Lock);
+    node = CMUTIL_CMapFind(shard, hash, key, keylen);
+    if (node) {
+        void *old = node->value;
+        CMUTIL_ATOMIC_STOREP(&node->value, value);
+        if (old != value)
+            CMUTIL_CMapRetireValue(imap, shard, old, prev);
+        else if (prev)
+            *prev = NULL;
+    } else {
+        if (prev) *prev = NULL;
+        res = CMUTIL_CMapInsert(imap, shard, hash, key, keylen, value);
+    }
+    CMCall(shard->mutex, Unlock);
+    return res;
+}
+
+CMUTIL_STATIC void *CMUTIL_ConcurrentMapGet(
+        const CMUTIL_ConcurrentMap *map, const char *key)
+{
+    const CMUTIL_ConcurrentMap_Internal *imap =
+            (const CMUTIL_ConcurrentMap_Internal*)map;
+    size_t keylen = strlen(key);
+    uint64_t hash = CMUTIL_HashBytes(key, keylen);
+    CMUTIL_CMapNode *node;
+    void *res = NULL;
+
+    CMUTIL_EpochEnter();
+    node = CMUTIL_CMapFind(CMUTIL_CMapShardOf(imap, hash), hash, key, keylen);
+    if (node)
+        res = CMUTIL_ATOMIC_LOADP(&node->value);
+    CMUTIL_EpochLeave();
+    return res;
+}
+
+CMUTIL_STATIC void *CMUTIL_CMapComputeBase(
+        CMUTIL_ConcurrentMap_Internal *imap, const char *key,
+        void *(*mapper)(const char *key, void *udata), void *udata,
+        CMBool *inserted)
+{
+    size_t keylen = strlen(key);
+    uint64_t hash = CMUTIL_HashBytes(key, keylen);
+    CMUTIL_CMapShard *shard = CMUTIL_CMapShardOf(imap, hash);
+    CMUTIL_CMapNode *node;
+    void *res = NULL;
+
+    *inserted = CMFalse;
+    // read-mostly callers find the key without locking.
+    CMUTIL_EpochEnter();
+    node = CMUTIL_CMapFind(shard, hash, key, keylen);
+    if (node)
+        res = CMUTIL_ATOMIC_LOADP(&node->value);
+    CMUTIL_EpochLeave();
+    if (node)
+        return res;
+
+    CMCall(shard->mutex, Lock);
+    node = CMUTIL_CMapFind(shard, hash, key, keylen);
+    if (node) {
+        res = node->value;
+    } else {
+        res = mapper(key, udata);
+        if (res) {
+            *inserted = CMUTIL_CMapInsert(
+                        imap, shard, hash, key, keylen, res);
+            if (!*inserted)
+                res = NULL;
+        }
+    }
+    CMCall(shard->mutex, Unlock);
+    return res;
+}
+
+CMUTIL_STATIC void *CMUTIL_ConcurrentMapComputeIfAbsent(
+        CMUTIL_ConcurrentMap *map, const char *key,
+        void *(*mapper)(const char *key, void *udata), void *udata)
+{
+    CMBool inserted;
+    return CMUTIL_CMapComputeBase((CMUTIL_ConcurrentMap_Internal*)map,
+                                  key, mapper, udata, &inserted);
+}
+
+CMUTIL_STATIC void *CMUTIL_ConcurrentMapPutIfAbsentMapper(
+        const char *key, void *udata)
+{
+    CMUTIL_UNUSED(key);
+    return udata;
+}
+
+CMUTIL_STATIC void *CMUTIL_ConcurrentMapPutIfAbsent(
+        CMUTIL_ConcurrentMap *map, const char *key, void *value)
+{
+    CMBool inserted;
+    void *res = CMUTIL_CMapComputeBase(
+                (CMUTIL_ConcurrentMap_Internal*)map, key,
+                CMUTIL_ConcurrentMapPutIfAbsentMapper, value, &inserted);
+    return inserted? NULL : res;
+}
+
+CMUTIL_STATIC CMBool CMUTIL_ConcurrentMapReplace(
+        CMUTIL_ConcurrentMap *map, const char *key,
+        void *expected, void *value)
+{
+    CMUTIL_ConcurrentMap_Internal *imap = (CMUTIL_ConcurrentMap_Internal*)map;
+    size_t keylen = strlen(key);
+    uint64_t hash = CMUTIL_HashBytes(key, keylen);
+    CMUTIL_CMapShard *shard = CMUTIL_CMapShardOf(imap, hash);
+    CMUTIL_CMapNode *node;
+    CMBool res = CMFalse;
+
+    CMCall(shard->mutex, Lock);
+    node = CMUTIL_CMapFind(shard, hash, key, keylen);
+    if (node && node->value == expected) {
+        CMUTIL_ATOMIC_STOREP(&node->value, value);
+        if (expected != value)
+            CMUTIL_CMapRetireValue(imap, shard, expected, NULL);
+        res = CMTrue;
+    }
+    CMCall(shard->mutex, Unlock);
+    return res;
+}
+
+CMUTIL_STATIC CMBool CMUTIL_ConcurrentMapRemove(
+        CMUTIL_ConcurrentMap *map, const char *key,
+        void *expected, void **prev)
+{
+    CMUTIL_ConcurrentMap_Internal *imap = (CMUTIL_ConcurrentMap_Internal*)map;
+    size_t keylen = strlen(key);
+    uint64_t hash = CMUTIL_HashBytes(key, keylen);
+    CMUTIL_CMapShard *shard = CMUTIL_CMapShardOf(imap, hash);
+    CMUTIL_CMapTable *tab;
+    CMUTIL_CMapNode **link, *node;
+    CMBool res = CMFalse;
+
+    if (prev) *prev = NULL;
+    CMCall(shard->mutex, Lock);
+    tab = shard->table;
+    link = &tab->buckets[hash & tab->mask];
+    while ((node = *link) != NULL) {
+        if (node->hash == hash && node->keylen == keylen &&
+                memcmp(node->key, key, keylen) == 0)
+            break;
+        link = &node->next;
+    }
+    if (node && (expected == NULL || node->value == expected)) {
+        CMUTIL_ATOMIC_STOREP(link, node->next);
+        CMUTIL_ATOMIC_ADD64(&shard->size, -1);
+        CMUTIL_CMapRetireValue(imap, shard, node->value, prev);
+        CMUTIL_CMapRetire(imap, shard, node, CMFalse);
+        res = CMTrue;
+    }
+    CMCall(shard->mutex, Unlock);
+    return res;
+}
+
+CMUTIL_STATIC size_t CMUTIL_ConcurrentMapGetSize(
+        const CMUTIL_ConcurrentMap *map)
+{
+    const CMUTIL_ConcurrentMap_Internal *imap =
+            (const CMUTIL_ConcurrentMap_Internal*)map;
+    int64_t res = 0;
+    uint32_t i;
+    for (i=0; i<=imap->shardmask; i++)
+        res += CMUTIL_ATOMIC_LOAD64(&imap->shards[i].size);
+    return res > 0? (size_t)res : 0;
+}
+
+CMUTIL_STATIC void CMUTIL_ConcurrentMapEnter(const CMUTIL_ConcurrentMap *map)
+{
+    CMUTIL_UNUSED(map);
+    CMUTIL_EpochEnter();
+}
+
+CMUTIL_STATIC void CMUTIL_ConcurrentMapLeave(const CMUTIL_ConcurrentMap *map)
+{
+    CMUTIL_UNUSED(map);
+    CMUTIL_EpochLeave();
+}
+
+CMUTIL_STATIC void CMUTIL_ConcurrentMapDestroy(CMUTIL_ConcurrentMap *map)
+{
+    CMUTIL_ConcurrentMap_Internal *imap = (CMUTIL_ConcurrentMap_Internal*)map;
+    uint32_t i;
+    if (imap == NULL)
+        return;
+    for (i=0; i<=imap->shardmask; i++) {
+        CMUTIL_CMapShard *shard = &imap->shards[i];
+        size_t j;
+        // no reader is left, retired objects can be freed at once.
+        for (j=0; j<shard->nretired; j++)
+            CMUTIL_CMapFreeRetired(imap, &shard->retired[j]);
+        if (shard->retired)
+            imap->memst->Free(shard->retired);
+        if (shard->table) {
+            for (j=0; j<=shard->table->mask; j++) {
+                CMUTIL_CMapNode *node = shard->table->buckets[j];
+                while (node) {
+                    CMUTIL_CMapNode *next = node->next;
+                    if (imap->freecb && node->value)
+                        imap->freecb(node->value);
+                    imap->memst->Free(node);
+                    node = next;
+                }
+            }
+            imap->memst->Free(shard->table);
+        }
+        if (shard->mutex)
+            CMCall(shard->mutex, Destroy);
+    }
+    imap->memst->Free(imap->shards);
+    imap->memst->Free(imap);
+}
+
+static CMUTIL_ConcurrentMap g_cmutil_concurrentmap = {
+    CMUTIL_ConcurrentMapPut,
+    CMUTIL_ConcurrentMapPutIfAbsent,
+    CMUTIL_ConcurrentMapComputeIfAbsent,
+    CMUTIL_ConcurrentMapGet,
+    CMUTIL_ConcurrentMapReplace,
+    CMUTIL_ConcurrentMapRemove,
+    CMUTIL_ConcurrentMapGetSize,
+    CMUTIL_ConcurrentMapEnter,
+    CMUTIL_ConcurrentMapLeave,
+    CMUTIL_ConcurrentMapDestroy
+};
+
+CMUTIL_ConcurrentMap *CMUTIL_ConcurrentMapCreateInternal(
+        CMUTIL_Mem *memst, uint32_t bucketsize,
+        uint32_t shards, CMFreeCB freecb)
+{
+    CMUTIL_ConcurrentMap_Internal *imap;
+    uint32_t i, nbuckets;
+
+    shards = CMUTIL_CMapPow2(shards? shards : CMUTIL_CMAP_SHARDS, 1);
+    nbuckets = CMUTIL_CMapPow2(bucketsize / shards, CMUTIL_CMAP_MINBUCKETS);
+
+    imap = memst->Alloc(sizeof(CMUTIL_ConcurrentMap_Internal));
+    memset(imap, 0x0, sizeof(CMUTIL_ConcurrentMap_Internal));
+    memcpy(imap, &g_cmutil_concurrentmap, sizeof(CMUTIL_ConcurrentMap));
+    imap->memst = memst;
+    imap->freecb = freecb;
+    imap->shardmask = shards - 1;
+    imap->shards = memst->Alloc(sizeof(CMUTIL_CMapShard) * shards);
+    if (imap->shards == NULL) {
+        memst->Free(imap);
+        return NULL;
+    }
+    memset(imap->shards, 0x0, sizeof(CMUTIL_CMapShard) * shards);
+    for (i=0; i<shards; i++) {
+        CMUTIL_CMapShard *shard = &imap->shards[i];
+        shard->reclaimat = CMUTIL_CMAP_RECLAIM;
+        shard->mutex = CMUTIL_MutexCreateInternal(memst);
+        shard->table = CMUTIL_CMapTableAlloc(imap, nbuckets);
+        if (shard->mutex == NULL || shard->table == NULL) {
+            CMUTIL_ConcurrentMapDestroy((CMUTIL_ConcurrentMap*)imap);
+            return NULL;
+        }
+    }
+    return (CMUTIL_ConcurrentMap*)imap;
+}
+
+CMUTIL_ConcurrentMap *CMUTIL_ConcurrentMapCreateEx(
+        uint32_t bucketsize, uint32_t shards, CMFreeCB freecb)
+{
+    return CMUTIL_ConcurrentMapCreateInternal(
+                CMUTIL_GetMem(), bucketsize, shards, freecb);
+}
@@ -467,9 +467,9 @@ typedef struct CMUTIL_Thread_Internal {
 } CMUTIL_Thread_Internal;
 
 typedef struct CMUTIL_Thread_Global_Context {
-    CMUTIL_Mutex    *mutex;
-    CMUTIL_Array    *threads;
-    unsigned int    threadIndex;
+    CMUTIL_Mutex        *mutex;
+    CMUTIL_SortedMap    *threads;
+    unsigned int        threadIndex;
 } CMUTIL_Thread_Global_Context;
 
 static CMUTIL_Thread_Global_Context *g_cmutil_thread_context = NULL;
@@ -492,8 +492,8 @@ void CMUTIL_ThreadInit()
     memset(g_cmutil_thread_context, 0x0, sizeof(CMUTIL_Thread_Global_Context));
     g_cmutil_thread_context->mutex =
             CMUTIL_MutexCreateInternal(CMUTIL_GetMem());
-    g_cmutil_thread_context->threads = CMUTIL_ArrayCreateInternal(
-                CMUTIL_GetMem(), 10, CMUTIL_ThreadComparator, NULL, CMTrue);
+    g_cmutil_thread_context->threads = CMUTIL_SortedMapCreateInternal(
+                CMUTIL_GetMem(), CMUTIL_ThreadComparator, NULL, NULL);
 }
 
 void CMUTIL_ThreadClear()
@@ -526,7 +526,7 @@ CMUTIL_STATIC void *CMUTIL_ThreadProc(void *param)
 
     // we must add this thread in the global pool before start user callback.
     CMCall(g_cmutil_thread_context->mutex, Lock);
-    CMCall(g_cmutil_thread_context->threads, Add, iparam, &res);
+    CMCall(g_cmutil_thread_context->threads, Put, iparam, iparam, &res);
     CMCall(g_cmutil_thread_context->mutex, Unlock);
     if (res != NULL) {
         CMLogErrorS("Previous thread found with same system thread id, "
@@ -539,6 +539,10 @@ CMUTIL_STATIC void *CMUTIL_ThreadProc(void *param)
     CMCall(g_cmutil_thread_context->mutex, Lock);
     CMCall(g_cmutil_thread_context->threads, Remove, iparam);
     CMCall(g_cmutil_thread_context->mutex, Unlock);
+    // give cached memory blocks of this thread back to other threads.
+    CMUTIL_ObjectPoolThreadRelease();
+    CMUTIL_MemThreadCacheRelease();
+    CMUTIL_EpochThreadRelease();
     iparam->isrunning = CMFalse;
 
 #if defined(MSWIN)
@@ -689,7 +693,7 @@ uint32_t CMUTIL_ThreadSelfId()
     q.sysid = CMUTIL_ThreadSystemSelfId();
     CMCall(g_cmutil_thread_context->mutex, Lock);
     r = (CMUTIL_Thread_Internal*)CMCall(
-        g_cmutil_thread_context->threads, Find, &q, NULL);
+        g_cmutil_thread_context->threads, Get, &q);
     CMCall(g_cmutil_thread_context->mutex, Unlock);
     if (r != NULL) res = r->id;
 
@@ -730,7 +734,7 @@ CMUTIL_Thread *CMUTIL_ThreadSelf()
     if (q.sysid == thmain.sysid) return (CMUTIL_Thread*)&thmain;
     CMCall(g_cmutil_thread_context->mutex, Lock);
     r = (CMUTIL_Thread_Internal*)CMCall(
-        g_cmutil_thread_context->threads, Find, &q, NULL);
+        g_cmutil_thread_context->threads, Get, &q);
     CMCall(g_cmutil_thread_context->mutex, Unlock);
     return (CMUTIL_Thread*)r;
 }
@@ -770,6 +774,7 @@ typedef struct CMUTIL_ThreadPool_Internal {
     CMBool                  is_running;
     CMUTIL_Cond             *idle_cond;
     char                    *name;
+    CMUTIL_ObjectPool       *jobpool;   // NULL to use memst
 } CMUTIL_ThreadPool_Internal;
 
 typedef struct CMUTIL_ThreadPoolJob {
@@ -777,6 +782,15 @@ typedef struct CMUTIL_ThreadPoolJob {
     void                        *udata;
 } CMUTIL_ThreadPoolJob;
 
+CMUTIL_STATIC void CMUTIL_ThreadPoolJobFree(
+        CMUTIL_ThreadPool_Internal *pool, CMUTIL_ThreadPoolJob *job)
+{
+    if (pool->jobpool)
+        CMCall(pool->jobpool, Free, job);
+    else
+        pool->memst->Free(job);
+}
+
 CMUTIL_STATIC void *CMUTIL_ThreadPoolProc(void *vp) {
     CMUTIL_ThreadPool_Internal *pool = (CMUTIL_ThreadPool_Internal*)vp;
     while (pool->is_running) {
@@ -800,7 +814,7 @@ CMUTIL_STATIC void *CMUTIL_ThreadPoolProc(void *vp) {
         // do job
         job->callback(job->udata);
 
-        pool->memst->Free(job);
+        CMUTIL_ThreadPoolJobFree(pool, job);
 
         // now this thread will be idle
         CMSync(pool->tmtx, {
@@ -816,7 +830,8 @@ CMUTIL_STATIC void CMUTIL_ThreadPoolExecute(
     CMUTIL_ThreadPool *tp, CMProcCB runnable, void *udata) {
     CMUTIL_ThreadPool_Internal *pool = (CMUTIL_ThreadPool_Internal*)tp;
     CMBool need_thread = CMFalse;
-    CMUTIL_ThreadPoolJob *job =
+    CMUTIL_ThreadPoolJob *job = pool->jobpool?
+        CMCall(pool->jobpool, Alloc) :
         pool->memst->Alloc(sizeof(CMUTIL_ThreadPoolJob));
 
     job->callback = runnable;
@@ -881,7 +896,8 @@ CMUTIL_STATIC void CMUTIL_ThreadPoolDestroy(CMUTIL_ThreadPool *tp) {
         CMLogWarn("thread pool(%d) destroying with remaining jobs(%d)",
             pool->pool_id, CMCall(pool->jobq, GetSize));
         while (CMCall(pool->jobq, GetSize) > 0)
-            pool->memst->Free(CMCall(pool->jobq, RemoveFront));
+            CMUTIL_ThreadPoolJobFree(
+                        pool, CMCall(pool->jobq, RemoveFront));
     }
 
     CMCall(pool->threads, Destroy);
@@ -914,6 +930,8 @@ CMUTIL_ThreadPool *CMUTIL_ThreadPoolCreateInternal(
     pool->tmtx = CMUTIL_MutexCreateInternal(memst);
     pool->qmtx = CMUTIL_MutexCreateInternal(memst);
     pool->idle_cond = CMUTIL_CondCreateInternal(memst, CMTrue);
+    if (memst == CMUTIL_GetMem())
+        pool->jobpool = CMUTIL_ObjectPoolShared(sizeof(CMUTIL_ThreadPoolJob));
     pool->pool_id = ++g_cmutil_thread_pool_id;
     pool->auto_increment = pool_size <= 0 ? CMTrue: CMFalse;
     pool->pool_size = pool_size <= 0 ? 1 : pool_size;
@@ -1368,13 +1386,14 @@ typedef struct CMUTIL_TimerTask_Internal {
     CMBool                  dispatched; // handed to a worker, not finished yet
     CMBool                  waiter;     // a canceller waits for this task
     uint64_t                runner;     // system id of the executing thread
+    size_t                  heapidx;    // position in the scheduled heap
     CMUTIL_Mem              *memst;     // memory management context
 } CMUTIL_TimerTask_Internal;
 
 typedef struct CMUTIL_Timer_Internal {
     CMUTIL_Timer            base;       // timer API interface
     CMUTIL_Mutex            *mutex;     // timer task add/remove synchronization
-    CMUTIL_Array            *scheduled; // tasks in scheduled to run
+    CMUTIL_Heap             *scheduled; // tasks in scheduled to run
     CMUTIL_ThreadPool       *tpool;      // worker thread pool
     CMUTIL_Array            *finished;  // finished tasks
     CMUTIL_Array            *alltasks;  // all tasks
@@ -1383,8 +1402,18 @@ typedef struct CMUTIL_Timer_Internal {
     CMBool                  running;    // timer running indicator
     int                     numthrs;    // number of worker threads
     CMUTIL_Mem              *memst;     // memory manger
+    CMUTIL_ObjectPool       *taskpool;  // task allocator, NULL to use memst
 } CMUTIL_Timer_Internal;
 
+CMUTIL_STATIC void CMUTIL_TimerTaskFree(
+        CMUTIL_Timer_Internal *itimer, CMUTIL_TimerTask_Internal *itask)
+{
+    if (itimer->taskpool)
+        CMCall(itimer->taskpool, Free, itask);
+    else
+        itimer->memst->Free(itask);
+}
+
 CMUTIL_STATIC CMBool CMUTIL_TimerTaskCancelPrivate(
         CMUTIL_TimerTask *task)
 {
@@ -1394,7 +1423,8 @@ CMUTIL_STATIC CMBool CMUTIL_TimerTaskCancelPrivate(
 
     CMCall(itimer->mutex, Lock);
     if (!itask->canceled) {
-        if (CMCall(itimer->scheduled, Remove, task) ||
+        if ((itask->heapidx != CMUTIL_HEAP_NONE &&
+                CMCall(itimer->scheduled, RemoveAt, itask->heapidx)) ||
                 CMCall(itimer->finished, Remove, task)) {
             CMCall(itimer->alltasks, Remove, task);
             isfree = CMTrue;
@@ -1430,7 +1460,7 @@ CMUTIL_STATIC CMBool CMUTIL_TimerTaskCancelPrivate(
     CMCall(itimer->mutex, Unlock);
 
     if (isfree)
-        itimer->memst->Free(itask);
+        CMUTIL_TimerTaskFree(itimer, itask);
 
     return isfree;
 }
@@ -1457,7 +1487,8 @@ CMUTIL_STATIC CMUTIL_TimerTask *CMUTIL_TimerTaskCreate(
 {
     if (proc != NULL && first != NULL && (type == TimerTask_OneTime || period > 0)) {
         CMUTIL_Timer_Internal *itimer = (CMUTIL_Timer_Internal*)timer;
-        CMUTIL_TimerTask_Internal *res =
+        CMUTIL_TimerTask_Internal *res = itimer->taskpool?
+                CMCall(itimer->taskpool, Alloc) :
                 itimer->memst->Alloc(sizeof(CMUTIL_TimerTask_Internal));
         memset(res, 0x0, sizeof(CMUTIL_TimerTask_Internal));
 
@@ -1469,10 +1500,11 @@ CMUTIL_STATIC CMUTIL_TimerTask *CMUTIL_TimerTaskCreate(
         res->proc = proc;
         res->type = type;
         res->memst = itimer->memst;
+        res->heapidx = CMUTIL_HEAP_NONE;
         res->base.Cancel = CMUTIL_TimerTaskCancel;
 
         CMSync(itimer->mutex, {
-            CMCall(itimer->scheduled, Add, res, NULL);
+            CMCall(itimer->scheduled, Push, res);
             CMCall(itimer->alltasks, Add, res, NULL);
         });
 
@@ -1570,19 +1602,22 @@ CMUTIL_STATIC void CMUTIL_TimerDestroy(CMUTIL_Timer *timer)
     if (itimer->tpool)
         CMCall(itimer->tpool, Destroy);
 
+    // the heap reports positions to its tasks while clearing,
+    // so it must go before the tasks are freed.
+    if (itimer->scheduled)
+        CMCall(itimer->scheduled, Destroy);
+
+    if (itimer->finished)
+        CMCall(itimer->finished, Destroy);
+
     // remove scheduled tasks
     if (itimer->alltasks) {
         while (CMCall(itimer->alltasks, GetSize) > 0)
-            itimer->memst->Free(CMCall(itimer->alltasks, RemoveAt, 0));
+            CMUTIL_TimerTaskFree(
+                        itimer, CMCall(itimer->alltasks, RemoveAt, 0));
         CMCall(itimer->alltasks, Destroy);
     }
 
-    if (itimer->finished)
-        CMCall(itimer->finished, Destroy);
-
-    if (itimer->scheduled)
-        CMCall(itimer->scheduled, Destroy);
-
     if (itimer->mutex)
         CMCall(itimer->mutex, Destroy);
 
@@ -1612,7 +1647,7 @@ CMUTIL_STATIC CMBool CMUTIL_TimerIsElapsed(
 
 CMUTIL_STATIC void CMUTIL_TimerWorker(void *param)
 {
-    CMUTIL_Array *addedto = NULL;
+    CMBool repeat = CMFalse, finished = CMFalse;
     CMBool isfree = CMFalse;
     CMUTIL_TimerTask_Internal *itask = (CMUTIL_TimerTask_Internal*)param;
     CMUTIL_Timer_Internal *itimer = NULL;
@@ -1627,7 +1662,7 @@ CMUTIL_STATIC void CMUTIL_TimerWorker(void *param)
 
         if (itask->type == TimerTask_Repeat && !itask->canceled) {
             struct timeval current;
-            addedto = itimer->scheduled;
+            repeat = CMTrue;
 
             gettimeofday(&current, NULL);
 
@@ -1642,7 +1677,7 @@ CMUTIL_STATIC void CMUTIL_TimerWorker(void *param)
             }
         }
         else {
-            addedto = itimer->finished;
+            finished = CMTrue;
         }
     }
 
@@ -1652,15 +1687,18 @@ CMUTIL_STATIC void CMUTIL_TimerWorker(void *param)
         // a waiting canceller takes over the ownership of this task.
         isfree = itask->waiter? CMFalse:CMTrue;
     }
-    else if (addedto) {
-        CMCall(addedto, Add, itask, NULL);
+    else if (repeat) {
+        CMCall(itimer->scheduled, Push, itask);
+    }
+    else if (finished) {
+        CMCall(itimer->finished, Add, itask, NULL);
     }
     itask->runner = 0;
     itask->dispatched = CMFalse;
     CMCall(itimer->mutex, Unlock);
 
     if (isfree)
-        itimer->memst->Free(itask);
+        CMUTIL_TimerTaskFree(itimer, itask);
 }
 
 CMUTIL_STATIC void *CMUTIL_TimerMainLoop(void *param)
@@ -1676,9 +1714,8 @@ CMUTIL_STATIC void *CMUTIL_TimerMainLoop(void *param)
         CMSync(itimer->mutex, {
             while (CMCall(itimer->scheduled, GetSize) > 0 &&
                 CMUTIL_TimerIsElapsed(
-                    CMCall(itimer->scheduled, Bottom), &curr)) {
-                task = (CMUTIL_TimerTask*)
-                        CMCall(itimer->scheduled, RemoveAt, 0);
+                    CMCall(itimer->scheduled, Peek), &curr)) {
+                task = (CMUTIL_TimerTask*)CMCall(itimer->scheduled, Pop);
 
                 // marked before the handover so that a canceller can tell
                 // a running task from a merely scheduled one.
@@ -1703,6 +1740,11 @@ CMUTIL_STATIC int CMUTIL_TimerTaskComp(const void *a, const void *b)
     return ret;
 }
 
+CMUTIL_STATIC void CMUTIL_TimerTaskIndex(void *task, size_t index)
+{
+    ((CMUTIL_TimerTask_Internal*)task)->heapidx = index;
+}
+
 CMUTIL_STATIC int CMUTIL_TimerAddrComp(const void *a, const void *b)
 {
     return a < b? -1:a > b? 1:0;
@@ -1732,14 +1774,18 @@ CMUTIL_Timer *CMUTIL_TimerCreateInternal(
     memcpy(res, &g_cmutil_timer, sizeof(CMUTIL_Timer));
 
     res->memst = memst;
+    if (memst == CMUTIL_GetMem())
+        res->taskpool = CMUTIL_ObjectPoolShared(
+                    sizeof(CMUTIL_TimerTask_Internal));
     res->running = CMTrue;
     res->precision = precision * 1000;  // milliseconds to microseconds
     res->numthrs = threads;
     res->mutex = CMUTIL_MutexCreateInternal(memst);
 
-    // create a timer task array which sorted by its schedule time.
-    res->scheduled = CMUTIL_ArrayCreateInternal(
-                memst, 5, CMUTIL_TimerTaskComp, NULL, CMTrue);
+    // create a timer task heap ordered by schedule time, each task knows
+    // its position so that cancelling does not search for it.
+    res->scheduled = CMUTIL_HeapCreateInternal(
+                memst, CMUTIL_TimerTaskComp, CMUTIL_TimerTaskIndex, NULL);
 
     // create
     res->finished = CMUTIL_ArrayCreateInternal(
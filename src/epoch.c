@@ -0,0 +1,154 @@
+/*
+MIT License
+
+Copyright (c) 2020 Dennis Soungjin Park<xcomart@gmail.com>
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+ */
+
+
+#include "functions.h"
+
+/*
+ * Epoch based reclamation for containers with lock-free readers.
+ * A reader announces the global epoch it observed while it is inside of
+ * a critical section. Writers unlink shared objects first and retire them
+ * tagged with the current epoch. The global epoch advances only when every
+ * active reader has observed it, so an object retired in epoch E can not
+ * be reached by any reader once the global epoch reaches E + 2.
+ */
+
+typedef struct CMUTIL_EpochRecord CMUTIL_EpochRecord;
+struct CMUTIL_EpochRecord {
+    uint64_t            epoch;      // 0 while not in critical section
+    CMUTIL_EpochRecord  *next;
+    int                 nest;
+    CMBool              inuse;
+    // keep records of different threads in different cache lines.
+    char                dummy_padder[40];
+};
+
+static CMUTIL_Mutex *g_cmutil_epoch_mutex = NULL;
+static CMUTIL_EpochRecord *g_cmutil_epoch_records = NULL;
+static uint64_t g_cmutil_epoch = 1;
+static uint32_t g_cmutil_epoch_gen = 0;
+static CMUTIL_TLS CMUTIL_EpochRecord *t_cmutil_epoch_rec = NULL;
+static CMUTIL_TLS uint32_t t_cmutil_epoch_gen = 0;
+
+void CMUTIL_EpochInit(void)
+{
+    g_cmutil_epoch_mutex = CMUTIL_MutexCreateInternal(CMUTIL_GetMem());
+    g_cmutil_epoch_records = NULL;
+    g_cmutil_epoch = 1;
+    // records cached by threads of previous initialization are stale.
+    g_cmutil_epoch_gen++;
+}
+
+void CMUTIL_EpochClear(void)
+{
+    CMUTIL_EpochRecord *rec = g_cmutil_epoch_records;
+    while (rec) {
+        CMUTIL_EpochRecord *next = rec->next;
+        CMFree(rec);
+        rec = next;
+    }
+    g_cmutil_epoch_records = NULL;
+    if (g_cmutil_epoch_mutex) {
+        CMCall(g_cmutil_epoch_mutex, Destroy);
+        g_cmutil_epoch_mutex = NULL;
+    }
+}
+
+CMUTIL_STATIC CMUTIL_EpochRecord *CMUTIL_EpochRecordGet(void)
+{
+    CMUTIL_EpochRecord *rec = t_cmutil_epoch_rec;
+    if (rec && t_cmutil_epoch_gen == g_cmutil_epoch_gen)
+        return rec;
+    CMCall(g_cmutil_epoch_mutex, Lock);
+    // reuse the record of an exited thread if any.
+    for (rec = g_cmutil_epoch_records; rec; rec = rec->next)
+        if (!rec->inuse)
+            break;
+    if (rec == NULL) {
+        rec = CMAlloc(sizeof(CMUTIL_EpochRecord));
+        memset(rec, 0x0, sizeof(CMUTIL_EpochRecord));
+        rec->next = g_cmutil_epoch_records;
+        CMUTIL_ATOMIC_STOREP(&g_cmutil_epoch_records, rec);
+    }
+    rec->inuse = CMTrue;
+    rec->nest = 0;
+    CMCall(g_cmutil_epoch_mutex, Unlock);
+    t_cmutil_epoch_rec = rec;
+    t_cmutil_epoch_gen = g_cmutil_epoch_gen;
+    return rec;
+}
+
+void CMUTIL_EpochThreadRelease(void)
+{
+    CMUTIL_EpochRecord *rec = t_cmutil_epoch_rec;
+    if (rec && t_cmutil_epoch_gen == g_cmutil_epoch_gen) {
+        CMCall(g_cmutil_epoch_mutex, Lock);
+        CMUTIL_ATOMIC_STORE64(&rec->epoch, 0);
+        rec->nest = 0;
+        rec->inuse = CMFalse;
+        CMCall(g_cmutil_epoch_mutex, Unlock);
+    }
+    t_cmutil_epoch_rec = NULL;
+}
+
+void CMUTIL_EpochEnter(void)
+{
+    CMUTIL_EpochRecord *rec = CMUTIL_EpochRecordGet();
+    if (rec->nest++ == 0) {
+        CMUTIL_ATOMIC_STORE64(
+                    &rec->epoch, CMUTIL_ATOMIC_LOAD64(&g_cmutil_epoch));
+        // announcement must be visible before any shared pointer is read.
+        CMUTIL_ATOMIC_FENCE();
+    }
+}
+
+void CMUTIL_EpochLeave(void)
+{
+    CMUTIL_EpochRecord *rec = t_cmutil_epoch_rec;
+    if (rec && rec->nest > 0 && --rec->nest == 0)
+        CMUTIL_ATOMIC_STORE64(&rec->epoch, 0);
+}
+
+uint64_t CMUTIL_EpochCurrent(void)
+{
+    // the epoch must be read after the retired object has been unlinked.
+    CMUTIL_ATOMIC_FENCE();
+    return CMUTIL_ATOMIC_LOAD64(&g_cmutil_epoch);
+}
+
+uint64_t CMUTIL_EpochAdvance(void)
+{
+    uint64_t epoch;
+    CMUTIL_EpochRecord *rec;
+    CMUTIL_ATOMIC_FENCE();
+    epoch = CMUTIL_ATOMIC_LOAD64(&g_cmutil_epoch);
+    for (rec = CMUTIL_ATOMIC_LOADP(&g_cmutil_epoch_records); rec;
+         rec = rec->next) {
+        uint64_t e = CMUTIL_ATOMIC_LOAD64(&rec->epoch);
+        if (e != 0 && e != epoch)
+            return epoch;
+    }
+    CMUTIL_ATOMIC_CAS64(&g_cmutil_epoch, epoch, epoch + 1);
+    return CMUTIL_ATOMIC_LOAD64(&g_cmutil_epoch);
+}
@@ -52,16 +52,73 @@ void CMUTIL_ThreadInit(void);
 void CMUTIL_ThreadClear(void);
 void CMUTIL_CallStackInit(void);
 void CMUTIL_CallStackClear(void);
+// captures up to maxdepth return addresses of the caller, without symbols.
+int CMUTIL_CallStackCapture(void **frames, int maxdepth, int skipdepth);
+// writes the symbol name of a code address, or the address if unknown.
+void CMUTIL_CallStackSymbol(void *addr, char *buf, size_t bufsz);
+// appends symbolized frames one per line, symbols are cached process wide.
+void CMUTIL_CallStackPrint(
+        void * const *frames, int depth, CMUTIL_String *outbuf);
 void CMUTIL_NetworkInit(void);
 void CMUTIL_NetworkClear(void);
 void CMUTIL_StringBaseInit(void);
 void CMUTIL_StringBaseClear(void);
 void CMUTIL_MemDebugInit(CMMemOper memoper);
 CMBool CMUTIL_MemDebugClear(void);
+void CMUTIL_MemThreadCacheRelease(void);
+void CMUTIL_ArenaInit(void);
+void CMUTIL_ArenaClear(void);
+void CMUTIL_ObjectPoolInit(void);
+void CMUTIL_ObjectPoolClear(void);
+void CMUTIL_ObjectPoolThreadRelease(void);
+void CMUTIL_HashInit(void);
+void CMUTIL_EpochInit(void);
+void CMUTIL_MapAtomInit(void);
+void CMUTIL_MapAtomClear(void);
+void CMUTIL_EpochClear(void);
+void CMUTIL_EpochThreadRelease(void);
+CMMemOper CMUTIL_MemGetOper(void);
 void CMUTIL_HttpInit(void);
 void CMUTIL_HttpClear(void);
 
 
+CMUTIL_Arena *CMUTIL_ArenaCreateInternal(CMUTIL_Mem *memst, size_t chunksz);
+
+CMUTIL_ObjectPool *CMUTIL_ObjectPoolCreateInternal(
+        CMUTIL_Mem *memst, size_t objsize);
+// process wide pool for internal nodes, NULL unless CMMemRecycle is used.
+CMUTIL_ObjectPool *CMUTIL_ObjectPoolShared(size_t objsize);
+
+/*
+ * Seeded 64 bit hashes for the hash containers. Upper variants hash as if
+ * ASCII letters were upper-cased, CMUTIL_HashEqUpper compares 'len' bytes
+ * of an upper-cased key with a key of any case.
+ */
+#define CMUTIL_ASCII_UPPER(c)   \
+    ((c) >= 'a' && (c) <= 'z'? (char)((c) - ('a' - 'A')) : (c))
+uint64_t CMUTIL_HashBytes(const void *data, size_t len);
+uint64_t CMUTIL_HashBytesUpper(const void *data, size_t len);
+uint64_t CMUTIL_HashStr(const char *str);
+uint64_t CMUTIL_HashStrUpper(const char *str);
+uint64_t CMUTIL_HashU64(uint64_t key);
+CMBool CMUTIL_HashEqUpper(const char *ukey, const char *key, size_t len);
+
+/*
+ * Epoch based reclamation for lock-free readers. Readers wrap shared
+ * accesses with Enter/Leave, which may nest. Writers tag unlinked objects
+ * with CMUTIL_EpochCurrent and may free an object tagged E once
+ * CMUTIL_EpochAdvance returns E + 2 or greater.
+ */
+void CMUTIL_EpochEnter(void);
+void CMUTIL_EpochLeave(void);
+uint64_t CMUTIL_EpochCurrent(void);
+uint64_t CMUTIL_EpochAdvance(void);
+
+CMUTIL_Vector *CMUTIL_VectorCreateInternal(
+        CMUTIL_Mem *mem, size_t elemsize, size_t initcapacity);
+CMUTIL_Heap *CMUTIL_HeapCreateInternal(
+        CMUTIL_Mem *mem, CMCompareCB comparator,
+        CMHeapIndexCB indexcb, CMFreeCB freecb);
 CMUTIL_Array *CMUTIL_ArrayCreateInternal(CMUTIL_Mem *mem,
         size_t initcapacity,
         CMCompareCB comparator,
@@ -90,6 +147,10 @@ CMUTIL_Semaphore *CMUTIL_SemaphoreCreateInternal(
         int initcnt);
 CMUTIL_RWLock *CMUTIL_RWLockCreateInternal(
         CMUTIL_Mem *memst);
+CMUTIL_Queue *CMUTIL_QueueCreateInternal(
+        CMUTIL_Mem *memst,
+        size_t capacity,
+        CMFreeCB freecb);
 CMUTIL_Timer *CMUTIL_TimerCreateInternal(
         CMUTIL_Mem *memst,
         long precision,
@@ -125,6 +186,20 @@ CMUTIL_LogSystem *CMUTIL_LogSystemGetInternal(CMUTIL_Mem *memst);
 
 CMUTIL_Map *CMUTIL_MapCreateInternal(CMUTIL_Mem *memst, uint32_t bucketsize,
         CMBool isucase, CMFreeCB freecb, float load_factor);
+CMUTIL_Map *CMUTIL_MapCreateInternedInternal(CMUTIL_Mem *memst,
+        uint32_t bucketsize, CMBool isucase, CMFreeCB freecb,
+        float load_factor);
+CMUTIL_IntMap *CMUTIL_IntMapCreateInternal(CMUTIL_Mem *memst,
+        uint32_t bucketsize, CMFreeCB freecb, float load_factor);
+CMUTIL_BinaryMap *CMUTIL_BinaryMapCreateInternal(CMUTIL_Mem *memst,
+        uint32_t bucketsize, CMFreeCB freecb, float load_factor);
+CMUTIL_ConcurrentMap *CMUTIL_ConcurrentMapCreateInternal(CMUTIL_Mem *memst,
+        uint32_t bucketsize, uint32_t shards, CMFreeCB freecb);
+CMUTIL_SortedMap *CMUTIL_SortedMapCreateInternal(CMUTIL_Mem *memst,
+        CMCompareCB comparator, CMFreeCB keyfreecb, CMFreeCB freecb);
+CMUTIL_Cache *CMUTIL_CacheCreateInternal(CMUTIL_Mem *memst,
+        size_t capacity, uint32_t shards, CMCachePolicy policy,
+        CMCacheEvictCB evictcb, void *udata, void *(*dupcb)(void *value));
 
 CMUTIL_JsonObject *CMUTIL_JsonObjectCreateInternal(CMUTIL_Mem *memst);
 CMUTIL_JsonArray *CMUTIL_JsonArrayCreateInternal(CMUTIL_Mem *memst);
@@ -196,6 +271,9 @@ CMUTIL_String *CMUTIL_StringCreateInternal(
 CMUTIL_ByteBuffer *CMUTIL_ByteBufferCreateInternal(
         CMUTIL_Mem  *memst,
         size_t initcapacity);
+CMUTIL_ByteRing *CMUTIL_ByteRingCreateInternal(
+        CMUTIL_Mem *memst,
+        size_t capacity);
 CMUTIL_StringArray *CMUTIL_StringArrayCreateInternal(
         CMUTIL_Mem *memst, size_t initcapacity);
 CMUTIL_CSConv *CMUTIL_CSConvCreateInternal(
@@ -0,0 +1,206 @@
+/*
+MIT License
+
+Copyright (c) 2020 Dennis Soungjin Park<xcomart@gmail.com>
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+ */
+
+#include "functions.h"
+
+#if defined(_MSC_VER) && defined(_M_X64)
+# include <intrin.h>
+#endif
+
+/*
+ * Seeded 64 bit hash of the wyhash family, shared by the hash containers.
+ * Input is consumed 8 or 16 bytes at a time and mixed with a 64x64->128 bit
+ * multiplication. The case folding variant upper-cases ASCII letters of
+ * every word it reads, so it hashes "Content-Type" and "CONTENT-TYPE"
+ * alike without copying the key.
+ * The seed is chosen randomly at initialization, so bucket positions
+ * can not be predicted from outside of the process.
+ */
+
+static const uint64_t g_cmutil_hash_secret[4] = {
+    0x2d358dccaa6c78a5ULL, 0x8bb84b93962eacc9ULL,
+    0x4b33a62ed433d4a3ULL, 0x4d5a2da51de1aa47ULL
+};
+
+static uint64_t g_cmutil_hash_seed = 0x9E3779B97F4A7C15ULL;
+
+#define CMUTIL_HASH_ONES    0x0101010101010101ULL
+#define CMUTIL_HASH_HIGHS   0x8080808080808080ULL
+
+CMUTIL_STATIC void CMUTIL_HashMum(uint64_t *a, uint64_t *b)
+{
+#if defined(__SIZEOF_INT128__)
+    __uint128_t r = *a;
+    r *= *b;
+    *a = (uint64_t)r;
+    *b = (uint64_t)(r >> 64);
+#elif defined(_MSC_VER) && defined(_M_X64)
+    *a = _umul128(*a, *b, b);
+#else
+    uint64_t ha = *a >> 32, hb = *b >> 32;
+    uint64_t la = (uint32_t)*a, lb = (uint32_t)*b;
+    uint64_t rh = ha * hb, rm0 = ha * lb, rm1 = hb * la, rl = la * lb;
+    uint64_t t = rl + (rm0 << 32), c = t < rl;
+    uint64_t lo = t + (rm1 << 32);
+    c += lo < t;
+    *a = lo;
+    *b = rh + (rm0 >> 32) + (rm1 >> 32) + c;
+#endif
+}
+
+CMUTIL_STATIC uint64_t CMUTIL_HashMix(uint64_t a, uint64_t b)
+{
+    CMUTIL_HashMum(&a, &b);
+    return a ^ b;
+}
+
+// upper-cases ASCII letters in every byte of the word at once.
+CMUTIL_STATIC uint64_t CMUTIL_HashFold(uint64_t v)
+{
+    uint64_t low = v & ~CMUTIL_HASH_HIGHS;
+    // high bit of a byte is set if the byte is within 'a'..'z'.
+    uint64_t az = ((low + CMUTIL_HASH_ONES * (0x80 - 'a')) ^
+                   (low + CMUTIL_HASH_ONES * (0x80 - 'z' - 1))) &
+                  ~v & CMUTIL_HASH_HIGHS;
+    return v - (az >> 2);
+}
+
+CMUTIL_STATIC uint64_t CMUTIL_HashRead8(const uint8_t *p, CMBool fold)
+{
+    uint64_t v;
+    memcpy(&v, p, sizeof(v));
+    return fold? CMUTIL_HashFold(v) : v;
+}
+
+CMUTIL_STATIC uint64_t CMUTIL_HashRead4(const uint8_t *p, CMBool fold)
+{
+    uint32_t v;
+    memcpy(&v, p, sizeof(v));
+    return fold? CMUTIL_HashFold(v) : v;
+}
+
+CMUTIL_STATIC uint64_t CMUTIL_HashRead3(
+        const uint8_t *p, size_t len, CMBool fold)
+{
+    uint64_t v = ((uint64_t)p[0] << 16) |
+            ((uint64_t)p[len >> 1] << 8) | p[len - 1];
+    return fold? CMUTIL_HashFold(v) : v;
+}
+
+CMUTIL_STATIC uint64_t CMUTIL_HashBase(
+        const void *data, size_t len, uint64_t seed, CMBool fold)
+{
+    const uint8_t *p = (const uint8_t*)data;
+    const uint64_t *s = g_cmutil_hash_secret;
+    uint64_t a, b;
+    seed ^= CMUTIL_HashMix(seed ^ s[0], s[1]);
+    if (len <= 16) {
+        if (len >= 4) {
+            size_t off = (len >> 3) << 2;
+            a = (CMUTIL_HashRead4(p, fold) << 32) |
+                    CMUTIL_HashRead4(p + off, fold);
+            b = (CMUTIL_HashRead4(p + len - 4, fold) << 32) |
+                    CMUTIL_HashRead4(p + len - 4 - off, fold);
+        } else if (len > 0) {
+            a = CMUTIL_HashRead3(p, len, fold);
+            b = 0;
+        } else {
+            a = b = 0;
+        }
+    } else {
+        size_t i = len;
+        if (i > 48) {
+            // three independent lanes keep the multipliers busy.
+            uint64_t see1 = seed, see2 = seed;
+            do {
+                seed = CMUTIL_HashMix(CMUTIL_HashRead8(p, fold) ^ s[1],
+                                      CMUTIL_HashRead8(p + 8, fold) ^ seed);
+                see1 = CMUTIL_HashMix(CMUTIL_HashRead8(p + 16, fold) ^ s[2],
+                                      CMUTIL_HashRead8(p + 24, fold) ^ see1);
+                see2 = CMUTIL_HashMix(CMUTIL_HashRead8(p + 32, fold) ^ s[3],
+                                      CMUTIL_HashRead8(p + 40, fold) ^ see2);
+                p += 48;
+                i -= 48;
+            } while (i > 48);
+            seed ^= see1 ^ see2;
+        }
+        while (i > 16) {
+            seed = CMUTIL_HashMix(CMUTIL_HashRead8(p, fold) ^ s[1],
+                                  CMUTIL_HashRead8(p + 8, fold) ^ seed);
+            p += 16;
+            i -= 16;
+        }
+        a = CMUTIL_HashRead8(p + i - 16, fold);
+        b = CMUTIL_HashRead8(p + i - 8, fold);
+    }
+    a ^= s[1];
+    b ^= seed;
+    CMUTIL_HashMum(&a, &b);
+    return CMUTIL_HashMix(a ^ s[0] ^ len, b ^ s[1]);
+}
+
+void CMUTIL_HashInit(void)
+{
+    struct timeval tv;
+    uint64_t seed;
+    gettimeofday(&tv, NULL);
+    // address of a local varies with ASLR, time and pid vary per run.
+    seed = CMUTIL_HashMix((uint64_t)tv.tv_sec * 1000000 + tv.tv_usec,
+                          (uint64_t)(size_t)&seed ^ (uint64_t)GETPID());
+    g_cmutil_hash_seed = CMUTIL_HashMix(seed, g_cmutil_hash_secret[2]);
+}
+
+uint64_t CMUTIL_HashBytes(const void *data, size_t len)
+{
+    return CMUTIL_HashBase(data, len, g_cmutil_hash_seed, CMFalse);
+}
+
+uint64_t CMUTIL_HashBytesUpper(const void *data, size_t len)
+{
+    return CMUTIL_HashBase(data, len, g_cmutil_hash_seed, CMTrue);
+}
+
+uint64_t CMUTIL_HashStr(const char *str)
+{
+    return CMUTIL_HashBase(str, strlen(str), g_cmutil_hash_seed, CMFalse);
+}
+
+uint64_t CMUTIL_HashStrUpper(const char *str)
+{
+    return CMUTIL_HashBase(str, strlen(str), g_cmutil_hash_seed, CMTrue);
+}
+
+uint64_t CMUTIL_HashU64(uint64_t key)
+{
+    return CMUTIL_HashMix(key ^ g_cmutil_hash_seed, g_cmutil_hash_secret[1]);
+}
+
+CMBool CMUTIL_HashEqUpper(const char *ukey, const char *key, size_t len)
+{
+    size_t i;
+    for (i=0; i<len; i++)
+        if (ukey[i] != CMUTIL_ASCII_UPPER(key[i]))
+            return CMFalse;
+    return CMTrue;
+}
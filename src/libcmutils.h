@@ -501,6 +501,20 @@ typedef void (*CMFreeCB)(void*);
  */
 typedef void (*CMProcCB)(void*);
 
+/**
+ * @brief Callback type visiting items of a container.
+ *
+ * Returns CMTrue to continue with the next item, CMFalse to stop.
+ */
+typedef CMBool (*CMEachCB)(void *item, void *udata);
+
+/**
+ * @brief Callback type visiting entries of a map.
+ *
+ * Returns CMTrue to continue with the next entry, CMFalse to stop.
+ */
+typedef CMBool (*CMMapEachCB)(const char *key, void *value, void *udata);
+
 /**
  * @defgroup CMUTILS_Initialization Initialization and memory operations.
  * @{
@@ -511,8 +525,8 @@ typedef void (*CMProcCB)(void*);
  *  <li> System version malloc, realloc, strdup, and free.
  *      This option has no memory management, proper for external memory
  *      debugger like 'duma' or 'valgrind'.</li>
- *  <li> Memory recycling, all memory allocation will be fit to 2^n sized memory
- *      blocks. This option prevents heap memory fragments,
+ *  <li> Memory recycling, all memory allocation will be fit to size classed
+ *      memory blocks. This option prevents heap memory fragments,
  *      supports memory leak detection, and detects memory overflow/underflow
  *      corruption while freeing.</li>
  *  <li> Memory recycling with stack information.
@@ -545,7 +559,8 @@ typedef enum CMMemOper {
  *         malloc, realloc, strdup, and free.
  *         Same as direct call system calls.</li>
  *   <li>CMMemRecycle: All memory allocation will be managed with pool.
- *         Pool is consists of memory blocks whose size is power of 2 bytes.
+ *         Pool is consists of memory blocks in size classes of 16 bytes
+ *         steps up to 256 bytes, and four classes per power of 2 above.
  *         Recommended for any purpose. This option prevents heap memory
  *         fragments and checks memory leak at termination. But a little
  *         overhead is required for recycling and needs much more memory
@@ -682,6 +697,270 @@ CMUTIL_API CMUTIL_Mem *CMUTIL_GetMem(void);
  */
 #define CMFree      CMUTIL_GetMem()->Free
 
+/**
+ * @brief Release cached free memory blocks to the operating system.
+ *
+ * Under CMMemRecycle and CMMemDebug, free blocks bigger than 4KB are
+ * cached for reuse. This function releases all of them, and the slabs of
+ * smaller blocks whose blocks are all free. Blocks cached by threads are
+ * not affected.
+ *
+ * @return Released bytes, always 0 under CMMemSystem.
+ */
+CMUTIL_API size_t CMUTIL_MemTrim(void);
+
+/**
+ * @brief Limit the amount of cached free memory blocks.
+ *
+ * A freed block bigger than 4KB is released immediately instead of being
+ * cached, if caching it exceeds one of these limits.
+ * Defaults are 64MB per size class and 512MB in total.
+ *
+ * @param class_limit Maximum cached bytes per size class.
+ * @param total_limit Maximum cached bytes of all size classes.
+ */
+CMUTIL_API void CMUTIL_MemSetCacheLimit(
+        size_t class_limit, size_t total_limit);
+
+/**
+ * @brief Set the size from which allocations are mapped from the OS.
+ *
+ * Under CMMemRecycle and CMMemDebug, an allocation of
+ * <code>threshold</code> bytes or more is served by its own memory
+ * mapping, which is unmapped on free instead of being cached.
+ * On Linux, <code>CMRealloc</code> of such a block resizes the mapping
+ * with <code>mremap</code> without copying. Default threshold is 1MB.
+ *
+ * @param threshold Minimum size of mapped allocations, 0 to disable.
+ * @param hugepage CMTrue to map with reserved huge pages
+ *        (<code>MAP_HUGETLB</code>), falling back to transparent huge page
+ *        hints if none is available. Ignored where not supported.
+ */
+CMUTIL_API void CMUTIL_MemSetMapThreshold(size_t threshold, CMBool hugepage);
+
+/**
+ * @brief Enable the sampling heap profiler.
+ *
+ * Under CMMemRecycle and CMMemDebug, about one allocation per
+ * <code>interval</code> bytes captures its raw call stack, and samples
+ * are aggregated per distinct stack. Under CMMemDebug, symbolized stacks
+ * of every allocation are not captured while sampling is enabled, so
+ * leak reports only show stacks of sampled blocks.
+ * Symbols are resolved when the profile is dumped with
+ * <code>CMUTIL_MemDumpProfile</code>.
+ *
+ * @param interval Average sampled bytes, 0 to disable sampling(default).
+ *        512KB gives a reasonable profile with negligible overhead.
+ */
+CMUTIL_API void CMUTIL_MemSetSampling(size_t interval);
+
+/**
+ * @brief Heap profile formats of <code>CMUTIL_MemDumpProfile</code>.
+ */
+typedef enum CMMemProfileFormat {
+    /**
+     * One line per stack, frames from the outermost separated by ';' and
+     * estimated in use bytes. Input format of flamegraph.pl.
+     */
+    CMMemProfileFolded = 0,
+    /**
+     * gperftools heap profile(heap_v2) with raw addresses and the process
+     * mappings, which can be read by <code>pprof</code>.
+     */
+    CMMemProfilePprof
+} CMMemProfileFormat;
+
+/**
+ * @brief Write the heap profile sampled so far to a file.
+ *
+ * @param path File path to be written, overwritten if exists.
+ * @param format Output format.
+ * @return CMTrue if the profile is written, CMFalse under CMMemSystem or
+ *         if the file cannot be written.
+ */
+CMUTIL_API CMBool CMUTIL_MemDumpProfile(
+        const char *path, CMMemProfileFormat format);
+
+/**
+ * @brief Maximum count of size classes in a CMUTIL_MemStats.
+ */
+#define CMUTIL_MEM_MAX_CLASSES  161
+
+/**
+ * @brief Statistics of a size class of the recycle allocator.
+ *
+ * Counters kept by other threads are read without locking, so the numbers
+ * are approximate while other threads allocate.
+ */
+typedef struct CMUTIL_MemClassStats {
+    /** Block size of this class, 0 for blocks mapped from the OS. */
+    size_t  size;
+    /** Blocks held by this class, in use or cached. */
+    int64_t blocks;
+    /** Bytes taken from the OS for this class, including headers. */
+    int64_t heldsz;
+    /** Blocks in use. */
+    int64_t inuse;
+    /** Requested bytes of blocks in use. */
+    int64_t inusesz;
+    /** Free blocks cached for reuse, by threads or by the class. */
+    int64_t cached;
+    /** Bytes of cached blocks. */
+    int64_t cachedsz;
+    /** High water mark of <code>blocks</code>. */
+    int64_t peakblocks;
+    /**
+     * High water mark of blocks in use, blocks cached by threads are
+     * counted as in use.
+     */
+    int64_t peakinuse;
+    /** Allocations since initialization. */
+    int64_t allocs;
+    /** Frees since initialization. */
+    int64_t frees;
+    /** Allocations per second during <code>interval</code>. */
+    double  allocrate;
+    /** Frees per second during <code>interval</code>. */
+    double  freerate;
+    /** Acquisitions of the class lock. */
+    int64_t locks;
+    /** Acquisitions of the class lock which had to wait for another thread. */
+    int64_t contended;
+} CMUTIL_MemClassStats;
+
+/**
+ * @brief Statistics of the recycle allocator.
+ */
+typedef struct CMUTIL_MemStats {
+    /** Memory operation type in use. */
+    CMMemOper               oper;
+    /** Count of valid items in <code>classes</code>. */
+    int                     count;
+    /** Seconds since the previous <code>CMUTIL_MemGetStats</code> call. */
+    double                  interval;
+    /** Bytes held by the allocator. */
+    int64_t                 heldsz;
+    /** High water mark of <code>heldsz</code>. */
+    int64_t                 peakheldsz;
+    /** Sum of all classes, high water marks are sums of the classes'. */
+    CMUTIL_MemClassStats    total;
+    /** Classes which have been used, from the smallest. */
+    CMUTIL_MemClassStats    classes[CMUTIL_MEM_MAX_CLASSES];
+} CMUTIL_MemStats;
+
+/**
+ * @brief Take statistics of the recycle allocator.
+ *
+ * Rates are measured from the previous call of this function, or from the
+ * initialization for the first call.
+ *
+ * @param stats Statistics to be filled.
+ * @return CMTrue if taken, CMFalse under CMMemSystem.
+ */
+CMUTIL_API CMBool CMUTIL_MemGetStats(CMUTIL_MemStats *stats);
+
+/**
+ * @brief Region(arena) allocator.
+ *
+ * An arena hands out memory from large chunks by bumping a pointer and
+ * releases everything at once with <code>Reset</code> or
+ * <code>Destroy</code>. Its memory operator table can be passed to any
+ * function accepting a <code>CMUTIL_Mem</code>, e.g.
+ * <code>CMUTIL_JsonParseWithMem</code>, so a whole object tree is built in
+ * one arena. <code>Free</code> of the table does nothing.
+ *
+ * An arena is not thread safe, and at most 32 arenas can exist at once.
+ */
+typedef struct CMUTIL_Arena CMUTIL_Arena;
+struct CMUTIL_Arena {
+    /**
+     * @brief Get the memory operator table of this arena.
+     *
+     * @param arena This arena object.
+     * @return Memory operators allocating from this arena. It is valid
+     *         until the arena is destroyed.
+     */
+    CMUTIL_Mem *(*GetMem)(
+            const CMUTIL_Arena *arena);
+
+    /**
+     * @brief Release all memory allocated from this arena at once.
+     *
+     * One chunk is kept for further allocations. Every object allocated
+     * from this arena becomes invalid.
+     *
+     * @param arena This arena object.
+     */
+    void (*Reset)(
+            CMUTIL_Arena *arena);
+
+    /**
+     * @brief Destroy this arena and all memory allocated from it.
+     *
+     * @param arena This arena object.
+     */
+    void (*Destroy)(
+            CMUTIL_Arena *arena);
+};
+
+/**
+ * @brief Create an arena allocator.
+ *
+ * @param chunk_size Size of each chunk in bytes, 0 for the default
+ *        size(64KB). Allocations bigger than a chunk get their own chunk.
+ * @return A new arena object, or NULL if 32 arenas already exist.
+ */
+CMUTIL_API CMUTIL_Arena *CMUTIL_ArenaCreate(size_t chunk_size);
+
+/**
+ * @brief Fixed size object pool.
+ *
+ * An object pool hands out objects of one size from slabs. Every thread
+ * keeps a small cache of free objects for each pool, so most calls of
+ * <code>Alloc</code> and <code>Free</code> take no lock. Objects may be
+ * freed by a thread other than the one which allocated them.
+ *
+ * At most 64 pools are cached by threads at once, further pools work the
+ * same way but take a lock on every call.
+ */
+typedef struct CMUTIL_ObjectPool CMUTIL_ObjectPool;
+struct CMUTIL_ObjectPool {
+    /**
+     * @brief Allocate an object from this pool.
+     *
+     * @param pool This object pool.
+     * @return An uninitialized object, or NULL if out of memory.
+     */
+    void *(*Alloc)(
+            CMUTIL_ObjectPool *pool);
+
+    /**
+     * @brief Return an object to this pool.
+     *
+     * @param pool This object pool.
+     * @param obj Object allocated from this pool, NULL is ignored.
+     */
+    void (*Free)(
+            CMUTIL_ObjectPool *pool, void *obj);
+
+    /**
+     * @brief Destroy this pool and all objects allocated from it.
+     *
+     * @param pool This object pool.
+     */
+    void (*Destroy)(
+            CMUTIL_ObjectPool *pool);
+};
+
+/**
+ * @brief Create an object pool.
+ *
+ * @param objsize Size of each object in bytes. It is rounded up to a
+ *        multiple of 16.
+ * @return A new object pool.
+ */
+CMUTIL_API CMUTIL_ObjectPool *CMUTIL_ObjectPoolCreate(size_t objsize);
+
 /**
  * @}
  */
@@ -1120,6 +1399,125 @@ struct CMUTIL_RWLock {
  */
 CMUTIL_API CMUTIL_RWLock *CMUTIL_RWLockCreate(void);
 
+/**
+ * @brief Bounded lock-free queue for multiple producers and consumers.
+ *
+ * Items are kept in a ring of fixed capacity, producers and consumers
+ * claim slots with atomic operations and never take a lock. Items are
+ * handed out in the order they were pushed. Blocking variants sleep only
+ * while the queue is full or empty.
+ */
+typedef struct CMUTIL_Queue CMUTIL_Queue;
+struct CMUTIL_Queue {
+
+    /**
+     * @brief Push an item without blocking.
+     *
+     * @param queue This queue object.
+     * @param item The item to be pushed, may be NULL.
+     * @return CMTrue if pushed, CMFalse if this queue is full.
+     */
+    CMBool (*TryPush)(
+            CMUTIL_Queue *queue, void *item);
+
+    /**
+     * @brief Pop an item without blocking.
+     *
+     * @param queue This queue object.
+     * @param item A pointer to receive the item.
+     * @return CMTrue if an item was popped, CMFalse if this queue is empty.
+     */
+    CMBool (*TryPop)(
+            CMUTIL_Queue *queue, void **item);
+
+    /**
+     * @brief Push an item, waiting for room while this queue is full.
+     *
+     * @param queue This queue object.
+     * @param item The item to be pushed, may be NULL.
+     * @param millisec Maximum waiting time in milliseconds,
+     *                 negative to wait forever.
+     * @return CMTrue if pushed, CMFalse if timed out.
+     */
+    CMBool (*Push)(
+            CMUTIL_Queue *queue, void *item, long millisec);
+
+    /**
+     * @brief Pop an item, waiting for one while this queue is empty.
+     *
+     * @param queue This queue object.
+     * @param item A pointer to receive the item.
+     * @param millisec Maximum waiting time in milliseconds,
+     *                 negative to wait forever.
+     * @return CMTrue if an item was popped, CMFalse if timed out.
+     */
+    CMBool (*Pop)(
+            CMUTIL_Queue *queue, void **item, long millisec);
+
+    /**
+     * @brief Push leading items of an array at once without blocking.
+     *
+     * The pushed items are consecutive in this queue.
+     *
+     * @param queue This queue object.
+     * @param items The items to be pushed.
+     * @param count The number of items.
+     * @return The number of leading items pushed, 0 if this queue is full.
+     */
+    size_t (*PushBatch)(
+            CMUTIL_Queue *queue, void *const *items, size_t count);
+
+    /**
+     * @brief Pop up to a number of items at once without blocking.
+     *
+     * @param queue This queue object.
+     * @param items An array to receive the items.
+     * @param count The maximum number of items.
+     * @return The number of items popped, 0 if this queue is empty.
+     */
+    size_t (*PopBatch)(
+            CMUTIL_Queue *queue, void **items, size_t count);
+
+    /**
+     * @brief Get the number of items in this queue.
+     *
+     * @param queue This queue object.
+     * @return The number of items, which may be stale when other threads
+     *         are using this queue.
+     */
+    size_t (*GetSize)(
+            const CMUTIL_Queue *queue);
+
+    /**
+     * @brief Get the maximum number of items of this queue.
+     *
+     * @param queue This queue object.
+     * @return The capacity of this queue.
+     */
+    size_t (*GetCapacity)(
+            const CMUTIL_Queue *queue);
+
+    /**
+     * @brief Destroy this queue, freeing remaining items with the free
+     *        callback if given. No other thread may use this queue any
+     *        more.
+     *
+     * @param queue This queue object.
+     */
+    void (*Destroy)(
+            CMUTIL_Queue *queue);
+};
+
+/**
+ * @brief Create a bounded lock-free queue.
+ *
+ * @param capacity The maximum number of items, rounded up to a power of 2.
+ * @param freecb A callback function to free items left when the queue is
+ *               destroyed, or NULL.
+ * @return A new queue object, or NULL on failure.
+ */
+CMUTIL_API CMUTIL_Queue *CMUTIL_QueueCreate(size_t capacity, CMFreeCB freecb);
+
 /**
  * @}
  */
@@ -1376,6 +1774,59 @@ struct CMUTIL_Array {
      * @param array This dynamic array object.
      */
     void (*Destroy)(CMUTIL_Array *array);
+
+    /**
+     * @brief Sort items of this array.
+     *
+     * Items are sorted in place by introsort, or by a merge sort on the
+     * given threadpool if the array is large. Equal items may be
+     * reordered. Not applicable to a sorted array except with its own
+     * comparator, which does nothing.
+     *
+     * @param array This dynamic array object.
+     * @param comparator Comparator of items, NULL to use the comparator
+     *        given at creation.
+     * @param pool Threadpool to sort a large array in parallel, or NULL.
+     *        Must not be called from a job of the same threadpool.
+     * @return CMTrue if sorted, CMFalse if no comparator is available or
+     *         the array is sorted by another comparator.
+     */
+    CMBool (*Sort)(CMUTIL_Array *array, CMCompareCB comparator,
+                   CMUTIL_ThreadPool *pool);
+
+    /**
+     * @brief Turn this array into a sorted array.
+     *
+     * Items added by <code>Add</code> or <code>Push</code> in any order
+     * are sorted at once, which is much faster than adding them to a
+     * sorted array one by one. Of equal items only the last added one is
+     * kept, the others are freed by <code>freecb</code> if supplied.
+     * The array behaves as a sorted array afterwards.
+     *
+     * @param array This dynamic array object.
+     * @param comparator Comparator of the sorted array, NULL to use the
+     *        comparator given at creation.
+     * @param pool Threadpool to sort a large array in parallel, or NULL.
+     *        Must not be called from a job of the same threadpool.
+     * @return CMTrue on success, CMFalse if no comparator is available or
+     *         on allocation failure.
+     */
+    CMBool (*SetSorted)(CMUTIL_Array *array, CMCompareCB comparator,
+                        CMUTIL_ThreadPool *pool);
+
+    /**
+     * @brief Call a function for all items in this array in order,
+     *        without allocating an iterator.
+     *
+     * The callback must not add or remove items of this array.
+     *
+     * @param array This dynamic array object.
+     * @param callback Function receiving each item and <code>udata</code>,
+     *                 returning CMFalse stops the iteration.
+     * @param udata User data passed to the callback.
+     * @return CMTrue if all items were visited, CMFalse if stopped.
+     */
+    CMBool (*Each)(const CMUTIL_Array *array, CMEachCB callback, void *udata);
 };
 
 /**
@@ -1408,110 +1859,409 @@ CMUTIL_API CMUTIL_Array *CMUTIL_ArrayCreateEx(
         CMFreeCB freecb);
 
 /**
- * @}
- */
-
-/**
- * @defgroup CMUTILS_Strings Strings, string arrays, byte buffers and charset conversion.
- * @{
+ * @brief Dynamic array of fixed size elements stored by value.
+ *
+ * Elements are kept in one contiguous block, so an element costs its own
+ * size only and needs no allocation of its own. Element pointers, such as
+ * the results of <code>GetAt</code> and <code>GetData</code>, are valid
+ * until the vector grows or elements are inserted or erased before them.
  */
+typedef struct CMUTIL_Vector CMUTIL_Vector;
+struct CMUTIL_Vector {
 
-/**
- * @brief Multifunctional string type.
- */
-typedef struct CMUTIL_String CMUTIL_String;
-struct CMUTIL_String {
     /**
-     * @brief Add a c-style string to this string object.
+     * @brief Append elements to the end of this vector.
      *
-     * Append the given string to the end of this string object.
-     *
-     * Appending an empty string is not an error, it just does nothing.
-     *
-     * @param string This string object.
-     * @param tobeadded C-style null terminated string to be appended.
-     * @return New size of this string object, which is the unchanged current
-     *         size when @a tobeadded is an empty string.
-     *         -1 if @a tobeadded is NULL.
+     * @param vec This vector object.
+     * @param elems <code>count</code> elements to be copied,
+     *              or NULL to append zero filled elements.
+     * @param count Number of elements to append.
+     * @return CMTrue if successful, CMFalse otherwise.
      */
-    ssize_t (*AddString)(
-            CMUTIL_String *string, const char *tobeadded);
+    CMBool (*Append)(CMUTIL_Vector *vec, const void *elems, size_t count);
 
     /**
-     * @brief Add n bytes string to this string object.
-     *
-     * Append the given string to the end of this string object.
-     * Given string is not needed to be null terminated.
+     * @brief Insert elements at the given position of this vector.
      *
-     * Appending zero bytes is not an error, it just does nothing.
+     * Elements from <code>index</code> are moved back by
+     * <code>count</code>.
      *
-     * @param string This string object.
-     * @param tobeadded C style string to be appended.
-     * @param size Number of bytes to be appended from the given string.
-     * @return New size of this string object, which is the unchanged current
-     *         size when @a size is zero.
-     *         -1 if @a tobeadded is NULL.
+     * @param vec This vector object.
+     * @param index Position of the first inserted element,
+     *              must not be greater than the size of this vector.
+     * @param elems <code>count</code> elements to be copied,
+     *              or NULL to insert zero filled elements.
+     * @param count Number of elements to insert.
+     * @return CMTrue if successful, CMFalse otherwise.
      */
-    ssize_t (*AddNString)(
-            CMUTIL_String *string, const char *tobeadded, size_t size);
+    CMBool (*Insert)(CMUTIL_Vector *vec, size_t index,
+                     const void *elems, size_t count);
 
     /**
-     * @brief Add a character to this string object.
-     *
-     * Append the given character to the end of this string object.
+     * @brief Erase elements from this vector.
      *
-     * @param string This string object.
-     * @param tobeadded Character to be appended.
-     * @return New size of this string object.
+     * @param vec This vector object.
+     * @param index Position of the first element to erase.
+     * @param count Number of elements to erase.
+     * @return CMTrue if successful, CMFalse if the range is out of bound.
      */
-    ssize_t (*AddChar)(
-            CMUTIL_String *string, char tobeadded);
+    CMBool (*Erase)(CMUTIL_Vector *vec, size_t index, size_t count);
 
     /**
-     * @brief Add a formatted string to this string object.
+     * @brief Get the element at the given position.
      *
-     * Append a ormatted string to the end of this string object.
+     * @param vec This vector object.
+     * @param index Position of the element.
+     * @return A pointer to the element in this vector,
+     *         NULL if the index is out of bound.
+     */
+    void *(*GetAt)(const CMUTIL_Vector *vec, size_t index);
+
+    /**
+     * @brief Overwrite the element at the given position.
      *
-     * @param string This string object.
-     * @param fmt Format string like a printf function.
-     * @param ... Arguments for format string.
-     * @return New size of this string object.
+     * @param vec This vector object.
+     * @param index Position of the element.
+     * @param elem The element to be copied.
+     * @return CMTrue if successful, CMFalse if the index is out of bound.
      */
-    ssize_t (*AddPrint)(
-            CMUTIL_String *string, const char *fmt, ...);
+    CMBool (*SetAt)(CMUTIL_Vector *vec, size_t index, const void *elem);
 
     /**
-     * @brief Add a formatted string to this string object.
+     * @brief Get the contiguous storage of this vector.
      *
-     * Append a formatted string to the end of this string object.
+     * @param vec This vector object.
+     * @return The first element, which may be NULL if this vector is empty.
+     */
+    void *(*GetData)(const CMUTIL_Vector *vec);
+
+    /**
+     * @brief Get the number of elements in this vector.
      *
-     * @param string This string object.
-     * @param fmt Format string like a vprintf function.
-     * @param args Arguments list for format string.
-     * @return New size of this string object.
+     * @param vec This vector object.
+     * @return Number of elements.
      */
-    ssize_t (*AddVPrint)(
-            CMUTIL_String *string, const char *fmt, va_list args);
+    size_t (*GetSize)(const CMUTIL_Vector *vec);
 
     /**
-     * @brief Add another string object to this string object.
+     * @brief Get the size of an element of this vector in bytes.
      *
-     * Append the given string object to the end of this string object.
+     * @param vec This vector object.
+     * @return Element size given at creation.
+     */
+    size_t (*GetElementSize)(const CMUTIL_Vector *vec);
+
+    /**
+     * @brief Change the number of elements of this vector.
      *
-     * Appending an empty string object is not an error,
-     * it just does nothing.
+     * Added elements are zero filled.
      *
-     * @param string This string object.
-     * @param tobeadded Another string object to be appended.
-     * @return New size of this string object, which is the unchanged current
-     *         size when @a tobeadded is an empty string object.
-     *         -1 if @a tobeadded is NULL.
+     * @param vec This vector object.
+     * @param count New number of elements.
+     * @return CMTrue if successful, CMFalse otherwise.
      */
-    ssize_t (*AddAnother)(
-            CMUTIL_String *string, const CMUTIL_String *tobeadded);
+    CMBool (*Resize)(CMUTIL_Vector *vec, size_t count);
 
     /**
-     * @brief Insert a c-style string to this string object.
+     * @brief Reserve room for a number of elements.
+     *
+     * @param vec This vector object.
+     * @param count Number of elements this vector must hold without growing.
+     * @return CMTrue if successful, CMFalse otherwise.
+     */
+    CMBool (*Reserve)(CMUTIL_Vector *vec, size_t count);
+
+    /**
+     * @brief Sort the elements of this vector.
+     *
+     * @param vec This vector object.
+     * @param comparator Callback comparing two elements,
+     *                   it receives pointers to the elements.
+     */
+    void (*Sort)(CMUTIL_Vector *vec, CMCompareCB comparator);
+
+    /**
+     * @brief Search a sorted vector with binary search.
+     *
+     * @param vec This vector object, sorted by <code>comparator</code>.
+     * @param key Pointer to the element to search.
+     * @param comparator Callback the vector was sorted with, it receives
+     *                   <code>key</code> first and an element second.
+     * @param index Pointer to receive the position of the element if found,
+     *              or the position it should be inserted at otherwise.
+     *              May be NULL.
+     * @return CMTrue if the element is found, CMFalse otherwise.
+     */
+    CMBool (*BinarySearch)(const CMUTIL_Vector *vec, const void *key,
+                           CMCompareCB comparator, size_t *index);
+
+    /**
+     * @brief Remove all elements of this vector, keeping its capacity.
+     *
+     * @param vec This vector object.
+     */
+    void (*Clear)(CMUTIL_Vector *vec);
+
+    /**
+     * @brief Destroy this vector object and its storage.
+     *
+     * @param vec This vector object.
+     */
+    void (*Destroy)(CMUTIL_Vector *vec);
+};
+
+/**
+ * @brief Creates a vector of elements of the given size.
+ *
+ * @param elemsize Size of an element in bytes.
+ * @return A new vector.
+ */
+#define CMUTIL_VectorCreate(elemsize)   \
+        CMUTIL_VectorCreateEx(elemsize, CMUTIL_ARRAY_DEFAULT)
+
+/**
+ * @brief Creates a vector with initial capacity.
+ *
+ * @param elemsize Size of an element in bytes.
+ * @param initcapacity Initial capacity of this vector in elements.
+ * @return A new vector, NULL if <code>elemsize</code> is 0 or allocation
+ *         failed.
+ */
+CMUTIL_API CMUTIL_Vector *CMUTIL_VectorCreateEx(
+        size_t elemsize, size_t initcapacity);
+
+/**
+ * @brief Callback type telling an item its position in a heap.
+ *
+ * Called whenever the item moves, with <code>CMUTIL_HEAP_NONE</code>
+ * when it leaves the heap. The position is the handle for
+ * <code>RemoveAt</code> and <code>Update</code>.
+ */
+typedef void (*CMHeapIndexCB)(void *item, size_t index);
+
+/**
+ * @brief Heap position of an item which is not in a heap.
+ */
+#define CMUTIL_HEAP_NONE    SIZE_MAX
+
+/**
+ * @brief Priority queue of pointers, the least item by the comparator
+ *        first.
+ *
+ * Kept as a 4-ary heap in one contiguous array. Push, Pop, RemoveAt and
+ * Update take O(log n).
+ */
+typedef struct CMUTIL_Heap CMUTIL_Heap;
+struct CMUTIL_Heap {
+
+    /**
+     * @brief Add an item to this heap.
+     *
+     * @param heap This heap object.
+     * @param item The item to be added.
+     * @return CMTrue if successful, CMFalse otherwise.
+     */
+    CMBool (*Push)(CMUTIL_Heap *heap, void *item);
+
+    /**
+     * @brief Get the least item without removing it.
+     *
+     * @param heap This heap object.
+     * @return The least item, NULL if this heap is empty.
+     */
+    void *(*Peek)(const CMUTIL_Heap *heap);
+
+    /**
+     * @brief Remove the least item.
+     *
+     * @param heap This heap object.
+     * @return The removed item, NULL if this heap is empty.
+     */
+    void *(*Pop)(CMUTIL_Heap *heap);
+
+    /**
+     * @brief Remove the item at the given position.
+     *
+     * @param heap This heap object.
+     * @param index Position of the item, as given to the index callback.
+     * @return The removed item, NULL if the index is out of bound.
+     */
+    void *(*RemoveAt)(CMUTIL_Heap *heap, size_t index);
+
+    /**
+     * @brief Restore the order after the key of an item has changed.
+     *
+     * Works for keys moved either way, so it serves as decrease-key and
+     * increase-key.
+     *
+     * @param heap This heap object.
+     * @param index Position of the changed item.
+     * @return CMTrue if successful, CMFalse if the index is out of bound.
+     */
+    CMBool (*Update)(CMUTIL_Heap *heap, size_t index);
+
+    /**
+     * @brief Get the item at the given position.
+     *
+     * Position 0 holds the least item, the others are in heap order.
+     *
+     * @param heap This heap object.
+     * @param index Position of the item.
+     * @return The item, NULL if the index is out of bound.
+     */
+    void *(*GetAt)(const CMUTIL_Heap *heap, size_t index);
+
+    /**
+     * @brief Get the number of items in this heap.
+     *
+     * @param heap This heap object.
+     * @return Number of items.
+     */
+    size_t (*GetSize)(const CMUTIL_Heap *heap);
+
+    /**
+     * @brief Remove all items, freeing them with the free callback if
+     *        given.
+     *
+     * @param heap This heap object.
+     */
+    void (*Clear)(CMUTIL_Heap *heap);
+
+    /**
+     * @brief Destroy this heap, freeing remaining items with the free
+     *        callback if given.
+     *
+     * @param heap This heap object.
+     */
+    void (*Destroy)(CMUTIL_Heap *heap);
+};
+
+/**
+ * @brief Creates a heap without index and free callbacks.
+ *
+ * @param comparator Callback comparing two items.
+ * @return A new heap.
+ */
+#define CMUTIL_HeapCreate(comparator)   \
+        CMUTIL_HeapCreateEx(comparator, NULL, NULL)
+
+/**
+ * @brief Creates a heap.
+ *
+ * @param comparator Callback comparing two items, the least comes first.
+ * @param indexcb Callback receiving item positions, or NULL.
+ * @param freecb Callback freeing items left in the heap, or NULL.
+ * @return A new heap, NULL if <code>comparator</code> is NULL or
+ *         allocation failed.
+ */
+CMUTIL_API CMUTIL_Heap *CMUTIL_HeapCreateEx(
+        CMCompareCB comparator, CMHeapIndexCB indexcb, CMFreeCB freecb);
+
+/**
+ * @}
+ */
+
+/**
+ * @defgroup CMUTILS_Strings Strings, string arrays, byte buffers and charset conversion.
+ * @{
+ */
+
+/**
+ * @brief Multifunctional string type.
+ */
+typedef struct CMUTIL_String CMUTIL_String;
+struct CMUTIL_String {
+    /**
+     * @brief Add a c-style string to this string object.
+     *
+     * Append the given string to the end of this string object.
+     *
+     * Appending an empty string is not an error, it just does nothing.
+     *
+     * @param string This string object.
+     * @param tobeadded C-style null terminated string to be appended.
+     * @return New size of this string object, which is the unchanged current
+     *         size when @a tobeadded is an empty string.
+     *         -1 if @a tobeadded is NULL.
+     */
+    ssize_t (*AddString)(
+            CMUTIL_String *string, const char *tobeadded);
+
+    /**
+     * @brief Add n bytes string to this string object.
+     *
+     * Append the given string to the end of this string object.
+     * Given string is not needed to be null terminated.
+     *
+     * Appending zero bytes is not an error, it just does nothing.
+     *
+     * @param string This string object.
+     * @param tobeadded C style string to be appended.
+     * @param size Number of bytes to be appended from the given string.
+     * @return New size of this string object, which is the unchanged current
+     *         size when @a size is zero.
+     *         -1 if @a tobeadded is NULL.
+     */
+    ssize_t (*AddNString)(
+            CMUTIL_String *string, const char *tobeadded, size_t size);
+
+    /**
+     * @brief Add a character to this string object.
+     *
+     * Append the given character to the end of this string object.
+     *
+     * @param string This string object.
+     * @param tobeadded Character to be appended.
+     * @return New size of this string object.
+     */
+    ssize_t (*AddChar)(
+            CMUTIL_String *string, char tobeadded);
+
+    /**
+     * @brief Add a formatted string to this string object.
+     *
+     * Append a ormatted string to the end of this string object.
+     *
+     * @param string This string object.
+     * @param fmt Format string like a printf function.
+     * @param ... Arguments for format string.
+     * @return New size of this string object.
+     */
+    ssize_t (*AddPrint)(
+            CMUTIL_String *string, const char *fmt, ...);
+
+    /**
+     * @brief Add a formatted string to this string object.
+     *
+     * Append a formatted string to the end of this string object.
+     *
+     * @param string This string object.
+     * @param fmt Format string like a vprintf function.
+     * @param args Arguments list for format string.
+     * @return New size of this string object.
+     */
+    ssize_t (*AddVPrint)(
+            CMUTIL_String *string, const char *fmt, va_list args);
+
+    /**
+     * @brief Add another string object to this string object.
+     *
+     * Append the given string object to the end of this string object.
+     *
+     * Appending an empty string object is not an error,
+     * it just does nothing.
+     *
+     * @param string This string object.
+     * @param tobeadded Another string object to be appended.
+     * @return New size of this string object, which is the unchanged current
+     *         size when @a tobeadded is an empty string object.
+     *         -1 if @a tobeadded is NULL.
+     */
+    ssize_t (*AddAnother)(
+            CMUTIL_String *string, const CMUTIL_String *tobeadded);
+
+    /**
+     * @brief Insert a c-style string to this string object.
      *
      * Insert the given string to this string object at the index.
      *
@@ -1944,6 +2694,22 @@ struct CMUTIL_StringArray {
     void (*PrintTo)(
             const CMUTIL_StringArray *array,
             CMUTIL_String *out);
+
+    /**
+     * @brief Call a function for all strings in this array in order,
+     *        without allocating an iterator.
+     *
+     * The callback must not add or remove strings of this array.
+     *
+     * @param array This string array object.
+     * @param callback Function receiving each <code>CMUTIL_String</code>
+     *                 and <code>udata</code>, returning CMFalse stops the
+     *                 iteration.
+     * @param udata User data passed to the callback.
+     * @return CMTrue if all strings were visited, CMFalse if stopped.
+     */
+    CMBool (*Each)(
+            const CMUTIL_StringArray *array, CMEachCB callback, void *udata);
 };
 
 /**
@@ -2297,68 +3063,238 @@ CMUTIL_API CMUTIL_ByteBuffer *CMUTIL_ByteBufferCreateEx(
         size_t initcapacity);
 
 /**
- * @}
+ * @brief Byte ring for one producer thread and one consumer thread.
+ *
+ * The producer reserves contiguous space, writes a record in place and
+ * commits it; the consumer peeks at committed bytes in place and consumes
+ * them. Neither side takes a lock or copies bytes. A reservation that
+ * does not fit before the end of the ring skips the rest of the lap, so
+ * the bytes of one commit are always contiguous for the consumer.
+ * Bytes given to Write that do not fit are kept in a byte buffer of the
+ * producer and go into the ring ahead of any later bytes.
+ *
+ * Reserve, Commit, Write, Flush and GetSpilled may be called from the
+ * producer thread only, Peek, Consume and ReadTo from the consumer
+ * thread only.
  */
+typedef struct CMUTIL_ByteRing CMUTIL_ByteRing;
+struct CMUTIL_ByteRing {
 
+    /**
+     * @brief Reserve contiguous space for a record without blocking.
+     *
+     * Spilled bytes are flushed first, the reservation fails while any
+     * of them are left. A later Reserve replaces a pending reservation.
+     *
+     * @param ring This ring object.
+     * @param size The number of bytes, up to the capacity of this ring.
+     * @return A pointer to <code>size</code> writable bytes, or NULL if
+     *         there is not enough room.
+     */
+    void *(*Reserve)(
+            CMUTIL_ByteRing *ring, size_t size);
 
-/**
- * @addtogroup CMUTILS_Collections
- * @{
- */
+    /**
+     * @brief Publish leading bytes of the last reservation to the consumer.
+     *
+     * @param ring This ring object.
+     * @param size The number of bytes written, up to the reserved size.
+     *             0 drops the reservation.
+     * @return CMTrue if committed, CMFalse if the size exceeds the
+     *         reservation.
+     */
+    CMBool (*Commit)(
+            CMUTIL_ByteRing *ring, size_t size);
 
-/**
- * @brief Key-value pair for CMUTIL_Map.
- */
-typedef struct CMUTIL_MapPair CMUTIL_MapPair;
-struct CMUTIL_MapPair {
     /**
-     * @brief Retrieves the key from a given CMUTIL_MapPair instance.
+     * @brief Copy bytes into this ring, spilling what does not fit.
      *
-     * This function pointer is used to obtain the key associated with a
-     * CMUTIL_MapPair object. The key is represented as a constant character
-     * string and provides a means to identify the pair in the map structure.
+     * @param ring This ring object.
+     * @param bytes The bytes to be written.
+     * @param size The number of bytes.
+     * @return CMTrue on success, CMFalse if the spill buffer could not grow.
+     */
+    CMBool (*Write)(
+            CMUTIL_ByteRing *ring, const void *bytes, size_t size);
+
+    /**
+     * @brief Move spilled bytes into this ring as far as they fit.
      *
-     * @param pair A pointer to the CMUTIL_MapPair instance from which the key
-     *             will be retrieved.
-     * @return A constant character pointer representing the key associated
-     *         with the given CMUTIL_MapPair.
+     * @param ring This ring object.
+     * @return CMTrue if no spilled bytes are left.
      */
-    const char *(*GetKey)(const CMUTIL_MapPair *pair);
+    CMBool (*Flush)(
+            CMUTIL_ByteRing *ring);
 
     /**
-     * @brief Retrieves the value from a given CMUTIL_MapPair instance.
+     * @brief Get the number of spilled bytes not in this ring yet.
      *
-     * This function pointer is used to get the value associated with a
-     * CMUTIL_MapPair object. The value is represented as a void pointer and
-     * provides the data associated with the pair in the map structure.
+     * @param ring This ring object.
+     * @return The number of spilled bytes.
+     */
+    size_t (*GetSpilled)(
+            const CMUTIL_ByteRing *ring);
+
+    /**
+     * @brief Get the committed bytes which are contiguous in this ring.
      *
-     * @param pair A pointer to the CMUTIL_MapPair instance from which the value
-     *             will be retrieved.
-     * @return A void pointer representing the value associated
-     *         with the given CMUTIL_MapPair.
+     * The bytes stay valid until they are consumed. Another Peek after
+     * consuming them returns the bytes after a wrap.
+     *
+     * @param ring This ring object.
+     * @param size A pointer to receive the number of readable bytes.
+     * @return A pointer to the readable bytes, or NULL if this ring is
+     *         empty.
      */
-    void *(*GetValue)(const CMUTIL_MapPair *pair);
-};
+    const void *(*Peek)(
+            CMUTIL_ByteRing *ring, size_t *size);
 
+    /**
+     * @brief Release leading bytes returned by the last Peek.
+     *
+     * @param ring This ring object.
+     * @param size The number of bytes to be released.
+     * @return CMTrue if released, CMFalse if the size exceeds the
+     *         peeked bytes.
+     */
+    CMBool (*Consume)(
+            CMUTIL_ByteRing *ring, size_t size);
 
-/**
- * @brief Hashmap type with item order preserved.
- */
-typedef struct CMUTIL_Map CMUTIL_Map;
-struct CMUTIL_Map {
     /**
-     * @brief Inserts a key-value pair into the map.
+     * @brief Move committed bytes into a byte buffer.
      *
-     * This function adds a new entry into the map with the specified key and value.
-     * If the key already exists in the map, the associated value is updated to the
-     * new value provided. The function returns a pointer to the previous value
-     * associated with the key if it existed, or NULL if the key was not found in
+     * @param ring This ring object.
+     * @param buffer The byte buffer the bytes are appended to.
+     * @param size The maximum number of bytes.
+     * @return The number of bytes moved.
+     */
+    size_t (*ReadTo)(
+            CMUTIL_ByteRing *ring, CMUTIL_ByteBuffer *buffer, size_t size);
+
+    /**
+     * @brief Get the number of committed bytes not consumed yet.
+     *
+     * @param ring This ring object.
+     * @return The number of bytes including skipped lap ends, which may
+     *         be stale when the other side is running.
+     */
+    size_t (*GetSize)(
+            const CMUTIL_ByteRing *ring);
+
+    /**
+     * @brief Get the number of bytes this ring can hold.
+     *
+     * @param ring This ring object.
+     * @return The capacity of this ring.
+     */
+    size_t (*GetCapacity)(
+            const CMUTIL_ByteRing *ring);
+
+    /**
+     * @brief Destroy this ring. Neither side may use it any more.
+     *
+     * @param ring This ring object.
+     */
+    void (*Destroy)(
+            CMUTIL_ByteRing *ring);
+};
+
+/**
+ * @brief Create a byte ring for one producer and one consumer.
+ *
+ * @param capacity The number of bytes, rounded up to a power of 2 and
+ *                 at least 64.
+ * @return A new ring object, or NULL on failure.
+ */
+CMUTIL_API CMUTIL_ByteRing *CMUTIL_ByteRingCreate(size_t capacity);
+
+/**
+ * @}
+ */
+
+
+/**
+ * @addtogroup CMUTILS_Collections
+ * @{
+ */
+
+/**
+ * @brief Key-value pair for CMUTIL_Map.
+ */
+typedef struct CMUTIL_MapPair CMUTIL_MapPair;
+struct CMUTIL_MapPair {
+    /**
+     * @brief Retrieves the key from a given CMUTIL_MapPair instance.
+     *
+     * This function pointer is used to obtain the key associated with a
+     * CMUTIL_MapPair object. The key is represented as a constant character
+     * string and provides a means to identify the pair in the map structure.
+     *
+     * @param pair A pointer to the CMUTIL_MapPair instance from which the key
+     *             will be retrieved.
+     * @return A constant character pointer representing the key associated
+     *         with the given CMUTIL_MapPair.
+     */
+    const char *(*GetKey)(const CMUTIL_MapPair *pair);
+
+    /**
+     * @brief Retrieves the value from a given CMUTIL_MapPair instance.
+     *
+     * This function pointer is used to get the value associated with a
+     * CMUTIL_MapPair object. The value is represented as a void pointer and
+     * provides the data associated with the pair in the map structure.
+     *
+     * @param pair A pointer to the CMUTIL_MapPair instance from which the value
+     *             will be retrieved.
+     * @return A void pointer representing the value associated
+     *         with the given CMUTIL_MapPair.
+     */
+    void *(*GetValue)(const CMUTIL_MapPair *pair);
+
+    /**
+     * @brief Retrieves the length of the key in bytes.
+     *
+     * Keys of CMUTIL_BinaryMap may contain NUL bytes, so the key returned
+     * by GetKey must be read with this length. The key is followed by a
+     * NUL byte in any case.
+     *
+     * @param pair A pointer to the CMUTIL_MapPair instance.
+     * @return Length of the key in bytes, not including the terminating NUL.
+     */
+    size_t (*GetKeyLength)(const CMUTIL_MapPair *pair);
+};
+
+
+/**
+ * @brief Hashmap type with item order preserved.
+ *
+ * Items are kept in an open addressing table whose slots are probed in
+ * groups of 16 with SIMD instructions where available.
+ * Keys are hashed with a seeded 64 bit hash, case insensitive maps fold
+ * ASCII letters on the fly, so Get and Remove do not allocate.
+ * Insertion order is kept by a list linked through the items and by the
+ * pairs array, which every write keeps current. Read-only methods never
+ * modify the map, so a map may be read from many threads while nothing
+ * writes to it.
+ */
+typedef struct CMUTIL_Map CMUTIL_Map;
+struct CMUTIL_Map {
+    /**
+     * @brief Inserts a key-value pair into the map.
+     *
+     * This function adds a new entry into the map with the specified key and value.
+     * If the key already exists in the map, the associated value is updated to the
+     * new value provided. The function returns a pointer to the previous value
+     * associated with the key if it existed, or NULL if the key was not found in
      * the map before the operation.
      * The order of the items in the map is preserved. If the key already exists,
      * the previous order is discarded and the new key-value pair is inserted at
      * the end of the map.
      * If the load factor ratio of buckets is occupied, the map is rebuilt with
      * 2 times of the current size to reduce the collision rate.
+     * Items of large maps are moved to the new table a few at a time by
+     * the following Put and Remove calls, so no single call rehashes the
+     * whole map.
      *
      * @param map A pointer to the map where the key-value pair should be inserted.
      * @param key The key associated with the value to insert or update in the map.
@@ -2369,215 +3305,1068 @@ struct CMUTIL_Map {
      * @return CMTrue if the operation was successful, CMFalse otherwise.
      */
     CMBool (*Put)(
-            CMUTIL_Map *map, const char* key, void* value, void** prev);
+            CMUTIL_Map *map, const char* key, void* value, void** prev);
+
+    /**
+     * @brief Copies all key-value pairs from one map to another.
+     *
+     * This function transfers all key-value pairs from the source map to the
+     * target map. If keys in the source map already exist in the target map,
+     * their values will be replaced with the values from the source map.
+     * The operation does not clear existing entries in the target map that
+     * do not have corresponding keys in the source map.
+     *
+     * @param map A pointer to the target map where the key-value pairs will be copied.
+     * @param src A pointer to the source map containing the key-value pairs to copy.
+     */
+    void (*PutAll)(
+            CMUTIL_Map *map, const CMUTIL_Map *src);
+
+    /**
+     * @brief Retrieves the value associated with a given key in the map.
+     *
+     * This function searches the map for the specified key and returns the
+     * value associated with it. If the key is not found, the function
+     * returns a null pointer.
+     *
+     * @param map A pointer to the map object to search.
+     * @param key The key whose associated value is to be retrieved.
+     * @return A pointer to the value associated with the given key, or NULL
+     *         if the key is not found.
+     */
+    void *(*Get)(
+            const CMUTIL_Map *map, const char* key);
+
+    /**
+     * @brief Removes the key-value pair associated with the given key from the map.
+     *
+     * This function searches the map for the specified key and removes the
+     * corresponding key-value pair if found. If the key is not found, the
+     * function does nothing and returns NULL.
+     *
+     * @param map A pointer to the map object from which to remove the key-value pair.
+     * @param key The key to be removed from the map.
+     * @return A pointer to the value associated with the removed key, or NULL
+     *         if the key was not found.
+     */
+    void *(*Remove)(
+            CMUTIL_Map *map, const char* key);
+
+    /**
+     * @brief Get the keys of the map.
+     *
+     * This function returns a string array containing all the keys present
+     * in the map.
+     * The caller is responsible for freeing the returned string array using
+     * the Destroy method.
+     *
+     * @param map A pointer to the map object from which to retrieve the keys.
+     * @return A pointer to a string array containing the keys
+     *         or nullptr if the map is empty.
+     */
+    CMUTIL_StringArray *(*GetKeys)(
+            const CMUTIL_Map *map);
+
+    /**
+     * @brief Function pointer that retrieves all key-value pairs from a map.
+     *
+     * This function pointer takes a constant CMUTIL_Map pointer and returns a
+     * CMUTIL_Array pointer containing all the key-value pairs
+     * with CMUTIL_MapPair form in the map. The CMUTIL library defines
+     * the structure and behavior of the map and the array.
+     *
+     * The array is a read only view of the map in insertion order, it
+     * follows later modifications. GetAt on it is constant time unless
+     * entries were removed from the middle of the order lately, then it
+     * skips the removed positions. Iterator and Each are always linear.
+     *
+     * @param map A constant pointer to the map from which key-value pairs are to be retrieved.
+     * @return A pointer to a CMUTIL_Array containing the map's key-value pairs.
+     *         Do not destroy the returned array as it is managed by the map.
+     */
+    const CMUTIL_Array *(*GetPairs)(
+            const CMUTIL_Map *map);
+
+    /**
+     * @brief Get the size of the map.
+     *
+     * This function returns the number of key-value pairs currently stored
+     * in the map.
+     *
+     * @param map A pointer to the map object from which to retrieve the size.
+     * @return The number of key-value pairs in the map.
+     */
+    size_t (*GetSize)(
+            const CMUTIL_Map *map);
+
+    /**
+     * @brief Get iterator for the map.
+     *
+     * This function returns an iterator object that can be used to traverse
+     * the values in the map. The caller is responsible for freeing
+     * the returned iterator using the Destroy method.
+     *
+     * @param map A pointer to the map object from which to retrieve the iterator.
+     * @return A pointer to the iterator object, or NULL if the map is empty.
+     */
+    CMUTIL_Iterator *(*Iterator)(
+            const CMUTIL_Map *map);
+
+    /**
+     * @brief Clear the map.
+     *
+     * This function removes all key-value pairs from the map, effectively
+     * resetting it to an empty state. The function does not free the memory
+     * associated with the map itself, only the key-value pairs.
+     * If this map is created with freecb, it will be called freecb for each value.
+     * Otherwise, it will not free the values.
+     *
+     * @param map A pointer to the map object to be cleared.
+     */
+    void (*Clear)(
+            CMUTIL_Map *map);
+
+    /**
+     * @brief Clear the map and free all key-value pairs.
+     *
+     * This function removes all key-value pairs from the map, effectively
+     * resetting it to an empty state. The function will free the memory
+     * associated with the map itself and all key-value pairs.
+     * Whether this map is created with or without freecb,
+     * it will not free the values.
+     *
+     * @param map A pointer to the map object to be cleared.
+     */
+    void (*ClearLink)(
+            CMUTIL_Map *map);
+
+    /**
+     * @brief Destroy the map object.
+     *
+     * This function frees the memory associated with the map object and
+     * all key-value pairs. If the map was created with a freecb function,
+     * it will be called for each value to free any additional memory.
+     *
+     * @param map A pointer to the map object to be destroyed.
+     */
+    void (*Destroy)(
+            CMUTIL_Map *map);
+
+    /**
+     * @brief Print the map to a string.
+     *
+     * This function appends a string representation of the map to the
+     * provided CMUTIL_String object. The format of the string is
+     * implementation-dependent.
+     *
+     * @param map A pointer to the map object to be printed.
+     * @param out A pointer to the CMUTIL_String object to append the output.
+     * @param to_strcb A callback function to convert value to string,
+     *                or NULL to use as string itself.
+     */
+    void (*PrintTo)(
+            const CMUTIL_Map *map, CMUTIL_String *out, const char*(*to_strcb)(void*));
+
+    /**
+     * @brief Get the value at a specific index in the map.
+     *
+     * This function retrieves the value at the specified index in the map.
+     * The index is zero-based, with 0 being the first element.
+     *
+     * @param map A pointer to the map object from which to retrieve the value.
+     * @param index The index of the value to retrieve.
+     * @return A pointer to the value at the specified index,
+     *         or NULL if the index is out of bounds.
+     */
+    void *(*GetAt)(
+            const CMUTIL_Map *map, uint32_t index);
+
+    /**
+     * @brief Remove the value at a specific index in the map.
+     *
+     * This function removes the value at the specified index in the map.
+     * The index is zero-based, with 0 being the first element.
+     *
+     * @param map A pointer to the map object from which to remove the value.
+     * @param index The index of the value to remove.
+     * @return A pointer to the removed value,
+     *         or NULL if the index is out of bounds.
+     */
+    void *(*RemoveAt)(
+            CMUTIL_Map *map, uint32_t index);
+
+    /**
+     * @brief Reserve room for a number of items in the map.
+     *
+     * This function grows the table at once, so that the map holds
+     * <code>count</code> items in total without being rebuilt.
+     * Bulk loaders may call this before inserting many items.
+     * The map never shrinks by this call.
+     *
+     * @param map A pointer to the map object.
+     * @param count The number of items the map must hold without rebuild.
+     * @return CMTrue if the room was reserved, CMFalse on allocation failure.
+     */
+    CMBool (*Reserve)(
+            CMUTIL_Map *map, size_t count);
+
+    /**
+     * @brief Call a function for all entries in insertion order, without
+     *        allocating an iterator.
+     *
+     * The callback may remove the entry it receives, but no other one.
+     *
+     * @param map A pointer to the map object.
+     * @param callback Function receiving each key, its value and
+     *                 <code>udata</code>, returning CMFalse stops the
+     *                 iteration.
+     * @param udata User data passed to the callback.
+     * @return CMTrue if all entries were visited, CMFalse if stopped.
+     */
+    CMBool (*Each)(
+            const CMUTIL_Map *map, CMMapEachCB callback, void *udata);
+};
+
+/**
+ * The default initial bucket size for the map.
+ */
+#define CMUTIL_MAP_DEFAULT  256
+
+/**
+ * Create a new map with default settings.
+ */
+#define CMUTIL_MapCreate()  CMUTIL_MapCreateEx(\
+        CMUTIL_MAP_DEFAULT, CMFalse, NULL, 0.75f)
+
+/**
+ * @brief Create a new map with custom settings.
+ * @param bucketsize The initial number of buckets(slots) for the map,
+ *                   rounded up to a power of 2.
+ * @param isucase Whether the key of the map should be case-insensitive.
+ * @param freecb A callback function to free values when the map is destroyed.
+ * @param load_factor The load factor for the map,
+ *                    0.75 may appropriate for most use cases. Values out of
+ *                    range (0.25, 0.875] are replaced by 0.875.
+ * @return A pointer to the newly created map, or NULL on failure.
+ */
+CMUTIL_API CMUTIL_Map *CMUTIL_MapCreateEx(
+        uint32_t bucketsize, CMBool isucase, CMFreeCB freecb,
+        float load_factor);
+
+/**
+ * @brief Create a new map whose keys are interned.
+ *
+ * Instead of a copy per map, a key is kept once in a process wide table
+ * of immutable atoms and shared by every interning map holding it. This
+ * suits many maps with recurring keys, like objects of a parsed document.
+ * Keys returned by the map point to the atom. Each insert or removal of a
+ * key takes the lock of its atom shard.
+ * Maps created on an allocator other than the global one, such as an
+ * arena, keep their keys inline instead, so resetting the arena releases
+ * them.
+ *
+ * @param bucketsize The initial number of buckets(slots) for the map,
+ *                   rounded up to a power of 2.
+ * @param isucase Whether the key of the map should be case-insensitive.
+ * @param freecb A callback function to free values when the map is destroyed.
+ * @param load_factor The load factor for the map, as in
+ *                    <code>CMUTIL_MapCreateEx</code>.
+ * @return A pointer to the newly created map, or NULL on failure.
+ */
+CMUTIL_API CMUTIL_Map *CMUTIL_MapCreateInterned(
+        uint32_t bucketsize, CMBool isucase, CMFreeCB freecb,
+        float load_factor);
+
+
+/**
+ * @brief Hashmap type with binary keys and item order preserved.
+ *
+ * Same as CMUTIL_Map, but keys are given as a pointer and a length, so
+ * they may hold any bytes including NUL. Keys are copied.
+ */
+typedef struct CMUTIL_BinaryMap CMUTIL_BinaryMap;
+struct CMUTIL_BinaryMap {
+    /**
+     * @brief Inserts a key-value pair into the map.
+     *
+     * If the key already exists, the previous value is replaced and the
+     * item moves to the end of the map.
+     *
+     * @param map A pointer to the map.
+     * @param key The key bytes.
+     * @param keylen Length of the key in bytes.
+     * @param value A pointer to the value to associate with the key.
+     * @param prev A pointer to receive the previous value, or NULL.
+     * @return CMTrue if the operation was successful, CMFalse otherwise.
+     */
+    CMBool (*Put)(
+            CMUTIL_BinaryMap *map, const void *key, size_t keylen,
+            void *value, void **prev);
+
+    /**
+     * @brief Retrieves the value associated with a given key in the map.
+     *
+     * @param map A pointer to the map.
+     * @param key The key bytes.
+     * @param keylen Length of the key in bytes.
+     * @return The value associated with the key, or NULL if not found.
+     */
+    void *(*Get)(
+            const CMUTIL_BinaryMap *map, const void *key, size_t keylen);
+
+    /**
+     * @brief Removes the item of the given key from the map.
+     *
+     * @param map A pointer to the map.
+     * @param key The key bytes.
+     * @param keylen Length of the key in bytes.
+     * @return The value of the removed item, or NULL if not found.
+     */
+    void *(*Remove)(
+            CMUTIL_BinaryMap *map, const void *key, size_t keylen);
+
+    /**
+     * @brief Get the number of items in the map.
+     *
+     * @param map A pointer to the map.
+     * @return The number of items in the map.
+     */
+    size_t (*GetSize)(
+            const CMUTIL_BinaryMap *map);
+
+    /**
+     * @brief Get all items of the map in insertion order.
+     *
+     * Use GetKeyLength of each CMUTIL_MapPair to read the keys.
+     * The array is a read only view managed by the map, it follows later
+     * modifications of the map.
+     *
+     * @param map A pointer to the map.
+     * @return An array of CMUTIL_MapPair.
+     */
+    const CMUTIL_Array *(*GetPairs)(
+            const CMUTIL_BinaryMap *map);
+
+    /**
+     * @brief Get iterator of the values in insertion order.
+     *
+     * The caller is responsible for freeing the returned iterator using
+     * the Destroy method.
+     *
+     * @param map A pointer to the map.
+     * @return An iterator of the values.
+     */
+    CMUTIL_Iterator *(*Iterator)(
+            const CMUTIL_BinaryMap *map);
+
+    /**
+     * @brief Remove all items, freeing values with the free callback
+     *        if given.
+     *
+     * @param map A pointer to the map.
+     */
+    void (*Clear)(
+            CMUTIL_BinaryMap *map);
+
+    /**
+     * @brief Remove all items without freeing values.
+     *
+     * @param map A pointer to the map.
+     */
+    void (*ClearLink)(
+            CMUTIL_BinaryMap *map);
+
+    /**
+     * @brief Reserve room for a number of items in the map.
+     *
+     * @param map A pointer to the map.
+     * @param count The number of items the map must hold without rebuild.
+     * @return CMTrue if the room was reserved, CMFalse on allocation failure.
+     */
+    CMBool (*Reserve)(
+            CMUTIL_BinaryMap *map, size_t count);
+
+    /**
+     * @brief Destroy the map, freeing values with the free callback
+     *        if given.
+     *
+     * @param map A pointer to the map.
+     */
+    void (*Destroy)(
+            CMUTIL_BinaryMap *map);
+};
+
+/**
+ * Create a new binary keyed map with default settings.
+ */
+#define CMUTIL_BinaryMapCreate()  CMUTIL_BinaryMapCreateEx(\
+        CMUTIL_MAP_DEFAULT, NULL, 0.75f)
+
+/**
+ * @brief Create a new binary keyed map with custom settings.
+ * @param bucketsize The initial number of slots, rounded up to a power of 2.
+ * @param freecb A callback function to free values when the map is destroyed.
+ * @param load_factor The load factor of the map, values out of
+ *                    range (0.25, 0.875] are replaced by 0.875.
+ * @return A pointer to the newly created map, or NULL on failure.
+ */
+CMUTIL_API CMUTIL_BinaryMap *CMUTIL_BinaryMapCreateEx(
+        uint32_t bucketsize, CMFreeCB freecb, float load_factor);
+
+
+/**
+ * @brief Hashmap type with 64 bit integer keys.
+ *
+ * Keys and values are stored in the table slots, so entries take no
+ * allocation of their own. The order of entries is not preserved.
+ */
+typedef struct CMUTIL_IntMap CMUTIL_IntMap;
+struct CMUTIL_IntMap {
+    /**
+     * @brief Inserts or replaces the value of a key.
+     *
+     * @param map A pointer to the map.
+     * @param key The key.
+     * @param value The value to associate with the key.
+     * @param prev A pointer to receive the previous value, or NULL.
+     * @return CMTrue if the operation was successful, CMFalse otherwise.
+     */
+    CMBool (*Put)(
+            CMUTIL_IntMap *map, uint64_t key, void *value, void **prev);
+
+    /**
+     * @brief Retrieves the value associated with a given key in the map.
+     *
+     * @param map A pointer to the map.
+     * @param key The key.
+     * @return The value associated with the key, or NULL if not found.
+     */
+    void *(*Get)(
+            const CMUTIL_IntMap *map, uint64_t key);
+
+    /**
+     * @brief Checks whether the map has the key.
+     *
+     * Use this to tell absent keys from keys mapped to NULL.
+     *
+     * @param map A pointer to the map.
+     * @param key The key.
+     * @return CMTrue if the key is in the map, CMFalse otherwise.
+     */
+    CMBool (*ContainsKey)(
+            const CMUTIL_IntMap *map, uint64_t key);
+
+    /**
+     * @brief Removes the key from the map.
+     *
+     * @param map A pointer to the map.
+     * @param key The key.
+     * @return The value of the removed key, or NULL if not found.
+     */
+    void *(*Remove)(
+            CMUTIL_IntMap *map, uint64_t key);
+
+    /**
+     * @brief Get the number of entries in the map.
+     *
+     * @param map A pointer to the map.
+     * @return The number of entries in the map.
+     */
+    size_t (*GetSize)(
+            const CMUTIL_IntMap *map);
+
+    /**
+     * @brief Walk the entries of the map without allocation.
+     *
+     * Set <code>*pos</code> to 0 before the first call. Each call stores
+     * the next entry to <code>key</code> and <code>value</code>, which may
+     * be NULL. The entry just returned may be removed while walking,
+     * putting new keys invalidates the position.
+     *
+     * @param map A pointer to the map.
+     * @param pos Position of the walk, updated by each call.
+     * @param key A pointer to receive the key, or NULL.
+     * @param value A pointer to receive the value, or NULL.
+     * @return CMTrue if an entry was returned, CMFalse at the end.
+     */
+    CMBool (*Next)(
+            const CMUTIL_IntMap *map, size_t *pos,
+            uint64_t *key, void **value);
+
+    /**
+     * @brief Remove all entries, freeing values with the free callback
+     *        if given.
+     *
+     * @param map A pointer to the map.
+     */
+    void (*Clear)(
+            CMUTIL_IntMap *map);
+
+    /**
+     * @brief Remove all entries without freeing values.
+     *
+     * @param map A pointer to the map.
+     */
+    void (*ClearLink)(
+            CMUTIL_IntMap *map);
+
+    /**
+     * @brief Reserve room for a number of entries in the map.
+     *
+     * @param map A pointer to the map.
+     * @param count The number of entries the map must hold without rebuild.
+     * @return CMTrue if the room was reserved, CMFalse on allocation failure.
+     */
+    CMBool (*Reserve)(
+            CMUTIL_IntMap *map, size_t count);
+
+    /**
+     * @brief Destroy the map, freeing values with the free callback
+     *        if given.
+     *
+     * @param map A pointer to the map.
+     */
+    void (*Destroy)(
+            CMUTIL_IntMap *map);
+};
+
+/**
+ * Create a new integer keyed map with default settings.
+ */
+#define CMUTIL_IntMapCreate()  CMUTIL_IntMapCreateEx(\
+        CMUTIL_MAP_DEFAULT, NULL, 0.75f)
+
+/**
+ * @brief Create a new integer keyed map with custom settings.
+ * @param bucketsize The initial number of slots, rounded up to a power of 2.
+ * @param freecb A callback function to free values when the map is destroyed.
+ * @param load_factor The load factor of the map, values out of
+ *                    range (0.25, 0.875] are replaced by 0.875.
+ * @return A pointer to the newly created map, or NULL on failure.
+ */
+CMUTIL_API CMUTIL_IntMap *CMUTIL_IntMapCreateEx(
+        uint32_t bucketsize, CMFreeCB freecb, float load_factor);
+
+/**
+ * @brief Thread safe hashmap type with lock-free readers.
+ *
+ * Entries are spread over shards by hash, each shard is guarded by its own
+ * mutex for writers. Readers take no lock and write no shared memory,
+ * unlinked entries and replaced values are reclaimed only after every
+ * reader which could see them has left, so lookups scale with the number
+ * of reading threads. NULL values are not supported.
+ *
+ * A value returned by <code>Get</code> may be freed by the free callback
+ * as soon as another thread replaces or removes it. Wrap the lookup and the
+ * use of the value with <code>Enter</code> and <code>Leave</code> to keep
+ * it alive.
+ */
+typedef struct CMUTIL_ConcurrentMap CMUTIL_ConcurrentMap;
+struct CMUTIL_ConcurrentMap {
+    /**
+     * @brief Inserts or replaces the value of a key.
+     *
+     * @param map A pointer to the map.
+     * @param key The key.
+     * @param value The value to associate with the key.
+     * @param prev A pointer to receive the previous value, or NULL to let
+     *             the free callback release it once no reader uses it.
+     * @return CMTrue if the operation was successful, CMFalse otherwise.
+     */
+    CMBool (*Put)(
+            CMUTIL_ConcurrentMap *map, const char *key,
+            void *value, void **prev);
+
+    /**
+     * @brief Inserts the value only if the key is not in the map.
+     *
+     * @param map A pointer to the map.
+     * @param key The key.
+     * @param value The value to associate with the key.
+     * @return NULL if the value was inserted, otherwise the value already
+     *         associated with the key.
+     */
+    void *(*PutIfAbsent)(
+            CMUTIL_ConcurrentMap *map, const char *key, void *value);
+
+    /**
+     * @brief Get the value of a key, creating it if the key is not in
+     *        the map.
+     *
+     * The mapper is called at most once per absent key, with the shard
+     * of the key locked, so it must not access this map.
+     *
+     * @param map A pointer to the map.
+     * @param key The key.
+     * @param mapper Callback creating the value, returning NULL inserts
+     *               nothing.
+     * @param udata User data passed to the mapper.
+     * @return The value associated with the key, or NULL if the mapper
+     *         returned NULL.
+     */
+    void *(*ComputeIfAbsent)(
+            CMUTIL_ConcurrentMap *map, const char *key,
+            void *(*mapper)(const char *key, void *udata), void *udata);
+
+    /**
+     * @brief Retrieves the value associated with a given key without
+     *        locking.
+     *
+     * @param map A pointer to the map.
+     * @param key The key.
+     * @return The value associated with the key, or NULL if not found.
+     */
+    void *(*Get)(
+            const CMUTIL_ConcurrentMap *map, const char *key);
+
+    /**
+     * @brief Replaces the value of a key if it is still the expected one.
+     *
+     * The previous value is released by the free callback once no reader
+     * uses it.
+     *
+     * @param map A pointer to the map.
+     * @param key The key.
+     * @param expected The value the key must be associated with.
+     * @param value The new value.
+     * @return CMTrue if the value was replaced, CMFalse otherwise.
+     */
+    CMBool (*Replace)(
+            CMUTIL_ConcurrentMap *map, const char *key,
+            void *expected, void *value);
+
+    /**
+     * @brief Removes the key if it is associated with the expected value.
+     *
+     * @param map A pointer to the map.
+     * @param key The key.
+     * @param expected The value the key must be associated with,
+     *                 or NULL to remove the key regardless of its value.
+     * @param prev A pointer to receive the removed value, or NULL to let
+     *             the free callback release it once no reader uses it.
+     * @return CMTrue if the key was removed, CMFalse otherwise.
+     */
+    CMBool (*Remove)(
+            CMUTIL_ConcurrentMap *map, const char *key,
+            void *expected, void **prev);
+
+    /**
+     * @brief Get the number of entries in the map.
+     *
+     * @param map A pointer to the map.
+     * @return The number of entries, which may be stale when other
+     *         threads are modifying the map.
+     */
+    size_t (*GetSize)(
+            const CMUTIL_ConcurrentMap *map);
+
+    /**
+     * @brief Enter a read side critical section of the calling thread.
+     *
+     * Values returned by <code>Get</code> are not freed until the
+     * matching <code>Leave</code>. Sections may nest and should be short,
+     * nothing retired meanwhile can be reclaimed.
+     *
+     * @param map A pointer to the map.
+     */
+    void (*Enter)(
+            const CMUTIL_ConcurrentMap *map);
+
+    /**
+     * @brief Leave a read side critical section of the calling thread.
+     *
+     * @param map A pointer to the map.
+     */
+    void (*Leave)(
+            const CMUTIL_ConcurrentMap *map);
+
+    /**
+     * @brief Destroy the map, freeing values with the free callback
+     *        if given. No other thread may use the map any more.
+     *
+     * @param map A pointer to the map.
+     */
+    void (*Destroy)(
+            CMUTIL_ConcurrentMap *map);
+};
+
+/**
+ * Create a new concurrent map with default settings.
+ */
+#define CMUTIL_ConcurrentMapCreate()  CMUTIL_ConcurrentMapCreateEx(\
+        CMUTIL_MAP_DEFAULT, 0, NULL)
+
+/**
+ * @brief Create a new concurrent map with custom settings.
+ * @param bucketsize The initial number of buckets of all shards.
+ * @param shards The number of shards, rounded up to a power of 2,
+ *               0 for the default of 16.
+ * @param freecb A callback function to free values which are replaced,
+ *               removed or left when the map is destroyed.
+ * @return A pointer to the newly created map, or NULL on failure.
+ */
+CMUTIL_API CMUTIL_ConcurrentMap *CMUTIL_ConcurrentMapCreateEx(
+        uint32_t bucketsize, uint32_t shards, CMFreeCB freecb);
+
+/**
+ * @brief Position of an entry in a sorted map.
+ *
+ * Set by <code>First</code>, <code>LowerBound</code> or
+ * <code>UpperBound</code> and advanced by <code>Next</code>. A cursor is
+ * invalidated by any modification of the map.
+ */
+typedef struct CMUTIL_SortedMapCursor {
+    /** Leaf node of the entry, internal. */
+    const void  *node;
+    /** Index of the entry in the leaf, internal. */
+    size_t      index;
+} CMUTIL_SortedMapCursor;
+
+/**
+ * @brief Ordered map type of arbitrary keys, a B+tree.
+ *
+ * Keys are ordered by the comparator given on creation. Entries are kept
+ * in wide nodes, so lookups, inserts and removes take O(log n) with few
+ * cache misses, and entries are visited in key order through cursors.
+ * This map is not thread safe.
+ */
+typedef struct CMUTIL_SortedMap CMUTIL_SortedMap;
+struct CMUTIL_SortedMap {
+    /**
+     * @brief Inserts or replaces the value of a key.
+     *
+     * If the key is already in the map, the stored key is kept and the
+     * given one is released by the key free callback.
+     *
+     * @param map A pointer to the map.
+     * @param key The key, owned by the map after this call.
+     * @param value The value to associate with the key.
+     * @param prev A pointer to receive the previous value, or NULL to
+     *             release it by the free callback.
+     * @return CMTrue if the operation was successful, CMFalse otherwise.
+     */
+    CMBool (*Put)(
+            CMUTIL_SortedMap *map, void *key, void *value, void **prev);
 
     /**
-     * @brief Copies all key-value pairs from one map to another.
-     *
-     * This function transfers all key-value pairs from the source map to the
-     * target map. If keys in the source map already exist in the target map,
-     * their values will be replaced with the values from the source map.
-     * The operation does not clear existing entries in the target map that
-     * do not have corresponding keys in the source map.
+     * @brief Retrieves the value associated with a given key.
      *
-     * @param map A pointer to the target map where the key-value pairs will be copied.
-     * @param src A pointer to the source map containing the key-value pairs to copy.
+     * @param map A pointer to the map.
+     * @param key The key.
+     * @return The value associated with the key, or NULL if not found.
      */
-    void (*PutAll)(
-            CMUTIL_Map *map, const CMUTIL_Map *src);
+    void *(*Get)(
+            const CMUTIL_SortedMap *map, const void *key);
 
     /**
-     * @brief Retrieves the value associated with a given key in the map.
+     * @brief Removes a key from the map.
      *
-     * This function searches the map for the specified key and returns the
-     * value associated with it. If the key is not found, the function
-     * returns a null pointer.
+     * The stored key is released by the key free callback.
      *
-     * @param map A pointer to the map object to search.
-     * @param key The key whose associated value is to be retrieved.
-     * @return A pointer to the value associated with the given key, or NULL
-     *         if the key is not found.
+     * @param map A pointer to the map.
+     * @param key The key.
+     * @return The removed value, or NULL if the key was not found.
      */
-    void *(*Get)(
-            const CMUTIL_Map *map, const char* key);
+    void *(*Remove)(
+            CMUTIL_SortedMap *map, const void *key);
 
     /**
-     * @brief Removes the key-value pair associated with the given key from the map.
-     *
-     * This function searches the map for the specified key and removes the
-     * corresponding key-value pair if found. If the key is not found, the
-     * function does nothing and returns NULL.
+     * @brief Get the number of entries in the map.
      *
-     * @param map A pointer to the map object from which to remove the key-value pair.
-     * @param key The key to be removed from the map.
-     * @return A pointer to the value associated with the removed key, or NULL
-     *         if the key was not found.
+     * @param map A pointer to the map.
+     * @return The number of entries.
      */
-    void *(*Remove)(
-            CMUTIL_Map *map, const char* key);
+    size_t (*GetSize)(
+            const CMUTIL_SortedMap *map);
 
     /**
-     * @brief Get the keys of the map.
+     * @brief Set a cursor to the entry of the smallest key.
      *
-     * This function returns a string array containing all the keys present
-     * in the map.
-     * The caller is responsible for freeing the returned string array using
-     * the Destroy method.
+     * @param map A pointer to the map.
+     * @param cursor The cursor to set.
+     * @return CMTrue if the map is not empty, CMFalse otherwise.
+     */
+    CMBool (*First)(
+            const CMUTIL_SortedMap *map, CMUTIL_SortedMapCursor *cursor);
+
+    /**
+     * @brief Set a cursor to the first entry whose key is not less than
+     *        the given key.
      *
-     * @param map A pointer to the map object from which to retrieve the keys.
-     * @return A pointer to a string array containing the keys
-     *         or nullptr if the map is empty.
+     * @param map A pointer to the map.
+     * @param key The key to search.
+     * @param cursor The cursor to set.
+     * @return CMTrue if such an entry exists, CMFalse otherwise.
      */
-    CMUTIL_StringArray *(*GetKeys)(
-            const CMUTIL_Map *map);
+    CMBool (*LowerBound)(
+            const CMUTIL_SortedMap *map, const void *key,
+            CMUTIL_SortedMapCursor *cursor);
 
     /**
-     * @brief Function pointer that retrieves all key-value pairs from a map.
+     * @brief Set a cursor to the first entry whose key is greater than
+     *        the given key.
      *
-     * This function pointer takes a constant CMUTIL_Map pointer and returns a
-     * CMUTIL_Array pointer containing all the key-value pairs
-     * with CMUTIL_MapPair form in the map. The CMUTIL library defines
-     * the structure and behavior of the map and the array.
+     * @param map A pointer to the map.
+     * @param key The key to search.
+     * @param cursor The cursor to set.
+     * @return CMTrue if such an entry exists, CMFalse otherwise.
+     */
+    CMBool (*UpperBound)(
+            const CMUTIL_SortedMap *map, const void *key,
+            CMUTIL_SortedMapCursor *cursor);
+
+    /**
+     * @brief Get the entry at a cursor and advance the cursor.
      *
-     * @param map A constant pointer to the map from which key-value pairs are to be retrieved.
-     * @return A pointer to a CMUTIL_Array containing the map's key-value pairs.
-     *         Do not destroy the returned array as it is managed by the map.
+     * @param map A pointer to the map.
+     * @param cursor The cursor.
+     * @param key A pointer to receive the key, may be NULL.
+     * @param value A pointer to receive the value, may be NULL.
+     * @return CMTrue if an entry was read, CMFalse at the end of the map.
      */
-    const CMUTIL_Array *(*GetPairs)(
-            const CMUTIL_Map *map);
+    CMBool (*Next)(
+            const CMUTIL_SortedMap *map, CMUTIL_SortedMapCursor *cursor,
+            void **key, void **value);
 
     /**
-     * @brief Get the size of the map.
+     * @brief Inserts entries given in strictly ascending key order.
      *
-     * This function returns the number of key-value pairs currently stored
-     * in the map.
+     * An empty map is built directly from the entries without any split,
+     * otherwise the entries are put one by one.
      *
-     * @param map A pointer to the map object from which to retrieve the size.
-     * @return The number of key-value pairs in the map.
+     * @param map A pointer to the map.
+     * @param keys The keys in ascending order, owned by the map on success.
+     * @param values The values in the order of keys, or NULL to use the
+     *               keys as values.
+     * @param count The number of entries.
+     * @return CMTrue if all entries were inserted, CMFalse if the keys are
+     *         not in order or on allocation failure.
      */
-    size_t (*GetSize)(
-            const CMUTIL_Map *map);
+    CMBool (*BulkLoad)(
+            CMUTIL_SortedMap *map, void *const *keys, void *const *values,
+            size_t count);
 
     /**
-     * @brief Get iterator for the map.
+     * @brief Remove all entries, freeing keys and values with the free
+     *        callbacks if given.
      *
-     * This function returns an iterator object that can be used to traverse
-     * the values in the map. The caller is responsible for freeing
-     * the returned iterator using the Destroy method.
+     * @param map A pointer to the map.
+     */
+    void (*Clear)(
+            CMUTIL_SortedMap *map);
+
+    /**
+     * @brief Destroy the map, freeing keys and values with the free
+     *        callbacks if given.
      *
-     * @param map A pointer to the map object from which to retrieve the iterator.
-     * @return A pointer to the iterator object, or NULL if the map is empty.
+     * @param map A pointer to the map.
      */
-    CMUTIL_Iterator *(*Iterator)(
-            const CMUTIL_Map *map);
+    void (*Destroy)(
+            CMUTIL_SortedMap *map);
+};
+
+/**
+ * Create a new sorted map which does not own its keys and values.
+ */
+#define CMUTIL_SortedMapCreate(comparator)  CMUTIL_SortedMapCreateEx(\
+        comparator, NULL, NULL)
+
+/**
+ * @brief Create a new sorted map.
+ * @param comparator A callback function ordering keys.
+ * @param keyfreecb A callback function to free keys which are removed or
+ *                  left when the map is destroyed.
+ * @param freecb A callback function to free values which are replaced,
+ *               removed by <code>Clear</code> or left when the map is
+ *               destroyed.
+ * @return A pointer to the newly created map, or NULL on failure.
+ */
+CMUTIL_API CMUTIL_SortedMap *CMUTIL_SortedMapCreateEx(
+        CMCompareCB comparator, CMFreeCB keyfreecb, CMFreeCB freecb);
 
+/**
+ * @brief Eviction policy of a cache.
+ */
+typedef enum CMCachePolicy {
+    /** Evict the least recently used entry. */
+    CMCacheLRU = 0,
     /**
-     * @brief Clear the map.
+     * Segmented LRU: entries read a second time are protected, victims
+     * are taken from entries read once first, so scanning many keys
+     * does not flush the working set.
+     */
+    CMCacheSegmented
+} CMCachePolicy;
+
+/**
+ * @brief The reason an entry left a cache.
+ */
+typedef enum CMCacheEvictReason {
+    /** Evicted to make room. */
+    CMCacheEvictCapacity = 0,
+    /** Its time to live has passed. */
+    CMCacheEvictExpired,
+    /** Another value was put with the same key. */
+    CMCacheEvictReplaced,
+    /** Removed by <code>Clear</code> or <code>Destroy</code>. */
+    CMCacheEvictCleared
+} CMCacheEvictReason;
+
+/**
+ * @brief Callback type receiving entries which leave a cache.
+ *
+ * Called with no lock of the cache held, the callback owns the value.
+ */
+typedef void (*CMCacheEvictCB)(
+        const char *key, void *value, CMCacheEvictReason reason, void *udata);
+
+/**
+ * @brief Counters of a cache.
+ */
+typedef struct CMUTIL_CacheStats {
+    /** Lookups which found a live entry. */
+    uint64_t    hits;
+    /** Lookups which found nothing or an expired entry. */
+    uint64_t    misses;
+    /** Entries evicted to make room. */
+    uint64_t    evictions;
+    /** Entries dropped because their time to live passed. */
+    uint64_t    expirations;
+    /** Entries in the cache. */
+    size_t      count;
+    /** Sum of the weights of the entries in the cache. */
+    size_t      weight;
+} CMUTIL_CacheStats;
+
+/**
+ * @brief Thread safe cache of string keyed values bounded by weight.
+ *
+ * Keys are spread over shards by hash, each with its own lock and its own
+ * share of the capacity, so threads using different keys rarely contend.
+ * Entries may expire after a time to live, and are evicted by the policy
+ * given at creation when a shard is full.
+ */
+typedef struct CMUTIL_Cache CMUTIL_Cache;
+struct CMUTIL_Cache {
+    /**
+     * @brief Inserts or replaces the value of a key.
      *
-     * This function removes all key-value pairs from the map, effectively
-     * resetting it to an empty state. The function does not free the memory
-     * associated with the map itself, only the key-value pairs.
-     * If this map is created with freecb, it will be called freecb for each value.
-     * Otherwise, it will not free the values.
+     * Entries of the shard are evicted until the new entry fits.
      *
-     * @param map A pointer to the map object to be cleared.
+     * @param cache A pointer to the cache.
+     * @param key The key.
+     * @param value The value, owned by the cache from now on.
+     * @param weight The share of the capacity this entry takes, 0 counts
+     *               as 1. Pass 1 for a cache bounded by entry count.
+     * @param ttl Time to live in milliseconds, 0 if it never expires.
+     * @return CMTrue if the entry was added, CMFalse if its weight exceeds
+     *         the capacity of a shard or allocation failed. The value is
+     *         not taken in that case. A shard holds the capacity divided
+     *         by the number of shards, so a cache of heavy entries should
+     *         be created with fewer shards.
      */
-    void (*Clear)(
-            CMUTIL_Map *map);
+    CMBool (*Put)(
+            CMUTIL_Cache *cache, const char *key, void *value,
+            size_t weight, long ttl);
 
     /**
-     * @brief Clear the map and free all key-value pairs.
+     * @brief Retrieves the value of a key and marks it as used.
      *
-     * This function removes all key-value pairs from the map, effectively
-     * resetting it to an empty state. The function will free the memory
-     * associated with the map itself and all key-value pairs.
-     * Whether this map is created with or without freecb,
-     * it will not free the values.
+     * Without a duplicating callback the returned value may be evicted
+     * and released by another thread at any time.
      *
-     * @param map A pointer to the map object to be cleared.
+     * @param cache A pointer to the cache.
+     * @param key The key.
+     * @return The value, a duplicate made by the duplicating callback if
+     *         given, or NULL if the key is absent or expired.
      */
-    void (*ClearLink)(
-            CMUTIL_Map *map);
+    void *(*Get)(
+            CMUTIL_Cache *cache, const char *key);
 
     /**
-     * @brief Destroy the map object.
-     *
-     * This function frees the memory associated with the map object and
-     * all key-value pairs. If the map was created with a freecb function,
-     * it will be called for each value to free any additional memory.
+     * @brief Removes a key without calling the eviction callback.
      *
-     * @param map A pointer to the map object to be destroyed.
+     * @param cache A pointer to the cache.
+     * @param key The key.
+     * @return The removed value, owned by the caller, or NULL if the key
+     *         was not found.
      */
-    void (*Destroy)(
-            CMUTIL_Map *map);
+    void *(*Remove)(
+            CMUTIL_Cache *cache, const char *key);
 
     /**
-     * @brief Print the map to a string.
+     * @brief Drops all expired entries.
      *
-     * This function appends a string representation of the map to the
-     * provided CMUTIL_String object. The format of the string is
-     * implementation-dependent.
+     * Expired entries are also dropped when they are looked up, this
+     * releases those nobody asks for.
      *
-     * @param map A pointer to the map object to be printed.
-     * @param out A pointer to the CMUTIL_String object to append the output.
-     * @param to_strcb A callback function to convert value to string,
-     *                or NULL to use as string itself.
+     * @param cache A pointer to the cache.
+     * @return The number of dropped entries.
      */
-    void (*PrintTo)(
-            const CMUTIL_Map *map, CMUTIL_String *out, const char*(*to_strcb)(void*));
+    size_t (*RemoveExpired)(
+            CMUTIL_Cache *cache);
 
     /**
-     * @brief Get the value at a specific index in the map.
+     * @brief Get the counters of the cache.
      *
-     * This function retrieves the value at the specified index in the map.
-     * The index is zero-based, with 0 being the first element.
+     * @param cache A pointer to the cache.
+     * @param stats A pointer to receive the counters.
+     */
+    void (*GetStats)(
+            const CMUTIL_Cache *cache, CMUTIL_CacheStats *stats);
+
+    /**
+     * @brief Get the number of entries in the cache.
      *
-     * @param map A pointer to the map object from which to retrieve the value.
-     * @param index The index of the value to retrieve.
-     * @return A pointer to the value at the specified index,
-     *         or NULL if the index is out of bounds.
+     * @param cache A pointer to the cache.
+     * @return The number of entries, expired ones included.
      */
-    void *(*GetAt)(
-            const CMUTIL_Map *map, uint32_t index);
+    size_t (*GetSize)(
+            const CMUTIL_Cache *cache);
 
     /**
-     * @brief Remove the value at a specific index in the map.
+     * @brief Removes all entries, passing them to the eviction callback.
      *
-     * This function removes the value at the specified index in the map.
-     * The index is zero-based, with 0 being the first element.
+     * @param cache A pointer to the cache.
+     */
+    void (*Clear)(
+            CMUTIL_Cache *cache);
+
+    /**
+     * @brief Destroy the cache, passing remaining entries to the eviction
+     *        callback. No other thread may use the cache any more.
      *
-     * @param map A pointer to the map object from which to remove the value.
-     * @param index The index of the value to remove.
-     * @return A pointer to the removed value,
-     *         or NULL if the index is out of bounds.
+     * @param cache A pointer to the cache.
      */
-    void *(*RemoveAt)(
-            CMUTIL_Map *map, uint32_t index);
+    void (*Destroy)(
+            CMUTIL_Cache *cache);
 };
 
 /**
- * The default initial bucket size for the map.
- */
-#define CMUTIL_MAP_DEFAULT  256
-
-/**
- * Create a new map with default settings.
+ * @brief Create a least recently used cache bounded by entry count.
+ * @param capacity The maximum number of entries.
  */
-#define CMUTIL_MapCreate()  CMUTIL_MapCreateEx(\
-        CMUTIL_MAP_DEFAULT, CMFalse, NULL, 0.75f)
+#define CMUTIL_CacheCreate(capacity)    CMUTIL_CacheCreateEx(\
+        capacity, 0, CMCacheLRU, NULL, NULL, NULL)
 
 /**
- * @brief Create a new map with custom settings.
- * @param bucketsize The initial number of buckets for the map.
- * @param isucase Whether the key of the map should be case-insensitive.
- * @param freecb A callback function to free values when the map is destroyed.
- * @param load_factor The load factor for the map,
- *                    0.75 may appropriate for most use cases.
- * @return A pointer to the newly created map, or NULL on failure.
+ * @brief Create a new cache.
+ * @param capacity The maximum total weight of the entries, divided evenly
+ *                 among the shards.
+ * @param shards The number of shards, rounded up to a power of 2 and
+ *               limited by the capacity, or 0 for the default. No entry
+ *               may weigh more than the share of one shard.
+ * @param policy The eviction policy.
+ * @param evictcb A callback receiving entries which leave the cache other
+ *                than by <code>Remove</code>, or NULL.
+ * @param udata User data passed to the eviction callback.
+ * @param dupcb A callback duplicating a value for <code>Get</code> while
+ *              its shard is locked, or NULL to return values as they are.
+ * @return A pointer to the newly created cache, or NULL on failure.
  */
-CMUTIL_API CMUTIL_Map *CMUTIL_MapCreateEx(
-        uint32_t bucketsize, CMBool isucase, CMFreeCB freecb,
-        float load_factor);
+CMUTIL_API CMUTIL_Cache *CMUTIL_CacheCreateEx(
+        size_t capacity, uint32_t shards, CMCachePolicy policy,
+        CMCacheEvictCB evictcb, void *udata, void *(*dupcb)(void *value));
 
 
 /**
@@ -2706,6 +4495,20 @@ struct CMUTIL_List {
      * @param src The source list from which items will be moved.
      */
     void (*MoveAll)(CMUTIL_List *dst, CMUTIL_List *src);
+
+    /**
+     * @brief Call a function for all items from the front, without
+     *        allocating an iterator.
+     *
+     * The callback may remove the item it receives, but no other one.
+     *
+     * @param list This list object.
+     * @param callback Function receiving each item and <code>udata</code>,
+     *                 returning CMFalse stops the iteration.
+     * @param udata User data passed to the callback.
+     * @return CMTrue if all items were visited, CMFalse if stopped.
+     */
+    CMBool (*Each)(const CMUTIL_List *list, CMEachCB callback, void *udata);
 };
 
 /**
@@ -2927,6 +4730,21 @@ CMUTIL_API CMUTIL_XmlNode *CMUTIL_XmlParse(CMUTIL_String *str);
 CMUTIL_API CMUTIL_XmlNode *CMUTIL_XmlParseString(
         const char *xmlstr, size_t len);
 
+/**
+ * @brief Parse an XML string into an XML node tree allocated with the
+ * given memory operators.
+ *
+ * With the memory operators of a <code>CMUTIL_Arena</code>, the whole tree
+ * is released by resetting the arena.
+ *
+ * @param memst Memory operators for the tree.
+ * @param xmlstr The XML string to parse.
+ * @param len The length of the XML string.
+ * @return The root XML node of the parsed tree, or NULL on failure.
+ */
+CMUTIL_API CMUTIL_XmlNode *CMUTIL_XmlParseStringWithMem(
+        CMUTIL_Mem *memst, const char *xmlstr, size_t len);
+
 /**
  * @brief Parse an XML file into an XML node tree.
  *
@@ -3177,6 +4995,38 @@ struct CMUTIL_Timer {
  */
 CMUTIL_API CMUTIL_Timer *CMUTIL_TimerCreateEx(long precision, int threads);
 
+/**
+ * @brief Start releasing idle cached memory blocks periodically.
+ *
+ * Every <code>interval</code> milliseconds, cached blocks which were not
+ * reused since the previous run are released, as by
+ * <code>CMUTIL_MemTrimIdle</code>. Pages of big blocks are
+ * discarded with <code>madvise</code> where available, keeping the block
+ * cached without its memory. This trimmer is stopped by
+ * <code>CMUTIL_Clear</code>.
+ *
+ * @param interval Trimming interval in milliseconds.
+ * @param timer A timer to run the trimmer on. Ownership of the timer is
+ *         not transferred. If NULL, an internal timer is created.
+ * @return CMTrue if the trimmer is started, CMFalse under CMMemSystem.
+ */
+CMUTIL_API CMBool CMUTIL_MemStartTrimmer(long interval, CMUTIL_Timer *timer);
+
+/**
+ * @brief Run one pass of the trimmer now.
+ *
+ * Releases cached blocks which were not reused since the previous pass,
+ * and slabs whose blocks are all free and were not reused either.
+ *
+ * @return Released bytes, always 0 under CMMemSystem.
+ */
+CMUTIL_API size_t CMUTIL_MemTrimIdle(void);
+
+/**
+ * @brief Stop the trimmer started by <code>CMUTIL_MemStartTrimmer</code>.
+ */
+CMUTIL_API void CMUTIL_MemStopTrimmer(void);
+
 /**
  * @}
  */
@@ -4116,10 +5966,12 @@ CMUTIL_API void CMUTIL_LogFallback(CMLogLevel level,
  */
 #define CMUTIL_LogDefine(name)                                           \
     static CMUTIL_Logger *l___logger = NULL;                             \
-    static CMUTIL_LogSystem *s__lsys = NULL;                             \
+    static uint64_t s__lserial = 0;                                      \
     static CMUTIL_Logger *g__CMUTIL_GetLogger() {                        \
-        if (l___logger == NULL || s__lsys != CMUTIL_LogSystemGet()) {    \
-            s__lsys = CMUTIL_LogSystemGet();                             \
+        CMUTIL_LogSystem *s__lsys = CMUTIL_LogSystemGet();               \
+        uint64_t serial = CMUTIL_LogSystemSerial();                      \
+        if (l___logger == NULL || s__lserial != serial) {                \
+            s__lserial = serial;                                         \
             if (s__lsys) l___logger = CMCall(s__lsys, GetLogger, name);  \
             else l___logger = NULL;                                      \
         }                                                                \
@@ -4457,6 +6309,17 @@ CMUTIL_API CMUTIL_LogSystem *CMUTIL_LogSystemConfigureFomJson(
  */
 CMUTIL_API CMUTIL_LogSystem *CMUTIL_LogSystemGet(void);
 
+/**
+ * @brief Get the install count of the global log system.
+ *
+ * The count changes whenever another log system is installed, so loggers
+ * cached by CMUTIL_LogDefine are looked up again even if the new system
+ * reuses the address of a destroyed one.
+ *
+ * @return The current install count.
+ */
+CMUTIL_API uint64_t CMUTIL_LogSystemSerial(void);
+
 /**
  * @brief Set the global log system.
  *
@@ -4479,6 +6342,25 @@ CMUTIL_API void CMUTIL_LogSystemSet(CMUTIL_LogSystem *lsys);
  * @{
  */
 
+/**
+ * @brief Maximum count of frames kept in a CMUTIL_StackTrace.
+ */
+#define CMUTIL_STACK_MAX_FRAMES 64
+
+/**
+ * @brief Raw call stack, return addresses only.
+ *
+ * Capturing a raw stack costs a stack unwinding only, symbols are resolved
+ * when it is printed. Being a plain structure, it can be embedded or
+ * copied freely.
+ */
+typedef struct CMUTIL_StackTrace {
+    /** Count of valid frames. */
+    int     depth;
+    /** Return addresses, the innermost frame first. */
+    void    *frames[CMUTIL_STACK_MAX_FRAMES];
+} CMUTIL_StackTrace;
+
 /**
  * @brief Stack walker object.
  */
@@ -4521,6 +6403,36 @@ struct CMUTIL_StackWalker {
      * @param walker A pointer to the CMUTIL_StackWalker object to be destroyed.
      */
     void(*Destroy)(CMUTIL_StackWalker *walker);
+
+    /**
+     * @brief Capture the current call stack without symbols.
+     *
+     * Up to CMUTIL_STACK_MAX_FRAMES return addresses are stored in
+     * <code>trace</code>, deeper frames are dropped.
+     *
+     * @param walker The stack walker object.
+     * @param trace The trace to be filled.
+     * @param skipdepth The number of frames to skip from the top of the stack.
+     * @return Count of captured frames.
+     */
+    int (*Capture)(
+            const CMUTIL_StackWalker *walker,
+            CMUTIL_StackTrace *trace, int skipdepth);
+
+    /**
+     * @brief Print a captured call stack to a string buffer.
+     *
+     * Frames are printed in the same form as <code>PrintStack</code>.
+     * Resolved symbols are cached process wide, so a frame printed before
+     * is not resolved again.
+     *
+     * @param walker The stack walker object.
+     * @param trace The trace captured by <code>Capture</code>.
+     * @param outbuf The string buffer to store the printed stack trace.
+     */
+    void (*PrintTrace)(
+            const CMUTIL_StackWalker *walker,
+            const CMUTIL_StackTrace *trace, CMUTIL_String *outbuf);
 };
 
 /**
@@ -5935,6 +7847,20 @@ CMUTIL_API CMUTIL_JsonArray *CMUTIL_JsonArrayCreate(void);
  */
 CMUTIL_API CMUTIL_Json *CMUTIL_JsonParse(CMUTIL_String *jsonstr);
 
+/**
+ * @brief Parse a JSON string into a JSON object allocated with the given
+ * memory operators.
+ *
+ * With the memory operators of a <code>CMUTIL_Arena</code>, the whole tree
+ * is released by resetting the arena.
+ *
+ * @param memst Memory operators for the JSON object.
+ * @param jsonstr The JSON string to parse.
+ * @return A new JSON object, or NULL if parsing fails.
+ */
+CMUTIL_API CMUTIL_Json *CMUTIL_JsonParseWithMem(
+        CMUTIL_Mem *memst, CMUTIL_String *jsonstr);
+
 /**
  * @brief Convert an XML node to a JSON object.
  *
@@ -5943,6 +7869,18 @@ CMUTIL_API CMUTIL_Json *CMUTIL_JsonParse(CMUTIL_String *jsonstr);
  */
 CMUTIL_API CMUTIL_Json *CMUTIL_XmlToJson(CMUTIL_XmlNode *node);
 
+/**
+ * @brief Convert allocator statistics to a JSON object.
+ *
+ * Fields are named after the structure members, e.g.
+ * <code>inUseBytes</code> for <code>inusesz</code>, and classes are
+ * listed in the <code>classes</code> array.
+ *
+ * @param stats Statistics taken by <code>CMUTIL_MemGetStats</code>.
+ * @return A new JSON object, which must be destroyed by the caller.
+ */
+CMUTIL_API CMUTIL_Json *CMUTIL_MemStatsToJson(const CMUTIL_MemStats *stats);
+
 /**
  * @}
  */
@@ -43,12 +43,30 @@ typedef struct CMUTIL_List_Internal {
     size_t              size;
     void                (*freecb)(void*);
     CMUTIL_Mem          *memst;
+    CMUTIL_ObjectPool   *pool;      // item pool, NULL to use memst
 } CMUTIL_List_Internal;
 
+CMUTIL_STATIC CMUTIL_ListItem *CMUTIL_ListItemAlloc(
+        CMUTIL_List_Internal *ilist)
+{
+    if (ilist->pool)
+        return CMCall(ilist->pool, Alloc);
+    return ilist->memst->Alloc(sizeof(CMUTIL_ListItem));
+}
+
+CMUTIL_STATIC void CMUTIL_ListItemFree(
+        CMUTIL_List_Internal *ilist, CMUTIL_ListItem *item)
+{
+    if (ilist->pool)
+        CMCall(ilist->pool, Free, item);
+    else
+        ilist->memst->Free(item);
+}
+
 CMUTIL_STATIC void CMUTIL_ListAddFront(CMUTIL_List *list, void *data)
 {
     CMUTIL_List_Internal *ilist = (CMUTIL_List_Internal*)list;
-    CMUTIL_ListItem *item = ilist->memst->Alloc(sizeof(CMUTIL_ListItem));
+    CMUTIL_ListItem *item = CMUTIL_ListItemAlloc(ilist);
     if (!item) {
         CMLogError("Failed to allocate memory for list item.");
         return;
@@ -68,7 +86,7 @@ CMUTIL_STATIC void CMUTIL_ListAddFront(CMUTIL_List *list, void *data)
 CMUTIL_STATIC void CMUTIL_ListAddTail(CMUTIL_List *list, void *data)
 {
     CMUTIL_List_Internal *ilist = (CMUTIL_List_Internal*)list;
-    CMUTIL_ListItem *item = ilist->memst->Alloc(sizeof(CMUTIL_ListItem));
+    CMUTIL_ListItem *item = CMUTIL_ListItemAlloc(ilist);
     if (!item) {
         CMLogError("Failed to allocate memory for list item.");
         return;
@@ -113,7 +131,7 @@ CMUTIL_STATIC void *CMUTIL_ListRemoveFront(CMUTIL_List *list)
         ilist->head = item->next;
         if (ilist->head)
             ilist->head->prev = NULL;
-        ilist->memst->Free(item);
+        CMUTIL_ListItemFree(ilist, item);
         ilist->size--;
         if (ilist->size == 0)
             ilist->tail = NULL;
@@ -131,7 +149,7 @@ CMUTIL_STATIC void *CMUTIL_ListRemoveTail(CMUTIL_List *list)
         ilist->tail = item->prev;
         if (ilist->tail)
             ilist->tail->next = NULL;
-        ilist->memst->Free(item);
+        CMUTIL_ListItemFree(ilist, item);
         ilist->size--;
         if (ilist->size == 0)
             ilist->head = NULL;
@@ -152,7 +170,7 @@ CMUTIL_STATIC void *CMUTIL_ListRemove(CMUTIL_List *list, void *data)
                 return CMCall(list, RemoveTail);
             item->prev->next = item->next;
             item->next->prev = item->prev;
-            ilist->memst->Free(item);
+            CMUTIL_ListItemFree(ilist, item);
             ilist->size--;
             return data;
         }
@@ -217,6 +235,21 @@ CMUTIL_STATIC CMUTIL_Iterator *CMUTIL_ListIterator(const CMUTIL_List *list)
     return (CMUTIL_Iterator*)res;
 }
 
+CMUTIL_STATIC CMBool CMUTIL_ListEach(
+        const CMUTIL_List *list, CMEachCB callback, void *udata)
+{
+    const CMUTIL_List_Internal *ilist = (const CMUTIL_List_Internal*)list;
+    CMUTIL_ListItem *item = ilist->head;
+    while (item) {
+        // the callback may remove the item it receives.
+        CMUTIL_ListItem *next = item->next;
+        if (!callback(item->data, udata))
+            return CMFalse;
+        item = next;
+    }
+    return CMTrue;
+}
+
 CMUTIL_STATIC void CMUTIL_ListDestroy(CMUTIL_List *list)
 {
     CMUTIL_List_Internal *ilist = (CMUTIL_List_Internal*)list;
@@ -225,7 +258,7 @@ CMUTIL_STATIC void CMUTIL_ListDestroy(CMUTIL_List *list)
         CMUTIL_ListItem* next = curr->next;
         if (ilist->freecb)
             ilist->freecb(curr->data);
-        ilist->memst->Free(curr);
+        CMUTIL_ListItemFree(ilist, curr);
         curr = next;
     }
     ilist->memst->Free(ilist);
@@ -264,7 +297,8 @@ static CMUTIL_List g_cmutil_list = {
     CMUTIL_ListGetSize,
     CMUTIL_ListIterator,
     CMUTIL_ListDestroy,
-    CMUTIL_ListMoveAll
+    CMUTIL_ListMoveAll,
+    CMUTIL_ListEach
 };
 
 CMUTIL_List *CMUTIL_ListCreateInternal(
@@ -279,6 +313,9 @@ CMUTIL_List *CMUTIL_ListCreateInternal(
     memcpy(ilist, &g_cmutil_list, sizeof(CMUTIL_List));
     ilist->memst = memst;
     ilist->freecb = freecb;
+    // lists sharing memory operators share items, see MoveAll.
+    if (memst == CMUTIL_GetMem())
+        ilist->pool = CMUTIL_ObjectPoolShared(sizeof(CMUTIL_ListItem));
     return (CMUTIL_List*)ilist;
 }
 
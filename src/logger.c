@@ -138,6 +138,9 @@ static CMUTIL_LogPatternAppendFunc
         g_cmutil_log_pattern_funcs[LogFormatItem_Length] = {0,};
 static CMUTIL_Mutex *g_cmutil_logsystem_mutex = NULL;
 static CMUTIL_LogSystem *__cmutil_logsystem = NULL;
+// changes whenever another system is installed, a new system may reuse
+// the address of a destroyed one.
+static uint64_t g_cmutil_logsystem_serial = 0;
 
 CMUTIL_STATIC void CMUTIL_LogPathCreate(const char *fpath) {
     char pdir[1024] = {0,};
@@ -503,6 +506,7 @@ void CMUTIL_LogClear()
     if (__cmutil_logsystem) {
         CMCall(__cmutil_logsystem, Destroy);
         __cmutil_logsystem = NULL;
+        g_cmutil_logsystem_serial++;
     }
 }
 
@@ -583,6 +587,15 @@ CMUTIL_STATIC CMUTIL_LogAppderAsyncItem *CMUTIL_LogAppderAsyncItemCreate(
     return res;
 }
 
+CMUTIL_STATIC CMBool CMUTIL_LogPatternAppendItem(void *item, void *udata)
+{
+    CMUTIL_LogPatternAppendFuncParam *param =
+            (CMUTIL_LogPatternAppendFuncParam*)udata;
+    param->item = (CMUTIL_LogAppenderFormatItem*)item;
+    g_cmutil_log_pattern_funcs[param->item->type](param);
+    return CMTrue;
+}
+
 CMUTIL_STATIC void CMUTIL_LogAppenderBaseAppend(
     CMUTIL_LogAppender *appender,
     CMUTIL_Logger *logger,
@@ -593,7 +606,6 @@ CMUTIL_STATIC void CMUTIL_LogAppenderBaseAppend(
     CMUTIL_String *logmsg)
 {
     CMUTIL_LogAppenderBase *iap = (CMUTIL_LogAppenderBase*)appender;
-    CMUTIL_Iterator *iter = NULL;
     struct tm currtm;
     CMUTIL_LogPatternAppendFuncParam param;
     struct timeval tv;
@@ -620,13 +632,8 @@ CMUTIL_STATIC void CMUTIL_LogAppenderBaseAppend(
     param.logmsg = logmsg;
     //param.args = args;
 
-    // create log string
-    iter = CMCall(iap->pattern, Iterator);
-    while (CMCall(iter, HasNext)) {
-        param.item = (CMUTIL_LogAppenderFormatItem*)CMCall(iter, Next);
-        g_cmutil_log_pattern_funcs[param.item->type](&param);
-    }
-    CMCall(iter, Destroy);
+    // create log string, no iterator is allocated per log line.
+    CMCall(iap->pattern, Each, CMUTIL_LogPatternAppendItem, &param);
 
     if (iap->isasync) {
         CMCall(iap->mutex, Lock);
@@ -1947,6 +1954,7 @@ CMUTIL_STATIC void CMUTIL_LogSystemInstall(CMUTIL_LogSystem *lsys)
     // Publish first: whatever the outgoing system logs while it tears itself
     // down then reaches the incoming one instead of reaching itself.
     __cmutil_logsystem = lsys;
+    g_cmutil_logsystem_serial++;
     if (prev)
         CMCall(prev, Destroy);
 }
@@ -2447,6 +2455,11 @@ CMUTIL_LogSystem *CMUTIL_LogSystemGet()
     return CMUTIL_LogSystemGetInternal(CMUTIL_GetMem());
 }
 
+uint64_t CMUTIL_LogSystemSerial(void)
+{
+    return g_cmutil_logsystem_serial;
+}
+
 void CMUTIL_LogFallback(const CMLogLevel level,
         const char *file, const int line, const char *fmt, ...)
 {
@@ -30,108 +30,456 @@ CMUTIL_LogDefine("cmutil.maps")
 // CMUTIL_Map implementation
 //*****************************************************************************
 
+/*
+ * Open addressing table with one control byte per slot(Swiss table).
+ * Slots are probed in groups of 16, control bytes of a group are compared
+ * at once with SSE2 or NEON, so most lookups touch a control group and
+ * the matching item only.
+ * A full slot's control byte holds 7 bits of the hash(h2), the remaining
+ * bits(h1) select the first group to probe.
+ */
+#if defined(__SSE2__) || defined(_M_X64) || \
+        (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+# include <emmintrin.h>
+# define CMUTIL_MAP_SSE2
+#elif defined(__ARM_NEON) && defined(__aarch64__)
+# include <arm_neon.h>
+# define CMUTIL_MAP_NEON
+#endif
+
+#if defined(_MSC_VER)
+# include <intrin.h>
+#endif
+
+#define CMUTIL_MAP_GROUP        16
+#define CMUTIL_MAP_EMPTY        ((int8_t)-128)
+#define CMUTIL_MAP_DELETED      ((int8_t)-2)
+// bits per slot in a match mask, NEON has no movemask instruction.
+#if defined(CMUTIL_MAP_NEON)
+# define CMUTIL_MAP_MASK_BITS   4
+#else
+# define CMUTIL_MAP_MASK_BITS   1
+#endif
+#define CMUTIL_MAP_H1(h)        ((h) >> 7)
+#define CMUTIL_MAP_H2(h)        ((int8_t)((h) & 0x7F))
+/*
+ * Tables of this many slots or more are migrated incrementally,
+ * CMUTIL_MAP_MIGRATE slots on every Put or Remove.
+ */
+#define CMUTIL_MAP_INCR_MIN     1024
+#define CMUTIL_MAP_MIGRATE      64
+/*
+ * Keys are stored in the item itself. Items with keys shorter than this
+ * come from the shared pool of their size, others are allocated by memst.
+ */
+#define CMUTIL_MAP_INLINE_KEY   40
+#define CMUTIL_MAP_ATOM_SHARDS  16
+
 typedef struct CMUTIL_MapItem {
     CMUTIL_MapPair  base;
-    char            *key;
+    char            *key;       // 'inkey' or an atom, NUL terminated
+    size_t          keylen;
     void            *value;
-    uint32_t        hash;
-    int             order;
+    uint64_t        hash;
+    struct CMUTIL_MapItem *prev;    // insertion order
+    struct CMUTIL_MapItem *next;
+    size_t          order;      // slot in the order array of the map
+    char            inkey[];    // not allocated if interned
 } CMUTIL_MapItem;
 
+typedef struct CMUTIL_MapTable {
+    int8_t          *ctrl;      // control bytes, followed by slots
+    CMUTIL_MapItem  **slots;
+    size_t          capacity;   // count of slots, power of 2
+    size_t          tombs;      // deleted slots
+    size_t          growth;     // size + tombs limit before resizing
+} CMUTIL_MapTable;
+
+struct CMUTIL_Map_Internal;
+
+// read only array of the pairs of a map, in insertion order.
+typedef struct CMUTIL_MapPairs {
+    CMUTIL_Array    base;
+    const struct CMUTIL_Map_Internal *imap;
+} CMUTIL_MapPairs;
+
 typedef struct CMUTIL_Map_Internal {
     CMUTIL_Map      base;
-    CMUTIL_Array    **buckets;
+    CMUTIL_MapTable table;
+    CMUTIL_MapTable old;        // table being migrated, ctrl is NULL if none
+    size_t          migrated;   // slots of the old table visited so far
     size_t          size;
-    CMUTIL_Array    *keyset;
+    CMUTIL_MapItem  *head;      // items in insertion order
+    CMUTIL_MapItem  *tail;
+    CMUTIL_MapItem  **order;    // items by position, NULL where removed
+    size_t          ordfirst;   // first used slot of 'order'
+    size_t          ordend;     // slot after the last used one
+    size_t          ordcap;
+    size_t          holes;      // NULL slots between ordfirst and ordend
+    CMUTIL_MapPairs pairs;
     void            (*freecb)(void*);
     CMUTIL_Mem      *memst;
+    CMUTIL_ObjectPool *pool;    // short item pool, NULL to use memst
     CMBool          is_ucase;
-    uint32_t        bucket_size;
-    uint32_t        use_count;
-    int             order_seq;
+    CMBool          interned;   // keys are shared atoms
+    CMBool          unordered;  // no insertion order is kept
     float           load_factor;
 } CMUTIL_Map_Internal;
 
-CMUTIL_STATIC uint32_t CMUTIL_MapHash(const char *in)
+CMUTIL_STATIC char *CMUTIL_MapAtomGet(
+        uint64_t hash, const char *key, size_t keylen, CMBool is_ucase);
+CMUTIL_STATIC void CMUTIL_MapAtomRelease(
+        uint64_t hash, const char *key, size_t keylen, CMBool is_ucase);
+
+CMUTIL_STATIC CMUTIL_MapItem *CMUTIL_MapItemAlloc(
+        CMUTIL_Map_Internal *imap, size_t keylen)
 {
-    register const char *p = in;
-    unsigned h=0, g=0;
-    while (*p) {
-        h=(h<<4)+(uint32_t)(*p);
-        if((g=h&0xf0000000) != 0) {
-            h ^= (g>>24);
-            h ^= g;
+    size_t ksize = imap->interned? 0 : keylen + 1;
+    if (imap->pool && ksize <= CMUTIL_MAP_INLINE_KEY)
+        return CMCall(imap->pool, Alloc);
+    return imap->memst->Alloc(sizeof(CMUTIL_MapItem) + ksize);
+}
+
+CMUTIL_STATIC void CMUTIL_MapItemFree(
+        CMUTIL_Map_Internal *imap, CMUTIL_MapItem *item)
+{
+    size_t ksize = imap->interned? 0 : item->keylen + 1;
+    if (imap->interned && item->key)
+        CMUTIL_MapAtomRelease(
+                    item->hash, item->key, item->keylen, imap->is_ucase);
+    if (imap->pool && ksize <= CMUTIL_MAP_INLINE_KEY)
+        CMCall(imap->pool, Free, item);
+    else
+        imap->memst->Free(item);
+}
+
+/*
+ * Insertion order is kept twice, by the list for walking and by the order
+ * array for positions. Removing an item only clears its slot in the
+ * array, slots cleared at either end are trimmed at once and the ones in
+ * between are squeezed out once they outnumber a quarter of the items, so
+ * every write is O(1) amortized. Readers never write, a position is found
+ * by skipping the cleared slots while there are any.
+ */
+CMUTIL_STATIC void CMUTIL_MapOrderCompact(CMUTIL_Map_Internal *imap)
+{
+    size_t i, j = 0;
+    for (i=imap->ordfirst; i<imap->ordend; i++) {
+        CMUTIL_MapItem *item = imap->order[i];
+        if (item) {
+            item->order = j;
+            imap->order[j++] = item;
         }
-        p++;
     }
-    return h;
+    imap->ordfirst = 0;
+    imap->ordend = j;
+    imap->holes = 0;
 }
 
-CMUTIL_STATIC uint32_t CMUTIL_MapHashUpper(const char *in)
+CMUTIL_STATIC CMBool CMUTIL_MapLinkItem(
+        CMUTIL_Map_Internal *imap, CMUTIL_MapItem *item)
 {
-    register const char *p = in;
-    unsigned h=0, g=0;
-    while (*p) {
-        h=(h<<4)+(uint32_t)toupper((unsigned char)*p);
-        if((g=h&0xf0000000) != 0) {
-            h ^= (g>>24);
-            h ^= g;
+    if (imap->unordered)
+        return CMTrue;
+    if (imap->ordend == imap->ordcap) {
+        size_t waste = imap->ordfirst + imap->holes;
+        size_t ncap = imap->ordcap? imap->ordcap * 2 : CMUTIL_MAP_GROUP;
+        CMUTIL_MapItem **order = NULL;
+        // squeezing out less than half of the slots is not worth it.
+        if (waste < imap->ordcap / 2 || waste == 0)
+            order = imap->order?
+                        imap->memst->Realloc(imap->order,
+                                ncap * sizeof(CMUTIL_MapItem*)) :
+                        imap->memst->Alloc(ncap * sizeof(CMUTIL_MapItem*));
+        if (order) {
+            imap->order = order;
+            imap->ordcap = ncap;
+        } else if (waste > 0) {
+            // also the way out of a failed allocation if there is room.
+            CMUTIL_MapOrderCompact(imap);
+        } else {
+            return CMFalse;
         }
-        p++;
     }
-    return h;
+    item->order = imap->ordend;
+    imap->order[imap->ordend++] = item;
+    item->prev = imap->tail;
+    item->next = NULL;
+    if (imap->tail)
+        imap->tail->next = item;
+    else
+        imap->head = item;
+    imap->tail = item;
+    return CMTrue;
 }
 
+CMUTIL_STATIC void CMUTIL_MapUnlinkItem(
+        CMUTIL_Map_Internal *imap, CMUTIL_MapItem *item)
+{
+    if (imap->unordered)
+        return;
+    imap->order[item->order] = NULL;
+    imap->holes++;
+    while (imap->ordfirst < imap->ordend &&
+           imap->order[imap->ordfirst] == NULL) {
+        imap->ordfirst++;
+        imap->holes--;
+    }
+    while (imap->ordend > imap->ordfirst &&
+           imap->order[imap->ordend - 1] == NULL) {
+        imap->ordend--;
+        imap->holes--;
+    }
+    if (imap->holes > 0 && imap->holes >= (imap->size + 3) / 4)
+        CMUTIL_MapOrderCompact(imap);
+    if (item->prev)
+        item->prev->next = item->next;
+    else
+        imap->head = item->next;
+    if (item->next)
+        item->next->prev = item->prev;
+    else
+        imap->tail = item->prev;
+}
+
+// item at the position in insertion order, the index must be in range.
+CMUTIL_STATIC CMUTIL_MapItem *CMUTIL_MapItemAt(
+        const CMUTIL_Map_Internal *imap, size_t index)
+{
+    size_t i = imap->ordfirst;
+    if (imap->holes == 0)
+        return imap->order[i + index];
+    for (;; i++) {
+        if (imap->order[i] && index-- == 0)
+            return imap->order[i];
+    }
+}
+
+CMUTIL_STATIC int CMUTIL_MapCtz(uint64_t v)
+{
+#if defined(__GNUC__)
+    return __builtin_ctzll(v);
+#elif defined(_MSC_VER) && defined(_WIN64)
+    unsigned long rval;
+    _BitScanForward64(&rval, v);
+    return (int)rval;
+#else
+    int rval = 0;
+    while (!(v & 1)) {
+        v >>= 1;
+        rval++;
+    }
+    return rval;
+#endif
+}
+
+// mask of slots in the group whose control byte equals 'c'.
+CMUTIL_STATIC uint64_t CMUTIL_MapMatch(const int8_t *group, int8_t c)
+{
+#if defined(CMUTIL_MAP_SSE2)
+    __m128i ctrl = _mm_loadu_si128((const __m128i*)group);
+    return (uint64_t)(uint32_t)_mm_movemask_epi8(
+                _mm_cmpeq_epi8(ctrl, _mm_set1_epi8(c)));
+#elif defined(CMUTIL_MAP_NEON)
+    uint8x16_t eq = vceqq_s8(vld1q_s8(group), vdupq_n_s8(c));
+    return vget_lane_u64(vreinterpret_u64_u8(
+                vshrn_n_u16(vreinterpretq_u16_u8(eq), 4)), 0);
+#else
+    uint64_t res = 0;
+    int i;
+    for (i=0; i<CMUTIL_MAP_GROUP; i++)
+        if (group[i] == c)
+            res |= (uint64_t)1 << i;
+    return res;
+#endif
+}
+
+// mask of empty or deleted slots in the group.
+CMUTIL_STATIC uint64_t CMUTIL_MapMatchFree(const int8_t *group)
+{
+#if defined(CMUTIL_MAP_SSE2)
+    // only empty and deleted slots have the sign bit.
+    return (uint64_t)(uint32_t)_mm_movemask_epi8(
+                _mm_loadu_si128((const __m128i*)group));
+#elif defined(CMUTIL_MAP_NEON)
+    uint8x16_t neg = vcltzq_s8(vld1q_s8(group));
+    return vget_lane_u64(vreinterpret_u64_u8(
+                vshrn_n_u16(vreinterpretq_u16_u8(neg), 4)), 0);
+#else
+    uint64_t res = 0;
+    int i;
+    for (i=0; i<CMUTIL_MAP_GROUP; i++)
+        if (group[i] < 0)
+            res |= (uint64_t)1 << i;
+    return res;
+#endif
+}
+
+// slot offset in the group of the lowest match, and drops it from mask.
+CMUTIL_STATIC size_t CMUTIL_MapMaskNext(uint64_t *mask)
+{
+    int lane = CMUTIL_MapCtz(*mask) / CMUTIL_MAP_MASK_BITS;
+    *mask &= ~((((uint64_t)1 << CMUTIL_MAP_MASK_BITS) - 1) <<
+               (lane * CMUTIL_MAP_MASK_BITS));
+    return (size_t)lane;
+}
+
+#define CMUTIL_MapHashKey(imap, key, len)  \
+    ((imap)->is_ucase? CMUTIL_HashBytesUpper(key, len) : \
+                       CMUTIL_HashBytes(key, len))
+
 CMUTIL_STATIC void CMUTIL_MapToUpper(char *in)
 {
     while (*in) {
-        *in = (char)toupper((unsigned char)*in);
+        *in = CMUTIL_ASCII_UPPER(*in);
         in++;
     }
 }
 
-CMUTIL_STATIC int CMUTIL_MapComparator(const void *a, const void *b)
+/*
+ * Returns the slot index of the key, or capacity if not found.
+ * Keys are stored upper cased in case insensitive maps, 'key' may be in
+ * any case.
+ */
+CMUTIL_STATIC size_t CMUTIL_MapFind(
+        const CMUTIL_MapTable *tab, uint64_t hash,
+        const char *key, size_t keylen, CMBool is_ucase)
 {
-    const CMUTIL_MapItem *ia = (const CMUTIL_MapItem*)a;
-    const CMUTIL_MapItem *ib = (const CMUTIL_MapItem*)b;
+    size_t gmask = tab->capacity / CMUTIL_MAP_GROUP - 1;
+    size_t gidx = (size_t)CMUTIL_MAP_H1(hash) & gmask;
+    size_t step = 0;
+    int8_t h2 = CMUTIL_MAP_H2(hash);
+    while (CMTrue) {
+        const int8_t *group = tab->ctrl + gidx * CMUTIL_MAP_GROUP;
+        uint64_t mask = CMUTIL_MapMatch(group, h2);
+        while (mask) {
+            size_t idx = gidx * CMUTIL_MAP_GROUP + CMUTIL_MapMaskNext(&mask);
+            const CMUTIL_MapItem *item = tab->slots[idx];
+            if (item->hash == hash && item->keylen == keylen && (is_ucase?
+                    CMUTIL_HashEqUpper(item->key, key, keylen) :
+                    memcmp(item->key, key, keylen) == 0))
+                return idx;
+        }
+        // an empty slot ends the probe sequence.
+        if (CMUTIL_MapMatch(group, CMUTIL_MAP_EMPTY))
+            return tab->capacity;
+        // triangular probing visits every group once.
+        gidx = (gidx + ++step) & gmask;
+    }
+}
 
-    return strcmp(ia->key, ib->key);
+// first empty or deleted slot in the probe sequence of the hash.
+CMUTIL_STATIC size_t CMUTIL_MapFindFree(
+        const int8_t *ctrl, size_t capacity, uint64_t hash)
+{
+    size_t gmask = capacity / CMUTIL_MAP_GROUP - 1;
+    size_t gidx = (size_t)CMUTIL_MAP_H1(hash) & gmask;
+    size_t step = 0;
+    while (CMTrue) {
+        uint64_t mask = CMUTIL_MapMatchFree(ctrl + gidx * CMUTIL_MAP_GROUP);
+        if (mask)
+            return gidx * CMUTIL_MAP_GROUP + CMUTIL_MapMaskNext(&mask);
+        gidx = (gidx + ++step) & gmask;
+    }
 }
 
-CMUTIL_STATIC void CMUTIL_MapRebuild(CMUTIL_Map_Internal *imap)
+CMUTIL_STATIC void CMUTIL_MapInsert(
+        CMUTIL_MapTable *tab, CMUTIL_MapItem *item)
 {
-    uint32_t i;
-    uint32_t usecount = 0;
-    uint32_t newbucketsize = imap->bucket_size * 2;
-    CMUTIL_Array **newbuckets =
-        imap->memst->Alloc(sizeof(CMUTIL_Array*) * newbucketsize);
-    memset(newbuckets, 0x0, sizeof(CMUTIL_Array*) * newbucketsize);
+    size_t idx = CMUTIL_MapFindFree(tab->ctrl, tab->capacity, item->hash);
+    if (tab->ctrl[idx] == CMUTIL_MAP_DELETED)
+        tab->tombs--;
+    tab->ctrl[idx] = CMUTIL_MAP_H2(item->hash);
+    tab->slots[idx] = item;
+}
 
-    for (i=0; i<CMCall(imap->keyset, GetSize); i++) {
-        CMUTIL_MapItem *item = (CMUTIL_MapItem*)CMCall(imap->keyset, GetAt, i);
-        uint32_t index = item->hash % newbucketsize;
-        CMUTIL_Array *bucket = newbuckets[index];
-        if (!bucket) {
-            bucket = CMUTIL_ArrayCreateInternal(
-                        imap->memst, 5, CMUTIL_MapComparator,
-                        NULL, CMTrue);
-            newbuckets[index] = bucket;
-            usecount++;
-        }
-        // cannot be duplicated when map rebuild.
-        CMCall(bucket, Add, item, NULL);
+/*
+ * Finds the key in the current table, then in the table being migrated.
+ * Returns the table holding the key with its slot index, or NULL.
+ */
+CMUTIL_STATIC CMUTIL_MapTable *CMUTIL_MapLocate(
+        const CMUTIL_Map_Internal *imap, uint64_t hash,
+        const char *key, size_t keylen, size_t *idx)
+{
+    const CMUTIL_MapTable *tab = &imap->table;
+    *idx = CMUTIL_MapFind(tab, hash, key, keylen, imap->is_ucase);
+    if (*idx < tab->capacity)
+        return (CMUTIL_MapTable*)tab;
+    tab = &imap->old;
+    if (tab->ctrl) {
+        *idx = CMUTIL_MapFind(tab, hash, key, keylen, imap->is_ucase);
+        if (*idx < tab->capacity)
+            return (CMUTIL_MapTable*)tab;
     }
+    return NULL;
+}
 
-    for (i=0; i<imap->bucket_size; i++) {
-        CMUTIL_Array *bucket = imap->buckets[i];
-        if (bucket) {
-            CMCall(bucket, Destroy);
+CMUTIL_STATIC CMBool CMUTIL_MapAllocTable(
+        CMUTIL_Map_Internal *imap, CMUTIL_MapTable *tab, size_t capacity)
+{
+    // control bytes and slots share one block.
+    int8_t *ctrl = imap->memst->Alloc(
+                capacity * (sizeof(int8_t) + sizeof(CMUTIL_MapItem*)));
+    if (ctrl == NULL)
+        return CMFalse;
+    memset(ctrl, CMUTIL_MAP_EMPTY, capacity);
+    tab->ctrl = ctrl;
+    tab->slots = (CMUTIL_MapItem**)(ctrl + capacity);
+    tab->capacity = capacity;
+    tab->tombs = 0;
+    tab->growth = (size_t)((double)capacity * imap->load_factor);
+    if (tab->growth >= capacity)
+        tab->growth = capacity - 1;
+    return CMTrue;
+}
+
+/*
+ * Moves up to 'count' slots of the old table to the current one, and
+ * frees the old table once all of its slots are moved.
+ */
+CMUTIL_STATIC void CMUTIL_MapMigrate(CMUTIL_Map_Internal *imap, size_t count)
+{
+    CMUTIL_MapTable *old = &imap->old;
+    size_t end;
+    if (old->ctrl == NULL)
+        return;
+    end = old->capacity - imap->migrated > count?
+                imap->migrated + count : old->capacity;
+    for (; imap->migrated < end; imap->migrated++) {
+        size_t i = imap->migrated;
+        if (old->ctrl[i] >= 0) {
+            CMUTIL_MapInsert(&imap->table, old->slots[i]);
+            // keeps probe sequences of the old table going.
+            old->ctrl[i] = CMUTIL_MAP_DELETED;
         }
     }
-    imap->memst->Free(imap->buckets);
-    imap->buckets = newbuckets;
-    imap->bucket_size = newbucketsize;
-    imap->use_count = usecount;
+    if (imap->migrated == old->capacity) {
+        imap->memst->Free(old->ctrl);
+        memset(old, 0x0, sizeof(CMUTIL_MapTable));
+    }
+}
+
+/*
+ * Replaces the table with a new one of the given capacity. Small tables
+ * are moved at once, larger ones are migrated a few slots per operation
+ * so a single Put never pays for rehashing the whole map.
+ */
+CMUTIL_STATIC CMBool CMUTIL_MapResize(
+        CMUTIL_Map_Internal *imap, size_t capacity)
+{
+    CMUTIL_MapTable prev;
+    CMLogTrace("Map capacity is %zu, size is %zu, deleted %zu, resize to %zu",
+               imap->table.capacity, imap->size, imap->table.tombs, capacity);
+    // only one migration at a time.
+    CMUTIL_MapMigrate(imap, imap->old.capacity);
+    prev = imap->table;
+    if (!CMUTIL_MapAllocTable(imap, &imap->table, capacity))
+        return CMFalse;
+    imap->old = prev;
+    imap->migrated = 0;
+    CMUTIL_MapMigrate(imap, prev.capacity < CMUTIL_MAP_INCR_MIN?
+                          prev.capacity : CMUTIL_MAP_MIGRATE);
+    return CMTrue;
 }
 
 CMUTIL_STATIC const char *CMUTIL_MapPairGetKey(const CMUTIL_MapPair *pair)
@@ -144,94 +492,108 @@ CMUTIL_STATIC void *CMUTIL_MapPairGetValue(const CMUTIL_MapPair *pair)
     return ((CMUTIL_MapItem*)pair)->value;
 }
 
-CMUTIL_STATIC CMUTIL_MapItem *CMUTIL_MapPutBase(
-        CMUTIL_Map_Internal *imap, const char* key, void* value, void **prev)
+CMUTIL_STATIC size_t CMUTIL_MapPairGetKeyLength(const CMUTIL_MapPair *pair)
 {
-    uint32_t hash = imap->is_ucase?
-                CMUTIL_MapHashUpper(key) :
-                CMUTIL_MapHash(key);
-    uint32_t index = hash % imap->bucket_size;
-    CMUTIL_Array *bucket = imap->buckets[index];
-    CMUTIL_MapItem *item = imap->memst->Alloc(sizeof(CMUTIL_MapItem));
-    CMUTIL_MapItem *ires = NULL;
+    return ((CMUTIL_MapItem*)pair)->keylen;
+}
+
+CMUTIL_STATIC CMBool CMUTIL_MapPutHashed(
+        CMUTIL_Map_Internal *imap, uint64_t hash,
+        const char *key, size_t keylen, void *value, void **prev)
+{
+    CMUTIL_MapItem *item;
+    CMUTIL_MapTable *tab;
+    size_t idx;
     if (prev)
         *prev = NULL;
 
-    memset(item, 0x0, sizeof(CMUTIL_MapItem));
-    item->base.GetKey = CMUTIL_MapPairGetKey;
-    item->base.GetValue = CMUTIL_MapPairGetValue;
-
-    if (!bucket) {
-        if ((double)(imap->use_count + 1) / (double)imap->bucket_size
-                > imap->load_factor) {
-            // Rebuild the map to reduce the collision rate
-            CMLogTrace("Map bucket size is %u, used count is %u, rebuild",
-                imap->bucket_size, imap->use_count);
-            CMUTIL_MapRebuild(imap);
-            index = hash % imap->bucket_size;
-            // rebuild may have populated this slot already.
-            bucket = imap->buckets[index];
-        }
-        if (!bucket) {
-            bucket = CMUTIL_ArrayCreateInternal(
-                        imap->memst, 5, CMUTIL_MapComparator,
-                        NULL, CMTrue);
-            imap->buckets[index] = bucket;
-            imap->use_count++;
+    CMUTIL_MapMigrate(imap, CMUTIL_MAP_MIGRATE);
+    tab = CMUTIL_MapLocate(imap, hash, key, keylen, &idx);
+    if (tab) {
+        // replaced item keeps its key, but goes to the end of the order.
+        item = tab->slots[idx];
+        if (prev)
+            *prev = item->value;
+        item->value = value;
+        // unlinking leaves room in the order array, so linking can't fail.
+        if (item != imap->tail) {
+            CMUTIL_MapUnlinkItem(imap, item);
+            CMUTIL_MapLinkItem(imap, item);
         }
+        return CMTrue;
     }
 
+    tab = &imap->table;
+    if (imap->size + tab->tombs >= tab->growth) {
+        // same size if deleted slots take the room, doubled otherwise.
+        size_t ncap = tab->tombs > imap->size / 2?
+                    tab->capacity : tab->capacity * 2;
+        if (!CMUTIL_MapResize(imap, ncap)) {
+            CMLogError("Failed to allocate memory for map table.");
+            return CMFalse;
+        }
+    }
+    item = CMUTIL_MapItemAlloc(imap, keylen);
+    if (!item) {
+        CMLogError("Failed to allocate memory for map item.");
+        return CMFalse;
+    }
+    memset(item, 0x0, sizeof(CMUTIL_MapItem));
+    item->base.GetKey = CMUTIL_MapPairGetKey;
+    item->base.GetValue = CMUTIL_MapPairGetValue;
+    item->base.GetKeyLength = CMUTIL_MapPairGetKeyLength;
     item->hash = hash;
-    item->key = imap->memst->Strdup(key);
-    if (imap->is_ucase)
-        CMUTIL_MapToUpper(item->key);
+    item->keylen = keylen;
     item->value = value;
-    item->order = imap->order_seq++;
-    if (!CMCall(bucket, Add, item, (void**)&ires)) {
-        CMLogError("CMUTIL_Array Add failed");
-        imap->memst->Free(item->key);
-        imap->memst->Free(item);
-        return NULL;
+    if (imap->interned) {
+        item->key = CMUTIL_MapAtomGet(hash, key, keylen, imap->is_ucase);
+        if (!item->key) {
+            CMLogError("Failed to allocate memory for map key.");
+            CMUTIL_MapItemFree(imap, item);
+            return CMFalse;
+        }
+    } else {
+        item->key = item->inkey;
+        if (keylen > 0)
+            memcpy(item->key, key, keylen);
+        item->key[keylen] = 0x0;
+        if (imap->is_ucase)
+            CMUTIL_MapToUpper(item->key);
     }
-    if (ires) {
-        if (prev)
-            *prev = ires->value;
-        CMCall(imap->keyset, Remove, ires);
-        imap->memst->Free(ires->key);
-        imap->memst->Free(ires);
-   } else {
-        imap->size++;
+    if (!CMUTIL_MapLinkItem(imap, item)) {
+        CMLogError("Failed to allocate memory for map pairs.");
+        CMUTIL_MapItemFree(imap, item);
+        return CMFalse;
     }
-    return item;
+    CMUTIL_MapInsert(tab, item);
+    imap->size++;
+    return CMTrue;
+}
+
+CMUTIL_STATIC CMBool CMUTIL_MapPutBase(
+        CMUTIL_Map_Internal *imap, const char *key, size_t keylen,
+        void *value, void **prev)
+{
+    return CMUTIL_MapPutHashed(imap, CMUTIL_MapHashKey(imap, key, keylen),
+                               key, keylen, value, prev);
 }
 
 CMUTIL_STATIC CMBool CMUTIL_MapPut(
         CMUTIL_Map *map, const char* key, void* value, void** prev)
 {
-    CMUTIL_Map_Internal *imap = (CMUTIL_Map_Internal*)map;
-    CMUTIL_MapItem *item = CMUTIL_MapPutBase(imap, key, value, prev);
-    if (!item) {
-        CMLogError("CMUTIL_MapPutBase failed");
-        return CMFalse;
-    }
-    if (!CMCall(imap->keyset, Add, item, NULL)) {
-        CMLogError("CMUTIL_Array Add failed");
-        CMCall(map, Remove, key);
-        return CMFalse;
-    }
-    return CMTrue;
+    return CMUTIL_MapPutBase(
+                (CMUTIL_Map_Internal*)map, key, strlen(key), value, prev);
 }
 
 CMUTIL_STATIC void CMUTIL_MapPutAll(
         CMUTIL_Map *map, const CMUTIL_Map *src)
 {
-    const CMUTIL_Map_Internal *imap = (const CMUTIL_Map_Internal*)map;
-    CMUTIL_Map_Internal *smap = (CMUTIL_Map_Internal*)src;
-    uint32_t i;
-    for (i=0; i<CMCall(smap->keyset, GetSize); i++) {
-        const CMUTIL_MapItem *item = CMCall(smap->keyset, GetAt, i);
+    CMUTIL_Map_Internal *imap = (CMUTIL_Map_Internal*)map;
+    const CMUTIL_Map_Internal *smap = (const CMUTIL_Map_Internal*)src;
+    const CMUTIL_MapItem *item;
+    for (item = smap->head; item; item = item->next) {
         void *prev = NULL;
-        CMCall(map, Put, item->key, item->value, &prev);
+        CMUTIL_MapPutBase(imap, item->key, item->keylen, item->value, &prev);
         if (prev) {
             if (imap->freecb)
                 imap->freecb(prev);
@@ -242,83 +604,134 @@ CMUTIL_STATIC void CMUTIL_MapPutAll(
     }
 }
 
+CMUTIL_STATIC void *CMUTIL_MapGetBase(
+        const CMUTIL_Map_Internal *imap, const char *key, size_t keylen)
+{
+    size_t idx;
+    const CMUTIL_MapTable *tab = CMUTIL_MapLocate(
+                imap, CMUTIL_MapHashKey(imap, key, keylen), key, keylen, &idx);
+    return tab? tab->slots[idx]->value : NULL;
+}
+
 CMUTIL_STATIC void *CMUTIL_MapGet(const CMUTIL_Map *map, const char* key)
 {
-    const CMUTIL_Map_Internal *imap = (const CMUTIL_Map_Internal*)map;
-    uint32_t hash = imap->is_ucase?
-                CMUTIL_MapHashUpper(key) :
-                CMUTIL_MapHash(key);
-    uint32_t index = hash % imap->bucket_size;
-    CMUTIL_Array *bucket = imap->buckets[index];
-    void *res = NULL;
-
-    if (bucket) {
-        CMUTIL_MapItem item = {{}, (char*)key, NULL};
-        uint32_t idx = 0;
-        CMUTIL_MapItem *ires = NULL;
-        if (imap->is_ucase) {
-            char *skey = imap->memst->Strdup(key);
-            CMUTIL_MapToUpper(skey);
-            item.key = skey;
-            ires = CMCall(bucket, Find, &item, &idx);
-            imap->memst->Free(skey);
-        } else {
-            ires = CMCall(bucket, Find, &item, &idx);
-        }
+    return CMUTIL_MapGetBase(
+                (const CMUTIL_Map_Internal*)map, key, strlen(key));
+}
 
-        if (ires)
-            res = ires->value;
+CMUTIL_STATIC void *CMUTIL_MapRemoveHashed(
+        CMUTIL_Map_Internal *imap, uint64_t hash,
+        const char *key, size_t keylen)
+{
+    CMUTIL_MapItem *ires;
+    CMUTIL_MapTable *tab;
+    size_t idx;
+    void *res;
+    CMUTIL_MapMigrate(imap, CMUTIL_MAP_MIGRATE);
+    tab = CMUTIL_MapLocate(imap, hash, key, keylen, &idx);
+    if (tab == NULL)
+        return NULL;
+    ires = tab->slots[idx];
+    /*
+     * A slot can be emptied only if its group never filled up, otherwise
+     * a probe sequence may pass this group and must keep going.
+     * The old table is never inserted into, so tombstones are not counted.
+     */
+    if (tab == &imap->table && CMUTIL_MapMatch(
+                tab->ctrl + (idx & ~(size_t)(CMUTIL_MAP_GROUP - 1)),
+                CMUTIL_MAP_EMPTY)) {
+        tab->ctrl[idx] = CMUTIL_MAP_EMPTY;
+    } else {
+        tab->ctrl[idx] = CMUTIL_MAP_DELETED;
+        tab->tombs++;
     }
-
+    imap->size--;
+    CMUTIL_MapUnlinkItem(imap, ires);
+    res = ires->value;
+    CMUTIL_MapItemFree(imap, ires);
     return res;
 }
 
-CMUTIL_STATIC void *CMUTIL_MapRemove(CMUTIL_Map *map, const char* key)
+CMUTIL_STATIC void *CMUTIL_MapRemoveBase(
+        CMUTIL_Map_Internal *imap, const char *key, size_t keylen)
 {
-    CMUTIL_Map_Internal *imap = (CMUTIL_Map_Internal*)map;
-    uint32_t hash = imap->is_ucase?
-                CMUTIL_MapHashUpper(key) :
-                CMUTIL_MapHash(key);
-    uint32_t index = hash % imap->bucket_size;
-    CMUTIL_Array *bucket = imap->buckets[index];
-    void *res = NULL;
-
-    if (bucket) {
-        CMUTIL_MapItem *ires = NULL;
-        CMUTIL_MapItem item = {{}, (char*)key, NULL, 0};
-        if (imap->is_ucase) {
-            char *skey = imap->memst->Strdup(key);
-            CMUTIL_MapToUpper(skey);
-            item.key = skey;
-            ires = (CMUTIL_MapItem*)CMCall(bucket, Remove, &item);
-            imap->memst->Free(skey);
-        } else {
-            ires = (CMUTIL_MapItem*)CMCall(bucket, Remove, &item);
-        }
-        if (ires) {
-            CMCall(imap->keyset, Remove, ires);
-            res = ires->value;
-            imap->memst->Free(ires->key);
-            imap->memst->Free(ires);
-        }
+    return CMUTIL_MapRemoveHashed(
+                imap, CMUTIL_MapHashKey(imap, key, keylen), key, keylen);
+}
 
-        if (res)
-            imap->size--;
+/*
+ * Interned keys are atoms of a process wide table shared by all interning
+ * maps. An atom is the key of an item in one of the atom maps, the item's
+ * value counts the map items referring to it. Atoms of case insensitive
+ * maps are upper-cased and kept apart.
+ */
+typedef struct CMUTIL_MapAtomShard {
+    CMUTIL_Mutex        *mutex;
+    CMUTIL_Map_Internal *atoms[2];  // case sensitive, case insensitive
+} CMUTIL_MapAtomShard;
+
+static CMUTIL_MapAtomShard g_cmutil_map_atoms[CMUTIL_MAP_ATOM_SHARDS];
+
+#define CMUTIL_MapAtomShardOf(hash) \
+    (&g_cmutil_map_atoms[(hash) >> 60 & (CMUTIL_MAP_ATOM_SHARDS - 1)])
+
+CMUTIL_STATIC char *CMUTIL_MapAtomGet(
+        uint64_t hash, const char *key, size_t keylen, CMBool is_ucase)
+{
+    CMUTIL_MapAtomShard *shard = CMUTIL_MapAtomShardOf(hash);
+    CMUTIL_Map_Internal *atoms = shard->atoms[is_ucase? 1 : 0];
+    CMUTIL_MapItem *atom = NULL;
+    CMUTIL_MapTable *tab;
+    size_t idx;
+
+    CMCall(shard->mutex, Lock);
+    tab = CMUTIL_MapLocate(atoms, hash, key, keylen, &idx);
+    if (tab) {
+        atom = tab->slots[idx];
+        atom->value = (void*)((intptr_t)atom->value + 1);
+    } else if (CMUTIL_MapPutHashed(
+                   atoms, hash, key, keylen, (void*)1, NULL)) {
+        tab = CMUTIL_MapLocate(atoms, hash, key, keylen, &idx);
+        atom = tab->slots[idx];
     }
+    CMCall(shard->mutex, Unlock);
+    // the reference just taken keeps the atom alive.
+    return atom? atom->key : NULL;
+}
 
-    return res;
+CMUTIL_STATIC void CMUTIL_MapAtomRelease(
+        uint64_t hash, const char *key, size_t keylen, CMBool is_ucase)
+{
+    CMUTIL_MapAtomShard *shard = CMUTIL_MapAtomShardOf(hash);
+    CMUTIL_Map_Internal *atoms = shard->atoms[is_ucase? 1 : 0];
+    CMUTIL_MapTable *tab;
+    size_t idx;
+
+    CMCall(shard->mutex, Lock);
+    tab = CMUTIL_MapLocate(atoms, hash, key, keylen, &idx);
+    if (tab) {
+        CMUTIL_MapItem *atom = tab->slots[idx];
+        if ((intptr_t)atom->value > 1)
+            atom->value = (void*)((intptr_t)atom->value - 1);
+        else
+            CMUTIL_MapRemoveHashed(atoms, hash, key, keylen);
+    }
+    CMCall(shard->mutex, Unlock);
+}
+
+CMUTIL_STATIC void *CMUTIL_MapRemove(CMUTIL_Map *map, const char* key)
+{
+    return CMUTIL_MapRemoveBase((CMUTIL_Map_Internal*)map, key, strlen(key));
 }
 
 CMUTIL_STATIC CMUTIL_StringArray *CMUTIL_MapGetKeys(const CMUTIL_Map *map)
 {
     const CMUTIL_Map_Internal *imap = (const CMUTIL_Map_Internal*)map;
     CMUTIL_StringArray *res = CMUTIL_StringArrayCreateInternal(
-            imap->memst, CMCall(imap->keyset, GetSize));
-    uint32_t i;
-    for (i=0; i<CMCall(imap->keyset, GetSize); i++) {
-        CMUTIL_MapItem *item = (CMUTIL_MapItem*)CMCall(imap->keyset, GetAt, i);
+            imap->memst, imap->size);
+    const CMUTIL_MapItem *item;
+    for (item = imap->head; item; item = item->next)
         CMCall(res, AddCString, item->key);
-    }
 
     return res;
 }
@@ -326,7 +739,7 @@ CMUTIL_STATIC CMUTIL_StringArray *CMUTIL_MapGetKeys(const CMUTIL_Map *map)
 CMUTIL_STATIC const CMUTIL_Array *CMUTIL_MapGetPairs(const CMUTIL_Map *map)
 {
     const CMUTIL_Map_Internal *imap = (const CMUTIL_Map_Internal*)map;
-    return imap->keyset;
+    return (const CMUTIL_Array*)&imap->pairs;
 }
 
 CMUTIL_STATIC size_t CMUTIL_MapGetSize(const CMUTIL_Map *map)
@@ -338,22 +751,22 @@ CMUTIL_STATIC size_t CMUTIL_MapGetSize(const CMUTIL_Map *map)
 typedef struct CMUTIL_MapIter_st {
     CMUTIL_Iterator             base;
     const CMUTIL_Map_Internal   *imap;
-    uint32_t                    index;
+    const CMUTIL_MapItem        *curr;  // item returned by next call
 } CMUTIL_MapIter_st;
 
 CMUTIL_STATIC CMBool CMUTIL_MapIterHasNext(const CMUTIL_Iterator *iter)
 {
     const CMUTIL_MapIter_st *iiter = (const CMUTIL_MapIter_st*)iter;
-    return iiter->index < CMCall(iiter->imap->keyset, GetSize) ?
-            CMTrue : CMFalse;
+    return iiter->curr? CMTrue : CMFalse;
 }
 
 CMUTIL_STATIC void *CMUTIL_MapIterNext(CMUTIL_Iterator *iter)
 {
     CMUTIL_MapIter_st *iiter = (CMUTIL_MapIter_st*)iter;
-    CMUTIL_MapItem *item = CMCall(iiter->imap->keyset, GetAt, iiter->index);
+    const CMUTIL_MapItem *item = iiter->curr;
     if (item) {
-        iiter->index++;
+        // the returned item may be removed before the next call.
+        iiter->curr = item->next;
         return item->value;
     }
     return NULL;
@@ -378,32 +791,65 @@ CMUTIL_STATIC CMUTIL_Iterator *CMUTIL_MapIterator(const CMUTIL_Map *map)
     memset(res, 0x0, sizeof(CMUTIL_MapIter_st));
     memcpy(res, &g_cmutil_map_iterator, sizeof(CMUTIL_Iterator));
     res->imap = imap;
-    res->index = 0;
+    res->curr = imap->head;
 
     return (CMUTIL_Iterator*)res;
 }
 
+CMUTIL_STATIC CMBool CMUTIL_MapEach(
+        const CMUTIL_Map *map, CMMapEachCB callback, void *udata)
+{
+    const CMUTIL_Map_Internal *imap = (const CMUTIL_Map_Internal*)map;
+    const CMUTIL_MapItem *item = imap->head;
+    while (item) {
+        // the callback may remove the item it receives.
+        const CMUTIL_MapItem *next = item->next;
+        if (!callback(item->key, item->value, udata))
+            return CMFalse;
+        item = next;
+    }
+    return CMTrue;
+}
+
+// frees the items of an unordered map, which are found in the tables only.
+CMUTIL_STATIC void CMUTIL_MapClearTable(
+        CMUTIL_Map_Internal *imap, CMUTIL_MapTable *tab, CMBool freedata)
+{
+    size_t i;
+    for (i=0; tab->ctrl && i<tab->capacity; i++) {
+        if (tab->ctrl[i] >= 0) {
+            if (imap->freecb && freedata)
+                imap->freecb(tab->slots[i]->value);
+            CMUTIL_MapItemFree(imap, tab->slots[i]);
+        }
+    }
+}
+
 CMUTIL_STATIC void CMUTIL_MapClearBase(CMUTIL_Map *map, CMBool freedata)
 {
     CMUTIL_Map_Internal *imap = (CMUTIL_Map_Internal*)map;
-    uint32_t i, j;
-
-    for (i=0; i<imap->bucket_size; i++) {
-        CMUTIL_Array *bucket = imap->buckets[i];
-        if (bucket) {
-            for (j=0; j<CMCall(bucket, GetSize); j++) {
-                CMUTIL_MapItem *item =
-                        (CMUTIL_MapItem*)CMCall(bucket, GetAt, j);
-                imap->memst->Free(item->key);
-                if (imap->freecb && freedata)
-                    imap->freecb(item->value);
-                imap->memst->Free(item);
-            }
-            bucket->Clear(bucket);
-        }
+    CMUTIL_MapItem *item = imap->head;
+
+    while (item) {
+        CMUTIL_MapItem *next = item->next;
+        if (imap->freecb && freedata)
+            imap->freecb(item->value);
+        CMUTIL_MapItemFree(imap, item);
+        item = next;
+    }
+    if (imap->unordered) {
+        CMUTIL_MapClearTable(imap, &imap->table, freedata);
+        CMUTIL_MapClearTable(imap, &imap->old, freedata);
+    }
+    memset(imap->table.ctrl, CMUTIL_MAP_EMPTY, imap->table.capacity);
+    imap->table.tombs = 0;
+    if (imap->old.ctrl) {
+        imap->memst->Free(imap->old.ctrl);
+        memset(&imap->old, 0x0, sizeof(CMUTIL_MapTable));
     }
 
-    CMCall(imap->keyset, Clear);
+    imap->head = imap->tail = NULL;
+    imap->ordfirst = imap->ordend = imap->holes = 0;
     imap->size = 0;
 }
 
@@ -417,46 +863,35 @@ CMUTIL_STATIC void CMUTIL_MapClearLink(CMUTIL_Map *map)
     CMUTIL_MapClearBase(map, CMFalse);
 }
 
+// frees everything but the map structure itself.
+CMUTIL_STATIC void CMUTIL_MapRelease(CMUTIL_Map_Internal *imap)
+{
+    CMUTIL_MapClearBase((CMUTIL_Map*)imap, CMTrue);
+    if (imap->order)
+        imap->memst->Free(imap->order);
+    imap->memst->Free(imap->table.ctrl);
+}
+
 CMUTIL_STATIC void CMUTIL_MapDestroy(CMUTIL_Map *map)
 {
     CMUTIL_Map_Internal *imap = (CMUTIL_Map_Internal*)map;
-    uint32_t i, j;
-
-    for (i=0; i<imap->bucket_size; i++) {
-        CMUTIL_Array *bucket = imap->buckets[i];
-        if (bucket) {
-            for (j=0; j<CMCall(bucket, GetSize); j++) {
-                CMUTIL_MapItem *item =
-                        (CMUTIL_MapItem*)CMCall(bucket, GetAt, j);
-                imap->memst->Free(item->key);
-                if (imap->freecb)
-                    imap->freecb(item->value);
-                imap->memst->Free(item);
-            }
-            CMCall(bucket, Destroy);
-        }
-    }
-    CMCall(imap->keyset, Destroy);
-    imap->memst->Free(imap->buckets);
+    CMUTIL_MapRelease(imap);
     imap->memst->Free(imap);
 }
 
 CMUTIL_STATIC void CMUTIL_MapPrintTo(const CMUTIL_Map *map, CMUTIL_String *out, const char*(*to_strcb)(void*))
 {
     const CMUTIL_Map_Internal *imap = (const CMUTIL_Map_Internal*)map;
-    uint32_t i;
+    const CMUTIL_MapItem *item;
 
     CMCall(out, AddChar, '{');
-    for (i=0; i<CMCall(imap->keyset, GetSize); i++) {
-        CMUTIL_String *sv = NULL;
+    for (item = imap->head; item; item = item->next) {
         const char *v = NULL;
-        const CMUTIL_MapItem *item =
-                (CMUTIL_MapItem*)CMCall(imap->keyset, GetAt, i);
-        if (i > 0)
+        void *val = item->value;
+        if (item != imap->head)
             CMCall(out, AddString, ", ");
         CMCall(out, AddString, item->key);
         CMCall(out, AddChar, '=');
-        void *val = CMCall(map, Get, item->key);
         if (to_strcb)
             v = to_strcb(val);
         else
@@ -471,8 +906,7 @@ CMUTIL_STATIC void *CMUTIL_MapGetAt(
 {
     const CMUTIL_Map_Internal *imap = (const CMUTIL_Map_Internal*)map;
     if (index < imap->size) {
-        CMUTIL_MapItem *item = (CMUTIL_MapItem*)CMCall(imap->keyset, GetAt, index);
-        return CMCall(map, Get, item->key);
+        return CMUTIL_MapItemAt(imap, index)->value;
     } else {
         CMLogErrorS("index out of bound map size: %u, index: %u",
                     (uint32_t)imap->size, index);
@@ -485,8 +919,8 @@ CMUTIL_STATIC void *CMUTIL_MapRemoveAt(
 {
     CMUTIL_Map_Internal *imap = (CMUTIL_Map_Internal*)map;
     if (index < imap->size) {
-        CMUTIL_MapItem *item = (CMUTIL_MapItem*)CMCall(imap->keyset, GetAt, index);
-        return CMCall(map, Remove, item->key);
+        const CMUTIL_MapItem *item = CMUTIL_MapItemAt(imap, index);
+        return CMUTIL_MapRemoveBase(imap, item->key, item->keylen);
     } else {
         CMLogErrorS("index out of bound map size: %u, index: %u",
                     (uint32_t)imap->size, index);
@@ -494,6 +928,180 @@ CMUTIL_STATIC void *CMUTIL_MapRemoveAt(
     }
 }
 
+CMUTIL_STATIC CMBool CMUTIL_MapReserve(CMUTIL_Map *map, size_t count)
+{
+    CMUTIL_Map_Internal *imap = (CMUTIL_Map_Internal*)map;
+    size_t capacity = imap->table.capacity;
+    while ((size_t)((double)capacity * imap->load_factor) <= count)
+        capacity *= 2;
+    if (capacity > imap->table.capacity &&
+            !CMUTIL_MapResize(imap, capacity)) {
+        CMLogError("Failed to allocate memory for map table.");
+        return CMFalse;
+    }
+    // reserving is an explicit request, so the table is moved at once.
+    CMUTIL_MapMigrate(imap, imap->old.capacity);
+    return CMTrue;
+}
+
+/*
+ * Array view of the pairs of a map, returned by GetPairs. It reads the
+ * map's order directly, so it is always current and is never built.
+ */
+#define CMUTIL_MapPairsOf(a)    (((const CMUTIL_MapPairs*)(a))->imap)
+
+CMUTIL_STATIC void *CMUTIL_MapPairsReadOnly(void)
+{
+    CMLogErrorS("Pairs of a map are read only.");
+    return NULL;
+}
+
+CMUTIL_STATIC CMBool CMUTIL_MapPairsAdd(
+        CMUTIL_Array *array, void *item, void **ret)
+{
+    CMUTIL_UNUSED(array, item, ret);
+    CMUTIL_MapPairsReadOnly();
+    return CMFalse;
+}
+
+CMUTIL_STATIC void *CMUTIL_MapPairsRemove(
+        CMUTIL_Array *array, const void *compval)
+{
+    CMUTIL_UNUSED(array, compval);
+    return CMUTIL_MapPairsReadOnly();
+}
+
+CMUTIL_STATIC void *CMUTIL_MapPairsSetAt(
+        CMUTIL_Array *array, void *item, uint32_t index)
+{
+    CMUTIL_UNUSED(array, item, index);
+    return CMUTIL_MapPairsReadOnly();
+}
+
+CMUTIL_STATIC void *CMUTIL_MapPairsRemoveAt(
+        CMUTIL_Array *array, uint32_t index)
+{
+    CMUTIL_UNUSED(array, index);
+    return CMUTIL_MapPairsReadOnly();
+}
+
+CMUTIL_STATIC void *CMUTIL_MapPairsGetAt(
+        const CMUTIL_Array *array, uint32_t index)
+{
+    const CMUTIL_Map_Internal *imap = CMUTIL_MapPairsOf(array);
+    if (index < imap->size)
+        return CMUTIL_MapItemAt(imap, index);
+    CMLogErrorS("index out of bound map size: %u, index: %u",
+                (uint32_t)imap->size, index);
+    return NULL;
+}
+
+CMUTIL_STATIC void *CMUTIL_MapPairsFind(
+        const CMUTIL_Array *array, const void *compval, uint32_t *index)
+{
+    // pairs have no comparator.
+    CMUTIL_UNUSED(array, compval, index);
+    return NULL;
+}
+
+CMUTIL_STATIC size_t CMUTIL_MapPairsGetSize(const CMUTIL_Array *array)
+{
+    return CMUTIL_MapPairsOf(array)->size;
+}
+
+CMUTIL_STATIC CMBool CMUTIL_MapPairsPush(CMUTIL_Array *array, void *item)
+{
+    return CMUTIL_MapPairsAdd(array, item, NULL);
+}
+
+CMUTIL_STATIC void *CMUTIL_MapPairsPop(CMUTIL_Array *array)
+{
+    CMUTIL_UNUSED(array);
+    return CMUTIL_MapPairsReadOnly();
+}
+
+CMUTIL_STATIC void *CMUTIL_MapPairsTop(const CMUTIL_Array *array)
+{
+    return CMUTIL_MapPairsOf(array)->tail;
+}
+
+CMUTIL_STATIC void *CMUTIL_MapPairsBottom(const CMUTIL_Array *array)
+{
+    return CMUTIL_MapPairsOf(array)->head;
+}
+
+CMUTIL_STATIC void *CMUTIL_MapPairsIterNext(CMUTIL_Iterator *iter)
+{
+    CMUTIL_MapIter_st *iiter = (CMUTIL_MapIter_st*)iter;
+    const CMUTIL_MapItem *item = iiter->curr;
+    if (item)
+        iiter->curr = item->next;
+    return (void*)item;
+}
+
+static CMUTIL_Iterator g_cmutil_map_pairs_iterator = {
+    CMUTIL_MapIterHasNext,
+    CMUTIL_MapPairsIterNext,
+    CMUTIL_MapIterDestroy
+};
+
+CMUTIL_STATIC CMUTIL_Iterator *CMUTIL_MapPairsIterator(
+        const CMUTIL_Array *array)
+{
+    CMUTIL_MapIter_st *res = (CMUTIL_MapIter_st*)CMUTIL_MapIterator(
+                (const CMUTIL_Map*)CMUTIL_MapPairsOf(array));
+    memcpy(res, &g_cmutil_map_pairs_iterator, sizeof(CMUTIL_Iterator));
+    return (CMUTIL_Iterator*)res;
+}
+
+CMUTIL_STATIC void CMUTIL_MapPairsClear(CMUTIL_Array *array)
+{
+    CMUTIL_UNUSED(array);
+    CMUTIL_MapPairsReadOnly();
+}
+
+CMUTIL_STATIC CMBool CMUTIL_MapPairsSort(
+        CMUTIL_Array *array, CMCompareCB comparator, CMUTIL_ThreadPool *pool)
+{
+    CMUTIL_UNUSED(array, comparator, pool);
+    CMUTIL_MapPairsReadOnly();
+    return CMFalse;
+}
+
+CMUTIL_STATIC CMBool CMUTIL_MapPairsEach(
+        const CMUTIL_Array *array, CMEachCB callback, void *udata)
+{
+    const CMUTIL_MapItem *item = CMUTIL_MapPairsOf(array)->head;
+    while (item) {
+        const CMUTIL_MapItem *next = item->next;
+        if (!callback((void*)item, udata))
+            return CMFalse;
+        item = next;
+    }
+    return CMTrue;
+}
+
+static CMUTIL_Array g_cmutil_map_pairs = {
+    CMUTIL_MapPairsAdd,
+    CMUTIL_MapPairsRemove,
+    CMUTIL_MapPairsSetAt,
+    CMUTIL_MapPairsRemoveAt,
+    CMUTIL_MapPairsSetAt,
+    CMUTIL_MapPairsGetAt,
+    CMUTIL_MapPairsFind,
+    CMUTIL_MapPairsGetSize,
+    CMUTIL_MapPairsPush,
+    CMUTIL_MapPairsPop,
+    CMUTIL_MapPairsTop,
+    CMUTIL_MapPairsBottom,
+    CMUTIL_MapPairsIterator,
+    CMUTIL_MapPairsClear,
+    CMUTIL_MapPairsClear,
+    CMUTIL_MapPairsSort,
+    CMUTIL_MapPairsSort,
+    CMUTIL_MapPairsEach
+};
+
 static CMUTIL_Map g_cmutil_map = {
     CMUTIL_MapPut,
     CMUTIL_MapPutAll,
@@ -508,36 +1116,83 @@ static CMUTIL_Map g_cmutil_map = {
     CMUTIL_MapDestroy,
     CMUTIL_MapPrintTo,
     CMUTIL_MapGetAt,
-    CMUTIL_MapRemoveAt
+    CMUTIL_MapRemoveAt,
+    CMUTIL_MapReserve,
+    CMUTIL_MapEach
 };
 
-CMUTIL_STATIC int CMUTIL_MapCompareOrder(const void *a, const void *b)
+// rounds the requested bucket size to a power of 2 table capacity.
+CMUTIL_STATIC size_t CMUTIL_MapCapacity(uint32_t bucketsize)
 {
-    return ((CMUTIL_MapItem*)a)->order - ((CMUTIL_MapItem*)b)->order;
+    size_t capacity = CMUTIL_MAP_GROUP;
+    // every slot is a bucket of its own.
+    while (capacity < bucketsize)
+        capacity *= 2;
+    return capacity;
 }
 
-CMUTIL_Map *CMUTIL_MapCreateInternal(
-        CMUTIL_Mem *memst, uint32_t bucketsize,
-        CMBool isucase, CMFreeCB freecb, float load_factor)
+CMUTIL_STATIC float CMUTIL_MapLoadFactor(float load_factor)
 {
-    CMUTIL_Map_Internal *imap = memst->Alloc(sizeof(CMUTIL_Map_Internal));
-    memset(imap, 0x0, sizeof(CMUTIL_Map_Internal));
+    // probing gets long beyond 7/8 of slots used.
+    if (load_factor <= 0.25f || load_factor > 0.875f)
+        load_factor = 0.875f;
+    return load_factor;
+}
 
-    memcpy(imap, &g_cmutil_map, sizeof(CMUTIL_Map));
-    imap->buckets = memst->Alloc(sizeof(CMUTIL_Array*)*bucketsize);
-    memset(imap->buckets, 0x0, sizeof(CMUTIL_Array*)*bucketsize);
-    imap->bucket_size = bucketsize;
-    imap->is_ucase = isucase;
-    imap->load_factor = load_factor;
-    imap->keyset = CMUTIL_ArrayCreateInternal(
-                memst, bucketsize, CMUTIL_MapCompareOrder,
-                NULL, CMTrue);
+CMUTIL_STATIC CMBool CMUTIL_MapInit(
+        CMUTIL_Map_Internal *imap, CMUTIL_Mem *memst, uint32_t bucketsize,
+        CMBool isucase, CMBool interned, CMFreeCB freecb, float load_factor)
+{
     imap->memst = memst;
+    imap->is_ucase = isucase;
+    // atoms live in the global allocator and would outlive an arena's
+    // reset, so maps on other allocators keep their keys inline.
+    imap->interned = interned && memst == CMUTIL_GetMem();
+    imap->load_factor = CMUTIL_MapLoadFactor(load_factor);
+    if (!CMUTIL_MapAllocTable(
+                imap, &imap->table, CMUTIL_MapCapacity(bucketsize)))
+        return CMFalse;
+    memcpy(&imap->pairs, &g_cmutil_map_pairs, sizeof(CMUTIL_Array));
+    imap->pairs.imap = imap;
     imap->freecb = freecb;
+    if (memst == CMUTIL_GetMem())
+        imap->pool = CMUTIL_ObjectPoolShared(
+                    sizeof(CMUTIL_MapItem) + CMUTIL_MAP_INLINE_KEY);
+    return CMTrue;
+}
 
+CMUTIL_STATIC CMUTIL_Map *CMUTIL_MapCreateBase(
+        CMUTIL_Mem *memst, uint32_t bucketsize, CMBool isucase,
+        CMBool interned, CMFreeCB freecb, float load_factor)
+{
+    CMUTIL_Map_Internal *imap = memst->Alloc(sizeof(CMUTIL_Map_Internal));
+    memset(imap, 0x0, sizeof(CMUTIL_Map_Internal));
+
+    memcpy(imap, &g_cmutil_map, sizeof(CMUTIL_Map));
+    if (!CMUTIL_MapInit(imap, memst, bucketsize,
+                        isucase, interned, freecb, load_factor)) {
+        memst->Free(imap);
+        return NULL;
+    }
     return (CMUTIL_Map*)imap;
 }
 
+CMUTIL_Map *CMUTIL_MapCreateInternal(
+        CMUTIL_Mem *memst, uint32_t bucketsize,
+        CMBool isucase, CMFreeCB freecb, float load_factor)
+{
+    return CMUTIL_MapCreateBase(
+                memst, bucketsize, isucase, CMFalse, freecb, load_factor);
+}
+
+CMUTIL_Map *CMUTIL_MapCreateInternedInternal(
+        CMUTIL_Mem *memst, uint32_t bucketsize,
+        CMBool isucase, CMFreeCB freecb, float load_factor)
+{
+    return CMUTIL_MapCreateBase(
+                memst, bucketsize, isucase, CMTrue, freecb, load_factor);
+}
+
 CMUTIL_Map *CMUTIL_MapCreateEx(
         uint32_t bucketsize, CMBool isucase, CMFreeCB freecb, float load_factor)
 {
@@ -545,3 +1200,406 @@ CMUTIL_Map *CMUTIL_MapCreateEx(
                 CMUTIL_GetMem(), bucketsize, isucase, freecb, load_factor);
 }
 
+CMUTIL_Map *CMUTIL_MapCreateInterned(
+        uint32_t bucketsize, CMBool isucase, CMFreeCB freecb, float load_factor)
+{
+    return CMUTIL_MapCreateInternedInternal(
+                CMUTIL_GetMem(), bucketsize, isucase, freecb, load_factor);
+}
+
+void CMUTIL_MapAtomInit(void)
+{
+    int i;
+    memset(g_cmutil_map_atoms, 0x0, sizeof(g_cmutil_map_atoms));
+    for (i=0; i<CMUTIL_MAP_ATOM_SHARDS; i++) {
+        CMUTIL_MapAtomShard *shard = &g_cmutil_map_atoms[i];
+        shard->mutex = CMUTIL_MutexCreateInternal(CMUTIL_GetMem());
+        shard->atoms[0] = (CMUTIL_Map_Internal*)CMUTIL_MapCreateInternal(
+                    CMUTIL_GetMem(), 0, CMFalse, NULL, 0.75f);
+        shard->atoms[1] = (CMUTIL_Map_Internal*)CMUTIL_MapCreateInternal(
+                    CMUTIL_GetMem(), 0, CMTrue, NULL, 0.75f);
+        // atoms are only looked up, nobody asks for their order.
+        shard->atoms[0]->unordered = CMTrue;
+        shard->atoms[1]->unordered = CMTrue;
+    }
+}
+
+void CMUTIL_MapAtomClear(void)
+{
+    int i;
+    for (i=0; i<CMUTIL_MAP_ATOM_SHARDS; i++) {
+        CMUTIL_MapAtomShard *shard = &g_cmutil_map_atoms[i];
+        if (shard->atoms[0])
+            CMCall((CMUTIL_Map*)shard->atoms[0], Destroy);
+        if (shard->atoms[1])
+            CMCall((CMUTIL_Map*)shard->atoms[1], Destroy);
+        if (shard->mutex)
+            CMCall(shard->mutex, Destroy);
+    }
+    memset(g_cmutil_map_atoms, 0x0, sizeof(g_cmutil_map_atoms));
+}
+
+
+//*****************************************************************************
+// CMUTIL_BinaryMap implementation
+//*****************************************************************************
+
+/*
+ * Binary keyed map shares the table and items with CMUTIL_Map, only the
+ * key length is given by the caller instead of strlen.
+ */
+typedef struct CMUTIL_BinaryMap_Internal {
+    CMUTIL_BinaryMap    base;
+    CMUTIL_Map_Internal map;
+} CMUTIL_BinaryMap_Internal;
+
+#define CMUTIL_BinaryMapCore(m) (&((CMUTIL_BinaryMap_Internal*)(m))->map)
+
+CMUTIL_STATIC CMBool CMUTIL_BinaryMapPut(
+        CMUTIL_BinaryMap *map, const void *key, size_t keylen,
+        void *value, void **prev)
+{
+    return CMUTIL_MapPutBase(
+                CMUTIL_BinaryMapCore(map), key, keylen, value, prev);
+}
+
+CMUTIL_STATIC void *CMUTIL_BinaryMapGet(
+        const CMUTIL_BinaryMap *map, const void *key, size_t keylen)
+{
+    return CMUTIL_MapGetBase(CMUTIL_BinaryMapCore(map), key, keylen);
+}
+
+CMUTIL_STATIC void *CMUTIL_BinaryMapRemove(
+        CMUTIL_BinaryMap *map, const void *key, size_t keylen)
+{
+    return CMUTIL_MapRemoveBase(CMUTIL_BinaryMapCore(map), key, keylen);
+}
+
+CMUTIL_STATIC size_t CMUTIL_BinaryMapGetSize(const CMUTIL_BinaryMap *map)
+{
+    return CMUTIL_BinaryMapCore(map)->size;
+}
+
+CMUTIL_STATIC const CMUTIL_Array *CMUTIL_BinaryMapGetPairs(
+        const CMUTIL_BinaryMap *map)
+{
+    return (const CMUTIL_Array*)&CMUTIL_BinaryMapCore(map)->pairs;
+}
+
+CMUTIL_STATIC CMUTIL_Iterator *CMUTIL_BinaryMapIterator(
+        const CMUTIL_BinaryMap *map)
+{
+    return CMUTIL_MapIterator((CMUTIL_Map*)CMUTIL_BinaryMapCore(map));
+}
+
+CMUTIL_STATIC void CMUTIL_BinaryMapClear(CMUTIL_BinaryMap *map)
+{
+    CMUTIL_MapClearBase((CMUTIL_Map*)CMUTIL_BinaryMapCore(map), CMTrue);
+}
+
+CMUTIL_STATIC void CMUTIL_BinaryMapClearLink(CMUTIL_BinaryMap *map)
+{
+    CMUTIL_MapClearBase((CMUTIL_Map*)CMUTIL_BinaryMapCore(map), CMFalse);
+}
+
+CMUTIL_STATIC CMBool CMUTIL_BinaryMapReserve(
+        CMUTIL_BinaryMap *map, size_t count)
+{
+    return CMUTIL_MapReserve((CMUTIL_Map*)CMUTIL_BinaryMapCore(map), count);
+}
+
+CMUTIL_STATIC void CMUTIL_BinaryMapDestroy(CMUTIL_BinaryMap *map)
+{
+    CMUTIL_Map_Internal *imap = CMUTIL_BinaryMapCore(map);
+    CMUTIL_Mem *memst = imap->memst;
+    CMUTIL_MapRelease(imap);
+    memst->Free(map);
+}
+
+static CMUTIL_BinaryMap g_cmutil_binarymap = {
+    CMUTIL_BinaryMapPut,
+    CMUTIL_BinaryMapGet,
+    CMUTIL_BinaryMapRemove,
+    CMUTIL_BinaryMapGetSize,
+    CMUTIL_BinaryMapGetPairs,
+    CMUTIL_BinaryMapIterator,
+    CMUTIL_BinaryMapClear,
+    CMUTIL_BinaryMapClearLink,
+    CMUTIL_BinaryMapReserve,
+    CMUTIL_BinaryMapDestroy
+};
+
+CMUTIL_BinaryMap *CMUTIL_BinaryMapCreateInternal(
+        CMUTIL_Mem *memst, uint32_t bucketsize,
+        CMFreeCB freecb, float load_factor)
+{
+    CMUTIL_BinaryMap_Internal *ibmap =
+            memst->Alloc(sizeof(CMUTIL_BinaryMap_Internal));
+    memset(ibmap, 0x0, sizeof(CMUTIL_BinaryMap_Internal));
+
+    memcpy(ibmap, &g_cmutil_binarymap, sizeof(CMUTIL_BinaryMap));
+    if (!CMUTIL_MapInit(&ibmap->map, memst, bucketsize,
+                        CMFalse, CMFalse, freecb, load_factor)) {
+        memst->Free(ibmap);
+        return NULL;
+    }
+    return (CMUTIL_BinaryMap*)ibmap;
+}
+
+CMUTIL_BinaryMap *CMUTIL_BinaryMapCreateEx(
+        uint32_t bucketsize, CMFreeCB freecb, float load_factor)
+{
+    return CMUTIL_BinaryMapCreateInternal(
+                CMUTIL_GetMem(), bucketsize, freecb, load_factor);
+}
+
+//*****************************************************************************
+// CMUTIL_IntMap implementation
+//*****************************************************************************
+
+/*
+ * Same control bytes and group probing as CMUTIL_Map, but keys and values
+ * live in the slots themselves, so entries need no allocation at all.
+ * Order of entries is not kept.
+ */
+typedef struct CMUTIL_IntMapSlot {
+    uint64_t            key;
+    void                *value;
+} CMUTIL_IntMapSlot;
+
+typedef struct CMUTIL_IntMap_Internal {
+    CMUTIL_IntMap       base;
+    int8_t              *ctrl;      // control bytes, followed by slots
+    CMUTIL_IntMapSlot   *slots;
+    size_t              capacity;   // count of slots, power of 2
+    size_t              size;
+    size_t              tombs;      // deleted slots
+    size_t              growth;     // size + tombs limit before resizing
+    CMFreeCB            freecb;
+    CMUTIL_Mem          *memst;
+    float               load_factor;
+    int                 dummy_padder;
+} CMUTIL_IntMap_Internal;
+
+CMUTIL_STATIC size_t CMUTIL_IntMapFind(
+        const CMUTIL_IntMap_Internal *imap, uint64_t hash, uint64_t key)
+{
+    size_t gmask = imap->capacity / CMUTIL_MAP_GROUP - 1;
+    size_t gidx = (size_t)CMUTIL_MAP_H1(hash) & gmask;
+    size_t step = 0;
+    int8_t h2 = CMUTIL_MAP_H2(hash);
+    while (CMTrue) {
+        const int8_t *group = imap->ctrl + gidx * CMUTIL_MAP_GROUP;
+        uint64_t mask = CMUTIL_MapMatch(group, h2);
+        while (mask) {
+            size_t idx = gidx * CMUTIL_MAP_GROUP + CMUTIL_MapMaskNext(&mask);
+            if (imap->slots[idx].key == key)
+                return idx;
+        }
+        if (CMUTIL_MapMatch(group, CMUTIL_MAP_EMPTY))
+            return imap->capacity;
+        gidx = (gidx + ++step) & gmask;
+    }
+}
+
+// moves all entries to a new table of the given capacity.
+CMUTIL_STATIC CMBool CMUTIL_IntMapRehash(
+        CMUTIL_IntMap_Internal *imap, size_t capacity)
+{
+    int8_t *octrl = imap->ctrl;
+    CMUTIL_IntMapSlot *oslots = imap->slots;
+    size_t i, ocap = imap->capacity;
+    int8_t *ctrl = imap->memst->Alloc(
+                capacity * (sizeof(int8_t) + sizeof(CMUTIL_IntMapSlot)));
+    if (ctrl == NULL)
+        return CMFalse;
+    memset(ctrl, CMUTIL_MAP_EMPTY, capacity);
+    imap->ctrl = ctrl;
+    imap->slots = (CMUTIL_IntMapSlot*)(ctrl + capacity);
+    imap->capacity = capacity;
+    imap->tombs = 0;
+    imap->growth = (size_t)((double)capacity * imap->load_factor);
+    if (imap->growth >= capacity)
+        imap->growth = capacity - 1;
+    for (i=0; i<ocap; i++) {
+        if (octrl[i] >= 0) {
+            uint64_t hash = CMUTIL_HashU64(oslots[i].key);
+            size_t idx = CMUTIL_MapFindFree(ctrl, capacity, hash);
+            ctrl[idx] = CMUTIL_MAP_H2(hash);
+            imap->slots[idx] = oslots[i];
+        }
+    }
+    if (octrl)
+        imap->memst->Free(octrl);
+    return CMTrue;
+}
+
+CMUTIL_STATIC CMBool CMUTIL_IntMapPut(
+        CMUTIL_IntMap *map, uint64_t key, void *value, void **prev)
+{
+    CMUTIL_IntMap_Internal *imap = (CMUTIL_IntMap_Internal*)map;
+    uint64_t hash = CMUTIL_HashU64(key);
+    size_t idx = CMUTIL_IntMapFind(imap, hash, key);
+    if (prev)
+        *prev = NULL;
+    if (idx < imap->capacity) {
+        if (prev)
+            *prev = imap->slots[idx].value;
+        imap->slots[idx].value = value;
+        return CMTrue;
+    }
+    if (imap->size + imap->tombs >= imap->growth) {
+        size_t ncap = imap->tombs > imap->size / 2?
+                    imap->capacity : imap->capacity * 2;
+        if (!CMUTIL_IntMapRehash(imap, ncap)) {
+            CMLogError("Failed to allocate memory for map table.");
+            return CMFalse;
+        }
+    }
+    idx = CMUTIL_MapFindFree(imap->ctrl, imap->capacity, hash);
+    if (imap->ctrl[idx] == CMUTIL_MAP_DELETED)
+        imap->tombs--;
+    imap->ctrl[idx] = CMUTIL_MAP_H2(hash);
+    imap->slots[idx].key = key;
+    imap->slots[idx].value = value;
+    imap->size++;
+    return CMTrue;
+}
+
+CMUTIL_STATIC void *CMUTIL_IntMapGet(const CMUTIL_IntMap *map, uint64_t key)
+{
+    const CMUTIL_IntMap_Internal *imap = (const CMUTIL_IntMap_Internal*)map;
+    size_t idx = CMUTIL_IntMapFind(imap, CMUTIL_HashU64(key), key);
+    return idx < imap->capacity? imap->slots[idx].value : NULL;
+}
+
+CMUTIL_STATIC CMBool CMUTIL_IntMapContainsKey(
+        const CMUTIL_IntMap *map, uint64_t key)
+{
+    const CMUTIL_IntMap_Internal *imap = (const CMUTIL_IntMap_Internal*)map;
+    return CMUTIL_IntMapFind(imap, CMUTIL_HashU64(key), key) < imap->capacity?
+                CMTrue : CMFalse;
+}
+
+CMUTIL_STATIC void *CMUTIL_IntMapRemove(CMUTIL_IntMap *map, uint64_t key)
+{
+    CMUTIL_IntMap_Internal *imap = (CMUTIL_IntMap_Internal*)map;
+    size_t idx = CMUTIL_IntMapFind(imap, CMUTIL_HashU64(key), key);
+    if (idx >= imap->capacity)
+        return NULL;
+    // same rule as CMUTIL_MapRemoveBase.
+    if (CMUTIL_MapMatch(imap->ctrl + (idx & ~(size_t)(CMUTIL_MAP_GROUP - 1)),
+                        CMUTIL_MAP_EMPTY)) {
+        imap->ctrl[idx] = CMUTIL_MAP_EMPTY;
+    } else {
+        imap->ctrl[idx] = CMUTIL_MAP_DELETED;
+        imap->tombs++;
+    }
+    imap->size--;
+    return imap->slots[idx].value;
+}
+
+CMUTIL_STATIC size_t CMUTIL_IntMapGetSize(const CMUTIL_IntMap *map)
+{
+    return ((const CMUTIL_IntMap_Internal*)map)->size;
+}
+
+CMUTIL_STATIC CMBool CMUTIL_IntMapNext(
+        const CMUTIL_IntMap *map, size_t *pos, uint64_t *key, void **value)
+{
+    const CMUTIL_IntMap_Internal *imap = (const CMUTIL_IntMap_Internal*)map;
+    while (*pos < imap->capacity) {
+        size_t idx = (*pos)++;
+        if (imap->ctrl[idx] >= 0) {
+            if (key)
+                *key = imap->slots[idx].key;
+            if (value)
+                *value = imap->slots[idx].value;
+            return CMTrue;
+        }
+    }
+    return CMFalse;
+}
+
+CMUTIL_STATIC void CMUTIL_IntMapClearBase(
+        CMUTIL_IntMap_Internal *imap, CMBool freedata)
+{
+    if (imap->freecb && freedata) {
+        size_t i;
+        for (i=0; i<imap->capacity; i++)
+            if (imap->ctrl[i] >= 0)
+                imap->freecb(imap->slots[i].value);
+    }
+    memset(imap->ctrl, CMUTIL_MAP_EMPTY, imap->capacity);
+    imap->size = 0;
+    imap->tombs = 0;
+}
+
+CMUTIL_STATIC void CMUTIL_IntMapClear(CMUTIL_IntMap *map)
+{
+    CMUTIL_IntMapClearBase((CMUTIL_IntMap_Internal*)map, CMTrue);
+}
+
+CMUTIL_STATIC void CMUTIL_IntMapClearLink(CMUTIL_IntMap *map)
+{
+    CMUTIL_IntMapClearBase((CMUTIL_IntMap_Internal*)map, CMFalse);
+}
+
+CMUTIL_STATIC CMBool CMUTIL_IntMapReserve(CMUTIL_IntMap *map, size_t count)
+{
+    CMUTIL_IntMap_Internal *imap = (CMUTIL_IntMap_Internal*)map;
+    size_t capacity = imap->capacity;
+    while ((size_t)((double)capacity * imap->load_factor) <= count)
+        capacity *= 2;
+    if (capacity > imap->capacity && !CMUTIL_IntMapRehash(imap, capacity)) {
+        CMLogError("Failed to allocate memory for map table.");
+        return CMFalse;
+    }
+    return CMTrue;
+}
+
+CMUTIL_STATIC void CMUTIL_IntMapDestroy(CMUTIL_IntMap *map)
+{
+    CMUTIL_IntMap_Internal *imap = (CMUTIL_IntMap_Internal*)map;
+    CMUTIL_IntMapClearBase(imap, CMTrue);
+    imap->memst->Free(imap->ctrl);
+    imap->memst->Free(imap);
+}
+
+static CMUTIL_IntMap g_cmutil_intmap = {
+    CMUTIL_IntMapPut,
+    CMUTIL_IntMapGet,
+    CMUTIL_IntMapContainsKey,
+    CMUTIL_IntMapRemove,
+    CMUTIL_IntMapGetSize,
+    CMUTIL_IntMapNext,
+    CMUTIL_IntMapClear,
+    CMUTIL_IntMapClearLink,
+    CMUTIL_IntMapReserve,
+    CMUTIL_IntMapDestroy
+};
+
+CMUTIL_IntMap *CMUTIL_IntMapCreateInternal(
+        CMUTIL_Mem *memst, uint32_t bucketsize,
+        CMFreeCB freecb, float load_factor)
+{
+    CMUTIL_IntMap_Internal *imap = memst->Alloc(sizeof(CMUTIL_IntMap_Internal));
+    memset(imap, 0x0, sizeof(CMUTIL_IntMap_Internal));
+
+    memcpy(imap, &g_cmutil_intmap, sizeof(CMUTIL_IntMap));
+    imap->memst = memst;
+    imap->freecb = freecb;
+    imap->load_factor = CMUTIL_MapLoadFactor(load_factor);
+    if (!CMUTIL_IntMapRehash(imap, CMUTIL_MapCapacity(bucketsize))) {
+        memst->Free(imap);
+        return NULL;
+    }
+    return (CMUTIL_IntMap*)imap;
+}
+
+CMUTIL_IntMap *CMUTIL_IntMapCreateEx(
+        uint32_t bucketsize, CMFreeCB freecb, float load_factor)
+{
+    return CMUTIL_IntMapCreateInternal(
+                CMUTIL_GetMem(), bucketsize, freecb, load_factor);
+}
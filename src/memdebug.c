@@ -22,11 +22,22 @@ OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
 SOFTWARE.
  */
 
+// mremap is a GNU extension.
+#if defined(__linux__) && !defined(_GNU_SOURCE)
+# define _GNU_SOURCE
+#endif
+
 #include "functions.h"
-#include <math.h>
 #include <assert.h>
 #include <time.h>
+#include <math.h>
 #include <stdint.h>
+#if !defined(MSWIN)
+# include <sys/mman.h>
+# if !defined(MAP_ANONYMOUS)
+#  define MAP_ANONYMOUS MAP_ANON
+# endif
+#endif
 
 #if defined(_MSC_VER)
 # define STRDUP _strdup
@@ -34,7 +45,13 @@ SOFTWARE.
 # define STRDUP strdup
 #endif
 
-#define MEM_BLOCK_SZ 45
+/*
+ * Size classes: 16 byte steps up to 256 bytes, then four classes per
+ * power of two(320, 384, 448, 512, 640, ...) up to 16TB.
+ */
+#define MEM_SMALL_CLASSES   16
+#define MEM_SMALL_STEP      16
+#define MEM_BLOCK_SZ        (MEM_SMALL_CLASSES + (44 - 8) * 4)
 
 
 static CMUTIL_Mem g_cmutil_memdebug_system = {
@@ -168,29 +185,21 @@ CMUTIL_STATIC void CMUTIL_MemLogWithStack(const char *fmt, ...)
 typedef struct CMUTIL_MemNode {
     size_t                  size;
     struct CMUTIL_MemNode   *next;
-    CMUTIL_String           *stack;
+    struct CMUTIL_MemNode   *prev;  // live list link, CMMemDebug only
+    CMUTIL_StackTrace       *stack; // allocation stack, CMMemDebug only
     int                     index;
-    char                    dummy_padder[3];
+    uint32_t                sample; // profile stack id + 1, 0 if not sampled
+    uint16_t                slabidx;// position in its slab, if any
+    // keeps the header a multiple of 16 bytes, so user data is aligned.
+    char                    dummy_padder[4];
+    unsigned char           state;
     unsigned char           flag;
 } CMUTIL_MemNode;
 
-CMUTIL_STATIC void CMUTIL_MemNodeDestroy(void *data)
-{
-    CMUTIL_MemNode *node = data;
-    if (node->stack)
-        CMCall(node->stack, Destroy);
-    free(data);
-}
-
-CMUTIL_STATIC int CMUTIL_MemRcyComparator(const void *a, const void *b)
-{
-    // memory address comparison
-    if (a > b)
-        return 1;
-    if (a < b)
-        return -1;
-    return 0;
-}
+// block states, only a block in use can be freed.
+#define CMUTIL_MEM_INUSE    0xA5
+#define CMUTIL_MEM_FREED    0x5A
+#define CMUTIL_MEM_TRIMMED  0x5B    // freed and its pages are discarded
 
 typedef struct CMUTIL_MemRcyList CMUTIL_MemRcyList;
 static struct CMUTIL_MemRcyList {
@@ -198,24 +207,825 @@ static struct CMUTIL_MemRcyList {
     int             cnt;
     int             avlcnt;
     CMUTIL_MemNode  *head;
-    CMUTIL_Array    *used;
-    size_t          usedsize;
+    CMUTIL_MemNode  *live;      // live blocks, tracked in CMMemDebug only
+    int64_t         inuse;      // live blocks not counted in any magazine
+    int64_t         usedsize;   // live bytes not counted in any magazine
+    int             magcap;     // capacity of a thread magazine, 0 if none
+    int             dummy_padder;
+    size_t          stride;     // block size including header, 0 if too big
+    size_t          slabsz;     // slab chunk size, 0 if malloc per block
+    struct CMUTIL_MemSlab *slabs; // chunks carved to blocks of this class
+    size_t          cachedsz;   // resident bytes in the free list
+    int             lowmark;    // least avlcnt since the last trimming
+    int             dummy_padder2;
+    // statistics, see CMUTIL_MemGetStats.
+    int64_t         heldsz;     // bytes of blocks or slabs of this class
+    int64_t         peakcnt;    // high water mark of cnt
+    int64_t         peakout;    // high water mark of cnt - avlcnt
+    int64_t         allocs;     // allocations not counted in any magazine
+    int64_t         frees;      // frees not counted in any magazine
+    int64_t         locks;
+    int64_t         contended;  // locks which had to wait for the mutex
 } g_cmutil_memrcyblocks[MEM_BLOCK_SZ];
 
+// bytes held by the allocator and its high water mark.
+static int64_t g_cmutil_mem_heldsz = 0;
+static int64_t g_cmutil_mem_peakheldsz = 0;
+// counters of the previous CMUTIL_MemGetStats call, for rates.
+static int64_t g_cmutil_memstat_prev[MEM_BLOCK_SZ + 1][2];
+static struct timeval g_cmutil_memstat_time;
+
+CMUTIL_STATIC void CMUTIL_MemRcyLock(CMUTIL_MemRcyList *list)
+{
+    if (!CMCall(list->mutex, TryLock)) {
+        CMCall(list->mutex, Lock);
+        list->contended++;
+    }
+    list->locks++;
+}
+
+// must be called with the list locked, whenever cnt or avlcnt changes.
+CMUTIL_STATIC void CMUTIL_MemRcyPeak(CMUTIL_MemRcyList *list)
+{
+    if (list->cnt > list->peakcnt)
+        list->peakcnt = list->cnt;
+    if (list->cnt - list->avlcnt > list->peakout)
+        list->peakout = list->cnt - list->avlcnt;
+}
+
+// must be called with the list locked, when memory is taken or released.
+CMUTIL_STATIC void CMUTIL_MemRcyHeld(CMUTIL_MemRcyList *list, int64_t delta)
+{
+    int64_t curr, peak;
+    list->heldsz += delta;
+    curr = CMUTIL_ATOMIC_ADD64(&g_cmutil_mem_heldsz, delta) + delta;
+    peak = CMUTIL_ATOMIC_LOAD64(&g_cmutil_mem_peakheldsz);
+    while (curr > peak &&
+           !CMUTIL_ATOMIC_CAS64(&g_cmutil_mem_peakheldsz, peak, curr))
+        peak = CMUTIL_ATOMIC_LOAD64(&g_cmutil_mem_peakheldsz);
+}
+
+/*
+ * Requests of g_cmutil_mem_mapthreshold bytes or more are mapped from the
+ * OS directly and unmapped on free. A mapping starts with its length and
+ * huge page flag, followed by the block header.
+ */
+#define CMUTIL_MEM_MAPPED       MEM_BLOCK_SZ    // class index of mappings
+#define CMUTIL_MEM_MAP_HDR      16
+#define CMUTIL_MEM_MAP_DEFAULT  ((size_t)1024 * 1024)
+#define CMUTIL_MEM_HUGEPAGE     ((size_t)2 * 1024 * 1024)
+
+static size_t g_cmutil_mem_mapthreshold = CMUTIL_MEM_MAP_DEFAULT;
+static CMBool g_cmutil_mem_hugepage = CMFalse;
+// counters and live list of mapped blocks, no free list is used.
+static CMUTIL_MemRcyList g_cmutil_memmapped;
+
+/*
+ * Free blocks of classes which are not carved from slabs are cached up to
+ * these limits, the others are released immediately.
+ */
+#define CMUTIL_MEM_CLASS_LIMIT  ((size_t)64 * 1024 * 1024)
+#define CMUTIL_MEM_TOTAL_LIMIT  ((size_t)512 * 1024 * 1024)
+// trimmed blocks of this size or bigger are kept with their pages discarded
+#define CMUTIL_MEM_DISCARD_MIN  ((size_t)256 * 1024)
+
+static size_t g_cmutil_mem_classlimit = CMUTIL_MEM_CLASS_LIMIT;
+static size_t g_cmutil_mem_totallimit = CMUTIL_MEM_TOTAL_LIMIT;
+static int64_t g_cmutil_mem_cachedsz = 0;
+static size_t g_cmutil_mem_pagesz = 4096;
+static CMUTIL_Timer *g_cmutil_mem_trimtimer = NULL;
+static CMUTIL_TimerTask *g_cmutil_mem_trimtask = NULL;
+static CMBool g_cmutil_mem_intimer = CMFalse;
+
+/*
+ * Blocks of small classes are carved from page multiple chunks(slabs).
+ * A slab header links the slabs of a class and counts the blocks of the
+ * slab in the free list, trimming releases slabs whose blocks are all free.
+ */
+typedef struct CMUTIL_MemSlab {
+    struct CMUTIL_MemSlab   *next;
+    struct CMUTIL_MemSlab   *prev;
+    int                     nfree;  // -1 while being released
+    int                     dummy_padder[3];
+} CMUTIL_MemSlab;
+
+#define CMUTIL_MEM_PAGE         4096
+#define CMUTIL_MEM_SLAB_HDR     sizeof(CMUTIL_MemSlab)
+#define CMUTIL_MEM_SLAB_MAX     4096    // largest block stride in slabs
+#define CMUTIL_MEM_SLAB_BLOCKS  8       // minimum blocks per chunk
+
+CMUTIL_STATIC CMUTIL_MemSlab *CMUTIL_MemSlabOf(
+        const CMUTIL_MemRcyList *list, const CMUTIL_MemNode *node)
+{
+    return (CMUTIL_MemSlab*)((uint8_t*)node - CMUTIL_MEM_SLAB_HDR -
+                             (size_t)node->slabidx * list->stride);
+}
+
+CMUTIL_STATIC void CMUTIL_MemNodeDestroy(
+        CMUTIL_MemRcyList *list, CMUTIL_MemNode *node)
+{
+    if (node->stack)
+        free(node->stack);
+    if (list->slabsz == 0)
+        free(node);
+}
+
+/*
+ * Puts a free block to the shared free list, must be called with the list
+ * locked. Returns CMFalse if the cache limits are exceeded, in that case
+ * the block must be released by the caller.
+ */
+CMUTIL_STATIC CMBool CMUTIL_MemRcyPutNode(
+        CMUTIL_MemRcyList *list, CMUTIL_MemNode *node)
+{
+    if (list->slabsz == 0) {
+        if (list->cachedsz + list->stride > g_cmutil_mem_classlimit ||
+                (size_t)CMUTIL_ATOMIC_LOAD64(&g_cmutil_mem_cachedsz) +
+                list->stride > g_cmutil_mem_totallimit) {
+            list->cnt--;
+            CMUTIL_MemRcyHeld(list, -(int64_t)list->stride);
+            return CMFalse;
+        }
+        list->cachedsz += list->stride;
+        CMUTIL_ATOMIC_ADD64(&g_cmutil_mem_cachedsz, (int64_t)list->stride);
+    } else {
+        CMUTIL_MemSlabOf(list, node)->nfree++;
+    }
+    node->next = list->head;
+    list->head = node;
+    list->avlcnt++;
+    return CMTrue;
+}
+
+// takes a free block from the shared free list with the list locked.
+CMUTIL_STATIC CMUTIL_MemNode *CMUTIL_MemRcyTakeNode(CMUTIL_MemRcyList *list)
+{
+    CMUTIL_MemNode *node = list->head;
+    if (node == NULL)
+        return NULL;
+    list->head = node->next;
+    list->avlcnt--;
+    if (list->avlcnt < list->lowmark)
+        list->lowmark = list->avlcnt;
+    CMUTIL_MemRcyPeak(list);
+    if (list->slabsz > 0) {
+        CMUTIL_MemSlabOf(list, node)->nfree--;
+    } else if (node->state != CMUTIL_MEM_TRIMMED) {
+        list->cachedsz -= list->stride;
+        CMUTIL_ATOMIC_ADD64(&g_cmutil_mem_cachedsz, -(int64_t)list->stride);
+    }
+    return node;
+}
+
+// gives back pages of a cached block to the OS, keeping its header.
+CMUTIL_STATIC CMBool CMUTIL_MemRcyDiscard(
+        CMUTIL_MemRcyList *list, CMUTIL_MemNode *node)
+{
+#if defined(MSWIN)
+    CMUTIL_UNUSED(list, node);
+    return CMFalse;
+#else
+    uintptr_t pmask = (uintptr_t)g_cmutil_mem_pagesz - 1;
+    uintptr_t start = ((uintptr_t)(node + 1) + pmask) & ~pmask;
+    uintptr_t end = ((uintptr_t)node + list->stride) & ~pmask;
+    if (list->stride < CMUTIL_MEM_DISCARD_MIN || end <= start)
+        return CMFalse;
+    return madvise((void*)start, end - start, MADV_DONTNEED) == 0?
+                CMTrue:CMFalse;
+#endif
+}
+
+/*
+ * Unlinks slabs whose blocks are all free, as long as 'keep' free blocks
+ * remain, and drops their blocks from the free list. Must be called with
+ * the list locked, unlinked slabs are returned to be freed by the caller.
+ */
+CMUTIL_STATIC CMUTIL_MemSlab *CMUTIL_MemRcyTrimSlabs(
+        CMUTIL_MemRcyList *list, int keep)
+{
+    int per = (int)((list->slabsz - CMUTIL_MEM_SLAB_HDR) / list->stride);
+    CMUTIL_MemSlab *slab = list->slabs, *release = NULL;
+    CMUTIL_MemNode **pp;
+    while (slab && list->avlcnt - per >= keep) {
+        CMUTIL_MemSlab *next = slab->next;
+        if (slab->nfree == per) {
+            if (slab->prev)
+                slab->prev->next = slab->next;
+            else
+                list->slabs = slab->next;
+            if (slab->next)
+                slab->next->prev = slab->prev;
+            slab->nfree = -1;
+            slab->next = release;
+            release = slab;
+            list->avlcnt -= per;
+            list->cnt -= per;
+            CMUTIL_MemRcyHeld(list, -(int64_t)list->slabsz);
+        }
+        slab = next;
+    }
+    if (release == NULL)
+        return NULL;
+    pp = &list->head;
+    while (*pp) {
+        CMUTIL_MemNode *node = *pp;
+        if (CMUTIL_MemSlabOf(list, node)->nfree < 0) {
+            *pp = node->next;
+            CMUTIL_MemNodeDestroy(list, node);
+        } else {
+            pp = &node->next;
+        }
+    }
+    return release;
+}
+
+/*
+ * Releases cached blocks of a class. If 'idle' is true, only blocks which
+ * were not reused since the previous trimming are released.
+ * Returns released bytes.
+ */
+CMUTIL_STATIC size_t CMUTIL_MemRcyTrimList(
+        CMUTIL_MemRcyList *list, CMBool idle)
+{
+    CMUTIL_MemNode **pp, *release = NULL;
+    size_t res = 0;
+    int keep;
+    if (list->stride == 0)
+        return 0;
+    CMUTIL_MemRcyLock(list);
+    // blocks under the low mark have stayed in the list since last time.
+    keep = idle? list->avlcnt - list->lowmark:0;
+    if (list->slabsz > 0) {
+        CMUTIL_MemSlab *slabs = CMUTIL_MemRcyTrimSlabs(list, keep);
+        list->lowmark = list->avlcnt;
+        CMCall(list->mutex, Unlock);
+        while (slabs) {
+            CMUTIL_MemSlab *slab = slabs;
+            slabs = slab->next;
+            free(slab);
+            res += list->slabsz;
+        }
+        return res;
+    }
+    pp = &list->head;
+    while (*pp && keep-- > 0)
+        pp = &(*pp)->next;
+    while (*pp) {
+        CMUTIL_MemNode *node = *pp;
+        if (node->state == CMUTIL_MEM_TRIMMED) {
+            pp = &node->next;
+            continue;
+        }
+        list->cachedsz -= list->stride;
+        CMUTIL_ATOMIC_ADD64(&g_cmutil_mem_cachedsz, -(int64_t)list->stride);
+        res += list->stride;
+        if (CMUTIL_MemRcyDiscard(list, node)) {
+            node->state = CMUTIL_MEM_TRIMMED;
+            pp = &node->next;
+        } else {
+            *pp = node->next;
+            node->next = release;
+            release = node;
+            list->avlcnt--;
+            list->cnt--;
+            CMUTIL_MemRcyHeld(list, -(int64_t)list->stride);
+        }
+    }
+    list->lowmark = list->avlcnt;
+    CMCall(list->mutex, Unlock);
+    while (release) {
+        CMUTIL_MemNode *node = release;
+        release = node->next;
+        free(node);
+    }
+    return res;
+}
+
+/*
+ * Every thread keeps a small stack(magazine) of free blocks per size class,
+ * so the class mutex is only taken when a magazine runs empty or overflows,
+ * and then half a magazine is moved at once.
+ * A magazine also counts blocks and bytes its thread allocated minus freed,
+ * these counters are summed up for the leak report.
+ */
+#define CMUTIL_MEM_MAG_MAX      64
+#define CMUTIL_MEM_MAG_BYTES    (256 * 1024)
+
+typedef struct CMUTIL_MemMagazine {
+    CMUTIL_MemNode  *head;
+    int             cnt;
+    int             dummy_padder;
+    int64_t         inuse;
+    int64_t         usedsize;
+    int64_t         allocs;
+    int64_t         frees;
+} CMUTIL_MemMagazine;
+
+typedef struct CMUTIL_MemThreadCache {
+    struct CMUTIL_MemThreadCache    *next;
+    CMBool                          active;
+    int                             dummy_padder;
+    CMUTIL_MemMagazine              mags[MEM_BLOCK_SZ];
+} CMUTIL_MemThreadCache;
+
+static CMUTIL_Mutex *g_cmutil_memcache_mutex = NULL;
+static CMUTIL_MemThreadCache *g_cmutil_memcaches = NULL;
+// increased on every initialization, so a cache pointer left in a thread
+// local variable by the previous initialization is never dereferenced.
+static uint32_t g_cmutil_memcache_gen = 0;
+static CMUTIL_TLS CMUTIL_MemThreadCache *t_cmutil_memcache = NULL;
+static CMUTIL_TLS uint32_t t_cmutil_memcache_gen = 0;
+// releases the cache of any exiting thread, not only of CMUTIL_Thread.
+static CMUTIL_TLSKey g_cmutil_memcache_key;
+static CMBool g_cmutil_memcache_haskey = CMFalse;
+
+CMUTIL_STATIC CMUTIL_MemThreadCache *CMUTIL_MemThreadCacheGet(void)
+{
+    CMUTIL_MemThreadCache *cache = t_cmutil_memcache;
+    if (cache && t_cmutil_memcache_gen == g_cmutil_memcache_gen)
+        return cache;
+
+    CMCall(g_cmutil_memcache_mutex, Lock);
+    // reuse a cache released by an exited thread.
+    for (cache = g_cmutil_memcaches; cache; cache = cache->next)
+        if (!cache->active)
+            break;
+    if (cache == NULL) {
+        cache = calloc(1, sizeof(CMUTIL_MemThreadCache));
+        if (cache) {
+            cache->next = g_cmutil_memcaches;
+            g_cmutil_memcaches = cache;
+        }
+    }
+    if (cache)
+        cache->active = CMTrue;
+    CMCall(g_cmutil_memcache_mutex, Unlock);
+
+    t_cmutil_memcache = cache;
+    t_cmutil_memcache_gen = g_cmutil_memcache_gen;
+    if (cache && g_cmutil_memcache_haskey)
+        CMUTIL_TLSKEY_SET(g_cmutil_memcache_key, cache);
+    return cache;
+}
+
+CMUTIL_STATIC void CMUTIL_MemMagazineFlush(
+        CMUTIL_MemMagazine *mag, CMUTIL_MemRcyList *list, int cnt)
+{
+    CMUTIL_MemNode *release = NULL;
+    if (mag->head == NULL || cnt <= 0)
+        return;
+    CMUTIL_MemRcyLock(list);
+    while (mag->head && cnt-- > 0) {
+        CMUTIL_MemNode *node = mag->head;
+        mag->head = node->next;
+        mag->cnt--;
+        if (!CMUTIL_MemRcyPutNode(list, node)) {
+            node->next = release;
+            release = node;
+        }
+    }
+    CMCall(list->mutex, Unlock);
+    while (release) {
+        CMUTIL_MemNode *node = release;
+        release = node->next;
+        free(node);
+    }
+}
+
+CMUTIL_STATIC void CMUTIL_MemMagazineFill(
+        CMUTIL_MemMagazine *mag, CMUTIL_MemRcyList *list, int cnt)
+{
+    CMUTIL_MemRcyLock(list);
+    while (list->head && cnt-- > 0) {
+        CMUTIL_MemNode *node = CMUTIL_MemRcyTakeNode(list);
+        node->next = mag->head;
+        mag->head = node;
+        mag->cnt++;
+    }
+    CMCall(list->mutex, Unlock);
+}
+
+CMUTIL_STATIC void CMUTIL_TLS_DTOR CMUTIL_MemThreadCacheExit(void *ptr)
+{
+    // the key is deleted on clear, so the cache is of this initialization.
+    if (ptr == t_cmutil_memcache)
+        CMUTIL_MemThreadCacheRelease();
+}
+
+void CMUTIL_MemThreadCacheRelease(void)
+{
+    int i;
+    CMUTIL_MemThreadCache *cache = t_cmutil_memcache;
+    if (cache == NULL || t_cmutil_memcache_gen != g_cmutil_memcache_gen)
+        return;
+    if (g_cmutil_memcache_haskey)
+        CMUTIL_TLSKEY_SET(g_cmutil_memcache_key, NULL);
+    for (i=0; i<MEM_BLOCK_SZ; i++) {
+        CMUTIL_MemMagazine *mag = &cache->mags[i];
+        CMUTIL_MemMagazineFlush(mag, &g_cmutil_memrcyblocks[i], mag->cnt);
+    }
+    // counters stay with the cache, the next thread continues them.
+    CMCall(g_cmutil_memcache_mutex, Lock);
+    cache->active = CMFalse;
+    CMCall(g_cmutil_memcache_mutex, Unlock);
+    t_cmutil_memcache = NULL;
+}
+
+/*
+ * Sampling heap profiler. About one allocation per g_cmutil_mem_sampling
+ * bytes captures its raw return addresses, which are aggregated per
+ * distinct stack. Sampling points follow a Poisson process, intervals are
+ * drawn from an exponential distribution, so the profile can be unsampled
+ * like gperftools' heap_v2 profiles. Symbols are resolved only on dump.
+ */
+typedef struct CMUTIL_MemProfStack {
+    uint32_t        hash;
+    int             dummy_padder;
+    int64_t         alloccnt;   // sampled allocations
+    int64_t         allocsz;    // sampled bytes
+    int64_t         livecnt;    // sampled allocations not freed yet
+    int64_t         livesz;     // sampled bytes not freed yet
+    CMUTIL_StackTrace   trace;
+} CMUTIL_MemProfStack;
+
+static size_t g_cmutil_mem_sampling = 0;
+static size_t g_cmutil_memprof_period = 0;  // last non-zero sampling
+static CMUTIL_Mutex *g_cmutil_memprof_mutex = NULL;
+static CMUTIL_MemProfStack *g_cmutil_memprof_stacks = NULL;
+static uint32_t g_cmutil_memprof_cnt = 0;
+static uint32_t g_cmutil_memprof_cap = 0;
+// open addressing table of stack id + 1, capacity is a power of 2.
+static uint32_t *g_cmutil_memprof_table = NULL;
+static uint32_t g_cmutil_memprof_tabsz = 0;
+static CMUTIL_TLS int64_t t_cmutil_memprof_left = 0;
+static CMUTIL_TLS uint64_t t_cmutil_memprof_rand = 0;
+
+CMUTIL_STATIC int64_t CMUTIL_MemProfNextInterval(void)
+{
+    uint64_t x = t_cmutil_memprof_rand;
+    double u;
+    if (x == 0)
+        x = ((uint64_t)(uintptr_t)&t_cmutil_memprof_rand ^
+             ((uint64_t)time(NULL) << 20)) | 1;
+    // xorshift64
+    x ^= x << 13;
+    x ^= x >> 7;
+    x ^= x << 17;
+    t_cmutil_memprof_rand = x;
+    u = (double)(x >> 11) * (1.0 / 9007199254740992.0);   // [0, 1)
+    return (int64_t)(-log(1.0 - u) * (double)g_cmutil_mem_sampling) + 1;
+}
+
+CMUTIL_STATIC uint32_t CMUTIL_MemProfHash(const CMUTIL_StackTrace *trace)
+{
+    uint64_t h = 14695981039346656037ULL;
+    int i;
+    for (i=0; i<trace->depth; i++) {
+        h ^= (uint64_t)(uintptr_t)trace->frames[i];
+        h *= 1099511628211ULL;
+    }
+    return (uint32_t)(h ^ (h >> 32));
+}
+
+// must be called with the profile locked.
+CMUTIL_STATIC CMBool CMUTIL_MemProfGrow(void)
+{
+    uint32_t i, nsz = g_cmutil_memprof_tabsz? g_cmutil_memprof_tabsz * 2:256;
+    uint32_t *ntab = calloc(nsz, sizeof(uint32_t));
+    CMUTIL_MemProfStack *nstacks = realloc(
+                g_cmutil_memprof_stacks, sizeof(CMUTIL_MemProfStack) * nsz / 2);
+    if (ntab == NULL || nstacks == NULL) {
+        if (ntab) free(ntab);
+        if (nstacks) g_cmutil_memprof_stacks = nstacks;
+        return CMFalse;
+    }
+    g_cmutil_memprof_stacks = nstacks;
+    g_cmutil_memprof_cap = nsz / 2;
+    for (i=0; i<g_cmutil_memprof_cnt; i++) {
+        uint32_t pos = nstacks[i].hash & (nsz - 1);
+        while (ntab[pos])
+            pos = (pos + 1) & (nsz - 1);
+        ntab[pos] = i + 1;
+    }
+    if (g_cmutil_memprof_table)
+        free(g_cmutil_memprof_table);
+    g_cmutil_memprof_table = ntab;
+    g_cmutil_memprof_tabsz = nsz;
+    return CMTrue;
+}
+
+CMUTIL_STATIC void CMUTIL_MemProfSample(CMUTIL_MemNode *node)
+{
+    CMUTIL_StackTrace trace;
+    uint32_t hash, pos;
+    CMUTIL_MemProfStack *stack = NULL;
+
+    // skips this function and MemRcyCapture only, allocator frames may be
+    // inlined so skipping more could drop frames of the caller.
+    CMCall(g_cmutil_memstackwalker, Capture, &trace, 2);
+    hash = CMUTIL_MemProfHash(&trace);
+    CMCall(g_cmutil_memprof_mutex, Lock);
+    if (g_cmutil_memprof_cnt >= g_cmutil_memprof_cap && !CMUTIL_MemProfGrow())
+        goto ENDPOINT;
+    pos = hash & (g_cmutil_memprof_tabsz - 1);
+    while (g_cmutil_memprof_table[pos]) {
+        CMUTIL_MemProfStack *curr =
+                &g_cmutil_memprof_stacks[g_cmutil_memprof_table[pos] - 1];
+        if (curr->hash == hash && curr->trace.depth == trace.depth &&
+                memcmp(curr->trace.frames, trace.frames,
+                       sizeof(void*) * (size_t)trace.depth) == 0) {
+            stack = curr;
+            break;
+        }
+        pos = (pos + 1) & (g_cmutil_memprof_tabsz - 1);
+    }
+    if (stack == NULL) {
+        stack = &g_cmutil_memprof_stacks[g_cmutil_memprof_cnt++];
+        memset(stack, 0x0, sizeof(CMUTIL_MemProfStack));
+        stack->hash = hash;
+        stack->trace = trace;
+        g_cmutil_memprof_table[pos] = g_cmutil_memprof_cnt;
+    }
+    stack->alloccnt++;
+    stack->allocsz += (int64_t)node->size;
+    stack->livecnt++;
+    stack->livesz += (int64_t)node->size;
+    node->sample = (uint32_t)(stack - g_cmutil_memprof_stacks) + 1;
+ENDPOINT:
+    CMCall(g_cmutil_memprof_mutex, Unlock);
+}
+
+/*
+ * Attaches allocation information to a block, a full symbolized stack in
+ * CMMemDebug mode, or a sampled raw stack if sampling is enabled.
+ */
+CMUTIL_STATIC void CMUTIL_MemRcyCapture(CMUTIL_MemNode *node)
+{
+    node->stack = NULL;
+    node->sample = 0;
+    if (g_cmutil_mem_sampling > 0) {
+        if (t_cmutil_memprof_rand == 0)
+            t_cmutil_memprof_left = CMUTIL_MemProfNextInterval();
+        t_cmutil_memprof_left -= (int64_t)node->size;
+        if (t_cmutil_memprof_left <= 0) {
+            t_cmutil_memprof_left = CMUTIL_MemProfNextInterval();
+            CMUTIL_MemProfSample(node);
+        }
+    } else if (g_cmutil_memoper == CMMemDebug) {
+        // raw frames only, symbols are resolved when a report prints them.
+        node->stack = malloc(sizeof(CMUTIL_StackTrace));
+        if (node->stack)
+            CMCall(g_cmutil_memstackwalker, Capture, node->stack, 1);
+    }
+}
+
+CMUTIL_STATIC void CMUTIL_MemRcyRelease(CMUTIL_MemNode *node)
+{
+    if (node->stack) {
+        free(node->stack);
+        node->stack = NULL;
+    }
+    if (node->sample) {
+        CMUTIL_MemProfStack *stack;
+        CMCall(g_cmutil_memprof_mutex, Lock);
+        stack = &g_cmutil_memprof_stacks[node->sample - 1];
+        stack->livecnt--;
+        stack->livesz -= (int64_t)node->size;
+        CMCall(g_cmutil_memprof_mutex, Unlock);
+        node->sample = 0;
+    }
+}
+
+/*
+ * Captures allocation information of a block, and in CMMemDebug mode,
+ * links it to the live list of the class.
+ */
+CMUTIL_STATIC void CMUTIL_MemRcyTrack(
+        CMUTIL_MemRcyList *list, CMUTIL_MemNode *node)
+{
+    node->next = NULL;
+    node->prev = NULL;
+    CMUTIL_MemRcyCapture(node);
+    if (g_cmutil_memoper == CMMemDebug) {
+        CMUTIL_MemRcyLock(list);
+        node->next = list->live;
+        if (list->live)
+            list->live->prev = node;
+        list->live = node;
+        CMCall(list->mutex, Unlock);
+    }
+}
+
+CMUTIL_STATIC void CMUTIL_MemRcyUntrack(
+        CMUTIL_MemRcyList *list, CMUTIL_MemNode *node)
+{
+    if (g_cmutil_memoper == CMMemDebug) {
+        CMUTIL_MemRcyLock(list);
+        if (node->prev)
+            node->prev->next = node->next;
+        else
+            list->live = node->next;
+        if (node->next)
+            node->next->prev = node->prev;
+        node->prev = NULL;
+        CMCall(list->mutex, Unlock);
+    }
+    CMUTIL_MemRcyRelease(node);
+}
+
+CMUTIL_STATIC int CMUTIL_MemHighBit(uint64_t v)
+{
+#if defined(__GNUC__)
+    return 63 - __builtin_clzll(v);
+#else
+    int rval = 0;
+    while (v >>= 1)
+        rval++;
+    return rval;
+#endif
+}
+
 CMUTIL_STATIC int CMUTIL_MemRcyIndex(size_t size)
 {
-    int rval = (int)ceil(log2((double)size));
-    return rval < 0? 0:rval;
+    int bit;
+    uint64_t last;
+    if (size <= MEM_SMALL_CLASSES * MEM_SMALL_STEP)
+        return size == 0? 0:(int)((size - 1) / MEM_SMALL_STEP);
+    last = (uint64_t)size - 1;
+    bit = CMUTIL_MemHighBit(last);
+    return MEM_SMALL_CLASSES + (bit - 8) * 4 +
+            (int)((last - ((uint64_t)1 << bit)) >> (bit - 2));
+}
+
+CMUTIL_STATIC uint64_t CMUTIL_MemRcyClassSize(int idx)
+{
+    int bit;
+    if (idx < MEM_SMALL_CLASSES)
+        return (uint64_t)(idx + 1) * MEM_SMALL_STEP;
+    bit = 8 + (idx - MEM_SMALL_CLASSES) / 4;
+    return ((uint64_t)1 << bit) +
+            (uint64_t)((idx - MEM_SMALL_CLASSES) % 4 + 1) *
+            ((uint64_t)1 << (bit - 2));
+}
+
+CMUTIL_STATIC CMUTIL_MemNode *CMUTIL_MemRcyNewBlock(
+        CMUTIL_MemRcyList *list, int idx)
+{
+    CMUTIL_MemNode *node;
+    if (list->slabsz > 0) {
+        size_t i, cnt = (list->slabsz - CMUTIL_MEM_SLAB_HDR) / list->stride;
+        CMUTIL_MemSlab *slab = malloc(list->slabsz);
+        if (slab == NULL)
+            return NULL;
+        CMUTIL_MemRcyLock(list);
+        slab->prev = NULL;
+        slab->next = list->slabs;
+        if (list->slabs)
+            list->slabs->prev = slab;
+        list->slabs = slab;
+        slab->nfree = (int)cnt - 1;
+        // the first block is returned, the others go to the free list.
+        for (i=cnt-1; i>0; i--) {
+            node = (CMUTIL_MemNode*)((uint8_t*)slab +
+                        CMUTIL_MEM_SLAB_HDR + i * list->stride);
+            node->index = idx;
+            node->slabidx = (uint16_t)i;
+            node->stack = NULL;
+            node->sample = 0;
+            node->state = CMUTIL_MEM_FREED;
+            node->next = list->head;
+            list->head = node;
+        }
+        list->cnt += (int)cnt;
+        list->avlcnt += (int)cnt - 1;
+        CMUTIL_MemRcyHeld(list, (int64_t)list->slabsz);
+        CMUTIL_MemRcyPeak(list);
+        CMCall(list->mutex, Unlock);
+        node = (CMUTIL_MemNode*)((uint8_t*)slab + CMUTIL_MEM_SLAB_HDR);
+        node->slabidx = 0;
+    } else {
+        node = malloc(list->stride);
+        if (node == NULL)
+            return NULL;
+        CMUTIL_MemRcyLock(list);
+        list->cnt++;
+        CMUTIL_MemRcyHeld(list, (int64_t)list->stride);
+        CMUTIL_MemRcyPeak(list);
+        CMCall(list->mutex, Unlock);
+    }
+    node->index = idx;
+    return node;
+}
+
+CMUTIL_STATIC size_t CMUTIL_MemMapLength(size_t size, CMBool huge)
+{
+    size_t align = huge? CMUTIL_MEM_HUGEPAGE:g_cmutil_mem_pagesz;
+    size_t len = CMUTIL_MEM_MAP_HDR + sizeof(CMUTIL_MemNode) + size + 1;
+    return (len + align - 1) & ~(align - 1);
+}
+
+CMUTIL_STATIC uint8_t *CMUTIL_MemMapPages(size_t length, CMBool *huge)
+{
+#if defined(MSWIN)
+    *huge = CMFalse;
+    return VirtualAlloc(NULL, length, MEM_RESERVE | MEM_COMMIT,
+                        PAGE_READWRITE);
+#else
+    void *res;
+# if defined(MAP_HUGETLB)
+    if (*huge) {
+        res = mmap(NULL, length, PROT_READ | PROT_WRITE,
+                   MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+        if (res != MAP_FAILED)
+            return res;
+    }
+# endif
+    res = mmap(NULL, length, PROT_READ | PROT_WRITE,
+               MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (res == MAP_FAILED)
+        return NULL;
+# if defined(MADV_HUGEPAGE)
+    // no reserved huge pages, ask for transparent huge pages instead.
+    if (*huge)
+        madvise(res, length, MADV_HUGEPAGE);
+# endif
+    *huge = CMFalse;
+    return res;
+#endif
+}
+
+CMUTIL_STATIC void CMUTIL_MemUnmapPages(uint8_t *base, size_t length)
+{
+#if defined(MSWIN)
+    CMUTIL_UNUSED(length);
+    VirtualFree(base, 0, MEM_RELEASE);
+#else
+    munmap(base, length);
+#endif
+}
+
+CMUTIL_STATIC void *CMUTIL_MemMapAlloc(size_t size)
+{
+    CMBool huge = g_cmutil_mem_hugepage;
+    CMUTIL_MemNode *node;
+    uint8_t *base = NULL;
+    size_t length = 0;
+    if (size <= SIZE_MAX - CMUTIL_MEM_HUGEPAGE * 2) {
+        length = CMUTIL_MemMapLength(size, huge);
+        base = CMUTIL_MemMapPages(length, &huge);
+    }
+    if (base == NULL) {
+        CMUTIL_MemLogWithStack(
+                    "*** FATAL - cannot map %zu bytes.", size);
+        return NULL;
+    }
+    ((size_t*)base)[0] = length;
+    ((size_t*)base)[1] = (size_t)huge;
+    node = (CMUTIL_MemNode*)(base + CMUTIL_MEM_MAP_HDR);
+    node->index = CMUTIL_MEM_MAPPED;
+    node->size = size;
+    node->state = CMUTIL_MEM_INUSE;
+    node->flag = 0xFF;
+    *((uint8_t*)(node + 1) + size) = 0xFF;
+    CMUTIL_MemRcyLock(&g_cmutil_memmapped);
+    g_cmutil_memmapped.cnt++;
+    g_cmutil_memmapped.inuse++;
+    g_cmutil_memmapped.usedsize += (int64_t)size;
+    g_cmutil_memmapped.allocs++;
+    CMUTIL_MemRcyHeld(&g_cmutil_memmapped, (int64_t)length);
+    CMUTIL_MemRcyPeak(&g_cmutil_memmapped);
+    CMCall(g_cmutil_memmapped.mutex, Unlock);
+    CMUTIL_MemRcyTrack(&g_cmutil_memmapped, node);
+    return node + 1;
+}
+
+CMUTIL_STATIC void CMUTIL_MemMapFree(CMUTIL_MemNode *node)
+{
+    uint8_t *base = (uint8_t*)node - CMUTIL_MEM_MAP_HDR;
+    CMUTIL_MemRcyUntrack(&g_cmutil_memmapped, node);
+    node->state = CMUTIL_MEM_FREED;
+    CMUTIL_MemRcyLock(&g_cmutil_memmapped);
+    g_cmutil_memmapped.cnt--;
+    g_cmutil_memmapped.inuse--;
+    g_cmutil_memmapped.usedsize -= (int64_t)node->size;
+    g_cmutil_memmapped.frees++;
+    CMUTIL_MemRcyHeld(&g_cmutil_memmapped, -(int64_t)*(size_t*)base);
+    CMCall(g_cmutil_memmapped.mutex, Unlock);
+    CMUTIL_MemUnmapPages(base, *(size_t*)base);
 }
 
 CMUTIL_STATIC void *CMUTIL_MemRcyAlloc(size_t size)
 {
     int idx = CMUTIL_MemRcyIndex(size);
     void *res;
-    CMUTIL_MemNode *node;
+    CMUTIL_MemNode *node = NULL;
     CMUTIL_MemRcyList *list;
-    // 1 << idx must not overflow size_t, so idx is bounded by its bit width.
-    if (idx < 0 || idx >= MEM_BLOCK_SZ || idx >= (int)(sizeof(size_t) * 8)) {
+    CMUTIL_MemMagazine *mag = NULL;
+    if (g_cmutil_mem_mapthreshold > 0 && size >= g_cmutil_mem_mapthreshold)
+        return CMUTIL_MemMapAlloc(size);
+    // stride is zero if a block of this class cannot be addressed by size_t.
+    if (idx < 0 || idx >= MEM_BLOCK_SZ ||
+            g_cmutil_memrcyblocks[idx].stride == 0) {
         CMUTIL_MemLogWithStack(
                     "*** FATAL - allocating size too big(%zu).", size);
         assert(0);
@@ -223,37 +1033,49 @@ CMUTIL_STATIC void *CMUTIL_MemRcyAlloc(size_t size)
         return NULL;
     }
     list = &g_cmutil_memrcyblocks[idx];
-    CMCall(list->mutex, Lock);
-    if (list->head) {
-        node = list->head;
-        res = (uint8_t*)node;
-        list->head = node->next;
-        list->avlcnt--;
+    if (list->magcap > 0) {
+        CMUTIL_MemThreadCache *cache = CMUTIL_MemThreadCacheGet();
+        if (cache)
+            mag = &cache->mags[idx];
+    }
+    if (mag) {
+        if (mag->head == NULL)
+            CMUTIL_MemMagazineFill(mag, list, list->magcap / 2);
+        node = mag->head;
+        if (node) {
+            mag->head = node->next;
+            mag->cnt--;
+        }
     } else {
-        res = malloc(sizeof(CMUTIL_MemNode) + ((size_t)1 << idx) + 1);
-        if (res == NULL) {
-            CMCall(list->mutex, Unlock);
+        CMUTIL_MemRcyLock(list);
+        node = CMUTIL_MemRcyTakeNode(list);
+        CMCall(list->mutex, Unlock);
+    }
+    if (node == NULL) {
+        node = CMUTIL_MemRcyNewBlock(list, idx);
+        if (node == NULL) {
             CMUTIL_MemLogWithStack(
                         "*** FATAL - cannot allocate %zu bytes.", size);
             return NULL;
         }
-        list->cnt++;
-        node = (CMUTIL_MemNode*)res;
-        node->index = idx;
     }
-    CMCall(list->used, Add, node, NULL);
-    list->usedsize += size;
-    CMCall(list->mutex, Unlock);
+    res = (uint8_t*)node;
+    if (mag) {
+        mag->inuse++;
+        mag->usedsize += (int64_t)size;
+        mag->allocs++;
+    } else {
+        CMUTIL_MemRcyLock(list);
+        list->inuse++;
+        list->usedsize += (int64_t)size;
+        list->allocs++;
+        CMCall(list->mutex, Unlock);
+    }
     node->size = size;
-    node->next = NULL;
+    node->state = CMUTIL_MEM_INUSE;
     node->flag = 0xFF;  // underflow writing checker
     *((uint8_t*)res + sizeof(CMUTIL_MemNode) + size) = 0xFF;    // overflow writing checker
-    if (g_cmutil_memoper == CMMemDebug) {
-        node->stack = CMUTIL_StringCreateInternal(
-                    &g_cmutil_memdebug_system, 256, NULL);
-        CMCall(g_cmutil_memstackwalker, PrintStack, node->stack, 0);
-    } else
-        node->stack = NULL;
+    CMUTIL_MemRcyTrack(list, node);
 
     return (uint8_t*)res + sizeof(CMUTIL_MemNode);
 }
@@ -275,15 +1097,27 @@ CMUTIL_STATIC void *CMUTIL_MemRcyCalloc(size_t nmem, size_t size)
     return res;
 }
 
+// symbolizes the allocation stack of a block, must be destroyed by caller.
+CMUTIL_STATIC CMUTIL_String *CMUTIL_MemNodeStack(CMUTIL_MemNode *node)
+{
+    CMUTIL_String *res = CMUTIL_StringCreateInternal(
+                &g_cmutil_memdebug_system, 256, NULL);
+    if (node->stack)
+        CMCall(g_cmutil_memstackwalker, PrintTrace, node->stack, res);
+    return res;
+}
+
 CMUTIL_STATIC CMBool CMUTIL_MemCheckFlow(CMUTIL_MemNode *node)
 {
     if (node->flag != 0xFF) {
         if (node->stack) {
+            CMUTIL_String *stack = CMUTIL_MemNodeStack(node);
             CMUTIL_MemLogWithStack(
                         "*** FATAL - memory underflow written detected while "
                         "freeing. which allocated from%s"S_CRLF
                         " freeing location is",
-                        CMCall(node->stack, GetCString));
+                        CMCall(stack, GetCString));
+            CMCall(stack, Destroy);
         } else {
             CMUTIL_MemLogWithStack(
                         "*** FATAL - memory underflow written detected while "
@@ -293,11 +1127,13 @@ CMUTIL_STATIC CMBool CMUTIL_MemCheckFlow(CMUTIL_MemNode *node)
     }
     if (*(((unsigned char*)node+sizeof(CMUTIL_MemNode)+node->size)) != 0xFF) {
         if (node->stack) {
+            CMUTIL_String *stack = CMUTIL_MemNodeStack(node);
             CMUTIL_MemLogWithStack(
                         "*** FATAL - memory overflow written detected while "
                         "freeing. which allocated from%s"S_CRLF
                         " freeing location is",
-                        CMCall(node->stack, GetCString));
+                        CMCall(stack, GetCString));
+            CMCall(stack, Destroy);
         } else {
             CMUTIL_MemLogWithStack(
                         "*** FATAL - memory overflow written detected while "
@@ -308,10 +1144,56 @@ CMUTIL_STATIC CMBool CMUTIL_MemCheckFlow(CMUTIL_MemNode *node)
     return CMTrue;
 }
 
+CMUTIL_STATIC void *CMUTIL_MemMapRealloc(CMUTIL_MemNode *node, size_t size)
+{
+    uint8_t *base = (uint8_t*)node - CMUTIL_MEM_MAP_HDR;
+    size_t length = ((size_t*)base)[0];
+    CMBool inplace = CMFalse;
+    void *res;
+    if (g_cmutil_mem_mapthreshold > 0 && size >= g_cmutil_mem_mapthreshold &&
+            ((size_t*)base)[1] == 0 &&
+            size <= SIZE_MAX - CMUTIL_MEM_HUGEPAGE * 2) {
+        size_t nlength = CMUTIL_MemMapLength(size, CMFalse);
+        if (nlength == length) {
+            inplace = CMTrue;
+        } else {
+#if defined(LINUX)
+            // the live list refers the block address, relink after moving.
+            CMUTIL_MemRcyUntrack(&g_cmutil_memmapped, node);
+            res = mremap(base, length, nlength, MREMAP_MAYMOVE);
+            if (res != MAP_FAILED) {
+                base = res;
+                ((size_t*)base)[0] = nlength;
+                node = (CMUTIL_MemNode*)(base + CMUTIL_MEM_MAP_HDR);
+                inplace = CMTrue;
+            }
+            CMUTIL_MemRcyTrack(&g_cmutil_memmapped, node);
+#endif
+        }
+    }
+    if (inplace) {
+        CMUTIL_MemRcyLock(&g_cmutil_memmapped);
+        g_cmutil_memmapped.usedsize += (int64_t)size - (int64_t)node->size;
+        CMUTIL_MemRcyHeld(&g_cmutil_memmapped,
+                          (int64_t)((size_t*)base)[0] - (int64_t)length);
+        CMCall(g_cmutil_memmapped.mutex, Unlock);
+        node->size = size;
+        *((uint8_t*)(node + 1) + size) = 0xFF;
+        return node + 1;
+    }
+    res = CMUTIL_MemRcyAlloc(size);
+    if (res == NULL)
+        return NULL;
+    memcpy(res, node + 1, size < node->size? size:node->size);
+    CMUTIL_MemMapFree(node);
+    return res;
+}
+
 CMUTIL_STATIC void CMUTIL_MemRcyFree(void *ptr)
 {
     CMUTIL_MemNode *node;
     CMUTIL_MemRcyList *list;
+    CMBool cached;
 
     if (ptr == NULL) {
         CMUTIL_MemLogWithStack("*** FATAL - freeing null pointer.");
@@ -319,38 +1201,54 @@ CMUTIL_STATIC void CMUTIL_MemRcyFree(void *ptr)
     }
 
     node = (CMUTIL_MemNode*)(((CMUTIL_MemNode*)ptr) - 1);
-    if (node->index < 0 || node->index >= MEM_BLOCK_SZ) {
+    if (node->index < 0 || node->index > CMUTIL_MEM_MAPPED) {
         CMUTIL_MemLogWithStack("*** FATAL - memory index out of bound. "
                                "is this memory allocated using CMAlloc?");
         return;
     }
-    list = &g_cmutil_memrcyblocks[node->index];
 
-    CMCall(list->mutex, Lock);
-    if (CMCall(list->used, Remove, node) == NULL) {
-        CMCall(list->mutex, Unlock);
+    if (node->state != CMUTIL_MEM_INUSE) {
         CMUTIL_MemLogWithStack(
                     "*** FATAL - not allocated memory to be freed.");
         return;
     }
 
-    if (!CMUTIL_MemCheckFlow(node)) {
-        CMCall(list->mutex, Unlock);
+    if (!CMUTIL_MemCheckFlow(node))
         return;
-    }
 
-    // clear stack
-    if (node->stack) {
-        CMCall(node->stack, Destroy);
-        node->stack = NULL;
+    if (node->index == CMUTIL_MEM_MAPPED) {
+        CMUTIL_MemMapFree(node);
+        return;
     }
+    list = &g_cmutil_memrcyblocks[node->index];
 
+    CMUTIL_MemRcyUntrack(list, node);
+    node->state = CMUTIL_MEM_FREED;
 
-    node->next = list->head;
-    list->head = node;
-    list->avlcnt++;
+    if (list->magcap > 0) {
+        CMUTIL_MemThreadCache *cache = CMUTIL_MemThreadCacheGet();
+        if (cache) {
+            CMUTIL_MemMagazine *mag = &cache->mags[node->index];
+            mag->inuse--;
+            mag->usedsize -= (int64_t)node->size;
+            mag->frees++;
+            node->next = mag->head;
+            mag->head = node;
+            mag->cnt++;
+            if (mag->cnt > list->magcap)
+                CMUTIL_MemMagazineFlush(mag, list, list->magcap / 2);
+            return;
+        }
+    }
 
+    CMUTIL_MemRcyLock(list);
+    list->inuse--;
+    list->usedsize -= (int64_t)node->size;
+    list->frees++;
+    cached = CMUTIL_MemRcyPutNode(list, node);
     CMCall(list->mutex, Unlock);
+    if (!cached)
+        free(node);
 }
 
 CMUTIL_STATIC void *CMUTIL_MemRcyRealloc(void *ptr, size_t size)
@@ -363,35 +1261,39 @@ CMUTIL_STATIC void *CMUTIL_MemRcyRealloc(void *ptr, size_t size)
         return CMUTIL_MemRcyAlloc(size);
 
     node = (CMUTIL_MemNode*)(((CMUTIL_MemNode*)ptr) - 1);
-    if (node->index < 0 || node->index >= MEM_BLOCK_SZ) {
+    if (node->index < 0 || node->index > CMUTIL_MEM_MAPPED) {
         CMUTIL_MemLogWithStack("*** FATAL - memory index out of bound. "
                                "is this memory allocated using CMAlloc?");
         return NULL;
     }
     if (!CMUTIL_MemCheckFlow(node))
         return NULL;
-    if (nidx >= MEM_BLOCK_SZ) {
+    if (node->index == CMUTIL_MEM_MAPPED)
+        return CMUTIL_MemMapRealloc(node, size);
+    if (g_cmutil_mem_mapthreshold > 0 && size >= g_cmutil_mem_mapthreshold)
+        nidx = -1;  // moves to a mapping
+    if (nidx >= MEM_BLOCK_SZ ||
+            (nidx >= 0 && g_cmutil_memrcyblocks[nidx].stride == 0)) {
         CMUTIL_MemLogWithStack("*** FATAL - memory index out of bound. "
                                "requested memory too big(%"PRIu64
                                ") to allocate.", (uint64_t)size);
         return NULL;
     }
     if (node->index == nidx) {
-        CMUTIL_MemRcyList *list;
-        list = &g_cmutil_memrcyblocks[nidx];
-        CMCall(list->mutex, Lock);
-        list->usedsize += (size - node->size);
+        CMUTIL_MemRcyList *list = &g_cmutil_memrcyblocks[nidx];
+        CMUTIL_MemThreadCache *cache =
+                list->magcap > 0? CMUTIL_MemThreadCacheGet():NULL;
+        if (cache) {
+            cache->mags[nidx].usedsize += (int64_t)size - (int64_t)node->size;
+        } else {
+            CMUTIL_MemRcyLock(list);
+            list->usedsize += (int64_t)size - (int64_t)node->size;
+            CMCall(list->mutex, Unlock);
+        }
+        // update allocation information
+        CMUTIL_MemRcyRelease(node);
         node->size = size;
-        CMCall(list->mutex, Unlock);
-        // update stack information
-        if (node->stack)
-            CMCall(node->stack, Destroy);
-        if (g_cmutil_memoper == CMMemDebug) {
-            node->stack = CMUTIL_StringCreateInternal(
-                        &g_cmutil_memdebug_system, 256, NULL);
-            CMCall(g_cmutil_memstackwalker, PrintStack, node->stack, 0);
-        } else
-            node->stack = NULL;
+        CMUTIL_MemRcyCapture(node);
         *(((uint8_t*)ptr) + size) = 0xFF;
         return ptr;
     } else {
@@ -434,16 +1336,49 @@ CMUTIL_STATIC void CMUTIL_MemRcyInit()
     __CMUTIL_Mem = &g_cmutil_memdebug;
     memset(g_cmutil_memrcyblocks, 0x0, sizeof(g_cmutil_memrcyblocks));
     for (i=0; i<MEM_BLOCK_SZ; i++) {
-        g_cmutil_memrcyblocks[i].mutex = CMUTIL_MutexCreateInternal(
-                    &g_cmutil_memdebug_system);
-        g_cmutil_memrcyblocks[i].used = CMUTIL_ArrayCreateInternal(
-                    &g_cmutil_memdebug_system, 10,
-                    CMUTIL_MemRcyComparator, CMUTIL_MemNodeDestroy, CMTrue);
+        CMUTIL_MemRcyList *list = &g_cmutil_memrcyblocks[i];
+        uint64_t clsz = CMUTIL_MemRcyClassSize(i);
+        // header, data and overflow checker, rounded up to 16 bytes.
+        uint64_t stride =
+                (sizeof(CMUTIL_MemNode) + clsz + 1 + 15) & ~(uint64_t)15;
+        list->mutex = CMUTIL_MutexCreateInternal(&g_cmutil_memdebug_system);
+        if (stride <= (uint64_t)(SIZE_MAX / 2))
+            list->stride = (size_t)stride;
+        if (list->stride > 0 && list->stride <= CMUTIL_MEM_SLAB_MAX) {
+            list->slabsz = CMUTIL_MEM_SLAB_HDR +
+                    list->stride * CMUTIL_MEM_SLAB_BLOCKS;
+            list->slabsz = (list->slabsz + CMUTIL_MEM_PAGE - 1) &
+                    ~(size_t)(CMUTIL_MEM_PAGE - 1);
+        }
+        // big blocks are not worth to be kept per thread.
+        if (clsz * 2 <= CMUTIL_MEM_MAG_BYTES) {
+            list->magcap = (int)(CMUTIL_MEM_MAG_BYTES / clsz);
+            if (list->magcap > CMUTIL_MEM_MAG_MAX)
+                list->magcap = CMUTIL_MEM_MAG_MAX;
+        }
     }
+    g_cmutil_memcache_mutex = CMUTIL_MutexCreateInternal(
+                &g_cmutil_memdebug_system);
+    g_cmutil_memcache_haskey = CMUTIL_TLSKEY_CREATE(
+                &g_cmutil_memcache_key, CMUTIL_MemThreadCacheExit);
+    memset(&g_cmutil_memmapped, 0x0, sizeof(g_cmutil_memmapped));
+    g_cmutil_memmapped.mutex = CMUTIL_MutexCreateInternal(
+                &g_cmutil_memdebug_system);
+    g_cmutil_memcache_gen++;
+    g_cmutil_mem_cachedsz = 0;
+    g_cmutil_mem_heldsz = 0;
+    g_cmutil_mem_peakheldsz = 0;
+    memset(g_cmutil_memstat_prev, 0x0, sizeof(g_cmutil_memstat_prev));
+    gettimeofday(&g_cmutil_memstat_time, NULL);
+#if !defined(MSWIN)
+    g_cmutil_mem_pagesz = (size_t)sysconf(_SC_PAGESIZE);
+#endif
     g_cmutil_memstackwalker = CMUTIL_StackWalkerCreateInternal(
                 &g_cmutil_memdebug_system);
     g_cmutil_memlog_mutex = CMUTIL_MutexCreateInternal(
                 &g_cmutil_memdebug_system);
+    g_cmutil_memprof_mutex = CMUTIL_MutexCreateInternal(
+                &g_cmutil_memdebug_system);
 }
 
 void CMUTIL_MemDebugInit(CMMemOper memoper)
@@ -458,39 +1393,87 @@ void CMUTIL_MemDebugInit(CMMemOper memoper)
     }
 }
 
+CMUTIL_STATIC void CMUTIL_MemLogLeaks(CMUTIL_MemRcyList *list)
+{
+    uint32_t j = 0;
+    CMUTIL_MemNode *node;
+    for (node = list->live; node; node = node->next, j++) {
+        CMUTIL_String *stack = CMUTIL_MemNodeStack(node);
+        CMUTIL_MemLog("* %uth memory leak. size:%zu%s"S_CRLF,
+                      j, node->size, CMCall(stack, GetCString));
+        CMCall(stack, Destroy);
+    }
+}
+
 CMBool CMUTIL_MemDebugClear()
 {
     CMBool res = CMTrue;
     if (g_cmutil_memoper != CMMemSystem) {
         uint32_t i;
+        if (g_cmutil_memcache_haskey) {
+            CMUTIL_TLSKEY_DELETE(g_cmutil_memcache_key);
+            g_cmutil_memcache_haskey = CMFalse;
+        }
+        // return every magazine to the global lists and sum up counters.
+        while (g_cmutil_memcaches) {
+            CMUTIL_MemThreadCache *cache = g_cmutil_memcaches;
+            g_cmutil_memcaches = cache->next;
+            for (i=0; i<MEM_BLOCK_SZ; i++) {
+                CMUTIL_MemRcyList *list = &g_cmutil_memrcyblocks[i];
+                CMUTIL_MemMagazine *mag = &cache->mags[i];
+                CMUTIL_MemMagazineFlush(mag, list, mag->cnt);
+                list->inuse += mag->inuse;
+                list->usedsize += mag->usedsize;
+            }
+            free(cache);
+        }
+        t_cmutil_memcache = NULL;
+        CMCall(g_cmutil_memcache_mutex, Destroy);
+        g_cmutil_memcache_mutex = NULL;
         for (i=0; i<MEM_BLOCK_SZ; i++) {
             CMUTIL_MemRcyList *list = &g_cmutil_memrcyblocks[i];
-            // TODO: print used items;
-            if (CMCall(list->used, GetSize) > 0) {
-                CMUTIL_MemLog("*** FATAL - index:%u count:%d "
-                              "total:%zu byte memory leak detected.",
-                              i, list->cnt - list->avlcnt, list->usedsize);
-                if (g_cmutil_memoper == CMMemDebug) {
-                    uint32_t j;
-                    for (j=0; j<CMCall(list->used, GetSize); j++) {
-                        CMUTIL_MemNode *node = (CMUTIL_MemNode*)CMCall(
-                                    list->used, GetAt, j);
-                        CMUTIL_MemLog("* %uth memory leak. size:%zu%s"S_CRLF,
-                                      j, node->size,
-                                      node->stack?
-                                          CMCall(node->stack, GetCString):"");
-                    }
-                }
+            if (list->inuse > 0) {
+                CMUTIL_MemLog("*** FATAL - index:%u count:%"PRId64" "
+                              "total:%"PRId64" byte memory leak detected.",
+                              i, list->inuse, list->usedsize);
+                CMUTIL_MemLogLeaks(list);
                 res = CMFalse;
             }
-            CMCall(list->used, Destroy);
+            while (list->live) {
+                CMUTIL_MemNode *curr = list->live;
+                list->live = curr->next;
+                CMUTIL_MemNodeDestroy(list, curr);
+            }
             while (list->head) {
                 CMUTIL_MemNode *curr = list->head;
                 list->head = curr->next;
-                CMUTIL_MemNodeDestroy(curr);
+                CMUTIL_MemNodeDestroy(list, curr);
+            }
+            while (list->slabs) {
+                CMUTIL_MemSlab *slab = list->slabs;
+                list->slabs = slab->next;
+                free(slab);
             }
             CMCall(list->mutex, Destroy);
         }
+        if (g_cmutil_memmapped.inuse > 0) {
+            CMUTIL_MemLog("*** FATAL - mapped count:%"PRId64" "
+                          "total:%"PRId64" byte memory leak detected.",
+                          g_cmutil_memmapped.inuse,
+                          g_cmutil_memmapped.usedsize);
+            CMUTIL_MemLogLeaks(&g_cmutil_memmapped);
+            res = CMFalse;
+        }
+        while (g_cmutil_memmapped.live) {
+            CMUTIL_MemNode *curr = g_cmutil_memmapped.live;
+            g_cmutil_memmapped.live = curr->next;
+            if (curr->stack)
+                free(curr->stack);
+            CMUTIL_MemUnmapPages((uint8_t*)curr - CMUTIL_MEM_MAP_HDR,
+                                 *(size_t*)((uint8_t*)curr - CMUTIL_MEM_MAP_HDR));
+        }
+        CMCall(g_cmutil_memmapped.mutex, Destroy);
+        g_cmutil_memmapped.mutex = NULL;
         if (g_cmutil_memstackwalker) {
             CMCall(g_cmutil_memstackwalker, Destroy);
             g_cmutil_memstackwalker = NULL;
@@ -499,6 +1482,18 @@ CMBool CMUTIL_MemDebugClear()
             CMCall(g_cmutil_memlog_mutex, Destroy);
             g_cmutil_memlog_mutex = NULL;
         }
+        if (g_cmutil_memprof_mutex) {
+            CMCall(g_cmutil_memprof_mutex, Destroy);
+            g_cmutil_memprof_mutex = NULL;
+        }
+        if (g_cmutil_memprof_stacks)
+            free(g_cmutil_memprof_stacks);
+        if (g_cmutil_memprof_table)
+            free(g_cmutil_memprof_table);
+        g_cmutil_memprof_stacks = NULL;
+        g_cmutil_memprof_table = NULL;
+        g_cmutil_memprof_cnt = g_cmutil_memprof_cap = 0;
+        g_cmutil_memprof_tabsz = 0;
         __CMUTIL_Mem = &g_cmutil_memdebug_system;
         g_cmutil_memoper = CMMemSystem;
     }
@@ -509,3 +1504,313 @@ CMUTIL_Mem *CMUTIL_GetMem()
 {
     return __CMUTIL_Mem;
 }
+
+CMMemOper CMUTIL_MemGetOper(void)
+{
+    return g_cmutil_memoper;
+}
+
+size_t CMUTIL_MemTrim(void)
+{
+    size_t res = 0;
+    int i;
+    if (g_cmutil_memoper == CMMemSystem)
+        return 0;
+    for (i=0; i<MEM_BLOCK_SZ; i++)
+        res += CMUTIL_MemRcyTrimList(&g_cmutil_memrcyblocks[i], CMFalse);
+    return res;
+}
+
+void CMUTIL_MemSetCacheLimit(size_t class_limit, size_t total_limit)
+{
+    g_cmutil_mem_classlimit = class_limit;
+    g_cmutil_mem_totallimit = total_limit;
+}
+
+void CMUTIL_MemSetMapThreshold(size_t threshold, CMBool hugepage)
+{
+    g_cmutil_mem_mapthreshold = threshold;
+    g_cmutil_mem_hugepage = hugepage;
+}
+
+size_t CMUTIL_MemTrimIdle(void)
+{
+    size_t res = 0;
+    int i;
+    if (g_cmutil_memoper == CMMemSystem)
+        return 0;
+    for (i=0; i<MEM_BLOCK_SZ; i++)
+        res += CMUTIL_MemRcyTrimList(&g_cmutil_memrcyblocks[i], CMTrue);
+    return res;
+}
+
+CMUTIL_STATIC void CMUTIL_MemTrimTask(void *udata)
+{
+    CMUTIL_UNUSED(udata);
+    CMUTIL_MemTrimIdle();
+}
+
+CMBool CMUTIL_MemStartTrimmer(long interval, CMUTIL_Timer *timer)
+{
+    if (g_cmutil_memoper == CMMemSystem || interval <= 0)
+        return CMFalse;
+    CMUTIL_MemStopTrimmer();
+    if (timer) {
+        g_cmutil_mem_trimtimer = timer;
+        g_cmutil_mem_intimer = CMFalse;
+    } else {
+        g_cmutil_mem_trimtimer = CMUTIL_TimerCreateInternal(
+                    &g_cmutil_memdebug_system, 100, 1);
+        g_cmutil_mem_intimer = CMTrue;
+    }
+    g_cmutil_mem_trimtask = CMCall(
+                g_cmutil_mem_trimtimer, ScheduleDelayRepeat, interval,
+                interval, CMTrue, CMUTIL_MemTrimTask, NULL);
+    return g_cmutil_mem_trimtask? CMTrue:CMFalse;
+}
+
+void CMUTIL_MemStopTrimmer(void)
+{
+    // Cancel waits for a running trimming, as the timer destruction does.
+    if (g_cmutil_mem_intimer && g_cmutil_mem_trimtimer)
+        CMCall(g_cmutil_mem_trimtimer, Destroy);
+    else if (g_cmutil_mem_trimtask)
+        CMCall(g_cmutil_mem_trimtask, Cancel);
+    g_cmutil_mem_trimtask = NULL;
+    g_cmutil_mem_trimtimer = NULL;
+    g_cmutil_mem_intimer = CMFalse;
+}
+
+void CMUTIL_MemSetSampling(size_t interval)
+{
+    g_cmutil_mem_sampling = interval;
+    if (interval > 0)
+        g_cmutil_memprof_period = interval;
+}
+
+CMUTIL_STATIC void CMUTIL_MemProfWritePprof(
+        FILE *fp, CMUTIL_MemProfStack *stacks, uint32_t cnt)
+{
+    int64_t tot[4] = {0,};
+    uint32_t i;
+    int j;
+    for (i=0; i<cnt; i++) {
+        tot[0] += stacks[i].livecnt;
+        tot[1] += stacks[i].livesz;
+        tot[2] += stacks[i].alloccnt;
+        tot[3] += stacks[i].allocsz;
+    }
+    fprintf(fp, "heap profile: %"PRId64": %"PRId64" [%"PRId64": %"PRId64
+            "] @ heap_v2/%zu\n", tot[0], tot[1], tot[2], tot[3],
+            g_cmutil_memprof_period);
+    for (i=0; i<cnt; i++) {
+        CMUTIL_MemProfStack *stack = &stacks[i];
+        fprintf(fp, "%"PRId64": %"PRId64" [%"PRId64": %"PRId64"] @",
+                stack->livecnt, stack->livesz,
+                stack->alloccnt, stack->allocsz);
+        for (j=0; j<stack->trace.depth; j++)
+            fprintf(fp, " 0x%"PRIxPTR, (uintptr_t)stack->trace.frames[j]);
+        fprintf(fp, "\n");
+    }
+#if defined(LINUX)
+    // pprof symbolizes addresses with the mapping of the process.
+    {
+        char buf[1024];
+        size_t len;
+        FILE *maps = fopen("/proc/self/maps", "r");
+        if (maps) {
+            fprintf(fp, "\nMAPPED_LIBRARIES:\n");
+            while ((len = fread(buf, 1, sizeof(buf), maps)) > 0)
+                fwrite(buf, 1, len, fp);
+            fclose(maps);
+        }
+    }
+#endif
+}
+
+CMUTIL_STATIC void CMUTIL_MemProfWriteFolded(
+        FILE *fp, CMUTIL_MemProfStack *stacks, uint32_t cnt)
+{
+    char sym[256];
+    uint32_t i;
+    int j;
+    for (i=0; i<cnt; i++) {
+        CMUTIL_MemProfStack *stack = &stacks[i];
+        double avg, scale = 1.0;
+        if (stack->livesz <= 0)
+            continue;
+        // an allocation of avg bytes is sampled with 1-exp(-avg/period).
+        avg = (double)stack->allocsz / (double)stack->alloccnt;
+        if (g_cmutil_memprof_period > 0 && avg > 0)
+            scale = 1.0 / (1.0 - exp(-avg / (double)g_cmutil_memprof_period));
+        // outermost frame first.
+        for (j=stack->trace.depth-1; j>=0; j--) {
+            CMUTIL_CallStackSymbol(stack->trace.frames[j], sym, sizeof(sym));
+            fprintf(fp, "%s%s", sym, j > 0? ";":"");
+        }
+        fprintf(fp, " %"PRId64"\n", (int64_t)((double)stack->livesz * scale));
+    }
+}
+
+CMBool CMUTIL_MemDumpProfile(const char *path, CMMemProfileFormat format)
+{
+    CMUTIL_MemProfStack *stacks = NULL;
+    uint32_t cnt;
+    FILE *fp;
+    if (g_cmutil_memoper == CMMemSystem || g_cmutil_memprof_mutex == NULL)
+        return CMFalse;
+    // symbols are resolved on a copy, not to block sampling meanwhile.
+    CMCall(g_cmutil_memprof_mutex, Lock);
+    cnt = g_cmutil_memprof_cnt;
+    if (cnt > 0) {
+        stacks = malloc(sizeof(CMUTIL_MemProfStack) * cnt);
+        if (stacks)
+            memcpy(stacks, g_cmutil_memprof_stacks,
+                   sizeof(CMUTIL_MemProfStack) * cnt);
+    }
+    CMCall(g_cmutil_memprof_mutex, Unlock);
+    if (cnt > 0 && stacks == NULL)
+        return CMFalse;
+    fp = fopen(path, "w");
+    if (fp == NULL) {
+        if (stacks) free(stacks);
+        return CMFalse;
+    }
+    if (format == CMMemProfilePprof)
+        CMUTIL_MemProfWritePprof(fp, stacks, cnt);
+    else
+        CMUTIL_MemProfWriteFolded(fp, stacks, cnt);
+    fclose(fp);
+    if (stacks) free(stacks);
+    return CMTrue;
+}
+
+// must be called with g_cmutil_memcache_mutex locked.
+CMUTIL_STATIC void CMUTIL_MemStatsClass(int idx, CMUTIL_MemClassStats *cls)
+{
+    CMUTIL_MemRcyList *list = idx < MEM_BLOCK_SZ?
+                &g_cmutil_memrcyblocks[idx] : &g_cmutil_memmapped;
+    CMUTIL_MemThreadCache *cache;
+    memset(cls, 0x0, sizeof(CMUTIL_MemClassStats));
+    CMCall(list->mutex, Lock);
+    cls->blocks = list->cnt;
+    cls->heldsz = list->heldsz;
+    cls->inuse = list->inuse;
+    cls->inusesz = list->usedsize;
+    cls->cached = list->avlcnt;
+    cls->peakblocks = list->peakcnt;
+    cls->peakinuse = list->peakout;
+    cls->allocs = list->allocs;
+    cls->frees = list->frees;
+    cls->locks = list->locks;
+    cls->contended = list->contended;
+    CMCall(list->mutex, Unlock);
+    if (idx == MEM_BLOCK_SZ)
+        return;
+    // magazines of other threads are read without locking.
+    for (cache = g_cmutil_memcaches; cache; cache = cache->next) {
+        const CMUTIL_MemMagazine *mag = &cache->mags[idx];
+        cls->inuse += mag->inuse;
+        cls->inusesz += mag->usedsize;
+        cls->cached += mag->cnt;
+        cls->allocs += mag->allocs;
+        cls->frees += mag->frees;
+    }
+    cls->size = (size_t)CMUTIL_MemRcyClassSize(idx);
+    cls->cachedsz = cls->cached * (int64_t)cls->size;
+}
+
+CMBool CMUTIL_MemGetStats(CMUTIL_MemStats *stats)
+{
+    struct timeval now;
+    int i;
+    if (stats == NULL || g_cmutil_memoper == CMMemSystem)
+        return CMFalse;
+    memset(stats, 0x0, sizeof(CMUTIL_MemStats));
+    stats->oper = g_cmutil_memoper;
+    gettimeofday(&now, NULL);
+    CMCall(g_cmutil_memcache_mutex, Lock);
+    stats->interval =
+            (double)(now.tv_sec - g_cmutil_memstat_time.tv_sec) +
+            (double)(now.tv_usec - g_cmutil_memstat_time.tv_usec) / 1000000.0;
+    for (i=0; i<=MEM_BLOCK_SZ; i++) {
+        CMUTIL_MemClassStats cls;
+        CMUTIL_MemClassStats *total = &stats->total;
+        CMUTIL_MemStatsClass(i, &cls);
+        if (stats->interval > 0) {
+            cls.allocrate = (double)(cls.allocs - g_cmutil_memstat_prev[i][0])
+                    / stats->interval;
+            cls.freerate = (double)(cls.frees - g_cmutil_memstat_prev[i][1])
+                    / stats->interval;
+        }
+        g_cmutil_memstat_prev[i][0] = cls.allocs;
+        g_cmutil_memstat_prev[i][1] = cls.frees;
+        total->blocks += cls.blocks;
+        total->heldsz += cls.heldsz;
+        total->inuse += cls.inuse;
+        total->inusesz += cls.inusesz;
+        total->cached += cls.cached;
+        total->cachedsz += cls.cachedsz;
+        total->peakblocks += cls.peakblocks;
+        total->peakinuse += cls.peakinuse;
+        total->allocs += cls.allocs;
+        total->frees += cls.frees;
+        total->allocrate += cls.allocrate;
+        total->freerate += cls.freerate;
+        total->locks += cls.locks;
+        total->contended += cls.contended;
+        if ((cls.blocks > 0 || cls.allocs > 0) &&
+                stats->count < CMUTIL_MEM_MAX_CLASSES)
+            stats->classes[stats->count++] = cls;
+    }
+    memcpy(&g_cmutil_memstat_time, &now, sizeof(struct timeval));
+    CMCall(g_cmutil_memcache_mutex, Unlock);
+    stats->heldsz = CMUTIL_ATOMIC_LOAD64(&g_cmutil_mem_heldsz);
+    stats->peakheldsz = CMUTIL_ATOMIC_LOAD64(&g_cmutil_mem_peakheldsz);
+    return CMTrue;
+}
+
+CMUTIL_STATIC CMUTIL_JsonObject *CMUTIL_MemClassStatsToJson(
+        const CMUTIL_MemClassStats *cls)
+{
+    CMUTIL_JsonObject *res = CMUTIL_JsonObjectCreateInternal(__CMUTIL_Mem);
+    CMCall(res, PutLong, "size", (int64_t)cls->size);
+    CMCall(res, PutLong, "blocks", cls->blocks);
+    CMCall(res, PutLong, "heldBytes", cls->heldsz);
+    CMCall(res, PutLong, "inUse", cls->inuse);
+    CMCall(res, PutLong, "inUseBytes", cls->inusesz);
+    CMCall(res, PutLong, "cached", cls->cached);
+    CMCall(res, PutLong, "cachedBytes", cls->cachedsz);
+    CMCall(res, PutLong, "peakBlocks", cls->peakblocks);
+    CMCall(res, PutLong, "peakInUse", cls->peakinuse);
+    CMCall(res, PutLong, "allocs", cls->allocs);
+    CMCall(res, PutLong, "frees", cls->frees);
+    CMCall(res, PutDouble, "allocRate", cls->allocrate);
+    CMCall(res, PutDouble, "freeRate", cls->freerate);
+    CMCall(res, PutLong, "locks", cls->locks);
+    CMCall(res, PutLong, "contended", cls->contended);
+    return res;
+}
+
+CMUTIL_Json *CMUTIL_MemStatsToJson(const CMUTIL_MemStats *stats)
+{
+    CMUTIL_JsonObject *res;
+    CMUTIL_JsonArray *classes;
+    int i;
+    if (stats == NULL)
+        return NULL;
+    res = CMUTIL_JsonObjectCreateInternal(__CMUTIL_Mem);
+    CMCall(res, PutString, "oper",
+           stats->oper == CMMemDebug? "debug":"recycle");
+    CMCall(res, PutDouble, "interval", stats->interval);
+    CMCall(res, PutLong, "heldBytes", stats->heldsz);
+    CMCall(res, PutLong, "peakHeldBytes", stats->peakheldsz);
+    CMCall(res, Put, "total",
+           (CMUTIL_Json*)CMUTIL_MemClassStatsToJson(&stats->total));
+    classes = CMUTIL_JsonArrayCreateInternal(__CMUTIL_Mem);
+    for (i=0; i<stats->count; i++)
+        CMCall(classes, Add,
+               (CMUTIL_Json*)CMUTIL_MemClassStatsToJson(&stats->classes[i]));
+    CMCall(res, Put, "classes", (CMUTIL_Json*)classes);
+    return (CMUTIL_Json*)res;
+}
@@ -111,7 +111,6 @@ typedef struct CMUTIL_JsonValue_Internal {
 typedef struct CMUTIL_JsonObject_Internal {
     CMUTIL_JsonObject   base;
     CMUTIL_Map          *map;
-    CMUTIL_Array        *keys;
     CMUTIL_Mem          *memst;
 } CMUTIL_JsonObject_Internal;
 
@@ -440,8 +439,6 @@ CMUTIL_STATIC void CMUTIL_JsonObjectDestroy(CMUTIL_Json *json)
     if (ijobj) {
         if (ijobj->map)
             CMCall(ijobj->map, Destroy);
-        if (ijobj->keys)
-            CMCall(ijobj->keys, Destroy);
         ijobj->memst->Free(ijobj);
     }
 }
@@ -514,7 +511,6 @@ CMUTIL_STATIC void CMUTIL_JsonObjectPut(
     CMCall(ijobj->map, Put, key, json, (void**)&prev);
     // destory previous mapped item
     if (prev) CMCall(prev, Destroy);
-    else CMCall(ijobj->keys, Add, ijobj->memst->Strdup(key), NULL);
 }
 
 #define CMUTIL_JsonObjectPutBody(jobj, key, method, value) do {             \
@@ -561,9 +557,6 @@ CMUTIL_STATIC CMUTIL_Json *CMUTIL_JsonObjectRemove(
         CMUTIL_JsonObject *jobj, const char *key)
 {
     CMUTIL_JsonObject_Internal *ijobj = (CMUTIL_JsonObject_Internal*)jobj;
-    uint32_t idx = 0;
-    if (CMCall(ijobj->keys, Find, key, &idx))
-        ijobj->memst->Free(CMCall(ijobj->keys, RemoveAt, idx));
     return (CMUTIL_Json*)CMCall(ijobj->map, Remove, key);
 }
 
@@ -606,12 +599,9 @@ CMUTIL_JsonObject *CMUTIL_JsonObjectCreateInternal(CMUTIL_Mem *memst)
     memset(res, 0x0, sizeof(CMUTIL_JsonObject_Internal));
     memcpy(res, &g_cmutil_jsonobject, sizeof(CMUTIL_JsonObject));
     res->memst = memst;
+    // the map keeps insertion order.
     res->map = CMUTIL_MapCreateInternal(
-                memst, 256, CMFalse,
-                CMUTIL_JsonDestroyInternal, 0.75f);
-    res->keys = CMUTIL_ArrayCreateInternal(
-                memst, 10, (int(*)(const void*,const void*))strcmp,
-                memst->Free, CMFalse);
+                memst, 0, CMFalse, CMUTIL_JsonDestroyInternal, 0.75f);
     return (CMUTIL_JsonObject*)res;
 }
 
@@ -1260,3 +1250,9 @@ CMUTIL_Json *CMUTIL_JsonParse(CMUTIL_String *jsonstr)
 {
     return CMUTIL_JsonParseInternal(CMUTIL_GetMem(), jsonstr, CMFalse);
 }
+
+CMUTIL_Json *CMUTIL_JsonParseWithMem(
+        CMUTIL_Mem *memst, CMUTIL_String *jsonstr)
+{
+    return CMUTIL_JsonParseInternal(memst, jsonstr, CMFalse);
+}
@@ -914,6 +914,12 @@ CMUTIL_XmlNode *CMUTIL_XmlParseString(const char *xmlstr, size_t len)
     return CMUTIL_XmlParseStringInternal(CMUTIL_GetMem(), xmlstr, len);
 }
 
+CMUTIL_XmlNode *CMUTIL_XmlParseStringWithMem(
+        CMUTIL_Mem *memst, const char *xmlstr, size_t len)
+{
+    return CMUTIL_XmlParseStringInternal(memst, xmlstr, len);
+}
+
 CMUTIL_XmlNode *CMUTIL_XmlParseInternal(
         CMUTIL_Mem *memst, CMUTIL_String *str)
 {
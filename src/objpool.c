@@ -0,0 +1,328 @@
+/*
+MIT License
+
+Copyright (c) 2020 Dennis Soungjin Park<xcomart@gmail.com>
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+ */
+
+
+#include "functions.h"
+
+CMUTIL_LogDefine("cmutils.objpool")
+
+/*
+ * Each pool owns one of fixed slots, every thread keeps a small free list
+ * (magazine) per slot, so Alloc and Free take no lock until a magazine
+ * runs empty or overflows. Magazines are tagged with the id of the pool,
+ * objects left in a magazine of a destroyed pool are simply forgotten.
+ */
+#define CMUTIL_OBJPOOL_SLOTS        64
+#define CMUTIL_OBJPOOL_ALIGN(x)     (((x) + 15) & ~(size_t)15)
+#define CMUTIL_OBJPOOL_MAGSZ        64  // objects kept by a thread at most
+#define CMUTIL_OBJPOOL_BATCH        32  // objects moved at once
+#define CMUTIL_OBJPOOL_SLABMIN      16  // objects in the first slab
+#define CMUTIL_OBJPOOL_SLABMAX      (64 * 1024)
+// largest object size served by shared pools.
+#define CMUTIL_OBJPOOL_SHAREDMAX    256
+#define CMUTIL_OBJPOOL_SHAREDCNT    (CMUTIL_OBJPOOL_SHAREDMAX / 16)
+
+typedef struct CMUTIL_ObjPoolMag {
+    void                *head;
+    uint32_t            id;
+    int                 cnt;
+} CMUTIL_ObjPoolMag;
+
+typedef struct CMUTIL_ObjectPool_Internal {
+    CMUTIL_ObjectPool   base;
+    CMUTIL_Mem          *memst;
+    CMUTIL_Mutex        *mutex;     // guards below
+    void                *head;      // objects not cached by threads
+    void                *slabs;
+    size_t              objsz;
+    size_t              slabcnt;    // objects in the next slab
+    uint32_t            id;
+    int                 slot;       // -1 if no slot was available
+} CMUTIL_ObjectPool_Internal;
+
+static CMUTIL_Mutex *g_cmutil_objpool_mutex = NULL;
+static CMUTIL_ObjectPool_Internal *g_cmutil_objpools[CMUTIL_OBJPOOL_SLOTS];
+static CMUTIL_ObjectPool_Internal
+        *g_cmutil_objpool_shared[CMUTIL_OBJPOOL_SHAREDCNT];
+static uint32_t g_cmutil_objpool_lastid = 0;
+static CMUTIL_TLS CMUTIL_ObjPoolMag
+        t_cmutil_objpool_mags[CMUTIL_OBJPOOL_SLOTS];
+// releases magazines of any exiting thread, not only of CMUTIL_Thread.
+static CMUTIL_TLSKey g_cmutil_objpool_key;
+static CMBool g_cmutil_objpool_haskey = CMFalse;
+
+CMUTIL_STATIC void CMUTIL_ObjectPoolGrow(CMUTIL_ObjectPool_Internal *ipool)
+{
+    // slab header holds the link to next slab, objects follow.
+    size_t hdrsz = CMUTIL_OBJPOOL_ALIGN(sizeof(void*));
+    char *slab = ipool->memst->Alloc(hdrsz + ipool->slabcnt * ipool->objsz);
+    size_t i;
+    if (slab == NULL)
+        return;
+    *(void**)slab = ipool->slabs;
+    ipool->slabs = slab;
+    for (i = ipool->slabcnt; i > 0; i--) {
+        void *obj = slab + hdrsz + (i - 1) * ipool->objsz;
+        *(void**)obj = ipool->head;
+        ipool->head = obj;
+    }
+    if (ipool->slabcnt * 2 * ipool->objsz <= CMUTIL_OBJPOOL_SLABMAX)
+        ipool->slabcnt *= 2;
+}
+
+CMUTIL_STATIC CMUTIL_ObjPoolMag *CMUTIL_ObjectPoolMag(
+        CMUTIL_ObjectPool_Internal *ipool)
+{
+    CMUTIL_ObjPoolMag *mag;
+    if (ipool->slot < 0)
+        return NULL;
+    mag = &t_cmutil_objpool_mags[ipool->slot];
+    if (mag->id != ipool->id) {
+        // stale magazine of a destroyed pool.
+        mag->head = NULL;
+        mag->cnt = 0;
+        mag->id = ipool->id;
+        // any non-null value makes the thread exit hook run.
+        if (g_cmutil_objpool_haskey)
+            CMUTIL_TLSKEY_SET(g_cmutil_objpool_key, t_cmutil_objpool_mags);
+    }
+    return mag;
+}
+
+CMUTIL_STATIC void *CMUTIL_ObjectPoolAlloc(CMUTIL_ObjectPool *pool)
+{
+    CMUTIL_ObjectPool_Internal *ipool = (CMUTIL_ObjectPool_Internal*)pool;
+    CMUTIL_ObjPoolMag *mag = CMUTIL_ObjectPoolMag(ipool);
+    void *res = NULL;
+    if (mag && mag->head) {
+        res = mag->head;
+        mag->head = *(void**)res;
+        mag->cnt--;
+        return res;
+    }
+    CMCall(ipool->mutex, Lock);
+    if (ipool->head == NULL)
+        CMUTIL_ObjectPoolGrow(ipool);
+    res = ipool->head;
+    if (res) {
+        ipool->head = *(void**)res;
+        // refill the magazine of this thread with a batch.
+        while (mag && ipool->head && mag->cnt < CMUTIL_OBJPOOL_BATCH) {
+            void *obj = ipool->head;
+            ipool->head = *(void**)obj;
+            *(void**)obj = mag->head;
+            mag->head = obj;
+            mag->cnt++;
+        }
+    }
+    CMCall(ipool->mutex, Unlock);
+    if (res == NULL)
+        CMLogError("cannot allocate object of size %lu",
+                   (unsigned long)ipool->objsz);
+    return res;
+}
+
+CMUTIL_STATIC void CMUTIL_ObjectPoolFree(CMUTIL_ObjectPool *pool, void *obj)
+{
+    CMUTIL_ObjectPool_Internal *ipool = (CMUTIL_ObjectPool_Internal*)pool;
+    CMUTIL_ObjPoolMag *mag;
+    if (obj == NULL)
+        return;
+    mag = CMUTIL_ObjectPoolMag(ipool);
+    if (mag) {
+        *(void**)obj = mag->head;
+        mag->head = obj;
+        if (++mag->cnt <= CMUTIL_OBJPOOL_MAGSZ)
+            return;
+        // magazine overflowed, give a batch back to the pool.
+        CMCall(ipool->mutex, Lock);
+        while (mag->cnt > CMUTIL_OBJPOOL_MAGSZ - CMUTIL_OBJPOOL_BATCH) {
+            obj = mag->head;
+            mag->head = *(void**)obj;
+            mag->cnt--;
+            *(void**)obj = ipool->head;
+            ipool->head = obj;
+        }
+        CMCall(ipool->mutex, Unlock);
+    } else {
+        CMCall(ipool->mutex, Lock);
+        *(void**)obj = ipool->head;
+        ipool->head = obj;
+        CMCall(ipool->mutex, Unlock);
+    }
+}
+
+CMUTIL_STATIC void CMUTIL_ObjectPoolDestroyPrivate(
+        CMUTIL_ObjectPool_Internal *ipool)
+{
+    while (ipool->slabs) {
+        void *next = *(void**)ipool->slabs;
+        ipool->memst->Free(ipool->slabs);
+        ipool->slabs = next;
+    }
+    if (ipool->mutex)
+        CMCall(ipool->mutex, Destroy);
+    ipool->memst->Free(ipool);
+}
+
+CMUTIL_STATIC void CMUTIL_ObjectPoolDestroy(CMUTIL_ObjectPool *pool)
+{
+    CMUTIL_ObjectPool_Internal *ipool = (CMUTIL_ObjectPool_Internal*)pool;
+    if (ipool == NULL)
+        return;
+    CMCall(g_cmutil_objpool_mutex, Lock);
+    if (ipool->slot >= 0)
+        g_cmutil_objpools[ipool->slot] = NULL;
+    CMCall(g_cmutil_objpool_mutex, Unlock);
+    CMUTIL_ObjectPoolDestroyPrivate(ipool);
+}
+
+static CMUTIL_ObjectPool g_cmutil_objectpool = {
+    CMUTIL_ObjectPoolAlloc,
+    CMUTIL_ObjectPoolFree,
+    CMUTIL_ObjectPoolDestroy
+};
+
+CMUTIL_STATIC void CMUTIL_TLS_DTOR CMUTIL_ObjectPoolThreadExit(void *ptr)
+{
+    CMUTIL_UNUSED(ptr);
+    CMUTIL_ObjectPoolThreadRelease();
+}
+
+void CMUTIL_ObjectPoolInit(void)
+{
+    memset(g_cmutil_objpools, 0x0, sizeof(g_cmutil_objpools));
+    memset(g_cmutil_objpool_shared, 0x0, sizeof(g_cmutil_objpool_shared));
+    g_cmutil_objpool_mutex = CMUTIL_MutexCreateInternal(CMUTIL_GetMem());
+    g_cmutil_objpool_haskey = CMUTIL_TLSKEY_CREATE(
+                &g_cmutil_objpool_key, CMUTIL_ObjectPoolThreadExit);
+}
+
+void CMUTIL_ObjectPoolClear(void)
+{
+    int i;
+    if (g_cmutil_objpool_haskey) {
+        CMUTIL_TLSKEY_DELETE(g_cmutil_objpool_key);
+        g_cmutil_objpool_haskey = CMFalse;
+    }
+    for (i=0; i<CMUTIL_OBJPOOL_SHAREDCNT; i++) {
+        if (g_cmutil_objpool_shared[i]) {
+            CMUTIL_ObjectPoolDestroy(
+                        (CMUTIL_ObjectPool*)g_cmutil_objpool_shared[i]);
+            g_cmutil_objpool_shared[i] = NULL;
+        }
+    }
+    if (g_cmutil_objpool_mutex) {
+        CMCall(g_cmutil_objpool_mutex, Destroy);
+        g_cmutil_objpool_mutex = NULL;
+    }
+}
+
+void CMUTIL_ObjectPoolThreadRelease(void)
+{
+    int i;
+    if (g_cmutil_objpool_mutex == NULL)
+        return;
+    if (g_cmutil_objpool_haskey)
+        CMUTIL_TLSKEY_SET(g_cmutil_objpool_key, NULL);
+    CMCall(g_cmutil_objpool_mutex, Lock);
+    for (i=0; i<CMUTIL_OBJPOOL_SLOTS; i++) {
+        CMUTIL_ObjPoolMag *mag = &t_cmutil_objpool_mags[i];
+        CMUTIL_ObjectPool_Internal *ipool = g_cmutil_objpools[i];
+        if (mag->head && ipool && ipool->id == mag->id) {
+            CMCall(ipool->mutex, Lock);
+            while (mag->head) {
+                void *obj = mag->head;
+                mag->head = *(void**)obj;
+                *(void**)obj = ipool->head;
+                ipool->head = obj;
+            }
+            CMCall(ipool->mutex, Unlock);
+        }
+        mag->head = NULL;
+        mag->cnt = 0;
+    }
+    CMCall(g_cmutil_objpool_mutex, Unlock);
+}
+
+CMUTIL_ObjectPool *CMUTIL_ObjectPoolCreateInternal(
+        CMUTIL_Mem *memst, size_t objsize)
+{
+    CMUTIL_ObjectPool_Internal *res =
+            memst->Alloc(sizeof(CMUTIL_ObjectPool_Internal));
+    if (res == NULL)
+        return NULL;
+    memset(res, 0x0, sizeof(CMUTIL_ObjectPool_Internal));
+    memcpy(res, &g_cmutil_objectpool, sizeof(CMUTIL_ObjectPool));
+    res->memst = memst;
+    if (objsize < sizeof(void*))
+        objsize = sizeof(void*);
+    res->objsz = CMUTIL_OBJPOOL_ALIGN(objsize);
+    res->slabcnt = CMUTIL_OBJPOOL_SLABMIN;
+    res->mutex = CMUTIL_MutexCreateInternal(memst);
+    res->slot = -1;
+    CMCall(g_cmutil_objpool_mutex, Lock);
+    res->id = ++g_cmutil_objpool_lastid;
+    for (int i=0; i<CMUTIL_OBJPOOL_SLOTS; i++) {
+        if (g_cmutil_objpools[i] == NULL) {
+            g_cmutil_objpools[i] = res;
+            res->slot = i;
+            break;
+        }
+    }
+    CMCall(g_cmutil_objpool_mutex, Unlock);
+    return (CMUTIL_ObjectPool*)res;
+}
+
+CMUTIL_ObjectPool *CMUTIL_ObjectPoolCreate(size_t objsize)
+{
+    return CMUTIL_ObjectPoolCreateInternal(CMUTIL_GetMem(), objsize);
+}
+
+CMUTIL_ObjectPool *CMUTIL_ObjectPoolShared(size_t objsize)
+{
+    CMUTIL_ObjectPool_Internal *res = NULL;
+    size_t idx = CMUTIL_OBJPOOL_ALIGN(objsize) / 16 - 1;
+    // other memory operators keep track of every single allocation.
+    if (g_cmutil_objpool_mutex == NULL ||
+            CMUTIL_MemGetOper() != CMMemRecycle ||
+            objsize == 0 || idx >= CMUTIL_OBJPOOL_SHAREDCNT)
+        return NULL;
+    CMCall(g_cmutil_objpool_mutex, Lock);
+    res = g_cmutil_objpool_shared[idx];
+    CMCall(g_cmutil_objpool_mutex, Unlock);
+    if (res == NULL) {
+        CMUTIL_ObjectPool_Internal *created = (CMUTIL_ObjectPool_Internal*)
+                CMUTIL_ObjectPoolCreateInternal(
+                    CMUTIL_GetMem(), (idx + 1) * 16);
+        CMCall(g_cmutil_objpool_mutex, Lock);
+        res = g_cmutil_objpool_shared[idx];
+        if (res == NULL)
+            res = g_cmutil_objpool_shared[idx] = created;
+        CMCall(g_cmutil_objpool_mutex, Unlock);
+        if (res != created && created)
+            CMUTIL_ObjectPoolDestroy((CMUTIL_ObjectPool*)created);
+    }
+    return (CMUTIL_ObjectPool*)res;
+}
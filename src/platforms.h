@@ -151,11 +151,83 @@ typedef int socklen_t;
 # define USLEEP             usleep
 #endif
 
+#include <stddef.h>
 #include <stdlib.h>
 #include <string.h>
 #include <stdio.h>
 #include <ctype.h>
 
+/* Thread local storage class specifier. */
+#if defined(_MSC_VER)
+# define CMUTIL_TLS         __declspec(thread)
+#else
+# define CMUTIL_TLS         __thread
+#endif
+
+/*
+ * Thread exit hooks. The destructor of a key is called with the value the
+ * exiting thread set, for threads not created by this library too.
+ */
+#if defined(MSWIN)
+typedef DWORD CMUTIL_TLSKey;
+# define CMUTIL_TLS_DTOR                WINAPI
+# define CMUTIL_TLSKEY_CREATE(k, d)     \
+    ((*(k) = FlsAlloc(d)) != FLS_OUT_OF_INDEXES)
+# define CMUTIL_TLSKEY_DELETE(k)        FlsFree(k)
+# define CMUTIL_TLSKEY_SET(k, v)        FlsSetValue(k, v)
+#else
+# include <pthread.h>
+typedef pthread_key_t CMUTIL_TLSKey;
+# define CMUTIL_TLS_DTOR
+# define CMUTIL_TLSKEY_CREATE(k, d)     (pthread_key_create(k, d) == 0)
+# define CMUTIL_TLSKEY_DELETE(k)        pthread_key_delete(k)
+# define CMUTIL_TLSKEY_SET(k, v)        pthread_setspecific(k, v)
+#endif
+
+/* Atomic operations on 64 bit integers, add and load are relaxed. */
+#if defined(_MSC_VER)
+# define CMUTIL_ATOMIC_ADD64(p, v)  \
+    InterlockedExchangeAdd64((volatile LONG64*)(p), (LONG64)(v))
+# define CMUTIL_ATOMIC_LOAD64(p)    \
+    InterlockedCompareExchange64((volatile LONG64*)(p), 0, 0)
+# define CMUTIL_ATOMIC_CAS64(p, e, d)   \
+    (InterlockedCompareExchange64(  \
+        (volatile LONG64*)(p), (LONG64)(d), (LONG64)(e)) == (LONG64)(e))
+#else
+# define CMUTIL_ATOMIC_ADD64(p, v)  \
+    __atomic_fetch_add((p), (v), __ATOMIC_RELAXED)
+# define CMUTIL_ATOMIC_LOAD64(p)    \
+    __atomic_load_n((p), __ATOMIC_RELAXED)
+# define CMUTIL_ATOMIC_CAS64(p, e, d)   \
+    __sync_bool_compare_and_swap((p), (e), (d))
+#endif
+
+/*
+ * Publication of shared data: stores release, loads acquire and the fence
+ * orders everything, including a store against a following load.
+ */
+#if defined(_MSC_VER)
+# define CMUTIL_ATOMIC_STORE64(p, v)    \
+    InterlockedExchange64((volatile LONG64*)(p), (LONG64)(v))
+# define CMUTIL_ATOMIC_LOADACQ64(p) \
+    InterlockedCompareExchange64((volatile LONG64*)(p), 0, 0)
+# define CMUTIL_ATOMIC_LOADP(p)     \
+    InterlockedCompareExchangePointer((PVOID volatile*)(p), NULL, NULL)
+# define CMUTIL_ATOMIC_STOREP(p, v) \
+    InterlockedExchangePointer((PVOID volatile*)(p), (PVOID)(v))
+# define CMUTIL_ATOMIC_FENCE()      MemoryBarrier()
+#else
+# define CMUTIL_ATOMIC_STORE64(p, v)    \
+    __atomic_store_n((p), (v), __ATOMIC_RELEASE)
+# define CMUTIL_ATOMIC_LOADACQ64(p) \
+    __atomic_load_n((p), __ATOMIC_ACQUIRE)
+# define CMUTIL_ATOMIC_LOADP(p)     \
+    __atomic_load_n((p), __ATOMIC_ACQUIRE)
+# define CMUTIL_ATOMIC_STOREP(p, v) \
+    __atomic_store_n((p), (v), __ATOMIC_RELEASE)
+# define CMUTIL_ATOMIC_FENCE()      __atomic_thread_fence(__ATOMIC_SEQ_CST)
+#endif
+
 #if defined(MSWIN)
 # if _WIN64
 #  define ARCH64
@@ -0,0 +1,387 @@
+/*
+MIT License
+
+Copyright (c) 2020 Dennis Soungjin Park<xcomart@gmail.com>
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+ */
+
+
+#include "functions.h"
+
+CMUTIL_LogDefine("cmutils.queue")
+
+/*
+ * Bounded MPMC ring of D. Vyukov. Every cell carries a sequence number
+ * telling which lap of the ring it is ready for: a producer owns the cell
+ * of position 'pos' when its sequence equals 'pos', a consumer when it
+ * equals 'pos + 1'. Positions are claimed by CAS, so producers and
+ * consumers never take a lock and only contend on their own counter.
+ *
+ * Blocking calls register themselves in a waiter count before sleeping on
+ * a semaphore. The opposite side takes one registration off the count for
+ * each permit it releases, so the semaphore is only touched when somebody
+ * is really woken. Both sides fence between their update and the check of
+ * the other side, so no wakeup is lost.
+ */
+
+typedef struct CMUTIL_QueueCell {
+    uint64_t            seq;
+    void                *data;
+} CMUTIL_QueueCell;
+
+typedef struct CMUTIL_Queue_Internal {
+    CMUTIL_Queue        base;
+    CMUTIL_QueueCell    *cells;
+    uint64_t            mask;
+    CMFreeCB            freecb;
+    CMUTIL_Mem          *memst;
+    CMUTIL_Semaphore    *pushsem;   // producers waiting for room
+    CMUTIL_Semaphore    *popsem;    // consumers waiting for items
+    uint64_t            pushwait;
+    uint64_t            popwait;
+    char                dummy_padder[64];
+    uint64_t            enqpos;
+    char                dummy_padder2[56];
+    uint64_t            deqpos;
+    char                dummy_padder3[56];
+} CMUTIL_Queue_Internal;
+
+CMUTIL_STATIC size_t CMUTIL_QueueTryPushBase(
+        CMUTIL_Queue_Internal *iq, void *const *items, size_t count)
+{
+    uint64_t pos = CMUTIL_ATOMIC_LOAD64(&iq->enqpos);
+    size_t i, n;
+    for (;;) {
+        // count cells free for this lap from 'pos' on.
+        for (n=0; n<count; n++) {
+            CMUTIL_QueueCell *cell = &iq->cells[(pos + n) & iq->mask];
+            int64_t dif = (int64_t)(CMUTIL_ATOMIC_LOADACQ64(&cell->seq) -
+                                    (pos + n));
+            if (dif != 0) {
+                if (n == 0 && dif > 0)
+                    n = (size_t)-1;     // 'pos' is stale
+                break;
+            }
+        }
+        if (n == (size_t)-1) {
+            pos = CMUTIL_ATOMIC_LOAD64(&iq->enqpos);
+            continue;
+        }
+        if (n == 0)
+            return 0;   // full
+        if (CMUTIL_ATOMIC_CAS64(&iq->enqpos, pos, pos + n))
+            break;
+        pos = CMUTIL_ATOMIC_LOAD64(&iq->enqpos);
+    }
+    for (i=0; i<n; i++) {
+        CMUTIL_QueueCell *cell = &iq->cells[(pos + i) & iq->mask];
+        cell->data = items[i];
+        CMUTIL_ATOMIC_STORE64(&cell->seq, pos + i + 1);
+    }
+    return n;
+}
+
+CMUTIL_STATIC size_t CMUTIL_QueueTryPopBase(
+        CMUTIL_Queue_Internal *iq, void **items, size_t count)
+{
+    uint64_t pos = CMUTIL_ATOMIC_LOAD64(&iq->deqpos);
+    size_t i, n;
+    for (;;) {
+        for (n=0; n<count; n++) {
+            CMUTIL_QueueCell *cell = &iq->cells[(pos + n) & iq->mask];
+            int64_t dif = (int64_t)(CMUTIL_ATOMIC_LOADACQ64(&cell->seq) -
+                                    (pos + n + 1));
+            if (dif != 0) {
+                if (n == 0 && dif > 0)
+                    n = (size_t)-1;
+                break;
+            }
+        }
+        if (n == (size_t)-1) {
+            pos = CMUTIL_ATOMIC_LOAD64(&iq->deqpos);
+            continue;
+        }
+        if (n == 0)
+            return 0;   // empty
+        if (CMUTIL_ATOMIC_CAS64(&iq->deqpos, pos, pos + n))
+            break;
+        pos = CMUTIL_ATOMIC_LOAD64(&iq->deqpos);
+    }
+    for (i=0; i<n; i++) {
+        CMUTIL_QueueCell *cell = &iq->cells[(pos + i) & iq->mask];
+        items[i] = cell->data;
+        CMUTIL_ATOMIC_STORE64(&cell->seq, pos + i + iq->mask + 1);
+    }
+    return n;
+}
+
+// wakes up to 'count' threads waiting on the other side.
+CMUTIL_STATIC void CMUTIL_QueueWake(
+        uint64_t *waiters, CMUTIL_Semaphore *sem, size_t count)
+{
+    CMUTIL_ATOMIC_FENCE();
+    while (count > 0) {
+        uint64_t nwait = CMUTIL_ATOMIC_LOAD64(waiters);
+        if (nwait == 0)
+            break;
+        // each permit released consumes one registration.
+        if (CMUTIL_ATOMIC_CAS64(waiters, nwait, nwait - 1)) {
+            CMCall(sem, Release);
+            count--;
+        }
+    }
+}
+
+// withdraws the registration of a waiter leaving without being woken.
+CMUTIL_STATIC void CMUTIL_QueueLeave(
+        uint64_t *waiters, CMUTIL_Semaphore *sem)
+{
+    uint64_t nwait = CMUTIL_ATOMIC_LOAD64(waiters);
+    while (nwait > 0) {
+        if (CMUTIL_ATOMIC_CAS64(waiters, nwait, nwait - 1))
+            return;
+        nwait = CMUTIL_ATOMIC_LOAD64(waiters);
+    }
+    // a waker has already taken it, drain the permit it releases.
+    while (!CMCall(sem, Acquire, -1))
+        ;
+}
+
+// milliseconds left until the deadline, -1 to wait forever.
+CMUTIL_STATIC long CMUTIL_QueueRemain(
+        const struct timeval *deadline, long millisec)
+{
+    struct timeval now;
+    long remain;
+    if (millisec < 0)
+        return -1;
+    gettimeofday(&now, NULL);
+    remain = (long)(deadline->tv_sec - now.tv_sec) * 1000 +
+            (long)(deadline->tv_usec - now.tv_usec) / 1000;
+    return remain > 0? remain : 0;
+}
+
+CMUTIL_STATIC void CMUTIL_QueueDeadline(
+        struct timeval *deadline, long millisec)
+{
+    gettimeofday(deadline, NULL);
+    if (millisec > 0) {
+        deadline->tv_sec += millisec / 1000;
+        deadline->tv_usec += (millisec % 1000) * 1000;
+        if (deadline->tv_usec >= 1000000) {
+            deadline->tv_sec++;
+            deadline->tv_usec -= 1000000;
+        }
+    }
+}
+
+CMUTIL_STATIC CMBool CMUTIL_QueueTryPush(CMUTIL_Queue *queue, void *item)
+{
+    CMUTIL_Queue_Internal *iq = (CMUTIL_Queue_Internal*)queue;
+    if (CMUTIL_QueueTryPushBase(iq, &item, 1) == 0)
+        return CMFalse;
+    CMUTIL_QueueWake(&iq->popwait, iq->popsem, 1);
+    return CMTrue;
+}
+
+CMUTIL_STATIC CMBool CMUTIL_QueueTryPop(CMUTIL_Queue *queue, void **item)
+{
+    CMUTIL_Queue_Internal *iq = (CMUTIL_Queue_Internal*)queue;
+    if (CMUTIL_QueueTryPopBase(iq, item, 1) == 0)
+        return CMFalse;
+    CMUTIL_QueueWake(&iq->pushwait, iq->pushsem, 1);
+    return CMTrue;
+}
+
+CMUTIL_STATIC CMBool CMUTIL_QueuePush(
+        CMUTIL_Queue *queue, void *item, long millisec)
+{
+    CMUTIL_Queue_Internal *iq = (CMUTIL_Queue_Internal*)queue;
+    struct timeval deadline;
+    CMBool res = CMFalse;
+    if (CMUTIL_QueueTryPush(queue, item))
+        return CMTrue;
+    CMUTIL_QueueDeadline(&deadline, millisec);
+    CMUTIL_ATOMIC_ADD64(&iq->pushwait, 1);
+    for (;;) {
+        long remain;
+        CMUTIL_ATOMIC_FENCE();
+        if (CMUTIL_QueueTryPushBase(iq, &item, 1) > 0) {
+            res = CMTrue;
+            break;
+        }
+        remain = CMUTIL_QueueRemain(&deadline, millisec);
+        if (remain == 0)
+            break;
+        // the waker has taken the registration, register again.
+        if (CMCall(iq->pushsem, Acquire, remain))
+            CMUTIL_ATOMIC_ADD64(&iq->pushwait, 1);
+    }
+    CMUTIL_QueueLeave(&iq->pushwait, iq->pushsem);
+    if (res)
+        CMUTIL_QueueWake(&iq->popwait, iq->popsem, 1);
+    return res;
+}
+
+CMUTIL_STATIC CMBool CMUTIL_QueuePop(
+        CMUTIL_Queue *queue, void **item, long millisec)
+{
+    CMUTIL_Queue_Internal *iq = (CMUTIL_Queue_Internal*)queue;
+    struct timeval deadline;
+    CMBool res = CMFalse;
+    if (CMUTIL_QueueTryPop(queue, item))
+        return CMTrue;
+    CMUTIL_QueueDeadline(&deadline, millisec);
+    CMUTIL_ATOMIC_ADD64(&iq->popwait, 1);
+    for (;;) {
+        long remain;
+        CMUTIL_ATOMIC_FENCE();
+        if (CMUTIL_QueueTryPopBase(iq, item, 1) > 0) {
+            res = CMTrue;
+            break;
+        }
+        remain = CMUTIL_QueueRemain(&deadline, millisec);
+        if (remain == 0)
+            break;
+        // the waker has taken the registration, register again.
+        if (CMCall(iq->popsem, Acquire, remain))
+            CMUTIL_ATOMIC_ADD64(&iq->popwait, 1);
+    }
+    CMUTIL_QueueLeave(&iq->popwait, iq->popsem);
+    if (res)
+        CMUTIL_QueueWake(&iq->pushwait, iq->pushsem, 1);
+    return res;
+}
+
+CMUTIL_STATIC size_t CMUTIL_QueuePushBatch(
+        CMUTIL_Queue *queue, void *const *items, size_t count)
+{
+    CMUTIL_Queue_Internal *iq = (CMUTIL_Queue_Internal*)queue;
+    size_t n = CMUTIL_QueueTryPushBase(iq, items, count);
+    if (n > 0)
+        CMUTIL_QueueWake(&iq->popwait, iq->popsem, n);
+    return n;
+}
+
+CMUTIL_STATIC size_t CMUTIL_QueuePopBatch(
+        CMUTIL_Queue *queue, void **items, size_t count)
+{
+    CMUTIL_Queue_Internal *iq = (CMUTIL_Queue_Internal*)queue;
+    size_t n = CMUTIL_QueueTryPopBase(iq, items, count);
+    if (n > 0)
+        CMUTIL_QueueWake(&iq->pushwait, iq->pushsem, n);
+    return n;
+}
+
+CMUTIL_STATIC size_t CMUTIL_QueueGetSize(const CMUTIL_Queue *queue)
+{
+    const CMUTIL_Queue_Internal *iq = (const CMUTIL_Queue_Internal*)queue;
+    uint64_t deq = CMUTIL_ATOMIC_LOAD64(&iq->deqpos);
+    uint64_t enq = CMUTIL_ATOMIC_LOAD64(&iq->enqpos);
+    // positions are read apart, clamp what other threads changed between.
+    if (enq <= deq)
+        return 0;
+    if (enq - deq > iq->mask + 1)
+        return (size_t)(iq->mask + 1);
+    return (size_t)(enq - deq);
+}
+
+CMUTIL_STATIC size_t CMUTIL_QueueGetCapacity(const CMUTIL_Queue *queue)
+{
+    const CMUTIL_Queue_Internal *iq = (const CMUTIL_Queue_Internal*)queue;
+    return (size_t)(iq->mask + 1);
+}
+
+CMUTIL_STATIC void CMUTIL_QueueDestroy(CMUTIL_Queue *queue)
+{
+    CMUTIL_Queue_Internal *iq = (CMUTIL_Queue_Internal*)queue;
+    if (iq) {
+        if (iq->cells) {
+            void *item;
+            while (CMUTIL_QueueTryPopBase(iq, &item, 1) > 0)
+                if (iq->freecb)
+                    iq->freecb(item);
+            iq->memst->Free(iq->cells);
+        }
+        if (iq->pushsem)
+            CMCall(iq->pushsem, Destroy);
+        if (iq->popsem)
+            CMCall(iq->popsem, Destroy);
+        iq->memst->Free(iq);
+    }
+}
+
+static CMUTIL_Queue g_cmutil_queue = {
+    CMUTIL_QueueTryPush,
+    CMUTIL_QueueTryPop,
+    CMUTIL_QueuePush,
+    CMUTIL_QueuePop,
+    CMUTIL_QueuePushBatch,
+    CMUTIL_QueuePopBatch,
+    CMUTIL_QueueGetSize,
+    CMUTIL_QueueGetCapacity,
+    CMUTIL_QueueDestroy
+};
+
+CMUTIL_Queue *CMUTIL_QueueCreateInternal(
+        CMUTIL_Mem *memst, size_t capacity, CMFreeCB freecb)
+{
+    CMUTIL_Queue_Internal *iq = NULL;
+    uint64_t i, cap = 2;
+    while (cap < capacity) {
+        if (cap > (SIZE_MAX / sizeof(CMUTIL_QueueCell)) / 2) {
+            CMLogErrorS("Queue capacity %zu is too large.", capacity);
+            return NULL;
+        }
+        cap <<= 1;
+    }
+    iq = memst->Alloc(sizeof(CMUTIL_Queue_Internal));
+    if (iq == NULL) {
+        CMLogErrorS("Failed to allocate memory for queue.");
+        return NULL;
+    }
+    memset(iq, 0x0, sizeof(CMUTIL_Queue_Internal));
+    memcpy(iq, &g_cmutil_queue, sizeof(CMUTIL_Queue));
+    iq->memst = memst;
+    iq->freecb = freecb;
+    iq->mask = cap - 1;
+    iq->cells = memst->Alloc((size_t)cap * sizeof(CMUTIL_QueueCell));
+    iq->pushsem = CMUTIL_SemaphoreCreateInternal(memst, 0);
+    iq->popsem = CMUTIL_SemaphoreCreateInternal(memst, 0);
+    if (iq->cells == NULL || iq->pushsem == NULL || iq->popsem == NULL) {
+        CMLogErrorS("Failed to allocate memory for queue.");
+        if (iq->cells) {
+            memst->Free(iq->cells);
+            iq->cells = NULL;
+        }
+        CMUTIL_QueueDestroy((CMUTIL_Queue*)iq);
+        return NULL;
+    }
+    for (i=0; i<cap; i++) {
+        iq->cells[i].seq = i;
+        iq->cells[i].data = NULL;
+    }
+    return (CMUTIL_Queue*)iq;
+}
+
+CMUTIL_Queue *CMUTIL_QueueCreate(size_t capacity, CMFreeCB freecb)
+{
+    return CMUTIL_QueueCreateInternal(CMUTIL_GetMem(), capacity, freecb);
+}
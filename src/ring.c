@@ -0,0 +1,331 @@
+/*
+MIT License
+
+Copyright (c) 2020 Dennis Soungjin Park<xcomart@gmail.com>
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+ */
+
+
+#include "functions.h"
+
+CMUTIL_LogDefine("cmutils.ring")
+
+/*
+ * Byte ring for one producer and one consumer. Positions grow forever and
+ * are masked into the buffer, 'head' is written by the producer only and
+ * 'tail' by the consumer only, each on its own cache line together with
+ * the cached copy of the other side's position, so the sides touch
+ * shared lines only when their cached view runs out.
+ *
+ * A reservation is always contiguous. If it does not fit before the end
+ * of the buffer, the rest of the lap is skipped: the skipped position is
+ * published in 'gapat' before 'head', and the consumer jumps over it.
+ */
+
+#define CMUTIL_RING_NOGAP   UINT64_MAX
+
+typedef struct CMUTIL_ByteRing_Internal {
+    CMUTIL_ByteRing     base;
+    uint8_t             *data;
+    uint64_t            mask;
+    CMUTIL_Mem          *memst;
+    uint64_t            gapat;      // start of the skipped end of a lap
+    char                dummy_padder[64];
+    // producer side
+    uint64_t            head;
+    uint64_t            tailcache;
+    uint64_t            respos;     // position of the pending reservation
+    size_t              reslen;
+    CMBool              resgap;
+    int                 dummy_padder2;
+    CMUTIL_ByteBuffer   *spill;     // bytes written but not fitted yet
+    size_t              spilloff;
+    char                dummy_padder3[64];
+    // consumer side
+    uint64_t            tail;
+    uint64_t            headcache;
+    size_t              peeked;     // bytes left from the last Peek
+    char                dummy_padder4[40];
+} CMUTIL_ByteRing_Internal;
+
+// free bytes for the producer, refreshing its view of the tail if short.
+CMUTIL_STATIC size_t CMUTIL_ByteRingFree(
+        CMUTIL_ByteRing_Internal *iring, uint64_t from, size_t need)
+{
+    uint64_t cap = iring->mask + 1;
+    if (from + need - iring->tailcache > cap)
+        iring->tailcache = CMUTIL_ATOMIC_LOADACQ64(&iring->tail);
+    // skipping to the next lap may go beyond the consumer.
+    if (from - iring->tailcache >= cap)
+        return 0;
+    return (size_t)(cap - (from - iring->tailcache));
+}
+
+// copies bytes into the ring as far as they fit, returns the copied size.
+CMUTIL_STATIC size_t CMUTIL_ByteRingCopyIn(
+        CMUTIL_ByteRing_Internal *iring, const uint8_t *bytes, size_t len)
+{
+    uint64_t head = iring->head;
+    size_t avail = CMUTIL_ByteRingFree(iring, head, len);
+    size_t off = (size_t)(head & iring->mask), first;
+    if (len > avail)
+        len = avail;
+    if (len == 0)
+        return 0;
+    first = (size_t)(iring->mask + 1) - off;
+    if (first > len)
+        first = len;
+    memcpy(iring->data + off, bytes, first);
+    memcpy(iring->data, bytes + first, len - first);
+    CMUTIL_ATOMIC_STORE64(&iring->head, head + len);
+    return len;
+}
+
+CMUTIL_STATIC CMBool CMUTIL_ByteRingFlush(CMUTIL_ByteRing *ring)
+{
+    CMUTIL_ByteRing_Internal *iring = (CMUTIL_ByteRing_Internal*)ring;
+    size_t size = CMCall(iring->spill, GetSize);
+    if (iring->spilloff < size) {
+        const uint8_t *bytes = CMCall(iring->spill, GetBytes);
+        iring->spilloff += CMUTIL_ByteRingCopyIn(
+                iring, bytes + iring->spilloff, size - iring->spilloff);
+        if (iring->spilloff < size)
+            return CMFalse;
+    }
+    if (size > 0) {
+        CMCall(iring->spill, Clear);
+        iring->spilloff = 0;
+    }
+    return CMTrue;
+}
+
+CMUTIL_STATIC void *CMUTIL_ByteRingReserve(CMUTIL_ByteRing *ring, size_t size)
+{
+    CMUTIL_ByteRing_Internal *iring = (CMUTIL_ByteRing_Internal*)ring;
+    uint64_t pos;
+    size_t contig;
+    CMBool gap = CMFalse;
+    if (size == 0 || size > iring->mask + 1) {
+        CMLogErrorS("Invalid reservation size: %zu (ring capacity is %zu).",
+                    size, (size_t)(iring->mask + 1));
+        return NULL;
+    }
+    // spilled bytes go first to keep the order of the stream.
+    if (!CMUTIL_ByteRingFlush(ring))
+        return NULL;
+    pos = iring->head;
+    contig = (size_t)(iring->mask + 1 - (pos & iring->mask));
+    if (contig < size) {
+        pos += contig;
+        gap = CMTrue;
+    }
+    if (CMUTIL_ByteRingFree(iring, pos, size) < size)
+        return NULL;
+    iring->respos = pos;
+    iring->reslen = size;
+    iring->resgap = gap;
+    return iring->data + (pos & iring->mask);
+}
+
+CMUTIL_STATIC CMBool CMUTIL_ByteRingCommit(CMUTIL_ByteRing *ring, size_t size)
+{
+    CMUTIL_ByteRing_Internal *iring = (CMUTIL_ByteRing_Internal*)ring;
+    if (size > iring->reslen) {
+        CMLogErrorS("Commit size %zu exceeds the reservation of %zu bytes.",
+                    size, iring->reslen);
+        return CMFalse;
+    }
+    if (size > 0) {
+        if (iring->resgap)
+            CMUTIL_ATOMIC_STORE64(&iring->gapat, iring->head);
+        CMUTIL_ATOMIC_STORE64(&iring->head, iring->respos + size);
+    }
+    iring->reslen = 0;
+    iring->resgap = CMFalse;
+    return CMTrue;
+}
+
+CMUTIL_STATIC CMBool CMUTIL_ByteRingWrite(
+        CMUTIL_ByteRing *ring, const void *bytes, size_t size)
+{
+    CMUTIL_ByteRing_Internal *iring = (CMUTIL_ByteRing_Internal*)ring;
+    const uint8_t *p = (const uint8_t*)bytes;
+    size_t done = 0;
+    if (CMUTIL_ByteRingFlush(ring))
+        done = CMUTIL_ByteRingCopyIn(iring, p, size);
+    while (done < size) {
+        size_t len = size - done;
+        if (len > UINT32_MAX)
+            len = UINT32_MAX;
+        if (!CMCall(iring->spill, AddBytes, p + done, (uint32_t)len)) {
+            CMLogErrorS("Failed to spill %zu bytes.", size - done);
+            return CMFalse;
+        }
+        done += len;
+    }
+    return CMTrue;
+}
+
+CMUTIL_STATIC size_t CMUTIL_ByteRingGetSpilled(const CMUTIL_ByteRing *ring)
+{
+    const CMUTIL_ByteRing_Internal *iring =
+            (const CMUTIL_ByteRing_Internal*)ring;
+    return CMCall(iring->spill, GetSize) - iring->spilloff;
+}
+
+CMUTIL_STATIC const void *CMUTIL_ByteRingPeek(
+        CMUTIL_ByteRing *ring, size_t *size)
+{
+    CMUTIL_ByteRing_Internal *iring = (CMUTIL_ByteRing_Internal*)ring;
+    uint64_t tail = iring->tail, end, gap;
+    if (tail == iring->headcache)
+        iring->headcache = CMUTIL_ATOMIC_LOADACQ64(&iring->head);
+    if (tail == iring->headcache) {
+        iring->peeked = 0;
+        *size = 0;
+        return NULL;
+    }
+    gap = CMUTIL_ATOMIC_LOAD64(&iring->gapat);
+    if (gap == tail) {
+        // the producer skipped the rest of this lap.
+        tail = (tail | iring->mask) + 1;
+        CMUTIL_ATOMIC_STORE64(&iring->tail, tail);
+    }
+    end = (tail | iring->mask) + 1;
+    if (end > iring->headcache)
+        end = iring->headcache;
+    if (gap > tail && gap < end)
+        end = gap;
+    *size = iring->peeked = (size_t)(end - tail);
+    return iring->data + (tail & iring->mask);
+}
+
+CMUTIL_STATIC CMBool CMUTIL_ByteRingConsume(CMUTIL_ByteRing *ring, size_t size)
+{
+    CMUTIL_ByteRing_Internal *iring = (CMUTIL_ByteRing_Internal*)ring;
+    if (size > iring->peeked) {
+        CMLogErrorS("Consume size %zu exceeds the peeked bytes.", size);
+        return CMFalse;
+    }
+    iring->peeked -= size;
+    CMUTIL_ATOMIC_STORE64(&iring->tail, iring->tail + size);
+    return CMTrue;
+}
+
+CMUTIL_STATIC size_t CMUTIL_ByteRingReadTo(
+        CMUTIL_ByteRing *ring, CMUTIL_ByteBuffer *buffer, size_t size)
+{
+    size_t done = 0;
+    while (done < size) {
+        size_t avail;
+        const void *bytes = CMUTIL_ByteRingPeek(ring, &avail);
+        if (bytes == NULL)
+            break;
+        if (avail > size - done)
+            avail = size - done;
+        if (avail > UINT32_MAX)
+            avail = UINT32_MAX;
+        if (!CMCall(buffer, AddBytes, bytes, (uint32_t)avail))
+            break;
+        CMUTIL_ByteRingConsume(ring, avail);
+        done += avail;
+    }
+    return done;
+}
+
+CMUTIL_STATIC size_t CMUTIL_ByteRingGetSize(const CMUTIL_ByteRing *ring)
+{
+    const CMUTIL_ByteRing_Internal *iring =
+            (const CMUTIL_ByteRing_Internal*)ring;
+    uint64_t tail = CMUTIL_ATOMIC_LOAD64(&iring->tail);
+    uint64_t head = CMUTIL_ATOMIC_LOAD64(&iring->head);
+    return head > tail? (size_t)(head - tail) : 0;
+}
+
+CMUTIL_STATIC size_t CMUTIL_ByteRingGetCapacity(const CMUTIL_ByteRing *ring)
+{
+    const CMUTIL_ByteRing_Internal *iring =
+            (const CMUTIL_ByteRing_Internal*)ring;
+    return (size_t)(iring->mask + 1);
+}
+
+CMUTIL_STATIC void CMUTIL_ByteRingDestroy(CMUTIL_ByteRing *ring)
+{
+    CMUTIL_ByteRing_Internal *iring = (CMUTIL_ByteRing_Internal*)ring;
+    if (iring) {
+        if (iring->data)
+            iring->memst->Free(iring->data);
+        if (iring->spill)
+            CMCall(iring->spill, Destroy);
+        iring->memst->Free(iring);
+    }
+}
+
+static CMUTIL_ByteRing g_cmutil_bytering = {
+    CMUTIL_ByteRingReserve,
+    CMUTIL_ByteRingCommit,
+    CMUTIL_ByteRingWrite,
+    CMUTIL_ByteRingFlush,
+    CMUTIL_ByteRingGetSpilled,
+    CMUTIL_ByteRingPeek,
+    CMUTIL_ByteRingConsume,
+    CMUTIL_ByteRingReadTo,
+    CMUTIL_ByteRingGetSize,
+    CMUTIL_ByteRingGetCapacity,
+    CMUTIL_ByteRingDestroy
+};
+
+CMUTIL_ByteRing *CMUTIL_ByteRingCreateInternal(
+        CMUTIL_Mem *memst, size_t capacity)
+{
+    CMUTIL_ByteRing_Internal *iring = NULL;
+    size_t cap = 64;
+    while (cap < capacity) {
+        if (cap > SIZE_MAX / 2) {
+            CMLogErrorS("Ring capacity %zu is too large.", capacity);
+            return NULL;
+        }
+        cap <<= 1;
+    }
+    iring = memst->Alloc(sizeof(CMUTIL_ByteRing_Internal));
+    if (iring == NULL) {
+        CMLogErrorS("Failed to allocate memory for ring.");
+        return NULL;
+    }
+    memset(iring, 0x0, sizeof(CMUTIL_ByteRing_Internal));
+    memcpy(iring, &g_cmutil_bytering, sizeof(CMUTIL_ByteRing));
+    iring->memst = memst;
+    iring->mask = cap - 1;
+    iring->gapat = CMUTIL_RING_NOGAP;
+    iring->data = memst->Alloc(cap);
+    iring->spill = CMUTIL_ByteBufferCreateInternal(
+                memst, CMUTIL_BYTEBUFFER_DEFAULT);
+    if (iring->data == NULL || iring->spill == NULL) {
+        CMLogErrorS("Failed to allocate memory for ring.");
+        CMUTIL_ByteRingDestroy((CMUTIL_ByteRing*)iring);
+        return NULL;
+    }
+    return (CMUTIL_ByteRing*)iring;
+}
+
+CMUTIL_ByteRing *CMUTIL_ByteRingCreate(size_t capacity)
+{
+    return CMUTIL_ByteRingCreateInternal(CMUTIL_GetMem(), capacity);
+}
@@ -0,0 +1,721 @@
+/*
+MIT License
+
+Copyright (c) 2020 Dennis Soungjin Park<xcomart@gmail.com>
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+ */
+
+
+#include "functions.h"
+
+CMUTIL_LogDefine("cmutils.sortedmap")
+
+/*
+ * B+tree: entries are kept in leaves chained in key order, inner nodes
+ * hold separators only. Separator i of an inner node is the smallest key
+ * of its child i + 1, so separators always point to live keys of leaves
+ * and may be given to the comparator. Keys and children of a node are
+ * stored in arrays, a lookup touches one node per level.
+ */
+
+#define CMUTIL_BTREE_ORDER      32      // keys of a node at most
+#define CMUTIL_BTREE_LEAFMIN    (CMUTIL_BTREE_ORDER / 2)
+#define CMUTIL_BTREE_INNERMIN   ((CMUTIL_BTREE_ORDER - 1) / 2)
+
+typedef struct CMUTIL_BTreeNode {
+    CMBool                  isleaf;
+    uint32_t                count;      // number of keys
+    void                    *keys[CMUTIL_BTREE_ORDER];
+} CMUTIL_BTreeNode;
+
+typedef struct CMUTIL_BTreeLeaf CMUTIL_BTreeLeaf;
+struct CMUTIL_BTreeLeaf {
+    CMUTIL_BTreeNode        node;
+    void                    *values[CMUTIL_BTREE_ORDER];
+    CMUTIL_BTreeLeaf        *prev;
+    CMUTIL_BTreeLeaf        *next;
+};
+
+typedef struct CMUTIL_BTreeInner {
+    CMUTIL_BTreeNode        node;
+    CMUTIL_BTreeNode        *children[CMUTIL_BTREE_ORDER + 1];
+} CMUTIL_BTreeInner;
+
+typedef struct CMUTIL_SortedMap_Internal {
+    CMUTIL_SortedMap        base;
+    CMUTIL_BTreeNode        *root;      // an empty leaf at least
+    CMUTIL_BTreeLeaf        *head;      // leaf of the smallest keys
+    size_t                  size;
+    CMCompareCB             comparator;
+    CMFreeCB                keyfreecb;
+    CMFreeCB                freecb;
+    CMUTIL_Mem              *memst;
+} CMUTIL_SortedMap_Internal;
+
+#define CMUTIL_BTreeLeafOf(n)   ((CMUTIL_BTreeLeaf*)(n))
+#define CMUTIL_BTreeInnerOf(n)  ((CMUTIL_BTreeInner*)(n))
+
+CMUTIL_STATIC CMUTIL_BTreeNode *CMUTIL_BTreeNodeAlloc(
+        CMUTIL_SortedMap_Internal *imap, CMBool isleaf)
+{
+    size_t size = isleaf? sizeof(CMUTIL_BTreeLeaf) : sizeof(CMUTIL_BTreeInner);
+    CMUTIL_BTreeNode *node = imap->memst->Alloc(size);
+    if (node == NULL) {
+        CMLogErrorS("Failed to allocate memory for sorted map node.");
+        return NULL;
+    }
+    memset(node, 0x0, size);
+    node->isleaf = isleaf;
+    return node;
+}
+
+// frees 'node' and its descendants except 'keep', entries only if asked.
+CMUTIL_STATIC void CMUTIL_BTreeNodeFree(
+        CMUTIL_SortedMap_Internal *imap, CMUTIL_BTreeNode *node,
+        CMUTIL_BTreeNode *keep, CMBool freedata)
+{
+    uint32_t i;
+    if (node->isleaf) {
+        CMUTIL_BTreeLeaf *leaf = CMUTIL_BTreeLeafOf(node);
+        for (i=0; freedata && i<node->count; i++) {
+            if (imap->keyfreecb)
+                imap->keyfreecb(node->keys[i]);
+            if (imap->freecb)
+                imap->freecb(leaf->values[i]);
+        }
+    } else {
+        CMUTIL_BTreeInner *inner = CMUTIL_BTreeInnerOf(node);
+        for (i=0; i<=node->count; i++)
+            CMUTIL_BTreeNodeFree(imap, inner->children[i], keep, freedata);
+    }
+    if (node != keep)
+        imap->memst->Free(node);
+}
+
+// index of the first key not less than 'key'.
+CMUTIL_STATIC uint32_t CMUTIL_BTreeLowerBound(
+        const CMUTIL_SortedMap_Internal *imap, const CMUTIL_BTreeNode *node,
+        const void *key, CMBool *found)
+{
+    uint32_t stpos = 0, edpos = node->count;
+    while (stpos < edpos) {
+        uint32_t mid = (stpos + edpos) / 2;
+        if (imap->comparator(key, node->keys[mid]) > 0)
+            stpos = mid + 1;
+        else
+            edpos = mid;
+    }
+    *found = stpos < node->count &&
+            imap->comparator(key, node->keys[stpos]) == 0? CMTrue : CMFalse;
+    return stpos;
+}
+
+// child of an inner node whose subtree may hold the key.
+CMUTIL_STATIC uint32_t CMUTIL_BTreeChildIndex(
+        const CMUTIL_SortedMap_Internal *imap, const CMUTIL_BTreeNode *node,
+        const void *key)
+{
+    CMBool found;
+    uint32_t idx = CMUTIL_BTreeLowerBound(imap, node, key, &found);
+    return found? idx + 1 : idx;
+}
+
+CMUTIL_STATIC CMUTIL_BTreeLeaf *CMUTIL_BTreeFindLeaf(
+        const CMUTIL_SortedMap_Internal *imap, const void *key)
+{
+    const CMUTIL_BTreeNode *node = imap->root;
+    while (!node->isleaf)
+        node = CMUTIL_BTreeInnerOf(node)->children[
+                CMUTIL_BTreeChildIndex(imap, node, key)];
+    return CMUTIL_BTreeLeafOf(node);
+}
+
+CMUTIL_STATIC void *CMUTIL_BTreeMinKey(const CMUTIL_BTreeNode *node)
+{
+    while (!node->isleaf)
+        node = CMUTIL_BTreeInnerOf(node)->children[0];
+    return node->keys[0];
+}
+
+/*
+ * Inserts into the subtree of 'node'. Returns 1 if a new entry is added,
+ * 0 if the value of an existing key is replaced and -1 on failure.
+ * If 'node' is split, its new right sibling is stored to 'split' and the
+ * smallest key of the sibling to 'splitkey'.
+ */
+CMUTIL_STATIC int CMUTIL_BTreeInsert(
+        CMUTIL_SortedMap_Internal *imap, CMUTIL_BTreeNode *node,
+        void *key, void *value, void **prev,
+        CMUTIL_BTreeNode **split, void **splitkey)
+{
+    CMBool found;
+    uint32_t idx, mid = CMUTIL_BTREE_ORDER / 2;
+    *split = NULL;
+    if (node->isleaf) {
+        CMUTIL_BTreeLeaf *leaf = CMUTIL_BTreeLeafOf(node), *right, *dest;
+        idx = CMUTIL_BTreeLowerBound(imap, node, key, &found);
+        if (found) {
+            void *old = leaf->values[idx];
+            leaf->values[idx] = value;
+            if (prev)
+                *prev = old;
+            else if (imap->freecb && old != value)
+                imap->freecb(old);
+            // separators may refer the stored key, so it stays.
+            if (imap->keyfreecb && node->keys[idx] != key)
+                imap->keyfreecb(key);
+            return 0;
+        }
+        dest = leaf;
+        if (node->count == CMUTIL_BTREE_ORDER) {
+            right = (CMUTIL_BTreeLeaf*)CMUTIL_BTreeNodeAlloc(imap, CMTrue);
+            if (right == NULL)
+                return -1;
+            memcpy(right->node.keys, node->keys + mid,
+                   (CMUTIL_BTREE_ORDER - mid) * sizeof(void*));
+            memcpy(right->values, leaf->values + mid,
+                   (CMUTIL_BTREE_ORDER - mid) * sizeof(void*));
+            right->node.count = CMUTIL_BTREE_ORDER - mid;
+            node->count = mid;
+            right->next = leaf->next;
+            right->prev = leaf;
+            if (leaf->next)
+                leaf->next->prev = right;
+            leaf->next = right;
+            if (idx > mid) {
+                dest = right;
+                idx -= mid;
+            }
+            *split = (CMUTIL_BTreeNode*)right;
+        }
+        memmove(dest->node.keys + idx + 1, dest->node.keys + idx,
+                (dest->node.count - idx) * sizeof(void*));
+        memmove(dest->values + idx + 1, dest->values + idx,
+                (dest->node.count - idx) * sizeof(void*));
+        dest->node.keys[idx] = key;
+        dest->values[idx] = value;
+        dest->node.count++;
+        if (*split)
+            *splitkey = (*split)->keys[0];
+        return 1;
+    } else {
+        CMUTIL_BTreeInner *inner = CMUTIL_BTreeInnerOf(node), *right = NULL;
+        CMUTIL_BTreeNode *csplit;
+        void *ckey;
+        void *tkeys[CMUTIL_BTREE_ORDER + 1];
+        CMUTIL_BTreeNode *tchildren[CMUTIL_BTREE_ORDER + 2];
+        int res;
+        // a split of the child could not be linked after the fact,
+        // so a full node gets its sibling ready beforehand.
+        if (node->count == CMUTIL_BTREE_ORDER) {
+            right = (CMUTIL_BTreeInner*)CMUTIL_BTreeNodeAlloc(imap, CMFalse);
+            if (right == NULL)
+                return -1;
+        }
+        idx = CMUTIL_BTreeChildIndex(imap, node, key);
+        res = CMUTIL_BTreeInsert(imap, inner->children[idx], key, value,
+                                 prev, &csplit, &ckey);
+        if (res < 0 || csplit == NULL) {
+            if (right)
+                imap->memst->Free(right);
+            return res;
+        }
+        if (right == NULL) {
+            memmove(node->keys + idx + 1, node->keys + idx,
+                    (node->count - idx) * sizeof(void*));
+            memmove(inner->children + idx + 2, inner->children + idx + 1,
+                    (node->count - idx) * sizeof(CMUTIL_BTreeNode*));
+            node->keys[idx] = ckey;
+            inner->children[idx + 1] = csplit;
+            node->count++;
+            return res;
+        }
+        // lay out keys and children of the overfull node, then halve it.
+        memcpy(tkeys, node->keys, idx * sizeof(void*));
+        tkeys[idx] = ckey;
+        memcpy(tkeys + idx + 1, node->keys + idx,
+               (CMUTIL_BTREE_ORDER - idx) * sizeof(void*));
+        memcpy(tchildren, inner->children, (idx + 1) * sizeof(void*));
+        tchildren[idx + 1] = csplit;
+        memcpy(tchildren + idx + 2, inner->children + idx + 1,
+               (CMUTIL_BTREE_ORDER - idx) * sizeof(void*));
+        mid = (CMUTIL_BTREE_ORDER + 1) / 2;
+        memcpy(node->keys, tkeys, mid * sizeof(void*));
+        memcpy(inner->children, tchildren, (mid + 1) * sizeof(void*));
+        node->count = mid;
+        memcpy(right->node.keys, tkeys + mid + 1,
+               (CMUTIL_BTREE_ORDER - mid) * sizeof(void*));
+        memcpy(right->children, tchildren + mid + 1,
+               (CMUTIL_BTREE_ORDER - mid + 1) * sizeof(void*));
+        right->node.count = CMUTIL_BTREE_ORDER - mid;
+        *split = (CMUTIL_BTreeNode*)right;
+        *splitkey = tkeys[mid];
+        return res;
+    }
+}
+
+// refills the underflowed child 'ci' of 'parent' from or into a sibling.
+CMUTIL_STATIC void CMUTIL_BTreeRebalance(
+        CMUTIL_SortedMap_Internal *imap, CMUTIL_BTreeInner *parent,
+        uint32_t ci)
+{
+    CMUTIL_BTreeNode *child = parent->children[ci];
+    CMUTIL_BTreeNode *left = ci > 0? parent->children[ci - 1] : NULL;
+    CMUTIL_BTreeNode *right =
+            ci < parent->node.count? parent->children[ci + 1] : NULL;
+    uint32_t min = child->isleaf?
+            CMUTIL_BTREE_LEAFMIN : CMUTIL_BTREE_INNERMIN;
+    uint32_t li;
+
+    if (left && left->count > min) {
+        // borrow the last entry of the left sibling.
+        memmove(child->keys + 1, child->keys, child->count * sizeof(void*));
+        if (child->isleaf) {
+            CMUTIL_BTreeLeaf *cl = CMUTIL_BTreeLeafOf(child);
+            CMUTIL_BTreeLeaf *ll = CMUTIL_BTreeLeafOf(left);
+            memmove(cl->values + 1, cl->values, child->count * sizeof(void*));
+            child->keys[0] = left->keys[left->count - 1];
+            cl->values[0] = ll->values[left->count - 1];
+            parent->node.keys[ci - 1] = child->keys[0];
+        } else {
+            CMUTIL_BTreeInner *ci_ = CMUTIL_BTreeInnerOf(child);
+            CMUTIL_BTreeInner *li_ = CMUTIL_BTreeInnerOf(left);
+            memmove(ci_->children + 1, ci_->children,
+                    (child->count + 1) * sizeof(CMUTIL_BTreeNode*));
+            ci_->children[0] = li_->children[left->count];
+            child->keys[0] = parent->node.keys[ci - 1];
+            parent->node.keys[ci - 1] = left->keys[left->count - 1];
+        }
+        child->count++;
+        left->count--;
+        return;
+    }
+    if (right && right->count > min) {
+        // borrow the first entry of the right sibling.
+        if (child->isleaf) {
+            CMUTIL_BTreeLeaf *cl = CMUTIL_BTreeLeafOf(child);
+            CMUTIL_BTreeLeaf *rl = CMUTIL_BTreeLeafOf(right);
+            child->keys[child->count] = right->keys[0];
+            cl->values[child->count] = rl->values[0];
+            memmove(rl->values, rl->values + 1,
+                    (right->count - 1) * sizeof(void*));
+            memmove(right->keys, right->keys + 1,
+                    (right->count - 1) * sizeof(void*));
+            parent->node.keys[ci] = right->keys[0];
+        } else {
+            CMUTIL_BTreeInner *ci_ = CMUTIL_BTreeInnerOf(child);
+            CMUTIL_BTreeInner *ri_ = CMUTIL_BTreeInnerOf(right);
+            child->keys[child->count] = parent->node.keys[ci];
+            ci_->children[child->count + 1] = ri_->children[0];
+            parent->node.keys[ci] = right->keys[0];
+            memmove(right->keys, right->keys + 1,
+                    (right->count - 1) * sizeof(void*));
+            memmove(ri_->children, ri_->children + 1,
+                    right->count * sizeof(CMUTIL_BTreeNode*));
+        }
+        child->count++;
+        right->count--;
+        return;
+    }
+
+    // siblings are at their minimum, merge the child with one of them.
+    if (left) {
+        li = ci - 1;
+        right = child;
+    } else {
+        li = ci;
+        left = child;
+    }
+    if (left->isleaf) {
+        CMUTIL_BTreeLeaf *ll = CMUTIL_BTreeLeafOf(left);
+        CMUTIL_BTreeLeaf *rl = CMUTIL_BTreeLeafOf(right);
+        memcpy(left->keys + left->count, right->keys,
+               right->count * sizeof(void*));
+        memcpy(ll->values + left->count, rl->values,
+               right->count * sizeof(void*));
+        left->count += right->count;
+        ll->next = rl->next;
+        if (rl->next)
+            rl->next->prev = ll;
+    } else {
+        CMUTIL_BTreeInner *li_ = CMUTIL_BTreeInnerOf(left);
+        CMUTIL_BTreeInner *ri_ = CMUTIL_BTreeInnerOf(right);
+        left->keys[left->count] = parent->node.keys[li];
+        memcpy(left->keys + left->count + 1, right->keys,
+               right->count * sizeof(void*));
+        memcpy(li_->children + left->count + 1, ri_->children,
+               (right->count + 1) * sizeof(CMUTIL_BTreeNode*));
+        left->count += right->count + 1;
+    }
+    imap->memst->Free(right);
+    memmove(parent->node.keys + li, parent->node.keys + li + 1,
+            (parent->node.count - li - 1) * sizeof(void*));
+    memmove(parent->children + li + 1, parent->children + li + 2,
+            (parent->node.count - li - 1) * sizeof(CMUTIL_BTreeNode*));
+    parent->node.count--;
+}
+
+CMUTIL_STATIC CMBool CMUTIL_BTreeRemove(
+        CMUTIL_SortedMap_Internal *imap, CMUTIL_BTreeNode *node,
+        const void *key, void **rkey, void **rvalue)
+{
+    CMBool found;
+    uint32_t idx;
+    if (node->isleaf) {
+        CMUTIL_BTreeLeaf *leaf = CMUTIL_BTreeLeafOf(node);
+        idx = CMUTIL_BTreeLowerBound(imap, node, key, &found);
+        if (!found)
+            return CMFalse;
+        *rkey = node->keys[idx];
+        *rvalue = leaf->values[idx];
+        memmove(node->keys + idx, node->keys + idx + 1,
+                (node->count - idx - 1) * sizeof(void*));
+        memmove(leaf->values + idx, leaf->values + idx + 1,
+                (node->count - idx - 1) * sizeof(void*));
+        node->count--;
+        return CMTrue;
+    } else {
+        CMUTIL_BTreeInner *inner = CMUTIL_BTreeInnerOf(node);
+        CMUTIL_BTreeNode *child;
+        idx = CMUTIL_BTreeChildIndex(imap, node, key);
+        child = inner->children[idx];
+        if (!CMUTIL_BTreeRemove(imap, child, key, rkey, rvalue))
+            return CMFalse;
+        // the removed key may be the separator of this child.
+        if (idx > 0 && node->keys[idx - 1] == *rkey)
+            node->keys[idx - 1] = CMUTIL_BTreeMinKey(child);
+        if (child->count < (child->isleaf?
+                CMUTIL_BTREE_LEAFMIN : CMUTIL_BTREE_INNERMIN))
+            CMUTIL_BTreeRebalance(imap, inner, idx);
+        return CMTrue;
+    }
+}
+
+CMUTIL_STATIC CMBool CMUTIL_SortedMapPut(
+        CMUTIL_SortedMap *map, void *key, void *value, void **prev)
+{
+    CMUTIL_SortedMap_Internal *imap = (CMUTIL_SortedMap_Internal*)map;
+    CMUTIL_BTreeNode *split, *root = NULL;
+    void *splitkey;
+    int res;
+    if (prev)
+        *prev = NULL;
+    // only a full root may be split, have the new root ready for it.
+    if (imap->root->count == CMUTIL_BTREE_ORDER) {
+        root = CMUTIL_BTreeNodeAlloc(imap, CMFalse);
+        if (root == NULL)
+            return CMFalse;
+    }
+    res = CMUTIL_BTreeInsert(imap, imap->root, key, value, prev,
+                             &split, &splitkey);
+    if (split) {
+        root->count = 1;
+        root->keys[0] = splitkey;
+        CMUTIL_BTreeInnerOf(root)->children[0] = imap->root;
+        CMUTIL_BTreeInnerOf(root)->children[1] = split;
+        imap->root = root;
+    } else if (root) {
+        imap->memst->Free(root);
+    }
+    if (res < 0)
+        return CMFalse;
+    if (res > 0)
+        imap->size++;
+    return CMTrue;
+}
+
+CMUTIL_STATIC void *CMUTIL_SortedMapGet(
+        const CMUTIL_SortedMap *map, const void *key)
+{
+    const CMUTIL_SortedMap_Internal *imap =
+            (const CMUTIL_SortedMap_Internal*)map;
+    CMUTIL_BTreeLeaf *leaf = CMUTIL_BTreeFindLeaf(imap, key);
+    CMBool found;
+    uint32_t idx = CMUTIL_BTreeLowerBound(imap, &leaf->node, key, &found);
+    return found? leaf->values[idx] : NULL;
+}
+
+CMUTIL_STATIC void *CMUTIL_SortedMapRemove(
+        CMUTIL_SortedMap *map, const void *key)
+{
+    CMUTIL_SortedMap_Internal *imap = (CMUTIL_SortedMap_Internal*)map;
+    CMUTIL_BTreeNode *root = imap->root;
+    void *rkey = NULL, *rvalue = NULL;
+    if (!CMUTIL_BTreeRemove(imap, root, key, &rkey, &rvalue))
+        return NULL;
+    if (!root->isleaf && root->count == 0) {
+        imap->root = CMUTIL_BTreeInnerOf(root)->children[0];
+        imap->memst->Free(root);
+    }
+    imap->size--;
+    if (imap->keyfreecb)
+        imap->keyfreecb(rkey);
+    return rvalue;
+}
+
+CMUTIL_STATIC size_t CMUTIL_SortedMapGetSize(const CMUTIL_SortedMap *map)
+{
+    const CMUTIL_SortedMap_Internal *imap =
+            (const CMUTIL_SortedMap_Internal*)map;
+    return imap->size;
+}
+
+// moves the cursor past exhausted leaves, fails at the end of the map.
+CMUTIL_STATIC CMBool CMUTIL_SortedMapSeek(
+        const CMUTIL_BTreeLeaf *leaf, uint32_t idx,
+        CMUTIL_SortedMapCursor *cursor)
+{
+    while (leaf && idx >= leaf->node.count) {
+        leaf = leaf->next;
+        idx = 0;
+    }
+    cursor->node = leaf;
+    cursor->index = idx;
+    return leaf? CMTrue : CMFalse;
+}
+
+CMUTIL_STATIC CMBool CMUTIL_SortedMapFirst(
+        const CMUTIL_SortedMap *map, CMUTIL_SortedMapCursor *cursor)
+{
+    const CMUTIL_SortedMap_Internal *imap =
+            (const CMUTIL_SortedMap_Internal*)map;
+    return CMUTIL_SortedMapSeek(imap->head, 0, cursor);
+}
+
+CMUTIL_STATIC CMBool CMUTIL_SortedMapLowerBound(
+        const CMUTIL_SortedMap *map, const void *key,
+        CMUTIL_SortedMapCursor *cursor)
+{
+    const CMUTIL_SortedMap_Internal *imap =
+            (const CMUTIL_SortedMap_Internal*)map;
+    CMUTIL_BTreeLeaf *leaf = CMUTIL_BTreeFindLeaf(imap, key);
+    CMBool found;
+    uint32_t idx = CMUTIL_BTreeLowerBound(imap, &leaf->node, key, &found);
+    return CMUTIL_SortedMapSeek(leaf, idx, cursor);
+}
+
+CMUTIL_STATIC CMBool CMUTIL_SortedMapUpperBound(
+        const CMUTIL_SortedMap *map, const void *key,
+        CMUTIL_SortedMapCursor *cursor)
+{
+    const CMUTIL_SortedMap_Internal *imap =
+            (const CMUTIL_SortedMap_Internal*)map;
+    CMUTIL_BTreeLeaf *leaf = CMUTIL_BTreeFindLeaf(imap, key);
+    CMBool found;
+    uint32_t idx = CMUTIL_BTreeLowerBound(imap, &leaf->node, key, &found);
+    return CMUTIL_SortedMapSeek(leaf, found? idx + 1 : idx, cursor);
+}
+
+CMUTIL_STATIC CMBool CMUTIL_SortedMapNext(
+        const CMUTIL_SortedMap *map, CMUTIL_SortedMapCursor *cursor,
+        void **key, void **value)
+{
+    const CMUTIL_BTreeLeaf *leaf;
+    CMUTIL_UNUSED(map);
+    if (!CMUTIL_SortedMapSeek(
+            (const CMUTIL_BTreeLeaf*)cursor->node,
+            (uint32_t)cursor->index, cursor))
+        return CMFalse;
+    leaf = (const CMUTIL_BTreeLeaf*)cursor->node;
+    if (key)
+        *key = leaf->node.keys[cursor->index];
+    if (value)
+        *value = leaf->values[cursor->index];
+    cursor->index++;
+    return CMTrue;
+}
+
+/*
+ * Builds the tree bottom up from sorted entries: leaves are filled
+ * evenly and every upper level is made of the nodes below, so no node
+ * is split or compared on the way.
+ */
+CMUTIL_STATIC CMBool CMUTIL_SortedMapBulkLoad(
+        CMUTIL_SortedMap *map, void *const *keys, void *const *values,
+        size_t count)
+{
+    CMUTIL_SortedMap_Internal *imap = (CMUTIL_SortedMap_Internal*)map;
+    CMUTIL_BTreeNode **nodes = NULL;
+    void **mins = NULL;
+    CMUTIL_BTreeLeaf *prevleaf = NULL, *firstleaf = NULL;
+    size_t i, j, nnodes, nparents, pos, built = 0;
+    CMBool res = CMFalse;
+
+    for (i=1; i<count; i++) {
+        if (imap->comparator(keys[i - 1], keys[i]) >= 0) {
+            CMLogError("keys are not in ascending order at %zu.", i);
+            return CMFalse;
+        }
+    }
+    if (count == 0)
+        return CMTrue;
+    if (imap->size > 0) {
+        // merging into a populated tree is done one by one.
+        for (i=0; i<count; i++)
+            if (!CMCall(map, Put, keys[i], values? values[i] : keys[i], NULL))
+                return CMFalse;
+        return CMTrue;
+    }
+
+    nnodes = (count + CMUTIL_BTREE_ORDER - 1) / CMUTIL_BTREE_ORDER;
+    nodes = imap->memst->Alloc(nnodes * sizeof(CMUTIL_BTreeNode*));
+    mins = imap->memst->Alloc(nnodes * sizeof(void*));
+    if (nodes == NULL || mins == NULL) {
+        CMLogErrorS("Failed to allocate memory for bulk loading.");
+        goto ENDPOINT;
+    }
+    for (i=0, pos=0; i<nnodes; i++) {
+        CMUTIL_BTreeLeaf *leaf;
+        size_t n = count / nnodes + (i < count % nnodes? 1 : 0);
+        nodes[i] = CMUTIL_BTreeNodeAlloc(imap, CMTrue);
+        if (nodes[i] == NULL)
+            goto ENDPOINT;
+        built = i + 1;
+        leaf = CMUTIL_BTreeLeafOf(nodes[i]);
+        memcpy(leaf->node.keys, keys + pos, n * sizeof(void*));
+        memcpy(leaf->values, (values? values : keys) + pos,
+               n * sizeof(void*));
+        leaf->node.count = (uint32_t)n;
+        leaf->prev = prevleaf;
+        if (prevleaf)
+            prevleaf->next = leaf;
+        else
+            firstleaf = leaf;
+        prevleaf = leaf;
+        mins[i] = leaf->node.keys[0];
+        pos += n;
+    }
+    built = 0;  // leaves are chained and freed with their parents now
+    while (nnodes > 1) {
+        nparents = (nnodes + CMUTIL_BTREE_ORDER) / (CMUTIL_BTREE_ORDER + 1);
+        for (i=0, pos=0; i<nparents; i++) {
+            CMUTIL_BTreeInner *inner;
+            size_t n = nnodes / nparents + (i < nnodes % nparents? 1 : 0);
+            inner = (CMUTIL_BTreeInner*)CMUTIL_BTreeNodeAlloc(imap, CMFalse);
+            if (inner == NULL) {
+                // parents made so far own their children, the rest
+                // is still listed from 'pos'.
+                for (j=0; j<i; j++)
+                    CMUTIL_BTreeNodeFree(imap, nodes[j], NULL, CMFalse);
+                for (j=pos; j<nnodes; j++)
+                    CMUTIL_BTreeNodeFree(imap, nodes[j], NULL, CMFalse);
+                goto ENDPOINT;
+            }
+            for (j=0; j<n; j++) {
+                inner->children[j] = nodes[pos + j];
+                if (j > 0)
+                    inner->node.keys[j - 1] = mins[pos + j];
+            }
+            inner->node.count = (uint32_t)(n - 1);
+            mins[i] = mins[pos];
+            nodes[i] = (CMUTIL_BTreeNode*)inner;
+            pos += n;
+        }
+        nnodes = nparents;
+    }
+    CMUTIL_BTreeNodeFree(imap, imap->root, NULL, CMFalse);
+    imap->root = nodes[0];
+    imap->head = firstleaf;
+    imap->size = count;
+    res = CMTrue;
+ENDPOINT:
+    for (i=0; i<built; i++)
+        imap->memst->Free(nodes[i]);
+    if (nodes)
+        imap->memst->Free(nodes);
+    if (mins)
+        imap->memst->Free(mins);
+    return res;
+}
+
+CMUTIL_STATIC void CMUTIL_SortedMapClear(CMUTIL_SortedMap *map)
+{
+    CMUTIL_SortedMap_Internal *imap = (CMUTIL_SortedMap_Internal*)map;
+    // the leftmost leaf is kept as the empty root.
+    CMUTIL_BTreeNodeFree(imap, imap->root, &imap->head->node, CMTrue);
+    imap->root = &imap->head->node;
+    imap->head->node.count = 0;
+    imap->head->next = NULL;
+    imap->size = 0;
+}
+
+CMUTIL_STATIC void CMUTIL_SortedMapDestroy(CMUTIL_SortedMap *map)
+{
+    CMUTIL_SortedMap_Internal *imap = (CMUTIL_SortedMap_Internal*)map;
+    if (imap) {
+        if (imap->root)
+            CMUTIL_BTreeNodeFree(imap, imap->root, NULL, CMTrue);
+        imap->memst->Free(imap);
+    }
+}
+
+static CMUTIL_SortedMap g_cmutil_sortedmap = {
+    CMUTIL_SortedMapPut,
+    CMUTIL_SortedMapGet,
+    CMUTIL_SortedMapRemove,
+    CMUTIL_SortedMapGetSize,
+    CMUTIL_SortedMapFirst,
+    CMUTIL_SortedMapLowerBound,
+    CMUTIL_SortedMapUpperBound,
+    CMUTIL_SortedMapNext,
+    CMUTIL_SortedMapBulkLoad,
+    CMUTIL_SortedMapClear,
+    CMUTIL_SortedMapDestroy
+};
+
+CMUTIL_SortedMap *CMUTIL_SortedMapCreateInternal(
+        CMUTIL_Mem *memst,
+        CMCompareCB comparator,
+        CMFreeCB keyfreecb,
+        CMFreeCB freecb)
+{
+    CMUTIL_SortedMap_Internal *imap = NULL;
+    if (comparator == NULL) {
+        CMLogErrorS("sorted map requires a comparator.");
+        return NULL;
+    }
+    imap = memst->Alloc(sizeof(CMUTIL_SortedMap_Internal));
+    if (imap == NULL) {
+        CMLogErrorS("Failed to allocate memory for sorted map.");
+        return NULL;
+    }
+    memset(imap, 0x0, sizeof(CMUTIL_SortedMap_Internal));
+    memcpy(imap, &g_cmutil_sortedmap, sizeof(CMUTIL_SortedMap));
+    imap->memst = memst;
+    imap->comparator = comparator;
+    imap->keyfreecb = keyfreecb;
+    imap->freecb = freecb;
+    imap->root = CMUTIL_BTreeNodeAlloc(imap, CMTrue);
+    if (imap->root == NULL) {
+        CMUTIL_SortedMapDestroy((CMUTIL_SortedMap*)imap);
+        return NULL;
+    }
+    imap->head = CMUTIL_BTreeLeafOf(imap->root);
+    return (CMUTIL_SortedMap*)imap;
+}
+
+CMUTIL_SortedMap *CMUTIL_SortedMapCreateEx(
+        CMCompareCB comparator,
+        CMFreeCB keyfreecb,
+        CMFreeCB freecb)
+{
+    return CMUTIL_SortedMapCreateInternal(
+            CMUTIL_GetMem(), comparator, keyfreecb, freecb);
+}
@@ -877,6 +877,14 @@ CMUTIL_STATIC CMUTIL_Iterator *CMUTIL_StringArrayIterator(
     return CMCall(iarray->array, Iterator);
 }
 
+CMUTIL_STATIC CMBool CMUTIL_StringArrayEach(
+        const CMUTIL_StringArray *array, CMEachCB callback, void *udata)
+{
+    const CMUTIL_StringArray_Internal *iarray =
+            (const CMUTIL_StringArray_Internal*)array;
+    return CMCall(iarray->array, Each, callback, udata);
+}
+
 CMUTIL_STATIC void CMUTIL_StringArrayDestroy(
         CMUTIL_StringArray *array)
 {
@@ -917,7 +925,8 @@ static CMUTIL_StringArray g_cmutil_stringarray = {
     CMUTIL_StringArrayGetSize,
     CMUTIL_StringArrayIterator,
     CMUTIL_StringArrayDestroy,
-    CMUTIL_StringArrayPrintTo
+    CMUTIL_StringArrayPrintTo,
+    CMUTIL_StringArrayEach
 };
 
 CMUTIL_StringArray *CMUTIL_StringArrayCreateInternal(
@@ -13,6 +13,45 @@ void destructor(void *data) {
     CMFree(data);
 }
 
+int compare_double(const void *a, const void *b) {
+    double da = *(const double*)a, db = *(const double*)b;
+    return da < db? -1 : da > db? 1 : 0;
+}
+
+int compare_intptr(const void *a, const void *b) {
+    intptr_t x = (intptr_t)a, y = (intptr_t)b;
+    return x < y? -1 : x > y? 1 : 0;
+}
+
+static CMBool is_ascending(CMUTIL_Array *arr) {
+    size_t i, size = CMCall(arr, GetSize);
+    for (i = 1; i < size; i++)
+        if ((intptr_t)CMCall(arr, GetAt, (uint32_t)i - 1) >
+            (intptr_t)CMCall(arr, GetAt, (uint32_t)i))
+            return CMFalse;
+    return CMTrue;
+}
+
+static CMBool count_until_null(void *item, void *udata) {
+    if (item == NULL)
+        return CMFalse;
+    (*(int*)udata)++;
+    return CMTrue;
+}
+
+typedef struct {
+    int key;
+    size_t index;
+} HeapItem;
+
+static int compare_heapitem(const void *a, const void *b) {
+    return ((const HeapItem*)a)->key - ((const HeapItem*)b)->key;
+}
+
+static void heapitem_index(void *item, size_t index) {
+    ((HeapItem*)item)->index = index;
+}
+
 int main()
 {
     int ir = -1;
@@ -22,6 +61,10 @@ int main()
 
     char *str = NULL;
     CMUTIL_Iterator *iter = NULL;
+    CMUTIL_Vector *vec = NULL;
+    CMUTIL_ThreadPool *pool = NULL;
+    CMUTIL_Heap *heap = NULL;
+    HeapItem hitems[1000];
     CMUTIL_Array *arr = CMUTIL_ArrayCreateEx(
         4, NULL, NULL);
     ASSERT(arr != NULL, "CMUTIL_ArrayCreateEx with capacity");
@@ -94,6 +137,20 @@ int main()
     }
     CMCall(iter, Destroy); iter = NULL;
     ASSERT(count == CMCall(arr, GetSize), "Iterator count matches array size");
+    count = 0;
+    ASSERT(CMCall(arr, Each, count_until_null, &count) &&
+           count == (int)CMCall(arr, GetSize), "Array Each");
+    {
+        CMUTIL_List *list = CMUTIL_ListCreate();
+        CMCall(list, AddTail, "a");
+        CMCall(list, AddTail, "b");
+        CMCall(list, AddTail, NULL);
+        CMCall(list, AddTail, "c");
+        count = 0;
+        ASSERT(!CMCall(list, Each, count_until_null, &count) && count == 2,
+               "List Each stops when the callback returns CMFalse");
+        CMCall(list, Destroy);
+    }
 
     str = (char*)CMCall(arr, Remove, "cherry");
     ASSERT(strcmp(str, "cherry") == 0 && CMCall(arr, GetSize) == 2, "Remove in sorted array");
@@ -111,11 +168,115 @@ int main()
     ASSERT(strcmp(CMCall(arr, GetAt, 1), "banana") == 0, "GetAt in sorted array");
     ASSERT(CMCall(arr, GetSize) == 3, "GetSize after SetAt/GetAt in sorted array");
 
+    vec = CMUTIL_VectorCreate(sizeof(double));
+    ASSERT(vec != NULL && CMCall(vec, GetElementSize) == sizeof(double),
+           "CMUTIL_VectorCreate");
+    for (int i = 0; i < 100000; i++) {
+        double d = (double)((i * 7919) % 100000);
+        CMCall(vec, Append, &d, 1);
+    }
+    ASSERT(CMCall(vec, GetSize) == 100000, "Vector Append");
+    CMCall(vec, Sort, compare_double);
+    {
+        const double *data = CMCall(vec, GetData);
+        size_t pos = 0;
+        double key = 4242.0, keys[3] = {-3.0, -2.0, -1.0};
+        ASSERT(data[0] == 0.0 && data[99999] == 99999.0 &&
+               CMCall(vec, BinarySearch, &key, compare_double, &pos) &&
+               pos == 4242, "Vector Sort and BinarySearch");
+        ASSERT(CMCall(vec, Insert, 0, keys, 3) &&
+               *(double*)CMCall(vec, GetAt, 1) == -2.0 &&
+               *(double*)CMCall(vec, GetAt, 3) == 0.0, "Vector Insert");
+        key = -1.5;
+        ASSERT(!CMCall(vec, BinarySearch, &key, compare_double, &pos) &&
+               pos == 2, "Vector BinarySearch insertion point");
+    }
+    ASSERT(CMCall(vec, Erase, 1, 2) && CMCall(vec, GetSize) == 100001 &&
+           *(double*)CMCall(vec, GetAt, 1) == 0.0 &&
+           !CMCall(vec, Erase, 100000, 2), "Vector Erase");
+    ASSERT(CMCall(vec, Resize, 4) && CMCall(vec, Resize, 6) &&
+           *(double*)CMCall(vec, GetAt, 5) == 0.0 &&
+           CMCall(vec, GetAt, 6) == NULL, "Vector Resize");
+
+    // bulk appended items are sorted at once, in parallel when large.
+    CMCall(arr, Destroy);
+    arr = CMUTIL_ArrayCreateEx(16, NULL, NULL);
+    for (intptr_t i = 0; i < 200000; i++)
+        CMCall(arr, Add, (void*)((i * 7919) % 100000 + 1), NULL);
+    ASSERT(CMCall(arr, Sort, compare_intptr, NULL) && is_ascending(arr) &&
+           CMCall(arr, GetSize) == 200000, "Array Sort");
+    for (intptr_t i = 0; i < 200000; i++)
+        CMCall(arr, SetAt, (void*)(200000 - i), (uint32_t)i);
+    pool = CMUTIL_ThreadPoolCreate(4, "sorter");
+    ASSERT(CMCall(arr, Sort, compare_intptr, pool) && is_ascending(arr) &&
+           CMCall(arr, GetAt, 0) == (void*)1, "Array Sort in parallel");
+    for (intptr_t i = 0; i < 200000; i++)
+        CMCall(arr, SetAt, (void*)((i * 7919) % 100000 + 1), (uint32_t)i);
+    ASSERT(CMCall(arr, SetSorted, compare_intptr, pool) && is_ascending(arr) &&
+           CMCall(arr, GetSize) == 100000 &&
+           CMCall(arr, Find, (void*)4242, NULL) == (void*)4242,
+           "Array SetSorted removes duplicates");
+    ASSERT(CMCall(arr, Add, (void*)100001, NULL) &&
+           CMCall(arr, GetAt, 100000) == (void*)100001 &&
+           CMCall(arr, SetAt, (void*)1, 0) == NULL &&
+           !CMCall(arr, Sort, compare_double, NULL),
+           "Array behaves sorted after SetSorted");
+
+    heap = CMUTIL_HeapCreate(compare_intptr);
+    ASSERT(heap != NULL && CMCall(heap, Pop) == NULL, "CMUTIL_HeapCreate");
+    for (intptr_t i = 0; i < 10000; i++)
+        CMCall(heap, Push, (void*)((i * 7919) % 5000 + 1));
+    {
+        intptr_t prev = 0, cur;
+        CMBool ordered = CMTrue;
+        while ((cur = (intptr_t)CMCall(heap, Pop)) != 0) {
+            if (cur < prev) ordered = CMFalse;
+            prev = cur;
+        }
+        ASSERT(ordered && prev == 5000 && CMCall(heap, GetSize) == 0,
+               "Heap Push and Pop in order");
+    }
+    CMCall(heap, Destroy);
+
+    heap = CMUTIL_HeapCreateEx(compare_heapitem, heapitem_index, NULL);
+    for (int i = 0; i < 1000; i++) {
+        hitems[i].key = (i * 617) % 1000;
+        CMCall(heap, Push, &hitems[i]);
+    }
+    ASSERT(CMCall(heap, GetAt, hitems[10].index) == &hitems[10] &&
+           ((HeapItem*)CMCall(heap, Peek))->key == 0,
+           "Heap index callback");
+    // every other item leaves by handle, some keys move either way.
+    for (int i = 0; i < 1000; i += 2)
+        CMCall(heap, RemoveAt, hitems[i].index);
+    hitems[999].key = -1;
+    CMCall(heap, Update, hitems[999].index);
+    hitems[1].key = 5000;
+    CMCall(heap, Update, hitems[1].index);
+    ASSERT(hitems[0].index == CMUTIL_HEAP_NONE &&
+           CMCall(heap, GetSize) == 500 &&
+           CMCall(heap, Pop) == &hitems[999] &&
+           CMCall(heap, RemoveAt, 500) == NULL,
+           "Heap RemoveAt and Update");
+    {
+        HeapItem *prev = NULL, *cur;
+        CMBool ordered = CMTrue;
+        while ((cur = CMCall(heap, Pop)) != NULL) {
+            if ((prev && cur->key < prev->key) || (cur - hitems) % 2 == 0)
+                ordered = CMFalse;
+            prev = cur;
+        }
+        ASSERT(ordered && prev == &hitems[1], "Heap order after updates");
+    }
+
     ir = 0;
 END_POINT:
     if (str) CMFree(str);
     if (iter) CMCall(iter, Destroy);
     if (arr) CMCall(arr, Destroy);
+    if (vec) CMCall(vec, Destroy);
+    if (pool) CMCall(pool, Destroy);
+    if (heap) CMCall(heap, Destroy);
     if (!CMUTIL_Clear()) ir = -1;
     return ir;
 }
\ No newline at end of file
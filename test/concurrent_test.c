@@ -3,6 +3,7 @@
 //
 
 #include <stdio.h>
+#include <string.h>
 
 #include "libcmutils.h"
 #include "test.h"
@@ -33,6 +34,230 @@ void thread_func2(void *param) {
     thread_func(param);
 }
 
+#define CMAP_WRITERS    4
+#define CMAP_READERS    4
+#define CMAP_KEYS       500
+
+typedef struct {
+    CMUTIL_ConcurrentMap *map;
+    int index;
+    int errors;
+    int64_t computed;
+    volatile int *done;
+} CMapParam;
+
+void *cmap_writer(void *param) {
+    CMapParam *cp = (CMapParam *)param;
+    char kbuf[32], vbuf[32];
+    for (int i = 0; i < 20000; i++) {
+        sprintf(kbuf, "w%d-%d", cp->index, i % CMAP_KEYS);
+        sprintf(vbuf, "v%d", i);
+        CMCall(cp->map, Put, kbuf, CMStrdup(vbuf), NULL);
+        if (i % 3 == 0)
+            CMCall(cp->map, Remove, kbuf, NULL, NULL);
+    }
+    // leaves every key of this writer with a known value.
+    for (int i = 0; i < CMAP_KEYS; i++) {
+        sprintf(kbuf, "w%d-%d", cp->index, i);
+        sprintf(vbuf, "v%d", i);
+        CMCall(cp->map, Put, kbuf, CMStrdup(vbuf), NULL);
+    }
+    return NULL;
+}
+
+void *cmap_reader(void *param) {
+    CMapParam *cp = (CMapParam *)param;
+    char kbuf[32];
+    unsigned int i = (unsigned int)cp->index;
+    while (!*cp->done) {
+        const char *v;
+        sprintf(kbuf, "w%u-%u", i % CMAP_WRITERS, i % CMAP_KEYS);
+        CMCall(cp->map, Enter);
+        v = CMCall(cp->map, Get, kbuf);
+        if (v && v[0] != 'v')
+            cp->errors++;
+        CMCall(cp->map, Leave);
+        i = i * 1103515245 + 12345;
+    }
+    return NULL;
+}
+
+void *cmap_mapper(const char *key, void *udata) {
+    CMapParam *cp = (CMapParam *)udata;
+    cp->computed++;
+    return CMStrdup(key);
+}
+
+void *cmap_computer(void *param) {
+    CMapParam *cp = (CMapParam *)param;
+    char kbuf[32];
+    for (int i = 0; i < CMAP_KEYS; i++) {
+        const char *v;
+        sprintf(kbuf, "c%d", i);
+        v = CMCall(cp->map, ComputeIfAbsent, kbuf, cmap_mapper, cp);
+        if (v == NULL || strcmp(v, kbuf) != 0)
+            cp->errors++;
+    }
+    return NULL;
+}
+
+#define QUEUE_PRODUCERS 4
+#define QUEUE_CONSUMERS 4
+#define QUEUE_ITEMS     20000
+
+typedef struct {
+    CMUTIL_Queue *queue;
+    int index;
+    int errors;
+    int64_t sum;
+} QueueParam;
+
+void *queue_producer(void *param) {
+    QueueParam *qp = (QueueParam *)param;
+    void *batch[8];
+    intptr_t i = 0;
+    while (i < QUEUE_ITEMS) {
+        // items are (producer, sequence) pairs, never NULL.
+        if (i % 100 < 8) {
+            size_t n = 0, cnt = 8;
+            for (size_t j = 0; j < cnt; j++)
+                batch[j] = (void*)(((intptr_t)qp->index << 20 | (i + (intptr_t)j)) + 1);
+            while (n < cnt)
+                n += CMCall(qp->queue, PushBatch, batch + n, cnt - n);
+            i += cnt;
+        } else {
+            if (!CMCall(qp->queue, Push,
+                        (void*)(((intptr_t)qp->index << 20 | i) + 1), -1))
+                qp->errors++;
+            i++;
+        }
+    }
+    return NULL;
+}
+
+void *queue_consumer(void *param) {
+    QueueParam *qp = (QueueParam *)param;
+    intptr_t last[QUEUE_PRODUCERS];
+    void *item;
+    for (int i = 0; i < QUEUE_PRODUCERS; i++)
+        last[i] = -1;
+    while (CMCall(qp->queue, Pop, &item, -1) && item != NULL) {
+        intptr_t v = (intptr_t)item - 1;
+        intptr_t p = v >> 20, seq = v & 0xFFFFF;
+        // one producer's items come out in the order they went in.
+        if (p >= QUEUE_PRODUCERS || seq <= last[p])
+            qp->errors++;
+        else
+            last[p] = seq;
+        qp->sum += seq;
+    }
+    return NULL;
+}
+
+#define CACHE_THREADS   4
+#define CACHE_OPS       20000
+
+typedef struct {
+    CMUTIL_Cache *cache;
+    int index;
+    int errors;
+} CacheParam;
+
+void *cache_worker(void *param) {
+    CacheParam *cp = (CacheParam *)param;
+    char kbuf[32];
+    for (int i = 0; i < CACHE_OPS; i++) {
+        // keys overlap between threads, values tell which key they belong to.
+        int k = (i * 7 + cp->index * 13) % 1000;
+        void *v;
+        sprintf(kbuf, "k%d", k);
+        v = CMCall(cp->cache, Get, kbuf);
+        if (v == NULL)
+            CMCall(cp->cache, Put, kbuf, (void*)(intptr_t)(k + 1), 1, 0);
+        else if (v != (void*)(intptr_t)(k + 1))
+            cp->errors++;
+    }
+    return NULL;
+}
+
+#define RING_BYTES      1000000
+
+typedef struct {
+    CMUTIL_ByteRing *ring;
+    int errors;
+} RingParam;
+
+static uint8_t ring_byte(size_t k) {
+    return (uint8_t)(k * 7 + (k >> 9));
+}
+
+void *ring_producer(void *param) {
+    RingParam *rp = (RingParam *)param;
+    uint8_t chunk[3000];
+    size_t k = 0, rec = 0;
+    while (k < RING_BYTES) {
+        size_t len = 1 + (rec * 37) % 300;
+        if (len > RING_BYTES - k)
+            len = RING_BYTES - k;
+        if (rec % 50 == 49) {
+            // larger than the ring, the rest goes to the spill buffer.
+            len = sizeof(chunk) < RING_BYTES - k? sizeof(chunk) : RING_BYTES - k;
+            for (size_t i = 0; i < len; i++)
+                chunk[i] = ring_byte(k + i);
+            if (!CMCall(rp->ring, Write, chunk, len))
+                rp->errors++;
+        } else {
+            uint8_t *p = CMCall(rp->ring, Reserve, len + 8);
+            size_t used = rec % 3 == 0? len / 2 + 1 : len;
+            if (p == NULL) {
+                usleep(10);
+                continue;
+            }
+            for (size_t i = 0; i < used; i++)
+                p[i] = ring_byte(k + i);
+            if (!CMCall(rp->ring, Commit, used))
+                rp->errors++;
+            len = used;
+        }
+        k += len;
+        rec++;
+    }
+    while (!CMCall(rp->ring, Flush))
+        usleep(10);
+    return NULL;
+}
+
+void *ring_consumer(void *param) {
+    RingParam *rp = (RingParam *)param;
+    CMUTIL_ByteBuffer *buf = CMUTIL_ByteBufferCreate();
+    size_t k = 0;
+    while (k < RING_BYTES) {
+        size_t size;
+        const uint8_t *p;
+        if (k % 7 == 0) {
+            // copy out now and then instead of reading in place.
+            size = CMCall(rp->ring, ReadTo, buf, 100);
+            p = CMCall(buf, GetBytes);
+        } else {
+            p = CMCall(rp->ring, Peek, &size);
+        }
+        if (size == 0) {
+            usleep(10);
+            continue;
+        }
+        for (size_t i = 0; i < size; i++)
+            if (p[i] != ring_byte(k + i))
+                rp->errors++;
+        if (k % 7 == 0)
+            CMCall(buf, Clear);
+        else
+            CMCall(rp->ring, Consume, size);
+        k += size;
+    }
+    CMCall(buf, Destroy);
+    return NULL;
+}
+
 int main() {
     int ir = -1;
     CMUTIL_Init(CMUTIL_MEM_TYPE);
@@ -41,6 +266,21 @@ int main() {
     CMUTIL_Mutex *mtx = NULL;
     ThreadParam tp;
     CMUTIL_Thread *t = NULL;
+    CMUTIL_ConcurrentMap *cmap = NULL;
+    CMUTIL_Thread *cthreads[CMAP_WRITERS + CMAP_READERS];
+    CMapParam cparams[CMAP_WRITERS + CMAP_READERS];
+    volatile int cdone = 0;
+    void *prev = NULL, *cur = NULL;
+    int64_t computed = 0;
+    int cerrors = 0;
+    CMUTIL_Queue *queue = NULL;
+    CMUTIL_Thread *qthreads[QUEUE_PRODUCERS + QUEUE_CONSUMERS];
+    QueueParam qparams[QUEUE_PRODUCERS + QUEUE_CONSUMERS];
+    CMUTIL_ByteRing *ring = NULL;
+    CMUTIL_Cache *cache = NULL;
+    CacheParam cacheparams[CACHE_THREADS];
+    CMUTIL_CacheStats cstats;
+    RingParam rparam;
 
     mtx = CMUTIL_MutexCreate();
     ASSERT(mtx != NULL, "CMUTIL_MutexCreate");
@@ -69,11 +309,185 @@ int main() {
               "So if this log shown without any error, "
               "all concurrent objects are working properly.");
 
+    cmap = CMUTIL_ConcurrentMapCreateEx(16, 4, CMUTIL_GetMem()->Free);
+    ASSERT(cmap != NULL, "CMUTIL_ConcurrentMapCreateEx");
+    ASSERT(CMCall(cmap, PutIfAbsent, "a", CMStrdup("v1")) == NULL,
+           "CMUTIL_ConcurrentMap PutIfAbsent inserts");
+    prev = CMStrdup("v2");
+    ASSERT(strcmp(CMCall(cmap, PutIfAbsent, "a", prev), "v1") == 0,
+           "CMUTIL_ConcurrentMap PutIfAbsent keeps");
+    cur = CMCall(cmap, Get, "a");
+    ASSERT(!CMCall(cmap, Replace, "a", prev, prev) &&
+           CMCall(cmap, Replace, "a", cur, prev),
+           "CMUTIL_ConcurrentMap Replace");
+    prev = NULL;
+    ASSERT(!CMCall(cmap, Remove, "a", "other", NULL) &&
+           CMCall(cmap, Remove, "a", NULL, &prev) &&
+           strcmp(prev, "v2") == 0 && CMCall(cmap, Get, "a") == NULL,
+           "CMUTIL_ConcurrentMap Remove");
+    CMFree(prev); prev = NULL;
+
+    for (int i = 0; i < CMAP_WRITERS + CMAP_READERS; i++) {
+        cparams[i].map = cmap;
+        cparams[i].index = i;
+        cparams[i].errors = 0;
+        cparams[i].computed = 0;
+        cparams[i].done = &cdone;
+        cthreads[i] = CMUTIL_ThreadCreate(
+                    i < CMAP_WRITERS? cmap_writer : cmap_reader,
+                    &cparams[i], "cmap");
+        CMCall(cthreads[i], Start);
+    }
+    for (int i = 0; i < CMAP_WRITERS; i++)
+        CMCall(cthreads[i], Join);
+    cdone = 1;
+    for (int i = CMAP_WRITERS; i < CMAP_WRITERS + CMAP_READERS; i++)
+        CMCall(cthreads[i], Join);
+    for (int i = 0; i < CMAP_WRITERS + CMAP_READERS; i++)
+        cerrors += cparams[i].errors;
+    ASSERT(cerrors == 0 &&
+           CMCall(cmap, GetSize) == CMAP_WRITERS * CMAP_KEYS &&
+           strcmp(CMCall(cmap, Get, "w3-499"), "v499") == 0,
+           "CMUTIL_ConcurrentMap concurrent Put/Remove/Get");
+
+    for (int i = 0; i < CMAP_WRITERS; i++) {
+        cthreads[i] = CMUTIL_ThreadCreate(cmap_computer, &cparams[i], "cmap");
+        CMCall(cthreads[i], Start);
+    }
+    for (int i = 0; i < CMAP_WRITERS; i++) {
+        CMCall(cthreads[i], Join);
+        cerrors += cparams[i].errors;
+        computed += cparams[i].computed;
+    }
+    ASSERT(cerrors == 0 && computed == CMAP_KEYS,
+           "CMUTIL_ConcurrentMap ComputeIfAbsent once per key");
+
+    queue = CMUTIL_QueueCreate(5, NULL);
+    ASSERT(queue != NULL && CMCall(queue, GetCapacity) == 8,
+           "CMUTIL_QueueCreate");
+    {
+        void *items[10] = {(void*)1, (void*)2, (void*)3, (void*)4, (void*)5,
+                           (void*)6, (void*)7, (void*)8, (void*)9, (void*)10};
+        void *item = NULL;
+        ASSERT(CMCall(queue, TryPush, NULL) &&
+               CMCall(queue, PushBatch, items, 10) == 7 &&
+               !CMCall(queue, TryPush, items[0]) &&
+               !CMCall(queue, Push, items[0], 10) &&
+               CMCall(queue, GetSize) == 8,
+               "CMUTIL_Queue push until full");
+        ASSERT(CMCall(queue, TryPop, &item) && item == NULL &&
+               CMCall(queue, PopBatch, items, 3) == 3 && items[2] == (void*)3 &&
+               CMCall(queue, PopBatch, items, 10) == 4 && items[3] == (void*)7 &&
+               !CMCall(queue, TryPop, &item) &&
+               !CMCall(queue, Pop, &item, 10),
+               "CMUTIL_Queue pop in order until empty");
+    }
+    CMCall(queue, Destroy);
+
+    // a small ring makes producers and consumers block on each other.
+    queue = CMUTIL_QueueCreate(64, NULL);
+    for (int i = 0; i < QUEUE_PRODUCERS + QUEUE_CONSUMERS; i++) {
+        qparams[i].queue = queue;
+        qparams[i].index = i;
+        qparams[i].errors = 0;
+        qparams[i].sum = 0;
+        qthreads[i] = CMUTIL_ThreadCreate(
+                    i < QUEUE_PRODUCERS? queue_producer : queue_consumer,
+                    &qparams[i], "queue");
+        CMCall(qthreads[i], Start);
+    }
+    for (int i = 0; i < QUEUE_PRODUCERS; i++)
+        CMCall(qthreads[i], Join);
+    for (int i = 0; i < QUEUE_CONSUMERS; i++)
+        CMCall(queue, Push, NULL, -1);
+    computed = 0;
+    for (int i = 0; i < QUEUE_PRODUCERS + QUEUE_CONSUMERS; i++) {
+        if (i >= QUEUE_PRODUCERS)
+            CMCall(qthreads[i], Join);
+        cerrors += qparams[i].errors;
+        computed += qparams[i].sum;
+    }
+    ASSERT(cerrors == 0 && CMCall(queue, GetSize) == 0 &&
+           computed == (int64_t)QUEUE_PRODUCERS *
+                       QUEUE_ITEMS * (QUEUE_ITEMS - 1) / 2,
+           "CMUTIL_Queue concurrent Push/Pop");
+
+    ring = CMUTIL_ByteRingCreate(100);
+    ASSERT(ring != NULL && CMCall(ring, GetCapacity) == 128,
+           "CMUTIL_ByteRingCreate");
+    {
+        size_t size;
+        uint8_t *p = CMCall(ring, Reserve, 100);
+        const uint8_t *r;
+        memset(p, 'a', 100);
+        ASSERT(CMCall(ring, Commit, 90) && !CMCall(ring, Commit, 1) &&
+               CMCall(ring, Reserve, 40) == NULL &&
+               CMCall(ring, GetSize) == 90,
+               "CMUTIL_ByteRing Reserve/Commit");
+        r = CMCall(ring, Peek, &size);
+        ASSERT(r == p && size == 90 && CMCall(ring, Consume, 80) &&
+               !CMCall(ring, Consume, 20),
+               "CMUTIL_ByteRing Peek/Consume");
+        // 38 bytes are left before the end, the record goes to the start.
+        p = CMCall(ring, Reserve, 40);
+        ASSERT(p != NULL && CMCall(ring, Commit, 40),
+               "CMUTIL_ByteRing Reserve over the end");
+        r = CMCall(ring, Peek, &size);
+        // the bytes after the wrap are not peeked yet.
+        ASSERT(size == 10 && r[0] == 'a' && !CMCall(ring, Consume, 20) &&
+               CMCall(ring, Consume, 10),
+               "CMUTIL_ByteRing Peek before the end");
+        r = CMCall(ring, Peek, &size);
+        ASSERT(r == p && size == 40 && CMCall(ring, Consume, 40) &&
+               CMCall(ring, Peek, &size) == NULL && size == 0,
+               "CMUTIL_ByteRing Peek skips the end of the lap");
+        ASSERT(CMCall(ring, Write, "0123456789", 10) &&
+               CMCall(ring, GetSpilled) == 0 &&
+               CMCall(ring, Reserve, 120) == NULL,
+               "CMUTIL_ByteRing Write");
+    }
+    CMCall(ring, Destroy);
+
+    ring = CMUTIL_ByteRingCreate(1024);
+    rparam.ring = ring;
+    rparam.errors = 0;
+    qthreads[0] = CMUTIL_ThreadCreate(ring_producer, &rparam, "ring");
+    qthreads[1] = CMUTIL_ThreadCreate(ring_consumer, &rparam, "ring");
+    CMCall(qthreads[0], Start);
+    CMCall(qthreads[1], Start);
+    CMCall(qthreads[0], Join);
+    CMCall(qthreads[1], Join);
+    ASSERT(rparam.errors == 0 && CMCall(ring, GetSize) == 0 &&
+           CMCall(ring, GetSpilled) == 0,
+           "CMUTIL_ByteRing stream between two threads");
+
+    cache = CMUTIL_CacheCreateEx(256, 0, CMCacheSegmented, NULL, NULL, NULL);
+    for (int i = 0; i < CACHE_THREADS; i++) {
+        cacheparams[i].cache = cache;
+        cacheparams[i].index = i;
+        cacheparams[i].errors = 0;
+        qthreads[i] = CMUTIL_ThreadCreate(cache_worker, &cacheparams[i], "cache");
+        CMCall(qthreads[i], Start);
+    }
+    cerrors = 0;
+    for (int i = 0; i < CACHE_THREADS; i++) {
+        CMCall(qthreads[i], Join);
+        cerrors += cacheparams[i].errors;
+    }
+    CMCall(cache, GetStats, &cstats);
+    ASSERT(cerrors == 0 && cstats.count <= 256 &&
+           cstats.hits + cstats.misses == CACHE_THREADS * CACHE_OPS,
+           "CMUTIL_Cache concurrent Get/Put");
+
     ir = 0;
 END_POINT:
     if (tpool) CMCall(tpool, Destroy);
     if (mtx) CMCall(mtx, Destroy);
     if (t) CMCall(t, Join);
+    if (cmap) CMCall(cmap, Destroy);
+    if (queue) CMCall(queue, Destroy);
+    if (ring) CMCall(ring, Destroy);
+    if (cache) CMCall(cache, Destroy);
     if (!CMUTIL_Clear()) ir = -1;
     return ir;
 }
\ No newline at end of file
@@ -10,11 +10,47 @@
 
 CMUTIL_LogDefine("test.map")
 
+static int compare_intptr(const void *a, const void *b)
+{
+    intptr_t x = (intptr_t)a, y = (intptr_t)b;
+    return x < y? -1 : x > y? 1 : 0;
+}
+
+static void count_evicted(const char *key, void *value,
+                          CMCacheEvictReason reason, void *udata)
+{
+    CMUTIL_UNUSED(key);
+    CMUTIL_UNUSED(value);
+    ((int*)udata)[reason]++;
+}
+
+static CMBool remove_odd_value(const char *key, void *value, void *udata)
+{
+    // removing the entry being visited is allowed.
+    if ((intptr_t)value % 2 == 1)
+        CMCall((CMUTIL_Map*)udata, Remove, key);
+    return CMTrue;
+}
+
+static void *dup_string(void *value)
+{
+    return CMStrdup((const char*)value);
+}
+
 int main() {
     int ir = -1;
     CMUTIL_ConfLogger *logger = NULL;
     CMUTIL_LogAppender *apndr = NULL;
     CMUTIL_Map *map = NULL;
+    CMUTIL_IntMap *imap = NULL;
+    CMUTIL_BinaryMap *bmap = NULL;
+    CMUTIL_Map *amap = NULL;
+    CMUTIL_SortedMap *smap = NULL;
+    void **skeys = NULL;
+    CMUTIL_Cache *cache = NULL;
+    CMUTIL_CacheStats cstats;
+    int evicted[4] = {0, 0, 0, 0};
+    char kbuf[32];
 
     CMUTIL_Init(CMUTIL_MEM_TYPE);
 
@@ -59,12 +95,430 @@ int main() {
 
     ASSERT(strcmp(CMCall(map, Get, "KEY1"), "value1") == 0 && strcmp(CMCall(map, Get, "key1"), "value1") == 0, "CMUTIL_Map Put/Get case insensitive");
 
+    CMCall(map, Put, "Accept-Encoding-With-A-Rather-Long-Header-Name-Over-48",
+           CMStrdup("long"), NULL);
+    ASSERT(strcmp(CMCall(map, Get,
+           "ACCEPT-ENCODING-with-a-rather-long-header-name-over-48"),
+                  "long") == 0 &&
+           CMCall(map, Get,
+                  "ACCEPT-ENCODING-with-a-rather-long-header-name-over-4") ==
+           NULL, "CMUTIL_Map Get long key case insensitive");
+    CMFree(CMCall(map, Remove, "Key99"));
+    ASSERT(CMCall(map, Get, "KEY99") == NULL && CMCall(map, GetSize) == 100,
+           "CMUTIL_Map Remove case insensitive");
+
+    CMCall(map, Destroy); map = NULL;
+
+    map = CMUTIL_MapCreateEx(16, CMFalse, NULL, 0.875f);
+    for (intptr_t i = 0; i < 10000; i++) {
+        char kbuf[32];
+        snprintf(kbuf, sizeof(kbuf), "key%ld", (long)i);
+        CMCall(map, Put, kbuf, (void*)(i + 1), NULL);
+    }
+    for (intptr_t i = 0; i < 10000; i += 2) {
+        char kbuf[32];
+        snprintf(kbuf, sizeof(kbuf), "key%ld", (long)i);
+        ASSERT(CMCall(map, Remove, kbuf) == (void*)(i + 1),
+               "CMUTIL_Map Remove many");
+    }
+    ASSERT(CMCall(map, GetSize) == 5000 && CMCall(map, Get, "key0") == NULL &&
+           CMCall(map, Get, "key9999") == (void*)10000 &&
+           CMCall(map, GetAt, 0) == (void*)2,
+           "CMUTIL_Map Get after Remove");
+    for (intptr_t i = 0; i < 10000; i += 2) {
+        char kbuf[32];
+        snprintf(kbuf, sizeof(kbuf), "key%ld", (long)i);
+        CMCall(map, Put, kbuf, (void*)(i + 1), NULL);
+    }
+    ASSERT(CMCall(map, GetSize) == 10000 &&
+           CMCall(map, Get, "key0") == (void*)1 &&
+           CMCall(map, GetAt, 5000) == (void*)1,
+           "CMUTIL_Map Put after Remove");
+    {
+        const CMUTIL_Array *pairs = CMCall(map, GetPairs);
+        const CMUTIL_MapPair *p1 = CMCall(pairs, GetAt, 4999);
+        const CMUTIL_MapPair *p2 = CMCall(pairs, GetAt, 5001);
+        ASSERT(CMCall(pairs, GetSize) == 10000 &&
+               strcmp(CMCall(p1, GetKey), "key9999") == 0 &&
+               strcmp(CMCall(p2, GetKey), "key2") == 0,
+               "CMUTIL_Map GetPairs in insertion order");
+    }
+    {
+        CMUTIL_Iterator *iter = CMCall(map, Iterator);
+        while (CMCall(iter, HasNext)) {
+            intptr_t v = (intptr_t)CMCall(iter, Next);
+            char kbuf[32];
+            if (v % 2 == 0) {
+                snprintf(kbuf, sizeof(kbuf), "key%ld", (long)(v - 1));
+                CMCall(map, Remove, kbuf);
+            }
+        }
+        CMCall(iter, Destroy);
+    }
+    ASSERT(CMCall(map, GetSize) == 5000 &&
+           CMCall(map, GetAt, 0) == (void*)1 &&
+           CMCall(map, GetAt, 2500) == (void*)5001,
+           "CMUTIL_Map Remove while iterating");
+    // odd values are left, put even ones among them.
+    for (intptr_t i = 1; i < 10000; i += 2) {
+        char kbuf[32];
+        snprintf(kbuf, sizeof(kbuf), "key%ld", (long)i);
+        CMCall(map, Put, kbuf, (void*)(i + 1), NULL);
+    }
+    ASSERT(CMCall(map, GetSize) == 10000 &&
+           CMCall(map, Each, remove_odd_value, map) &&
+           CMCall(map, GetSize) == 5000 &&
+           CMCall(map, Get, "key0") == NULL &&
+           CMCall(map, Get, "key1") == (void*)2 &&
+           CMCall(map, Get, "key9999") == (void*)10000,
+           "CMUTIL_Map Each");
+    for (uint32_t i = 0; i < 5000; i++)
+        if ((intptr_t)CMCall(map, GetAt, i) % 2 != 0)
+            ASSERT(CMFalse, "CMUTIL_Map Each keeps even values");
+
+    // removing the oldest key, as a FIFO does, never shifts the order.
+    CMCall(map, Clear);
+    for (intptr_t i = 0; i < 20000; i++) {
+        char kbuf[32];
+        snprintf(kbuf, sizeof(kbuf), "key%ld", (long)i);
+        CMCall(map, Put, kbuf, (void*)(i + 1), NULL);
+        if (i >= 100) {
+            snprintf(kbuf, sizeof(kbuf), "key%ld", (long)(i - 100));
+            CMCall(map, Remove, kbuf);
+        }
+    }
+    ASSERT(CMCall(map, GetSize) == 100 &&
+           CMCall(map, GetAt, 0) == (void*)19901 &&
+           CMCall(map, GetAt, 99) == (void*)20000,
+           "CMUTIL_Map FIFO removal");
+    {
+        // pairs follow the map, positions skip the removed entries.
+        const CMUTIL_Array *pairs = CMCall(map, GetPairs);
+        CMUTIL_Iterator *iter;
+        CMBool same = CMTrue;
+        uint32_t i = 0;
+        for (intptr_t j = 19900; j < 20000; j += 7) {
+            char kbuf[32];
+            snprintf(kbuf, sizeof(kbuf), "key%ld", (long)j);
+            CMCall(map, Remove, kbuf);
+        }
+        CMCall(map, Put, "key19950", (void*)19951, NULL);
+        iter = CMCall(map, Iterator);
+        while (CMCall(iter, HasNext)) {
+            const CMUTIL_MapPair *pair = CMCall(pairs, GetAt, i++);
+            if (pair == NULL || CMCall(pair, GetValue) != CMCall(iter, Next))
+                same = CMFalse;
+        }
+        CMCall(iter, Destroy);
+        ASSERT(same && i == CMCall(pairs, GetSize) && i == 85 &&
+               CMCall(map, GetAt, 84) == (void*)19951 &&
+               CMCall(pairs, Top) == CMCall(pairs, GetAt, 84) &&
+               !CMCall((CMUTIL_Array*)pairs, Add, NULL, NULL),
+               "CMUTIL_Map GetPairs follows removals");
+    }
+
+    // removes while large tables are migrated.
+    CMCall(map, Clear);
+    for (intptr_t i = 0; i < 50000; i++) {
+        char kbuf[32];
+        snprintf(kbuf, sizeof(kbuf), "key%ld", (long)i);
+        CMCall(map, Put, kbuf, (void*)(i + 1), NULL);
+        if (i >= 1000 && i % 3 == 0) {
+            snprintf(kbuf, sizeof(kbuf), "key%ld", (long)(i - 1000));
+            if (CMCall(map, Remove, kbuf) != (void*)(i - 999))
+                ASSERT(CMFalse, "CMUTIL_Map Remove while migrating");
+        }
+    }
+    for (intptr_t i = 0; i < 50000; i++) {
+        char kbuf[32];
+        void *expect = i < 49000 && i % 3 == 2? NULL : (void*)(i + 1);
+        snprintf(kbuf, sizeof(kbuf), "key%ld", (long)i);
+        if (CMCall(map, Get, kbuf) != expect)
+            ASSERT(CMFalse, "CMUTIL_Map Get while migrating");
+    }
+
+    CMCall(map, Clear);
+    ASSERT(CMCall(map, Reserve, 100000), "CMUTIL_Map Reserve");
+    for (intptr_t i = 0; i < 100000; i++) {
+        char kbuf[32];
+        snprintf(kbuf, sizeof(kbuf), "key%ld", (long)i);
+        CMCall(map, Put, kbuf, (void*)(i + 1), NULL);
+    }
+    ASSERT(CMCall(map, GetSize) == 100000 &&
+           CMCall(map, Get, "key99999") == (void*)100000,
+           "CMUTIL_Map Put after Reserve");
+
+    // interned keys are shared between maps and released with their items.
+    CMCall(map, Destroy);
+    map = CMUTIL_MapCreateInterned(16, CMTrue, NULL, 0.75f);
+    amap = CMUTIL_MapCreateInterned(16, CMTrue, NULL, 0.75f);
+    ASSERT(map != NULL && amap != NULL, "CMUTIL_MapCreateInterned");
+    CMCall(map, Put, "Content-Type", "a", NULL);
+    CMCall(amap, Put, "CONTENT-type", "b", NULL);
+    CMCall(map, Put, "X-A-Header-Name-Longer-Than-Inline-Key-Room", "c", NULL);
+    {
+        const CMUTIL_MapPair *p1 = CMCall(CMCall(map, GetPairs), GetAt, 0);
+        const CMUTIL_MapPair *p2 = CMCall(CMCall(amap, GetPairs), GetAt, 0);
+        ASSERT(CMCall(p1, GetKey) == CMCall(p2, GetKey) &&
+               strcmp(CMCall(p1, GetKey), "CONTENT-TYPE") == 0 &&
+               strcmp(CMCall(map, Get, "content-type"), "a") == 0 &&
+               strcmp(CMCall(amap, Get, "Content-Type"), "b") == 0,
+               "CMUTIL_Map interned keys shared");
+    }
+    ASSERT(strcmp(CMCall(map, Remove, "CONTENT-TYPE"), "a") == 0 &&
+           strcmp(CMCall(amap, Get, "content-type"), "b") == 0 &&
+           strcmp(CMCall(map, Get,
+                         "x-a-header-name-longer-than-inline-key-room"),
+                  "c") == 0,
+           "CMUTIL_Map interned key survives other map's Remove");
+    CMCall(amap, Destroy); amap = NULL;
+
+    imap = CMUTIL_IntMapCreate();
+    ASSERT(imap != NULL, "CMUTIL_IntMapCreate");
+    for (uint64_t i = 0; i < 20000; i++)
+        CMCall(imap, Put, i * 0x100000001ULL, (void*)(intptr_t)(i + 1), NULL);
+    for (uint64_t i = 0; i < 20000; i += 2)
+        CMCall(imap, Remove, i * 0x100000001ULL);
+    CMCall(imap, Put, 42, NULL, NULL);
+    ASSERT(CMCall(imap, GetSize) == 10001 &&
+           CMCall(imap, Get, 0) == NULL &&
+           CMCall(imap, Get, 19999 * 0x100000001ULL) == (void*)20000 &&
+           CMCall(imap, ContainsKey, 42) &&
+           !CMCall(imap, ContainsKey, 2 * 0x100000001ULL),
+           "CMUTIL_IntMap Put/Get/Remove");
+    {
+        size_t pos = 0, cnt = 0;
+        uint64_t key;
+        void *val;
+        while (CMCall(imap, Next, &pos, &key, &val))
+            if (key == 42 || (uint64_t)(intptr_t)val == key / 0x100000001ULL + 1)
+                cnt++;
+        ASSERT(cnt == 10001, "CMUTIL_IntMap Next");
+    }
+    CMCall(imap, Destroy); imap = NULL;
+
+    bmap = CMUTIL_BinaryMapCreate();
+    ASSERT(bmap != NULL, "CMUTIL_BinaryMapCreate");
+    CMCall(bmap, Put, "a\0b", 3, "first", NULL);
+    CMCall(bmap, Put, "a\0c", 3, "second", NULL);
+    CMCall(bmap, Put, "a", 1, "third", NULL);
+    ASSERT(strcmp(CMCall(bmap, Get, "a\0b", 3), "first") == 0 &&
+           strcmp(CMCall(bmap, Get, "a\0c", 3), "second") == 0 &&
+           strcmp(CMCall(bmap, Get, "a", 1), "third") == 0 &&
+           CMCall(bmap, Get, "a\0", 2) == NULL,
+           "CMUTIL_BinaryMap Put/Get keys with NUL");
+    {
+        const CMUTIL_MapPair *pair = CMCall(CMCall(bmap, GetPairs), GetAt, 1);
+        ASSERT(CMCall(pair, GetKeyLength) == 3 &&
+               memcmp(CMCall(pair, GetKey), "a\0c", 3) == 0,
+               "CMUTIL_BinaryMap GetPairs");
+    }
+    ASSERT(strcmp(CMCall(bmap, Remove, "a\0b", 3), "first") == 0 &&
+           CMCall(bmap, GetSize) == 2, "CMUTIL_BinaryMap Remove");
+
+    // keys are put in scattered order and visited in key order.
+    smap = CMUTIL_SortedMapCreate(compare_intptr);
+    ASSERT(smap != NULL, "CMUTIL_SortedMapCreate");
+    for (intptr_t i = 0; i < 100000; i++) {
+        intptr_t k = (i * 7919) % 100000;
+        CMCall(smap, Put, (void*)k, (void*)(k + 1), NULL);
+    }
+    for (intptr_t i = 0; i < 100000; i += 2)
+        if (CMCall(smap, Remove, (void*)i) != (void*)(i + 1))
+            ASSERT(CMFalse, "CMUTIL_SortedMap Remove");
+    ASSERT(CMCall(smap, GetSize) == 50000 &&
+           CMCall(smap, Get, (void*)2) == NULL &&
+           CMCall(smap, Get, (void*)99999) == (void*)100000,
+           "CMUTIL_SortedMap Put/Get/Remove");
+    {
+        CMUTIL_SortedMapCursor cur;
+        void *key, *val;
+        intptr_t expect = 1;
+        CMBool ok = CMCall(smap, First, &cur);
+        while (ok && CMCall(smap, Next, &cur, &key, &val)) {
+            if ((intptr_t)key != expect || (intptr_t)val != expect + 1)
+                ok = CMFalse;
+            expect += 2;
+        }
+        ASSERT(ok && expect == 100001, "CMUTIL_SortedMap First/Next in order");
+        ASSERT(CMCall(smap, LowerBound, (void*)1000, &cur) &&
+               CMCall(smap, Next, &cur, &key, NULL) && key == (void*)1001 &&
+               CMCall(smap, UpperBound, (void*)1001, &cur) &&
+               CMCall(smap, Next, &cur, &key, NULL) && key == (void*)1003 &&
+               !CMCall(smap, UpperBound, (void*)99999, &cur),
+               "CMUTIL_SortedMap LowerBound/UpperBound");
+    }
+
+    // bulk loaded tree accepts later changes.
+    CMCall(smap, Clear);
+    skeys = CMAlloc(sizeof(void*) * 10000);
+    for (intptr_t i = 0; i < 10000; i++)
+        skeys[i] = (void*)(i * 2);
+    ASSERT(CMCall(smap, BulkLoad, skeys, NULL, 10000) &&
+           CMCall(smap, GetSize) == 10000, "CMUTIL_SortedMap BulkLoad");
+    for (intptr_t i = 0; i < 10000; i++)
+        CMCall(smap, Put, (void*)(i * 2 + 1), (void*)(i * 2 + 1), NULL);
+    for (intptr_t i = 0; i < 20000; i += 3)
+        CMCall(smap, Remove, (void*)i);
+    {
+        CMUTIL_SortedMapCursor cur;
+        void *key, *val;
+        intptr_t expect = 1;
+        CMBool ok = CMCall(smap, First, &cur);
+        while (ok && CMCall(smap, Next, &cur, &key, &val)) {
+            if ((intptr_t)key != expect || key != val)
+                ok = CMFalse;
+            expect += expect % 3 == 2? 2 : 1;
+        }
+        ASSERT(ok && expect == 20000 &&
+               CMCall(smap, GetSize) == 20000 - 6667,
+               "CMUTIL_SortedMap changes after BulkLoad");
+    }
+    skeys[1] = (void*)0;
+    ASSERT(!CMCall(smap, BulkLoad, skeys, NULL, 10),
+           "CMUTIL_SortedMap BulkLoad rejects unordered keys");
+    CMCall(smap, Destroy); smap = NULL;
+
+    // the map owns string keys and values.
+    smap = CMUTIL_SortedMapCreateEx((CMCompareCB)strcmp,
+                                    CMUTIL_GetMem()->Free,
+                                    CMUTIL_GetMem()->Free);
+    ASSERT(smap != NULL, "CMUTIL_SortedMapCreateEx");
+    CMCall(smap, Put, CMStrdup("banana"), CMStrdup("1"), NULL);
+    CMCall(smap, Put, CMStrdup("apple"), CMStrdup("2"), NULL);
+    CMCall(smap, Put, CMStrdup("banana"), CMStrdup("3"), NULL);
+    {
+        CMUTIL_SortedMapCursor cur;
+        void *key;
+        ASSERT(CMCall(smap, GetSize) == 2 &&
+               strcmp(CMCall(smap, Get, "banana"), "3") == 0 &&
+               CMCall(smap, LowerBound, "b", &cur) &&
+               CMCall(smap, Next, &cur, &key, NULL) &&
+               strcmp(key, "banana") == 0,
+               "CMUTIL_SortedMap string keys");
+    }
+    CMFree(CMCall(smap, Remove, "apple"));
+
+    // a single shard makes the eviction order predictable.
+    cache = CMUTIL_CacheCreateEx(3, 1, CMCacheLRU, count_evicted, evicted, NULL);
+    ASSERT(cache != NULL, "CMUTIL_CacheCreateEx");
+    CMCall(cache, Put, "a", (void*)1, 1, 0);
+    CMCall(cache, Put, "b", (void*)2, 1, 0);
+    CMCall(cache, Put, "c", (void*)3, 1, 0);
+    CMCall(cache, Get, "a");
+    CMCall(cache, Put, "d", (void*)4, 1, 0);
+    CMCall(cache, Put, "a", (void*)5, 1, 0);
+    CMCall(cache, GetStats, &cstats);
+    ASSERT(CMCall(cache, Get, "b") == NULL &&
+           CMCall(cache, Get, "a") == (void*)5 &&
+           evicted[CMCacheEvictCapacity] == 1 &&
+           evicted[CMCacheEvictReplaced] == 1 &&
+           cstats.hits == 1 && cstats.misses == 0 && cstats.evictions == 1 &&
+           cstats.count == 3,
+           "CMUTIL_Cache LRU eviction and replacement");
+    ASSERT(CMCall(cache, Remove, "c") == (void*)3 &&
+           CMCall(cache, Remove, "c") == NULL &&
+           CMCall(cache, GetSize) == 2 && evicted[CMCacheEvictCleared] == 0,
+           "CMUTIL_Cache Remove");
+    CMCall(cache, Put, "e", (void*)6, 1, 1);
+    CMCall(cache, Put, "f", (void*)7, 1, 1);
+    usleep(5000);
+    ASSERT(CMCall(cache, Get, "e") == NULL &&
+           CMCall(cache, RemoveExpired) == 1 &&
+           evicted[CMCacheEvictExpired] == 2 &&
+           CMCall(cache, Get, "a") == (void*)5,
+           "CMUTIL_Cache time to live");
+    CMCall(cache, Destroy); cache = NULL;
+    ASSERT(evicted[CMCacheEvictCleared] == 1, "CMUTIL_Cache Destroy");
+
+    cache = CMUTIL_CacheCreateEx(100, 1, CMCacheLRU, NULL, NULL, NULL);
+    CMCall(cache, Put, "a", (void*)1, 40, 0);
+    CMCall(cache, Put, "b", (void*)2, 40, 0);
+    CMCall(cache, Put, "c", (void*)3, 40, 0);
+    CMCall(cache, GetStats, &cstats);
+    ASSERT(cstats.weight == 80 && cstats.count == 2 &&
+           CMCall(cache, Get, "a") == NULL &&
+           !CMCall(cache, Put, "d", (void*)4, 101, 0),
+           "CMUTIL_Cache bounded by weight");
+    CMCall(cache, Destroy); cache = NULL;
+
+    // hot keys read twice survive a scan of keys read once.
+    cache = CMUTIL_CacheCreateEx(10, 1, CMCacheSegmented, NULL, NULL, NULL);
+    for (int i = 0; i < 5; i++) {
+        sprintf(kbuf, "hot%d", i);
+        CMCall(cache, Put, kbuf, (void*)(intptr_t)(i + 1), 1, 0);
+        CMCall(cache, Get, kbuf);
+    }
+    for (int i = 0; i < 100; i++) {
+        sprintf(kbuf, "scan%d", i);
+        CMCall(cache, Put, kbuf, (void*)(intptr_t)(i + 1), 1, 0);
+    }
+    {
+        CMBool kept = CMTrue;
+        for (int i = 0; i < 5; i++) {
+            sprintf(kbuf, "hot%d", i);
+            if (CMCall(cache, Get, kbuf) != (void*)(intptr_t)(i + 1))
+                kept = CMFalse;
+        }
+        ASSERT(kept && CMCall(cache, GetSize) == 10 &&
+               CMCall(cache, Get, "scan99") == (void*)100 &&
+               CMCall(cache, Get, "scan0") == NULL,
+               "CMUTIL_Cache segmented policy resists scans");
+    }
+    CMCall(cache, Destroy); cache = NULL;
+
+    cache = CMUTIL_CacheCreateEx(1000, 8, CMCacheLRU, NULL, NULL,
+                                 dup_string);
+    ASSERT(cache != NULL, "CMUTIL_CacheCreateEx sharded");
+    for (int i = 0; i < 2000; i++) {
+        sprintf(kbuf, "k%d", i);
+        CMCall(cache, Put, kbuf, "value", 1, 0);
+    }
+    {
+        char *v = CMCall(cache, Get, "k1999");
+        CMCall(cache, GetStats, &cstats);
+        ASSERT(v != NULL && strcmp(v, "value") == 0 && v != (char*)"value" &&
+               cstats.count <= 1000 && cstats.count > 900 &&
+               cstats.count + cstats.evictions == 2000,
+               "CMUTIL_Cache shards share the capacity");
+        CMFree(v);
+    }
+    CMCall(cache, Destroy); cache = NULL;
+
+    // one shard grows its index well past the initial buckets.
+    cache = CMUTIL_CacheCreateEx(500, 1, CMCacheLRU, NULL, NULL, NULL);
+    for (int i = 0; i < 500; i++) {
+        sprintf(kbuf, "k%d", i);
+        CMCall(cache, Put, kbuf, (void*)(intptr_t)(i + 1), 1, 0);
+    }
+    {
+        CMBool found = CMTrue;
+        for (int i = 0; i < 500; i += 2) {
+            sprintf(kbuf, "k%d", i);
+            if (CMCall(cache, Remove, kbuf) != (void*)(intptr_t)(i + 1))
+                found = CMFalse;
+        }
+        for (int i = 0; i < 500; i++) {
+            sprintf(kbuf, "k%d", i);
+            if (CMCall(cache, Get, kbuf) !=
+                    (i % 2? (void*)(intptr_t)(i + 1) : NULL))
+                found = CMFalse;
+        }
+        ASSERT(found && CMCall(cache, GetSize) == 250,
+               "CMUTIL_Cache index grows");
+    }
 
     ir = 0;
 END_POINT:
     if (apndr) CMCall(apndr, Destroy);
     if (lsys) CMCall(lsys, Destroy);
     if (map) CMCall(map, Destroy);
+    if (imap) CMCall(imap, Destroy);
+    if (bmap) CMCall(bmap, Destroy);
+    if (amap) CMCall(amap, Destroy);
+    if (smap) CMCall(smap, Destroy);
+    if (skeys) CMFree(skeys);
+    if (cache) CMCall(cache, Destroy);
     if (!CMUTIL_Clear()) ir = -1;
     return ir;
 }
\ No newline at end of file
@@ -0,0 +1,353 @@
+//
+// Created by Dennis Park on 26. 10. 16..
+//
+
+#include <stdio.h>
+#include <string.h>
+#if !defined(_WIN32)
+# include <pthread.h>
+#endif
+
+#include "libcmutils.h"
+#include "test.h"
+
+CMUTIL_LogDefine("test.mem")
+
+#define MEM_TEST_THREADS    8
+#define MEM_TEST_BLOCKS     512
+#define MEM_TEST_ROUNDS     200
+
+typedef struct MemTestCtx {
+    CMUTIL_Mutex *mutex;
+    CMUTIL_ObjectPool *pool;
+    void *shared[MEM_TEST_BLOCKS];  // blocks freed by another thread
+    void *objs[MEM_TEST_BLOCKS];    // pool objects freed by another thread
+    int failed;
+} MemTestCtx;
+
+void *mem_test_proc(void *udata) {
+    MemTestCtx *ctx = (MemTestCtx *)udata;
+    void *blocks[MEM_TEST_BLOCKS];
+    for (int r = 0; r < MEM_TEST_ROUNDS; r++) {
+        for (int i = 0; i < MEM_TEST_BLOCKS; i++) {
+            size_t size = (size_t)((i * 37 + r) % 2000 + 1);
+            blocks[i] = CMAlloc(size);
+            memset(blocks[i], i & 0xFF, size);
+        }
+        for (int i = 0; i < MEM_TEST_BLOCKS; i++) {
+            size_t size = (size_t)((i * 37 + r) % 2000 + 1);
+            unsigned char *p = blocks[i];
+            if (p[0] != (i & 0xFF) || p[size - 1] != (i & 0xFF))
+                ctx->failed = 1;
+            // hand over every other block to be freed by another thread.
+            if (i % 2) {
+                void *prev;
+                CMCall(ctx->mutex, Lock);
+                prev = ctx->shared[i];
+                ctx->shared[i] = blocks[i];
+                CMCall(ctx->mutex, Unlock);
+                if (prev) CMFree(prev);
+            } else {
+                CMFree(blocks[i]);
+            }
+        }
+        for (int i = 0; i < MEM_TEST_BLOCKS; i++) {
+            blocks[i] = CMCall(ctx->pool, Alloc);
+            memset(blocks[i], i & 0xFF, 48);
+        }
+        for (int i = 0; i < MEM_TEST_BLOCKS; i++) {
+            unsigned char *p = blocks[i];
+            if (p[0] != (i & 0xFF) || p[47] != (i & 0xFF))
+                ctx->failed = 1;
+            if (i % 2) {
+                void *prev;
+                CMCall(ctx->mutex, Lock);
+                prev = ctx->objs[i];
+                ctx->objs[i] = blocks[i];
+                CMCall(ctx->mutex, Unlock);
+                CMCall(ctx->pool, Free, prev);
+            } else {
+                CMCall(ctx->pool, Free, blocks[i]);
+            }
+        }
+    }
+    return NULL;
+}
+
+#if !defined(_WIN32)
+// a thread not created by CMUTIL_ThreadCreate leaves its freed blocks in
+// its own magazine when it exits.
+static void *mem_foreign_proc(void *udata) {
+    void *blocks[20];
+    int i;
+    CMUTIL_UNUSED(udata);
+    for (i = 0; i < 20; i++)
+        blocks[i] = CMAlloc(7000);
+    for (i = 0; i < 20; i++)
+        CMFree(blocks[i]);
+    return NULL;
+}
+
+// same for objects of a pool, udata is the pool and objects allocated.
+static void *mem_foreign_pool_proc(void *udata) {
+    void **objs = (void**)udata;
+    CMUTIL_ObjectPool *pool = (CMUTIL_ObjectPool*)objs[0];
+    int i;
+    for (i = 1; i <= 40; i++)
+        objs[i] = CMCall(pool, Alloc);
+    for (i = 1; i <= 40; i++)
+        CMCall(pool, Free, objs[i]);
+    return NULL;
+}
+#endif
+
+static int64_t mem_class_blocks(size_t size) {
+    CMUTIL_MemStats stats;
+    int i;
+    if (!CMUTIL_MemGetStats(&stats))
+        return -1;
+    for (i = 0; i < stats.count; i++)
+        if (stats.classes[i].size >= size)
+            return stats.classes[i].blocks;
+    return -1;
+}
+
+static int64_t mem_held_size(void) {
+    CMUTIL_MemStats stats;
+    if (!CMUTIL_MemGetStats(&stats))
+        return -1;
+    return stats.heldsz;
+}
+
+int main() {
+    int ir = -1;
+    CMUTIL_Init(CMUTIL_MEM_TYPE);
+
+    CMUTIL_Thread *threads[MEM_TEST_THREADS] = {NULL,};
+    MemTestCtx ctx;
+    char *str = NULL;
+    CMUTIL_Arena *arena = NULL;
+    CMUTIL_Mem *amem;
+    CMUTIL_String *jstr = NULL;
+    CMUTIL_Json *json = NULL;
+    void *first, *big;
+    void *blocks[MEM_TEST_BLOCKS];
+    FILE *fp = NULL;
+    char line[1024];
+    CMUTIL_MemStats stats;
+    CMUTIL_MemClassStats *cls = NULL;
+    int64_t held;
+    int i;
+
+    memset(&ctx, 0x0, sizeof(ctx));
+    ctx.mutex = CMUTIL_MutexCreate();
+    ctx.pool = CMUTIL_ObjectPoolCreate(40);
+
+    first = CMCall(ctx.pool, Alloc);
+    ASSERT(first != NULL && ((size_t)first % 16) == 0,
+           "CMUTIL_ObjectPool Alloc");
+    CMCall(ctx.pool, Free, first);
+    ASSERT(CMCall(ctx.pool, Alloc) == first, "CMUTIL_ObjectPool reuse");
+    CMCall(ctx.pool, Free, first);
+
+    str = CMStrdup("recycle");
+    ASSERT(str != NULL && strcmp(str, "recycle") == 0, "CMStrdup");
+    str = CMRealloc(str, 5000);
+    ASSERT(str != NULL && strcmp(str, "recycle") == 0,
+           "CMRealloc to other size class");
+    CMFree(str); str = NULL;
+
+    arena = CMUTIL_ArenaCreate(4096);
+    ASSERT(arena != NULL, "CMUTIL_ArenaCreate");
+    amem = CMCall(arena, GetMem);
+    first = amem->Alloc(10);
+    for (i = 0; i < 1000; i++)
+        memset(amem->Alloc(100), 0xAB, 100);
+    big = amem->Calloc(1, 100000);
+    ASSERT(big != NULL && ((unsigned char*)big)[99999] == 0,
+           "Arena Calloc bigger than a chunk");
+    str = amem->Strdup("arena");
+    str = amem->Realloc(str, 200);
+    ASSERT(str != NULL && strcmp(str, "arena") == 0, "Arena Realloc");
+    amem->Free(str); str = NULL;
+    jstr = CMUTIL_StringCreate();
+    CMCall(jstr, AddString, "{\"key\": [1, 2, {\"nested\": \"value\"}]}");
+    json = CMUTIL_JsonParseWithMem(amem, jstr);
+    ASSERT(json != NULL && CMCall(json, GetType) == CMJsonTypeObject,
+           "CMUTIL_JsonParseWithMem");
+    CMCall(json, Destroy); json = NULL;
+    CMCall(arena, Reset);
+    ASSERT(amem->Alloc(10) == first, "Arena Reset reuses chunk");
+
+    for (i = 0; i < 64; i++)
+        blocks[i] = CMAlloc(64 * 1024);
+    for (i = 0; i < 64; i++)
+        CMFree(blocks[i]);
+    ASSERT(CMUTIL_MemTrim() > 0, "CMUTIL_MemTrim");
+    ASSERT(CMUTIL_MemTrim() == 0, "CMUTIL_MemTrim with empty cache");
+
+    big = CMAlloc(512 * 1024);
+    CMFree(big);
+    ASSERT(CMUTIL_MemTrim() > 0, "CMUTIL_MemTrim discards big block");
+    big = CMAlloc(512 * 1024);
+    memset(big, 0x5A, 512 * 1024);
+    ASSERT(((unsigned char*)big)[256 * 1024] == 0x5A, "reuse discarded block");
+    CMFree(big);
+
+    big = CMAlloc(2 * 1024 * 1024);
+    memset(big, 0x3C, 2 * 1024 * 1024);
+    big = CMRealloc(big, 8 * 1024 * 1024);
+    ASSERT(big != NULL && ((unsigned char*)big)[2 * 1024 * 1024 - 1] == 0x3C,
+           "CMRealloc of mapped block");
+    big = CMRealloc(big, 100);
+    ASSERT(big != NULL && ((unsigned char*)big)[99] == 0x3C,
+           "CMRealloc of mapped block to small one");
+    CMFree(big);
+
+    CMUTIL_MemTrim();
+    CMUTIL_MemSetCacheLimit(256 * 1024, 1024 * 1024 * 1024);
+    for (i = 0; i < 64; i++)
+        blocks[i] = CMAlloc(64 * 1024);
+    for (i = 0; i < 64; i++)
+        CMFree(blocks[i]);
+    ASSERT(CMUTIL_MemTrim() <= 256 * 1024, "CMUTIL_MemSetCacheLimit");
+    CMUTIL_MemSetCacheLimit(64 * 1024 * 1024, 512 * 1024 * 1024);
+
+    for (i = 0; i < 64; i++)
+        blocks[i] = CMAlloc(64 * 1024);
+    for (i = 0; i < 64; i++)
+        CMFree(blocks[i]);
+    held = mem_held_size();
+    ASSERT(CMUTIL_MemStartTrimmer(20, NULL), "CMUTIL_MemStartTrimmer");
+    // blocks freed since the previous pass survive one pass, a few stay
+    // in the magazine of this thread. give the timer two seconds at most.
+    for (i = 0; i < 200; i++) {
+        if (mem_held_size() + 32 * 64 * 1024 <= held)
+            break;
+        usleep(10 * 1000);
+    }
+    CMUTIL_MemStopTrimmer();
+    ASSERT(mem_held_size() + 32 * 64 * 1024 <= held,
+           "idle blocks trimmed by the trimmer");
+
+    for (i = 0; i < MEM_TEST_BLOCKS; i++)
+        blocks[i] = CMAlloc(100);
+    for (i = 0; i < MEM_TEST_BLOCKS; i++)
+        CMFree(blocks[i]);
+    held = mem_class_blocks(100);
+    CMUTIL_MemTrim();
+    ASSERT(mem_class_blocks(100) + MEM_TEST_BLOCKS / 2 <= held,
+           "empty slabs released by trimming");
+
+    CMUTIL_MemSetSampling(4096);
+    for (i = 0; i < MEM_TEST_BLOCKS; i++)
+        blocks[i] = CMAlloc(1000);
+    ASSERT(CMUTIL_MemDumpProfile("mem_test_heap.folded", CMMemProfileFolded),
+           "CMUTIL_MemDumpProfile folded");
+    ASSERT(CMUTIL_MemDumpProfile("mem_test_heap.prof", CMMemProfilePprof),
+           "CMUTIL_MemDumpProfile pprof");
+    for (i = 0; i < MEM_TEST_BLOCKS; i++)
+        CMFree(blocks[i]);
+    CMUTIL_MemSetSampling(0);
+    fp = fopen("mem_test_heap.folded", "r");
+    ASSERT(fp != NULL && fgets(line, sizeof(line), fp) != NULL &&
+           strchr(line, ' ') != NULL, "folded profile has samples");
+    fclose(fp); fp = NULL;
+    fp = fopen("mem_test_heap.prof", "r");
+    ASSERT(fp != NULL && fgets(line, sizeof(line), fp) != NULL &&
+           strncmp(line, "heap profile:", 13) == 0, "pprof profile header");
+    fclose(fp); fp = NULL;
+    remove("mem_test_heap.folded");
+    remove("mem_test_heap.prof");
+
+    for (i = 0; i < MEM_TEST_THREADS; i++) {
+        threads[i] = CMUTIL_ThreadCreate(mem_test_proc, &ctx, "MemTest");
+        CMCall(threads[i], Start);
+    }
+    for (i = 0; i < MEM_TEST_THREADS; i++) {
+        CMCall(threads[i], Join);
+        threads[i] = NULL;
+    }
+    ASSERT(ctx.failed == 0, "multi-thread allocation contents");
+    for (i = 0; i < MEM_TEST_BLOCKS; i++)
+        CMCall(ctx.pool, Free, ctx.objs[i]);
+
+    for (i = 0; i < MEM_TEST_BLOCKS; i++)
+        if (ctx.shared[i]) CMFree(ctx.shared[i]);
+
+#if !defined(_WIN32)
+    {
+        pthread_t tid;
+        ASSERT(pthread_create(&tid, NULL, mem_foreign_proc, NULL) == 0,
+               "pthread_create");
+        pthread_join(tid, NULL);
+        held = mem_class_blocks(7000);
+        for (i = 0; i < 20; i++)
+            blocks[i] = CMAlloc(7000);
+        ASSERT(held > 0 && mem_class_blocks(7000) == held,
+               "blocks of an exited foreign thread are reused");
+        for (i = 0; i < 20; i++)
+            CMFree(blocks[i]);
+    }
+    {
+        pthread_t tid;
+        void *objs[41];
+        int j, reused = 0;
+        CMUTIL_ObjectPool *pool = CMUTIL_ObjectPoolCreate(64);
+        objs[0] = pool;
+        ASSERT(pthread_create(&tid, NULL, mem_foreign_pool_proc, objs) == 0,
+               "pthread_create");
+        pthread_join(tid, NULL);
+        for (i = 0; i < 48; i++) {
+            void *obj = CMCall(pool, Alloc);
+            for (j = 1; j <= 40; j++)
+                if (objs[j] == obj)
+                    reused++;
+        }
+        CMCall(pool, Destroy);
+        ASSERT(reused == 40, "objects of an exited foreign thread are reused");
+    }
+#endif
+
+    for (i = 0; i < 100; i++)
+        blocks[i] = CMAlloc(3000);
+    ASSERT(CMUTIL_MemGetStats(&stats), "CMUTIL_MemGetStats");
+    for (i = 0; i < 100; i++)
+        CMFree(blocks[i]);
+    for (i = 0; i < stats.count; i++)
+        if (stats.classes[i].size >= 3000) {
+            cls = &stats.classes[i];
+            break;
+        }
+    ASSERT(cls != NULL && cls->inuse >= 100 && cls->inusesz >= 300000 &&
+           cls->blocks >= cls->inuse + cls->cached &&
+           cls->peakinuse >= 100 && cls->allocs >= 100,
+           "allocator class statistics");
+    ASSERT(stats.total.allocs >= stats.total.frees &&
+           stats.total.locks > 0 && stats.interval > 0 &&
+           stats.peakheldsz >= stats.heldsz && stats.heldsz > 0,
+           "allocator total statistics");
+    json = CMUTIL_MemStatsToJson(&stats);
+    ASSERT(json != NULL && CMCall((CMUTIL_JsonObject*)json, GetLong,
+                                  "heldBytes") == stats.heldsz,
+           "CMUTIL_MemStatsToJson");
+    CMCall(jstr, Clear);
+    CMCall(json, ToString, jstr, CMFalse);
+    ASSERT(strstr(CMCall(jstr, GetCString), "\"classes\":[{") != NULL,
+           "allocator statistics serialized");
+    CMCall(json, Destroy); json = NULL;
+
+    ir = 0;
+END_POINT:
+    for (i = 0; i < MEM_TEST_THREADS; i++)
+        if (threads[i]) CMCall(threads[i], Join);
+    if (fp) fclose(fp);
+    if (str) CMFree(str);
+    if (json) CMCall(json, Destroy);
+    if (jstr) CMCall(jstr, Destroy);
+    if (arena) CMCall(arena, Destroy);
+    if (ctx.pool) CMCall(ctx.pool, Destroy);
+    if (ctx.mutex) CMCall(ctx.mutex, Destroy);
+    if (!CMUTIL_Clear()) ir = -1;
+    return ir;
+}
@@ -16,6 +16,11 @@ void add_vprint(CMUTIL_String *str, const char *fmt, ...) {
     va_end(ap);
 }
 
+static CMBool sum_length(void *item, void *udata) {
+    *(size_t*)udata += CMCall((CMUTIL_String*)item, GetSize);
+    return CMTrue;
+}
+
 int main() {
     int ir = -1;
     CMUTIL_Init(CMUTIL_MEM_TYPE);
@@ -266,6 +271,13 @@ int main() {
         ASSERT(strcmp(CMCall(item, GetCString), CMCall(sarr, GetCString, i)) == 0, "StringArray Iterator validation");
     }
     ASSERT(i == CMCall(sarr, GetSize) && !CMCall(iter, HasNext), "StringArray Iterator count");
+    {
+        size_t total = 0, expect = 0;
+        for (i = 0; i < CMCall(sarr, GetSize); i++)
+            expect += strlen(CMCall(sarr, GetCString, i));
+        ASSERT(CMCall(sarr, Each, sum_length, &total) && total == expect,
+               "StringArray Each");
+    }
 
     CMLogInfo("StringArray's GetSize is tested in other tests.");
 